@@ -0,0 +1,312 @@
+/* drivers/apic.c - Local APIC and I/O APIC driver
+ *
+ * The local APIC of every CPU sits at the same physical address; each
+ * CPU sees its own. Register accesses are 32-bit MMIO reads and writes.
+ */
+
+#include "apic.h"
+#include "../kernel/kernel.h"
+#include "../mm/vmm.h"
+
+#define LAPIC_SVR_ENABLE     0x100
+#define LAPIC_LVT_MASKED     0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIV_16   0x3
+
+#define ICR_INIT             0x00000500
+#define ICR_STARTUP          0x00000600
+#define ICR_LEVEL_ASSERT     0x00004000
+#define ICR_LEVEL_TRIGGER    0x00008000
+#define ICR_DELIVERY_PENDING 0x00001000
+
+#define IA32_APIC_BASE_MSR   0x1B
+#define IA32_APIC_BASE_ENABLE 0x800
+
+#define IOAPIC_REGSEL        0x00
+#define IOAPIC_WINDOW        0x10
+#define IOAPIC_REG_VERSION   0x01
+#define IOAPIC_REG_REDTBL    0x10
+
+#define IOAPIC_MASKED        0x10000
+#define IOAPIC_ACTIVE_LOW    0x2000
+#define IOAPIC_LEVEL         0x8000
+
+static volatile uint32_t *lapic = NULL;
+static volatile uint32_t *ioapic = NULL;
+static uint32_t ioapic_gsi_base = 0;
+static uint32_t ioapic_entries = 0;
+static uint32_t lapic_ticks_per_ms = 0;
+
+bool apic_irq_routing = false;
+
+/* ================================================================
+ * HELPERS
+ * ================================================================ */
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic[reg / 4] = value;
+    (void)lapic[LAPIC_ID / 4];  /* Flush the posted write */
+}
+
+static inline uint32_t ioapic_read(uint32_t reg)
+{
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static inline void ioapic_write(uint32_t reg, uint32_t value)
+{
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WINDOW / 4] = value;
+}
+
+static inline void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d)
+{
+    __asm__ volatile("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(0));
+}
+
+static inline uint64_t rdmsr(uint32_t msr)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value)
+{
+    __asm__ volatile("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+/* Identity map a page of device registers, uncached */
+static void apic_map(uint32_t base)
+{
+    vmm_map_page(base & ~0xFFF, base & ~0xFFF,
+                 VMM_PRESENT | VMM_WRITE | VMM_WRITETHROUGH | VMM_CACHEDISABLE);
+}
+
+/* Busy-wait on the PIT tick (needs interrupts enabled) */
+static void apic_delay_ms(uint32_t ms)
+{
+    uint32_t start = timer_get_ticks();
+    while (timer_get_ticks() - start < ms + 1)
+        __asm__ volatile("pause");
+}
+
+/* ================================================================
+ * LOCAL APIC
+ * ================================================================ */
+
+bool lapic_supported(void)
+{
+    uint32_t a, b, c, d;
+    cpuid(1, &a, &b, &c, &d);
+    return (d & (1u << 9)) != 0;
+}
+
+void lapic_init(uint32_t base)
+{
+    apic_map(base);
+    lapic = (volatile uint32_t *)base;
+
+    lapic_enable();
+}
+
+void lapic_enable(void)
+{
+    /* Firmware normally leaves the APIC globally enabled; make sure */
+    uint64_t msr = rdmsr(IA32_APIC_BASE_MSR);
+    if (!(msr & IA32_APIC_BASE_ENABLE))
+        wrmsr(IA32_APIC_BASE_MSR, msr | IA32_APIC_BASE_ENABLE);
+
+    /* Accept every priority, mask the timer until someone wants it */
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+
+    /* Device IRQs come from the I/O APIC, not the virtual wire */
+    if (apic_irq_routing)
+        lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+
+    /* Clear stale errors (the ESR needs a write before a read) */
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_eoi();
+}
+
+bool lapic_available(void)
+{
+    return lapic != NULL;
+}
+
+uint8_t lapic_id(void)
+{
+    if (!lapic)
+        return 0;
+    return (uint8_t)(lapic_read(LAPIC_ID) >> 24);
+}
+
+void lapic_eoi(void)
+{
+    if (lapic)
+        lapic[LAPIC_EOI / 4] = 0;
+}
+
+static void lapic_wait_icr(void)
+{
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_PENDING)
+        __asm__ volatile("pause");
+}
+
+static void lapic_send_icr(uint8_t apic_id, uint32_t command)
+{
+    uint32_t flags = irq_save();
+
+    lapic_wait_icr();
+    lapic_write(LAPIC_ICR_HIGH, (uint32_t)apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    lapic_wait_icr();
+
+    irq_restore(flags);
+}
+
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector)
+{
+    if (lapic)
+        lapic_send_icr(apic_id, vector);
+}
+
+void lapic_start_ap(uint8_t apic_id, uint32_t trampoline)
+{
+    if (!lapic)
+        return;
+
+    /* INIT (assert, then de-assert for pre-xAPIC parts), wait 10ms */
+    lapic_send_icr(apic_id, ICR_INIT | ICR_LEVEL_ASSERT | ICR_LEVEL_TRIGGER);
+    lapic_send_icr(apic_id, ICR_INIT | ICR_LEVEL_TRIGGER);
+    apic_delay_ms(10);
+
+    /* Two STARTUPs, as the MP spec recommends; the vector is the page
+     * number of the real-mode entry point */
+    for (int i = 0; i < 2; i++) {
+        lapic_send_icr(apic_id, ICR_STARTUP | ((trampoline >> 12) & 0xFF));
+        apic_delay_ms(1);
+    }
+}
+
+/* ================================================================
+ * LOCAL APIC TIMER
+ * ================================================================ */
+
+void lapic_timer_calibrate(void)
+{
+    if (!lapic)
+        return;
+
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+
+    /* Line up with a tick edge, then count down for 10 ticks */
+    uint32_t start = timer_get_ticks();
+    while (timer_get_ticks() == start)
+        __asm__ volatile("pause");
+
+    lapic_write(LAPIC_TIMER_INIT, 0xFFFFFFFF);
+    start = timer_get_ticks();
+    while (timer_get_ticks() - start < 10)
+        __asm__ volatile("pause");
+    uint32_t elapsed = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+
+    lapic_ticks_per_ms = elapsed / 10;
+}
+
+uint32_t lapic_timer_ticks_per_ms(void)
+{
+    return lapic_ticks_per_ms;
+}
+
+void lapic_timer_start(uint32_t hz)
+{
+    if (!lapic || !lapic_ticks_per_ms || !hz)
+        return;
+
+    uint32_t count = lapic_ticks_per_ms * 1000 / hz;
+
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | APIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INIT, count ? count : 1);
+}
+
+void lapic_timer_stop(void)
+{
+    if (!lapic)
+        return;
+
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+/* ================================================================
+ * I/O APIC
+ * ================================================================ */
+
+void ioapic_init(uint32_t base, uint32_t gsi_base)
+{
+    apic_map(base);
+    ioapic = (volatile uint32_t *)base;
+    ioapic_gsi_base = gsi_base;
+    ioapic_entries = ((ioapic_read(IOAPIC_REG_VERSION) >> 16) & 0xFF) + 1;
+
+    for (uint32_t i = 0; i < ioapic_entries; i++) {
+        ioapic_write(IOAPIC_REG_REDTBL + 2 * i, IOAPIC_MASKED);
+        ioapic_write(IOAPIC_REG_REDTBL + 2 * i + 1, 0);
+    }
+}
+
+void ioapic_route(uint32_t gsi, uint8_t vector, uint8_t apic_id,
+                  uint16_t flags, bool masked)
+{
+    if (!ioapic || gsi < ioapic_gsi_base || gsi - ioapic_gsi_base >= ioapic_entries)
+        return;
+
+    uint32_t pin = gsi - ioapic_gsi_base;
+    uint32_t low = vector;  /* Fixed delivery, physical destination */
+
+    if (flags & APIC_IRQ_ACTIVE_LOW)
+        low |= IOAPIC_ACTIVE_LOW;
+    if (flags & APIC_IRQ_LEVEL)
+        low |= IOAPIC_LEVEL;
+    if (masked)
+        low |= IOAPIC_MASKED;
+
+    ioapic_write(IOAPIC_REG_REDTBL + 2 * pin + 1, (uint32_t)apic_id << 24);
+    ioapic_write(IOAPIC_REG_REDTBL + 2 * pin, low);
+}
+
+void ioapic_set_mask(uint32_t gsi, bool masked)
+{
+    if (!ioapic || gsi < ioapic_gsi_base || gsi - ioapic_gsi_base >= ioapic_entries)
+        return;
+
+    uint32_t reg = IOAPIC_REG_REDTBL + 2 * (gsi - ioapic_gsi_base);
+    uint32_t low = ioapic_read(reg);
+
+    if (masked)
+        low |= IOAPIC_MASKED;
+    else
+        low &= ~IOAPIC_MASKED;
+    ioapic_write(reg, low);
+}
+
+uint32_t ioapic_max_gsi(void)
+{
+    return ioapic_gsi_base + ioapic_entries;
+}
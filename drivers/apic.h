@@ -0,0 +1,103 @@
+/* drivers/apic.h - Local APIC and I/O APIC
+ *
+ * Every CPU has a local APIC: it receives interrupts for that CPU,
+ * sends inter-processor interrupts (IPIs) - including the INIT/SIPI
+ * sequence that starts an application processor - and has a timer of
+ * its own. The I/O APIC replaces the 8259 PIC: it turns device IRQ
+ * lines into interrupt messages that can be steered to any CPU.
+ *
+ * Both are memory mapped; the registers are identity mapped uncached
+ * when the driver is initialised.
+ */
+
+#ifndef APIC_H
+#define APIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* ====================================================================
+ * CONSTANTS
+ * ==================================================================== */
+
+#define LAPIC_DEFAULT_BASE   0xFEE00000
+#define IOAPIC_DEFAULT_BASE  0xFEC00000
+
+/* Local APIC register offsets */
+#define LAPIC_ID             0x020
+#define LAPIC_VERSION        0x030
+#define LAPIC_TPR            0x080   /* Task priority */
+#define LAPIC_EOI            0x0B0
+#define LAPIC_SVR            0x0F0   /* Spurious vector + enable bit */
+#define LAPIC_ESR            0x280   /* Error status */
+#define LAPIC_ICR_LOW        0x300   /* Interrupt command */
+#define LAPIC_ICR_HIGH       0x310
+#define LAPIC_LVT_TIMER      0x320
+#define LAPIC_LVT_LINT0      0x350
+#define LAPIC_LVT_LINT1      0x360
+#define LAPIC_LVT_ERROR      0x370
+#define LAPIC_TIMER_INIT     0x380
+#define LAPIC_TIMER_CURRENT  0x390
+#define LAPIC_TIMER_DIVIDE   0x3E0
+
+/* Vectors above the legacy IRQ range (32-47) */
+#define APIC_TIMER_VECTOR    0xF0
+#define APIC_RESCHED_VECTOR  0xF1
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+/* ISA IRQ override flags (MADT / MP table encoding) */
+#define APIC_IRQ_ACTIVE_LOW  0x0002
+#define APIC_IRQ_LEVEL       0x0008
+
+/* ====================================================================
+ * LOCAL APIC
+ * ==================================================================== */
+
+/* Does the CPU have a local APIC at all? */
+bool lapic_supported(void);
+
+/* Map the local APIC registers and enable it on the boot CPU */
+void lapic_init(uint32_t base);
+
+/* Enable the local APIC of the calling CPU (APs, after lapic_init) */
+void lapic_enable(void);
+
+bool lapic_available(void);
+uint8_t lapic_id(void);
+void lapic_eoi(void);
+
+/* Send a fixed interrupt to another CPU */
+void lapic_send_ipi(uint8_t apic_id, uint8_t vector);
+
+/* INIT-SIPI-SIPI: start the AP with the given APIC ID in real mode at
+ * trampoline (page aligned, below 1MB) */
+void lapic_start_ap(uint8_t apic_id, uint32_t trampoline);
+
+/* Measure the local APIC timer against the PIT (boot CPU, interrupts
+ * enabled). All CPUs share the bus clock, so one calibration is enough. */
+void lapic_timer_calibrate(void);
+uint32_t lapic_timer_ticks_per_ms(void);
+
+/* Periodic timer interrupt on the calling CPU (APIC_TIMER_VECTOR) */
+void lapic_timer_start(uint32_t hz);
+void lapic_timer_stop(void);
+
+/* ====================================================================
+ * I/O APIC
+ * ==================================================================== */
+
+/* Map the I/O APIC and mask every input */
+void ioapic_init(uint32_t base, uint32_t gsi_base);
+
+/* Route a global system interrupt to vector on the CPU with apic_id */
+void ioapic_route(uint32_t gsi, uint8_t vector, uint8_t apic_id,
+                  uint16_t flags, bool masked);
+void ioapic_set_mask(uint32_t gsi, bool masked);
+
+/* Number of inputs (redirection entries) */
+uint32_t ioapic_max_gsi(void);
+
+/* Set once device IRQs arrive through the I/O APIC instead of the PIC */
+extern bool apic_irq_routing;
+
+#endif /* APIC_H */
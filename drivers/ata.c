@@ -23,6 +23,7 @@
 
 #include "ata.h"
 #include "../kernel/kernel.h"
+#include "../kernel/mutex.h"
 
 /* ====================================================================
  * GLOBAL STATE
@@ -30,6 +31,12 @@
 
 static ata_drive_info_t drives[4];  /* Primary Master/Slave, Secondary Master/Slave */
 
+/* One command at a time: the caller (FAT included) may be preempted in
+ * the middle of a transfer, and another task must not start a command
+ * on the same ports meanwhile. Not taken by ata_init(), which runs
+ * before there are tasks. */
+static mutex_t ata_mutex = MUTEX_INIT("ata");
+
 /* ====================================================================
  * HELPER FUNCTIONS
  * ==================================================================== */
@@ -255,7 +262,7 @@ void ata_init(void) {
  * SECTOR READ/WRITE
  * ==================================================================== */
 
-int ata_read_sector(uint8_t drive, uint32_t lba, uint8_t *buffer) {
+static int ata_read_sector_locked(uint8_t drive, uint32_t lba, uint8_t *buffer) {
     if (drive >= 4 || !drives[drive].present) {
         return -1;
     }
@@ -299,7 +306,7 @@ int ata_read_sector(uint8_t drive, uint32_t lba, uint8_t *buffer) {
     return 0;
 }
 
-int ata_write_sector(uint8_t drive, uint32_t lba, const uint8_t *buffer) {
+static int ata_write_sector_locked(uint8_t drive, uint32_t lba, const uint8_t *buffer) {
     if (drive >= 4 || !drives[drive].present) {
         return -1;
     }
@@ -346,6 +353,20 @@ int ata_write_sector(uint8_t drive, uint32_t lba, const uint8_t *buffer) {
     return 0;
 }
 
+int ata_read_sector(uint8_t drive, uint32_t lba, uint8_t *buffer) {
+    mutex_lock(&ata_mutex);
+    int ret = ata_read_sector_locked(drive, lba, buffer);
+    mutex_unlock(&ata_mutex);
+    return ret;
+}
+
+int ata_write_sector(uint8_t drive, uint32_t lba, const uint8_t *buffer) {
+    mutex_lock(&ata_mutex);
+    int ret = ata_write_sector_locked(drive, lba, buffer);
+    mutex_unlock(&ata_mutex);
+    return ret;
+}
+
 int ata_read_sectors(uint8_t drive, uint32_t lba, uint8_t count, uint8_t *buffer) {
     for (uint8_t i = 0; i < count; i++) {
         if (ata_read_sector(drive, lba + i, buffer + (i * 512)) < 0) {
@@ -371,8 +392,11 @@ int ata_flush_cache(uint8_t drive) {
     
     uint16_t port_base = ata_get_port_base(drive);
     
+    mutex_lock(&ata_mutex);
     outb(port_base + 7, ATA_CMD_CACHE_FLUSH);
-    return ata_wait_bsy(port_base + 7);
+    int ret = ata_wait_bsy(port_base + 7);
+    mutex_unlock(&ata_mutex);
+    return ret;
 }
 
 ata_drive_info_t *ata_get_drive_info(uint8_t drive) {
@@ -10,8 +10,9 @@
  * 1. User presses a key
  * 2. Keyboard sends scancode to controller
  * 3. Controller triggers IRQ 1
- * 4. Our interrupt handler reads the scancode from port 0x60
- * 5. We convert scancode to ASCII
+ * 4. Our interrupt handler reads the scancode from port 0x60, queues it
+ *    and schedules the keyboard tasklet
+ * 5. The tasklet (interrupts enabled) converts scancodes to ASCII
  * 6. Store character in buffer for shell to read
  *
  * SCANCODES:
@@ -29,6 +30,8 @@
  */
 
 #include "../kernel/kernel.h"
+#include "../kernel/wait.h"
+#include "../kernel/softirq.h"
 #include "terminal.h"
 
 #define KEYBOARD_DATA_PORT 0x60
@@ -42,6 +45,20 @@ static char keyboard_buffer[KEYBOARD_BUFFER_SIZE];
 static volatile size_t buffer_read_pos = 0;
 static volatile size_t buffer_write_pos = 0;
 
+/* Raw scancodes from the IRQ handler, waiting for the tasklet.
+ * Written only by the IRQ handler and read only by the tasklet, which
+ * runs on the CPU that took the interrupt. */
+#define SCANCODE_QUEUE_SIZE 64
+static uint8_t scancode_queue[SCANCODE_QUEUE_SIZE];
+static volatile uint32_t scancode_head = 0;
+static volatile uint32_t scancode_tail = 0;
+
+static void keyboard_tasklet_fn(uint32_t data);
+static DECLARE_TASKLET(keyboard_tasklet, keyboard_tasklet_fn, 0);
+
+/* Tasks waiting for input (shell, sys_read) */
+static wait_queue_t keyboard_wq = WAIT_QUEUE_INIT;
+
 /* Keyboard state flags */
 static bool shift_pressed = false;
 static bool ctrl_pressed = false;
@@ -149,29 +166,21 @@ static bool is_letter(char c)
     return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
 }
 
-/* Keyboard interrupt handler
- *
- * Called by IRQ 1 handler when a key is pressed or released.
+/* Translate one scancode (keyboard tasklet)
  *
  * PROCESS:
- * 1. Read scancode from port 0x60
- * 2. Check if it's a key press (bit 7 clear) or release (bit 7 set)
- * 3. Handle special keys (Shift, Ctrl, Caps Lock)
- * 4. Convert scancode to ASCII
- * 5. Add to keyboard buffer
+ * 1. Check if it's a key press (bit 7 clear) or release (bit 7 set)
+ * 2. Handle special keys (Shift, Ctrl, Caps Lock)
+ * 3. Convert scancode to ASCII
+ * 4. Add to keyboard buffer
  *
  * AI INTEGRATION:
  * - Track key patterns for prediction
  * - Learn common key combinations
  * - Provide smart suggestions
  */
-void keyboard_handler(void)
+static void keyboard_process_scancode(uint8_t scancode)
 {
-    /* Read scancode from keyboard data port
-     * IMPORTANT: We MUST read this even if we don't use it!
-     * If we don't, the keyboard controller won't send more interrupts. */
-
-    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
     /* Handle extended scancode prefix */
     if (scancode == 0xE0)
     {
@@ -317,6 +326,7 @@ void keyboard_handler(void)
     if (c)
     {
         keyboard_buffer_push(c);
+        wake_up(&keyboard_wq);
 
         /* AI: Learn from this keystroke
          * Track patterns, common sequences, typing speed, etc.
@@ -325,6 +335,41 @@ void keyboard_handler(void)
     }
 }
 
+/* Keyboard tasklet: translate everything the IRQ handler queued */
+static void keyboard_tasklet_fn(uint32_t data)
+{
+    (void)data;
+
+    while (scancode_tail != scancode_head) {
+        uint8_t scancode = scancode_queue[scancode_tail];
+        scancode_tail = (scancode_tail + 1) % SCANCODE_QUEUE_SIZE;
+        keyboard_process_scancode(scancode);
+    }
+}
+
+/* Keyboard interrupt handler
+ *
+ * Called by IRQ 1 handler when a key is pressed or released. Only
+ * acknowledges the controller and queues the scancode; translation
+ * happens in the tasklet once the interrupt is done.
+ */
+void keyboard_handler(void)
+{
+    /* Read scancode from keyboard data port
+     * IMPORTANT: We MUST read this even if we don't use it!
+     * If we don't, the keyboard controller won't send more interrupts. */
+    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+
+    /* Queue full - drop the scancode */
+    uint32_t next = (scancode_head + 1) % SCANCODE_QUEUE_SIZE;
+    if (next != scancode_tail) {
+        scancode_queue[scancode_head] = scancode;
+        scancode_head = next;
+    }
+
+    tasklet_schedule(&keyboard_tasklet);
+}
+
 /* Initialize keyboard driver
  *
  * Sets up the keyboard interrupt handler and initializes state.
@@ -338,6 +383,8 @@ void keyboard_init(void)
     /* Initialize buffer pointers */
     buffer_read_pos = 0;
     buffer_write_pos = 0;
+    scancode_head = 0;
+    scancode_tail = 0;
 
     /* Clear keyboard state */
     shift_pressed = false;
@@ -353,4 +400,27 @@ void keyboard_init(void)
 bool keyboard_has_data(void)
 {
     return buffer_read_pos != buffer_write_pos;
-}
\ No newline at end of file
+}
+
+/* Sleep until at least one character is buffered */
+void keyboard_wait_for_data(void)
+{
+    wait_event(keyboard_wq, keyboard_has_data());
+}
+
+/* Blocking read: waits for input, then returns whatever is buffered
+ * (at most len characters) */
+size_t keyboard_read(char *buf, size_t len)
+{
+    size_t n = 0;
+
+    if (len == 0)
+        return 0;
+
+    keyboard_wait_for_data();
+
+    while (n < len && keyboard_has_data())
+        buf[n++] = keyboard_buffer_pop();
+
+    return n;
+}
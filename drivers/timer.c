@@ -1,64 +1,337 @@
 /* drivers/timer.c - PIT (Programmable Interval Timer) driver
- * 
- * Drives the scheduler by calling scheduler_tick() every millisecond
+ *
+ * Drives the scheduler by calling scheduler_tick() every millisecond.
+ *
+ * Dynamic tick: when the CPU is idle, or a single task has the CPU to
+ * itself, nothing needs a 1ms tick. The PIT is then switched to
+ * one-shot mode and programmed for the next scheduler deadline (the
+ * earliest sleeper, at most ~54ms - the 16-bit counter limit). When the
+ * one-shot fires, or any other IRQ or wakeup arrives first, the elapsed
+ * time is read back from the counter, the missed ticks are handed to
+ * the scheduler in one go and periodic mode is restored. The sub-tick
+ * remainder is carried over so timer_ticks does not drift.
+ *
+ * Each tick also advances the kernel timer wheel (kernel/ktimer.c), and
+ * the tick is only stopped until the next timer is due.
+ *
+ * The TSC is calibrated once at boot against PIT channel 2 (polled, so
+ * it works before interrupts are on) for cycle-precise CPU accounting.
  */
 
 #include "../kernel/kernel.h"
 #include "../kernel/scheduler.h"
+#include "../kernel/smp.h"
+#include "../kernel/ktimer.h"
+#include "../kernel/vvar.h"
 
 #define PIT_FREQUENCY 1193182  /* PIT oscillator frequency in Hz */
 #define TIMER_HZ 1000          /* We want 1000 ticks per second (1ms) */
+#define TIMER_NOHZ 1           /* Stop the tick when nothing needs it */
+
+#define PIT_DIVISOR (PIT_FREQUENCY / TIMER_HZ)
+#define PIT_MAX_COUNT 0xFFFF
+#define NOHZ_MAX_TICKS (PIT_MAX_COUNT / PIT_DIVISOR)
+
+#define PIT_CMD_PERIODIC 0x36  /* Channel 0, lobyte/hibyte, square wave */
+#define PIT_CMD_ONESHOT  0x30  /* Channel 0, lobyte/hibyte, terminal count */
+#define PIT_CMD_LATCH    0x00  /* Channel 0, latch current count */
+#define PIT_CMD_CH2_ONESHOT 0xB0  /* Channel 2, lobyte/hibyte, terminal count */
+
+#define PIT_CH2_GATE   0x01     /* Port 0x61: channel 2 gate input */
+#define PIT_CH2_SPEAKER 0x02    /* Port 0x61: speaker data enable */
+#define PIT_CH2_OUT    0x20     /* Port 0x61: channel 2 output */
+#define TSC_CALIBRATE_MS 10
 
 static volatile uint32_t timer_ticks = 0;
+static volatile uint32_t timer_ticks_hi = 0;  /* Wraps of timer_ticks */
+static volatile uint32_t timer_ticks_seq = 0;  /* Odd while a wrap is written */
+
+/* Dynamic tick state */
+static bool nohz_active = false;
+static uint32_t nohz_count = 0;      /* PIT clocks programmed for the one-shot */
+static uint32_t pit_remainder = 0;   /* Elapsed clocks not yet worth a tick */
+static timer_nohz_stats_t nohz_stats = {0};
+
+static uint32_t tsc_khz = 0;         /* TSC cycles per millisecond */
+
+/* ================================================================
+ * PIT PROGRAMMING
+ * ================================================================ */
+
+static void pit_program(uint8_t command, uint32_t count)
+{
+    outb(0x43, command);
+    outb(0x40, (uint8_t)(count & 0xFF));        /* Low byte */
+    outb(0x40, (uint8_t)((count >> 8) & 0xFF)); /* High byte */
+}
+
+static uint32_t pit_read_count(void)
+{
+    outb(0x43, PIT_CMD_LATCH);
+    uint32_t lo = inb(0x40);
+    uint32_t hi = inb(0x40);
+    return lo | (hi << 8);
+}
+
+/* PIT clocks -> whole ticks, carrying the remainder forward */
+static uint32_t clocks_to_ticks(uint32_t clocks)
+{
+    clocks += pit_remainder;
+    pit_remainder = clocks % PIT_DIVISOR;
+    return clocks / PIT_DIVISOR;
+}
+
+/* Only CPU 0 advances the count, from its timer interrupt or with
+ * interrupts off. User space sees it through the vvar page. */
+static void timer_advance(uint32_t ticks)
+{
+    uint32_t old = timer_ticks;
+
+    if (old + ticks >= old) {
+        timer_ticks = old + ticks;
+    } else {
+        /* Both words change: let timer_get_ticks64() readers retry */
+        timer_ticks_seq++;
+        __asm__ volatile("" : : : "memory");
+        timer_ticks = old + ticks;
+        timer_ticks_hi++;
+        __asm__ volatile("" : : : "memory");
+        timer_ticks_seq++;
+    }
+
+    vvar_update_ticks(((uint64_t)timer_ticks_hi << 32) | timer_ticks);
+}
+
+/* ================================================================
+ * DYNAMIC TICK
+ * ================================================================ */
+
+/* Called with interrupts disabled */
+void timer_nohz_enter(void)
+{
+#if TIMER_NOHZ
+    if (nohz_active)
+        return;
+
+    uint32_t ticks = scheduler_next_event();
+    if (ticks <= 1)
+        return;
+    if (ticks > NOHZ_MAX_TICKS)
+        ticks = NOHZ_MAX_TICKS;
+
+    ticks = ktimer_next_event(timer_ticks, ticks);
+    if (ticks <= 1)
+        return;
+
+    nohz_count = ticks * PIT_DIVISOR;
+    pit_program(PIT_CMD_ONESHOT, nohz_count);
+    nohz_active = true;
+    nohz_stats.stops++;
+#endif
+}
+
+/* Leave one-shot mode early: account the time that has passed and go
+ * back to periodic ticks. Called with interrupts disabled. */
+void timer_nohz_exit(void)
+{
+    if (!nohz_active)
+        return;
+
+    uint32_t remaining = pit_read_count();
+    uint32_t elapsed;
+
+    if (remaining == 0 || remaining > nohz_count) {
+        /* Already expired (counter wrapped); the pending IRQ 0 will
+         * deliver the final tick itself */
+        elapsed = nohz_count - PIT_DIVISOR;
+    } else {
+        elapsed = nohz_count - remaining;
+    }
+
+    nohz_active = false;
+    pit_program(PIT_CMD_PERIODIC, PIT_DIVISOR);
+
+    uint32_t ticks = clocks_to_ticks(elapsed);
+    if (ticks > 0) {
+        timer_advance(ticks);
+        nohz_stats.ticks_avoided += ticks;
+        ktimer_tick(timer_ticks);
+        scheduler_catch_up(ticks);
+    }
+}
+
+/* Something became runnable - make sure the tick is running. The PIT
+ * belongs to CPU 0; other CPUs ask it with an IPI, whose handler
+ * leaves one-shot mode like any other interrupt does. */
+void timer_nohz_kick(void)
+{
+    if (!nohz_active)
+        return;
+
+    if (smp_processor_id() != 0) {
+        smp_send_resched(0);
+        return;
+    }
+
+    uint32_t flags = irq_save();
+    timer_nohz_exit();
+    irq_restore(flags);
+}
+
+timer_nohz_stats_t timer_get_nohz_stats(void)
+{
+    return nohz_stats;
+}
+
+/* ================================================================
+ * INTERRUPT HANDLER
+ * ================================================================ */
 
 /* Timer interrupt handler - called by IRQ 0 */
 void timer_handler(void)
 {
-    timer_ticks++;
-    
-    /* Call scheduler every tick */
-    scheduler_tick();
-    
-    /* Send EOI to PIC */
-    pic_send_eoi(IRQ_TIMER);
+    uint32_t ticks = 1;
+
+    if (nohz_active) {
+        /* One-shot expired: the whole programmed interval has passed */
+        nohz_active = false;
+        pit_program(PIT_CMD_PERIODIC, PIT_DIVISOR);
+
+        ticks = clocks_to_ticks(nohz_count);
+        if (ticks > 1)
+            nohz_stats.ticks_avoided += ticks - 1;
+        if (ticks == 0)
+            ticks = 1;
+    }
+
+    timer_advance(ticks);
+    ktimer_tick(timer_ticks);
+
+    /* Call scheduler (may stop the tick again or switch tasks - the
+     * EOI has already been sent by irq_handler_c) */
+    scheduler_tick_n(ticks);
+}
+
+/* ================================================================
+ * TSC CALIBRATION
+ * ================================================================ */
+
+/* Count TSC cycles across a TSC_CALIBRATE_MS one-shot on channel 2 */
+static void tsc_calibrate(void)
+{
+    uint32_t count = PIT_FREQUENCY * TSC_CALIBRATE_MS / 1000;
+    uint8_t port61 = inb(0x61);
+
+    /* Gate low, speaker off, while the count is loaded */
+    outb(0x61, port61 & ~(PIT_CH2_GATE | PIT_CH2_SPEAKER));
+    outb(0x43, PIT_CMD_CH2_ONESHOT);
+    outb(0x42, (uint8_t)(count & 0xFF));
+    outb(0x42, (uint8_t)((count >> 8) & 0xFF));
+
+    /* Raising the gate starts the count; OUT goes high at zero */
+    outb(0x61, (port61 & ~PIT_CH2_SPEAKER) | PIT_CH2_GATE);
+    uint64_t start = rdtsc();
+    uint32_t spins = 0;
+    while (!(inb(0x61) & PIT_CH2_OUT) && ++spins < 100000000)
+        ;
+    uint64_t cycles = rdtsc() - start;
+
+    outb(0x61, port61);
+    tsc_khz = (uint32_t)div_u64(cycles, TSC_CALIBRATE_MS);
+}
+
+uint32_t timer_tsc_khz(void)
+{
+    return tsc_khz;
 }
 
+uint64_t timer_cycles_to_us(uint64_t cycles)
+{
+    if (!tsc_khz)
+        return 0;
+
+    uint32_t rem;
+    uint64_t ms = div_u64_rem(cycles, tsc_khz, &rem);
+    return ms * 1000 + div_u64((uint64_t)rem * 1000, tsc_khz);
+}
+
+/* ================================================================
+ * PUBLIC API
+ * ================================================================ */
+
 /* Initialize PIT to generate interrupts at TIMER_HZ */
 void timer_init(void)
 {
-    /* Calculate divisor for desired frequency */
-    uint32_t divisor = PIT_FREQUENCY / TIMER_HZ;
-    
-    /* Send command byte: channel 0, lobyte/hibyte, rate generator */
-    outb(0x43, 0x36);
-    
-    /* Send divisor */
-    outb(0x40, (uint8_t)(divisor & 0xFF));        /* Low byte */
-    outb(0x40, (uint8_t)((divisor >> 8) & 0xFF)); /* High byte */
-    
+    /* Channel 0 as a rate generator at TIMER_HZ */
+    pit_program(PIT_CMD_PERIODIC, PIT_DIVISOR);
+
     /* Install handler for IRQ 0 */
     irq_install_handler(IRQ_TIMER, timer_handler);
-    
+
+    tsc_calibrate();
+
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
     terminal_writestring("[TIMER] PIT initialized (");
     char buf[16];
     itoa(TIMER_HZ, buf);
     terminal_writestring(buf);
-    terminal_writestring(" Hz)\n");
+    terminal_writestring(" Hz");
+#if TIMER_NOHZ
+    terminal_writestring(", dynamic tick");
+#endif
+    terminal_writestring("), TSC ");
+    itoa(tsc_khz / 1000, buf);
+    terminal_writestring(buf);
+    terminal_writestring(" MHz\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 }
 
 /* Get number of timer ticks since boot */
 uint32_t timer_get_ticks(void)
 {
-    return timer_ticks;
+    uint32_t flags = irq_save();
+    uint32_t ticks = timer_ticks;
+
+    /* Tick stopped: add what the one-shot counter has consumed so far
+     * (only CPU 0 touches the PIT) */
+    if (nohz_active && smp_processor_id() == 0) {
+        uint32_t remaining = pit_read_count();
+        if (remaining != 0 && remaining <= nohz_count)
+            ticks += (nohz_count - remaining + pit_remainder) / PIT_DIVISOR;
+    }
+
+    irq_restore(flags);
+    return ticks;
+}
+
+/* Ticks since boot in 64 bits. A read that overlaps a wrap of the low
+ * word is retried. */
+uint64_t timer_get_ticks64(void)
+{
+    uint32_t seq, hi, lo;
+
+    do {
+        seq = timer_ticks_seq;
+        __asm__ volatile("" : : : "memory");
+        hi = timer_ticks_hi;
+        lo = timer_ticks;
+        __asm__ volatile("" : : : "memory");
+    } while ((seq & 1) || seq != timer_ticks_seq);
+
+    return ((uint64_t)hi << 32) | lo;
 }
 
 /* Sleep for approximately ms milliseconds */
 void timer_sleep(uint32_t ms)
 {
+    /* Once tasking is up, sleep on the scheduler's sleep queue */
+    if (task_current()) {
+        task_sleep(ms);
+        return;
+    }
+
     uint32_t target = timer_ticks + ms;
     while (timer_ticks < target) {
         __asm__ volatile("hlt");
     }
-}
\ No newline at end of file
+}
@@ -10,6 +10,7 @@ void timer_init(void);
 
 /* Get number of ticks since boot */
 uint32_t timer_get_ticks(void);
+uint64_t timer_get_ticks64(void);
 
 /* Sleep for ms milliseconds */
 void timer_sleep(uint32_t ms);
@@ -6,11 +6,21 @@
 
 #include "fat.h"
 #include "../kernel/kernel.h"
+#include "../kernel/klog.h"
 #include "../drivers/ata.h"
+#include "../kernel/mutex.h"
+#include "../kernel/workqueue.h"
 
 static fat_fs_t fat_fs;
 static bool fat_initialized = false;
 
+/* Serializes every operation on fat_fs: the in-memory FAT, directory
+ * sectors and the shared sector buffers. A sleeping lock, since it is
+ * held across the (polled) disk I/O: the holder can be preempted, and
+ * other tasks wanting the filesystem sleep instead of spinning. Only
+ * tasks take it. */
+static mutex_t fat_lock = MUTEX_INIT("fat");
+
 /* Forward declarations */
 static int fat_node_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer);
 static int fat_node_write(vfs_node_t *node, uint32_t offset, uint32_t size, const uint8_t *buffer);
@@ -21,6 +31,8 @@ static vfs_node_t *fat_node_create(vfs_node_t *parent, const char *name, uint32_
 static vfs_node_t *fat_node_mkdir(vfs_node_t *parent, const char *name, uint32_t mode);
 static int fat_node_unlink(vfs_node_t *parent, const char *name);
 static int fat_node_rmdir(vfs_node_t *parent, const char *name);
+static int fat_sync_locked(void);
+static void fat_sync_later(void);
 
 static vfs_operations_t fat_ops = {
     .open = NULL, .close = NULL,
@@ -249,7 +261,7 @@ static int fat_write_dir_entry(uint32_t sector, uint32_t offset, fat_dir_entry_t
  * VFS OPERATIONS
  * ================================================================ */
 
-static int fat_node_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
+static int fat_node_read_locked(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
     if (!node || node->type != VFS_FILE) return -1;
     fat_node_data_t *data = (fat_node_data_t *)node->impl_data;
     if (!data || offset >= node->size) return 0;
@@ -259,16 +271,8 @@ static int fat_node_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8
     uint32_t cluster_size = fat_fs.sectors_per_cluster * 512;
     uint16_t cluster = data->first_cluster;
 
-    /* DEBUG: Show file read info */
-    terminal_writestring("[FAT_READ] File: ");
-    terminal_writestring(node->name);
-    terminal_writestring(" size=");
-    terminal_write_dec(node->size);
-    terminal_writestring(" first_cluster=");
-    terminal_write_dec(cluster);
-    terminal_writestring(" cluster_size=");
-    terminal_write_dec(cluster_size);
-    terminal_writestring("\n");
+    klog_debug(KLOG_FS, "read %s size=%u first_cluster=%u offset=%u len=%u",
+               node->name, node->size, cluster, offset, size);
 
     /* Skip to offset */
     uint32_t skip = offset / cluster_size;
@@ -281,29 +285,8 @@ static int fat_node_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8
 
     int cluster_num = 0;
     while (bytes_read < size && cluster >= 2 && cluster < FAT_CLUSTER_EOC) {
-        /* DEBUG: Show each cluster being read (first few only) */
-        if (cluster_num < 5) {
-            terminal_writestring("[FAT_READ] Cluster ");
-            terminal_write_dec(cluster_num);
-            terminal_writestring(": cluster#=");
-            terminal_write_dec(cluster);
-            terminal_writestring(" LBA=");
-            terminal_write_dec(cluster_to_lba(cluster));
-            terminal_writestring("\n");
-        }
-
         if (fat_read_cluster(cluster, buf) < 0) break;
 
-        /* DEBUG: Show first 8 bytes of first few clusters */
-        if (cluster_num < 3) {
-            terminal_writestring("[FAT_READ] First 8 bytes: ");
-            for (int j = 0; j < 8; j++) {
-                terminal_write_hex(buf[j]);
-                terminal_putchar(' ');
-            }
-            terminal_writestring("\n");
-        }
-
         uint32_t to_read = cluster_size - cluster_offset;
         if (to_read > size - bytes_read) to_read = size - bytes_read;
 
@@ -314,17 +297,13 @@ static int fat_node_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8
         cluster_num++;
     }
 
-    terminal_writestring("[FAT_READ] Total bytes_read=");
-    terminal_write_dec(bytes_read);
-    terminal_writestring(" clusters_read=");
-    terminal_write_dec(cluster_num);
-    terminal_writestring("\n");
+    klog_debug(KLOG_FS, "read %s: %u bytes from %d clusters", node->name, bytes_read, cluster_num);
 
     return bytes_read;
 }
 
 
-static int fat_node_write(vfs_node_t *node, uint32_t offset, uint32_t size, const uint8_t *buffer) {
+static int fat_node_write_locked(vfs_node_t *node, uint32_t offset, uint32_t size, const uint8_t *buffer) {
     if (!node || node->type != VFS_FILE) return -1;
     fat_node_data_t *data = (fat_node_data_t *)node->impl_data;
     if (!data) return -1;
@@ -439,13 +418,13 @@ static int fat_node_write(vfs_node_t *node, uint32_t offset, uint32_t size, cons
     }
 size_updated:
     
-    /* Sync FAT table to disk */
-    fat_sync();
+    /* Write the FAT back from the workqueue */
+    fat_sync_later();
     
     return bytes_written;
 }
 
-static dirent_t *fat_node_readdir(vfs_node_t *node, uint32_t index) {
+static dirent_t *fat_node_readdir_locked(vfs_node_t *node, uint32_t index) {
     if (!node || node->type != VFS_DIRECTORY) return NULL;
     
     static dirent_t dent;
@@ -500,7 +479,7 @@ static dirent_t *fat_node_readdir(vfs_node_t *node, uint32_t index) {
     return NULL;
 }
 
-static vfs_node_t *fat_node_finddir(vfs_node_t *node, const char *name) {
+static vfs_node_t *fat_node_finddir_locked(vfs_node_t *node, const char *name) {
     if (!node || node->type != VFS_DIRECTORY) return NULL;
     
     fat_node_data_t *data = (fat_node_data_t *)node->impl_data;
@@ -530,7 +509,7 @@ static vfs_node_t *fat_node_finddir(vfs_node_t *node, const char *name) {
     return child;
 }
 
-static vfs_node_t *fat_node_create(vfs_node_t *parent, const char *name, uint32_t mode) {
+static vfs_node_t *fat_node_create_locked(vfs_node_t *parent, const char *name, uint32_t mode) {
     (void)mode;
     if (!parent || parent->type != VFS_DIRECTORY) return NULL;
     
@@ -569,8 +548,8 @@ static vfs_node_t *fat_node_create(vfs_node_t *parent, const char *name, uint32_
         return NULL;
     }
     
-    /* Sync FAT table */
-    fat_sync();
+    /* Write the FAT back from the workqueue */
+    fat_sync_later();
     
     /* Create VFS node */
     vfs_node_t *node = kmalloc(sizeof(vfs_node_t));
@@ -598,7 +577,7 @@ static vfs_node_t *fat_node_create(vfs_node_t *parent, const char *name, uint32_
  * MOUNT
  * ================================================================ */
 
-vfs_node_t *fat_mount(uint8_t drive, uint32_t partition_start) {
+static vfs_node_t *fat_mount_locked(uint8_t drive, uint32_t partition_start) {
     terminal_writestring("[FAT] Mounting FAT16 filesystem...\n");
     
     fat_boot_sector_t *boot = kmalloc(512);
@@ -680,7 +659,7 @@ vfs_node_t *fat_mount(uint8_t drive, uint32_t partition_start) {
     return root;
 }
 
-int fat_sync(void) {
+static int fat_sync_locked(void) {
     if (!fat_initialized || !fat_fs.fat_dirty) return 0;
     
     for (uint8_t i = 0; i < fat_fs.num_fats; i++) {
@@ -696,10 +675,30 @@ int fat_sync(void) {
     return 0;
 }
 
-void fat_unmount(vfs_node_t *root) {
+/* Writeback: rewriting every FAT sector after each change used to be
+ * the bulk of a small write, all with fat_lock held.
+ * Changes now only mark the FAT dirty and queue fat_sync_work, so a
+ * burst of updates costs one flush, done by the kworker thread. sync
+ * and unmount still write it out immediately. */
+static void fat_sync_work_fn(work_t *work) {
+    (void)work;
+    if (fat_sync() < 0)
+        klog_warn(KLOG_FS, "FAT writeback failed");
+}
+
+static work_t fat_sync_work = WORK_INIT(fat_sync_work_fn);
+
+static void fat_sync_later(void) {
+    if (!fat_fs.fat_dirty) return;
+    /* No worker yet (early boot): write through */
+    if (!queue_work(system_wq, &fat_sync_work) && !system_wq)
+        fat_sync_locked();
+}
+
+static void fat_unmount_locked(vfs_node_t *root) {
     (void)root;
     if (!fat_initialized) return;
-    fat_sync();
+    fat_sync_locked();
     if (fat_fs.fat_table) kfree(fat_fs.fat_table);
     fat_initialized = false;
 }
@@ -714,7 +713,7 @@ void fat_init(void) {
  * DIRECTORY CREATION
  * ================================================================ */
 
-static vfs_node_t *fat_node_mkdir(vfs_node_t *parent, const char *name, uint32_t mode) {
+static vfs_node_t *fat_node_mkdir_locked(vfs_node_t *parent, const char *name, uint32_t mode) {
     (void)mode;
     if (!parent || parent->type != VFS_DIRECTORY) return NULL;
     
@@ -777,8 +776,8 @@ static vfs_node_t *fat_node_mkdir(vfs_node_t *parent, const char *name, uint32_t
         return NULL;
     }
     
-    /* Sync FAT table */
-    fat_sync();
+    /* Write the FAT back from the workqueue */
+    fat_sync_later();
     
     /* Create VFS node */
     vfs_node_t *node = kmalloc(sizeof(vfs_node_t));
@@ -806,7 +805,7 @@ static vfs_node_t *fat_node_mkdir(vfs_node_t *parent, const char *name, uint32_t
  * FILE/DIRECTORY DELETION
  * ================================================================ */
 
-static int fat_node_unlink(vfs_node_t *parent, const char *name) {
+static int fat_node_unlink_locked(vfs_node_t *parent, const char *name) {
     if (!parent || parent->type != VFS_DIRECTORY) return -1;
     
     fat_node_data_t *parent_data = (fat_node_data_t *)parent->impl_data;
@@ -838,7 +837,7 @@ static int fat_node_unlink(vfs_node_t *parent, const char *name) {
                     
                     /* Free cluster chain */
                     fat_free_cluster_chain(first_cluster);
-                    fat_sync();
+                    fat_sync_later();
                     return 0;
                 }
             }
@@ -867,7 +866,7 @@ static int fat_node_unlink(vfs_node_t *parent, const char *name) {
                 
                 /* Free cluster chain */
                 fat_free_cluster_chain(first_cluster);
-                fat_sync();
+                fat_sync_later();
                 return 0;
             }
         }
@@ -878,7 +877,87 @@ static int fat_node_unlink(vfs_node_t *parent, const char *name) {
     return -1;  /* Not found */
 }
 
-static int fat_node_rmdir(vfs_node_t *parent, const char *name) {
+static int fat_node_rmdir_locked(vfs_node_t *parent, const char *name) {
     /* For now, just call unlink - should check if directory is empty */
-    return fat_node_unlink(parent, name);
-}
\ No newline at end of file
+    return fat_node_unlink_locked(parent, name);
+}
+
+/* ================================================================
+ * LOCKED ENTRY POINTS
+ * ================================================================ */
+
+static int fat_node_read(vfs_node_t *node, uint32_t offset, uint32_t size, uint8_t *buffer) {
+    mutex_lock(&fat_lock);
+    int ret = fat_node_read_locked(node, offset, size, buffer);
+    mutex_unlock(&fat_lock);
+    return ret;
+}
+
+static int fat_node_write(vfs_node_t *node, uint32_t offset, uint32_t size, const uint8_t *buffer) {
+    mutex_lock(&fat_lock);
+    int ret = fat_node_write_locked(node, offset, size, buffer);
+    mutex_unlock(&fat_lock);
+    return ret;
+}
+
+static dirent_t *fat_node_readdir(vfs_node_t *node, uint32_t index) {
+    mutex_lock(&fat_lock);
+    dirent_t *ret = fat_node_readdir_locked(node, index);
+    mutex_unlock(&fat_lock);
+    return ret;
+}
+
+static vfs_node_t *fat_node_finddir(vfs_node_t *node, const char *name) {
+    mutex_lock(&fat_lock);
+    vfs_node_t *ret = fat_node_finddir_locked(node, name);
+    mutex_unlock(&fat_lock);
+    return ret;
+}
+
+static vfs_node_t *fat_node_create(vfs_node_t *parent, const char *name, uint32_t mode) {
+    mutex_lock(&fat_lock);
+    vfs_node_t *ret = fat_node_create_locked(parent, name, mode);
+    mutex_unlock(&fat_lock);
+    return ret;
+}
+
+static vfs_node_t *fat_node_mkdir(vfs_node_t *parent, const char *name, uint32_t mode) {
+    mutex_lock(&fat_lock);
+    vfs_node_t *ret = fat_node_mkdir_locked(parent, name, mode);
+    mutex_unlock(&fat_lock);
+    return ret;
+}
+
+static int fat_node_unlink(vfs_node_t *parent, const char *name) {
+    mutex_lock(&fat_lock);
+    int ret = fat_node_unlink_locked(parent, name);
+    mutex_unlock(&fat_lock);
+    return ret;
+}
+
+static int fat_node_rmdir(vfs_node_t *parent, const char *name) {
+    mutex_lock(&fat_lock);
+    int ret = fat_node_rmdir_locked(parent, name);
+    mutex_unlock(&fat_lock);
+    return ret;
+}
+
+vfs_node_t *fat_mount(uint8_t drive, uint32_t partition_start) {
+    mutex_lock(&fat_lock);
+    vfs_node_t *root = fat_mount_locked(drive, partition_start);
+    mutex_unlock(&fat_lock);
+    return root;
+}
+
+int fat_sync(void) {
+    mutex_lock(&fat_lock);
+    int ret = fat_sync_locked();
+    mutex_unlock(&fat_lock);
+    return ret;
+}
+
+void fat_unmount(vfs_node_t *root) {
+    mutex_lock(&fat_lock);
+    fat_unmount_locked(root);
+    mutex_unlock(&fat_lock);
+}
@@ -12,6 +12,7 @@
 
 #include "vfs.h"
 #include "../kernel/kernel.h"
+#include "../kernel/spinlock.h"
 #include "../lib/string.h"
 
 /* ====================================================================
@@ -28,6 +29,10 @@ vfs_node_t *vfs_cwd = NULL;
  * TODO: Per-process FD table when we add process management */
 static file_descriptor_t fd_table[MAX_OPEN_FILES];
 
+/* Covers fd_table slot ownership and node open counts. Filesystem
+ * operations run outside it. Only tasks take it, so interrupts stay on. */
+static spinlock_t fd_lock = SPINLOCK_INIT("vfs_fd", LOCK_ORDER_VFS);
+
 /* Mount points list */
 static vfs_mount_t *mount_list = NULL;
 
@@ -35,32 +40,55 @@ static vfs_mount_t *mount_list = NULL;
  * FILE DESCRIPTOR MANAGEMENT
  * ==================================================================== */
 
-/* Allocate a new file descriptor
+/* Allocate a new file descriptor for an opened node
  * Returns FD number, or -1 if table is full */
-static int fd_alloc(void)
+static int fd_alloc(vfs_node_t *node, uint32_t flags)
 {
+    spin_lock(&fd_lock);
+
     for (int i = 0; i < MAX_OPEN_FILES; i++)
     {
         if (!fd_table[i].in_use)
         {
+            /* Fully set up before it becomes visible to fd_get() */
+            fd_table[i].node = node;
+            fd_table[i].flags = flags;
+            fd_table[i].position = (flags & O_APPEND) ? node->size : 0;
             fd_table[i].in_use = true;
-            fd_table[i].position = 0;
+            node->open_count++;
+
+            spin_unlock(&fd_lock);
             return i;
         }
     }
+
+    spin_unlock(&fd_lock);
     return -1; /* No free slots */
 }
 
-/* Free a file descriptor */
-static void fd_free(int fd)
+/* Free a file descriptor, returning the node it referred to
+ * Returns NULL if invalid FD */
+static vfs_node_t *fd_free(int fd)
 {
-    if (fd >= 0 && fd < MAX_OPEN_FILES)
+    vfs_node_t *node = NULL;
+    spin_lock(&fd_lock);
+
+    if (fd >= 0 && fd < MAX_OPEN_FILES && fd_table[fd].in_use)
     {
+        node = fd_table[fd].node;
+        if (node->open_count > 0)
+        {
+            node->open_count--;
+        }
+
         fd_table[fd].in_use = false;
         fd_table[fd].node = NULL;
         fd_table[fd].position = 0;
         fd_table[fd].flags = 0;
     }
+
+    spin_unlock(&fd_lock);
+    return node;
 }
 
 /* Get file descriptor entry
@@ -279,71 +307,50 @@ int vfs_open(const char *path, uint32_t flags)
         return -1; /* File not found */
     }
 
-    /* Allocate file descriptor */
-    int fd = fd_alloc();
-    if (fd < 0)
-    {
-        return -1; /* No free file descriptors */
-    }
-
     /* Call filesystem-specific open if it exists */
     if (node->ops && node->ops->open)
     {
         if (node->ops->open(node, flags) < 0)
         {
-            fd_free(fd);
             return -1;
         }
     }
 
-    /* Set up file descriptor */
-    fd_table[fd].node = node;
-    fd_table[fd].flags = flags;
-    fd_table[fd].position = 0;
-
     /* If truncate flag, set size to 0 */
     if (flags & O_TRUNC)
     {
         node->size = 0;
     }
 
-    /* If append flag, start at end */
-    if (flags & O_APPEND)
+    /* Allocate file descriptor (takes a reference on the node) */
+    int fd = fd_alloc(node, flags);
+    if (fd < 0)
     {
-        fd_table[fd].position = node->size;
+        if (node->ops && node->ops->close)
+        {
+            node->ops->close(node);
+        }
+        return -1; /* No free file descriptors */
     }
 
-    /* Increment reference count */
-    node->open_count++;
-
     return fd;
 }
 
 int vfs_close(int fd)
 {
-    file_descriptor_t *file = fd_get(fd);
-    if (!file)
+    /* Free the file descriptor (drops the node reference) */
+    vfs_node_t *node = fd_free(fd);
+    if (!node)
     {
         return -1; /* Invalid FD */
     }
 
-    vfs_node_t *node = file->node;
-
     /* Call filesystem-specific close if it exists */
     if (node->ops && node->ops->close)
     {
         node->ops->close(node);
     }
 
-    /* Decrement reference count */
-    if (node->open_count > 0)
-    {
-        node->open_count--;
-    }
-
-    /* Free the file descriptor */
-    fd_free(fd);
-
     return 0;
 }
 
@@ -31,7 +31,7 @@ echo "      Done"
 # Copy new programs
 echo "[3/4] Installing programs..."
 
-PROGRAMS="hello counter sysinfo spin test"
+PROGRAMS="hello counter sysinfo spin test cyclic futex vdso"
 INSTALLED=0
 
 for prog in $PROGRAMS; do
@@ -70,6 +70,9 @@ if [ $? -eq 0 ]; then
     echo "  exec /bin/sysinfo  - Display system info"
     echo "  exec /bin/spin     - Spinner animation"
     echo "  exec /bin/test     - Basic syscall tests"
+    echo "  exec /bin/cyclic   - Wakeup latency per scheduling class"
+    echo "  exec /bin/futex    - Futex lock and condition variable"
+    echo "  exec /bin/vdso     - getpid/clock_gettime without syscalls"
     echo ""
 else
     echo "ERROR: Failed to unmount disk.img"
@@ -1,6 +1,7 @@
 /* idt.c - Current version from your documents */
 
 #include "../kernel/kernel.h"
+#include "../drivers/apic.h"
 
 /* The actual IDT - 256 entries, each 8 bytes = 2KB total */
 static struct idt_entry idt[IDT_ENTRIES];
@@ -60,6 +61,11 @@ extern void irq13(void);  /* FPU / coprocessor / inter-processor */
 extern void irq14(void);  /* Primary ATA hard disk */
 extern void irq15(void);  /* Secondary ATA hard disk */
 
+/* Local APIC interrupts (SMP) */
+extern void irq_lapic_timer(void);    /* Per-CPU tick */
+extern void irq_resched(void);        /* Reschedule IPI */
+extern void irq_spurious(void);       /* Spurious APIC interrupt */
+
 void idt_set_gate(uint8_t num, uint32_t handler, uint16_t selector, uint8_t flags) {
     idt[num].base_low = handler & 0xFFFF;
     idt[num].base_high = (handler >> 16) & 0xFFFF;
@@ -127,7 +133,17 @@ void idt_init(void) {
     idt_set_gate(45, (uint32_t)irq13, 0x08, 0x8E);
     idt_set_gate(46, (uint32_t)irq14, 0x08, 0x8E);
     idt_set_gate(47, (uint32_t)irq15, 0x08, 0x8E);
+
+    /* Install local APIC vectors */
+    idt_set_gate(APIC_TIMER_VECTOR, (uint32_t)irq_lapic_timer, 0x08, 0x8E);
+    idt_set_gate(APIC_RESCHED_VECTOR, (uint32_t)irq_resched, 0x08, 0x8E);
+    idt_set_gate(APIC_SPURIOUS_VECTOR, (uint32_t)irq_spurious, 0x08, 0x8E);
     
     /* Load the IDT */
+    idt_load();
+}
+
+/* Load the (shared) IDT on the calling CPU */
+void idt_load(void) {
     __asm__ volatile("lidt %0" : : "m"(idtp));
 }
@@ -373,6 +373,28 @@ irq15:
     push $47
     jmp irq_common_stub
 
+/* ================================================================
+ * LOCAL APIC INTERRUPTS - Per-CPU tick and IPIs (SMP)
+ * ================================================================ */
+.global irq_lapic_timer
+irq_lapic_timer:
+    cli
+    push $0
+    push $0xF0
+    jmp irq_common_stub
+
+.global irq_resched
+irq_resched:
+    cli
+    push $0
+    push $0xF1
+    jmp irq_common_stub
+
+/* Spurious interrupts must not be acknowledged */
+.global irq_spurious
+irq_spurious:
+    iret
+
 /* ================================================================
  * ISR COMMON STUB - For CPU Exceptions (int 0-31)
  * FIXED: Now passes stack pointer as argument like irq_common_stub
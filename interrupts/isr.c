@@ -4,6 +4,12 @@
 
 #include "../kernel/kernel.h"
 #include "../kernel/fpu.h"
+#include "../kernel/schedtrace.h"
+#include "../kernel/scheduler.h"
+#include "../kernel/task.h"
+#include "../kernel/softirq.h"
+#include "../kernel/preempt.h"
+#include "../drivers/apic.h"
 #include "isr_stack.h"
 
 /* Forward declarations */
@@ -99,8 +105,16 @@ void isr_handler(uint32_t *stack_ptr)
     /* SPECIAL CASE: Page fault (#14) */
     if (int_no == 14)
     {
+        /* Servicing a user fault is kernel time, not user time */
+        bool from_user = (STACK_CS(stack_ptr) & 3) == 3;
+        if (from_user)
+            acct_enter(ACCT_KERNEL);
+
         /* Pass stack_ptr directly - NO dereferencing needed! */
         page_fault_handler(stack_ptr);
+
+        if (from_user)
+            acct_enter(ACCT_USER);
         return;
     }
 
@@ -163,28 +177,84 @@ void irq_uninstall_handler(uint8_t irq)
     }
 }
 
-/* IRQ handler C wrapper - Uses STACK_* macros (direct, no indirection) */
-void irq_handler_c(uint32_t *stack_ptr)
+/* Acknowledge a device IRQ at whichever controller delivered it */
+static void irq_send_eoi(uint8_t irq)
+{
+    if (apic_irq_routing)
+        lapic_eoi();
+    else
+        pic_send_eoi(irq);
+}
+
+/* Local APIC interrupts: the APs' tick and reschedule IPIs */
+static void lapic_irq(uint32_t vector)
+{
+    lapic_eoi();
+
+    /* CPU 0 may be sitting in a stopped tick, like for any other IRQ */
+    if (smp_processor_id() == 0)
+        timer_nohz_exit();
+
+    if (vector == APIC_TIMER_VECTOR)
+        scheduler_tick_local();
+    else
+        scheduler_resched_ipi();
+}
+
+/* The EOI goes out before the handler runs: irq_handler_c() may switch
+ * tasks afterwards, and the controller must not be left waiting until
+ * this task happens to be scheduled again. Interrupts stay disabled
+ * until the iret (or the next task's sti), so nothing nests early. */
+static void irq_dispatch(uint32_t *stack_ptr)
 {
     uint32_t int_no = STACK_INTNO(stack_ptr);
 
+    if (int_no == APIC_TIMER_VECTOR || int_no == APIC_RESCHED_VECTOR)
+    {
+        lapic_irq(int_no);
+        return;
+    }
+
     /* Ensure valid IRQ range */
     if (int_no < 32 || int_no > 47)
     {
-        pic_send_eoi(0);
+        irq_send_eoi(0);
         return;
     }
 
     uint8_t irq = int_no - 32;
 
+    trace_irq(irq, task_current());
+
+    /* Tick may be stopped: bring jiffies up to date before anyone looks */
+    if (irq != IRQ_TIMER)
+        timer_nohz_exit();
+
+    irq_send_eoi(irq);
+
     /* Execute handler if installed */
     if (irq_handlers[irq])
     {
         irq_handlers[irq]();
     }
+}
 
-    /* Send EOI */
-    pic_send_eoi(irq);
+/* IRQ handler C wrapper - Uses STACK_* macros (direct, no indirection)
+ *
+ * Time spent here is billed as IRQ time to the interrupted task. If the
+ * handler switches tasks, the saved mode travels with this stack frame
+ * and is restored when the task comes back to finish the interrupt.
+ * Softirqs the handler raised run on the way out, still billed as IRQ
+ * time but with interrupts enabled. Last comes the preemption point:
+ * if the tick or a wakeup asked for the CPU and the interrupted code
+ * holds no spinlock, the task is switched out here - user or kernel. */
+void irq_handler_c(uint32_t *stack_ptr)
+{
+    uint8_t mode = acct_enter(ACCT_IRQ);
+    irq_dispatch(stack_ptr);
+    softirq_run();
+    preempt_schedule_irq();
+    acct_enter(mode);
 }
 
 /* IRQ handler entry (naked) */
@@ -1,12 +1,24 @@
-/* interrupts/pagefault.c - Page Fault Handler with EXTENSIVE DEBUG
+/* interrupts/pagefault.c - Page Fault Handler
  * FIXED: Uses STACK_* macros (direct access)
+ *
+ * Recoverable faults are serviced silently and counted; the full
+ * diagnostic dump is only printed for faults that end in a panic.
+ * Demand-paged kernel heap faults map up to PF_FAULT_AROUND_PAGES
+ * neighbouring pages while frames are plentiful, so sequential heap
+ * growth takes one fault per window instead of one per page. Those
+ * extra pages are remembered, and a shrinker unmaps the ones that were
+ * never touched (accessed bit still clear) when memory runs low.
  */
 
 #include "../kernel/kernel.h"
 #include "../mm/vmm.h"
 #include "../mm/pmm.h"
+#include "../mm/shrinker.h"
+#include "../kernel/fpu.h"
+#include "../kernel/spinlock.h"
 #include "../drivers/terminal.h"
 #include "isr_stack.h"
+#include "pagefault.h"
 
 /* Page fault error code bits */
 #define PF_PRESENT 0x01
@@ -15,77 +27,171 @@
 #define PF_RESERVED 0x08
 #define PF_INSTRUCTION 0x10
 
-void page_fault_handler(uint32_t *stack_ptr)
+/* Covers pf_stats and the fault-around list. Never held across
+ * pmm_alloc_block(), which may call into the shrinker below. */
+static spinlock_t pf_lock = SPINLOCK_INIT("pagefault", LOCK_ORDER_FAULT);
+
+static pf_stats_t pf_stats;
+
+/* Pages mapped by fault-around and not known to be in use yet */
+static uint32_t fa_pages[PF_FAULT_AROUND_TRACKED];
+static uint32_t fa_count = 0;
+
+/* ================================================================
+ * HELPERS
+ * ================================================================ */
+
+/* Record how long the fault took in the log2 cycle histogram (pf_lock
+ * held) */
+static void pf_account_latency(uint64_t start)
 {
-    /* Disable interrupts to prevent nested faults */
-    __asm__ volatile("cli");
+    uint32_t cycles = (uint32_t)(rdtsc() - start);
+    uint32_t bucket = 0;
 
-    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
-    terminal_writestring("\n=== PAGE FAULT HANDLER ENTERED ===\n");
-    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    while (bucket < PF_LATENCY_BUCKETS - 1 &&
+           cycles >= (1u << (bucket + PF_LATENCY_SHIFT)))
+        bucket++;
 
-    uint32_t fault_addr;
-    asm volatile("mov %%cr2, %0" : "=r"(fault_addr));
+    pf_stats.latency[bucket]++;
+}
 
-    uint32_t esp_value;
-    asm volatile("mov %%esp, %0" : "=r"(esp_value));
+/* Back a kernel heap page with a zeroed frame. The frame is cleared
+ * through the identity map before it is mapped, so the new PTE starts
+ * with its accessed bit clear. */
+static bool pf_map_zero_page(uint32_t page_addr)
+{
+    void *phys = pmm_alloc_block();
+    if (!phys)
+        return false;
 
-    /* Use STACK_* macros - stack_ptr is already the direct stack pointer */
+    clear_page(phys);
+    vmm_map_page(page_addr, (uint32_t)phys, VMM_PRESENT | VMM_WRITE);
+    return true;
+}
+
+/* Map the unmapped neighbours of page_addr inside its fault-around
+ * window. Only done while frames are available without reclaim, so
+ * fault-around never pushes the system into memory pressure, and only
+ * as long as the pages can be tracked for the shrinker. */
+static uint32_t pf_fault_around(uint32_t page_addr)
+{
+    uint32_t window = PF_FAULT_AROUND_PAGES * PAGE_SIZE;
+    uint32_t start = page_addr & ~(window - 1);
+    uint32_t mapped = 0;
+
+    for (uint32_t addr = start; addr < start + window; addr += PAGE_SIZE)
+    {
+        if (addr == page_addr || addr < KERNEL_HEAP_START || addr >= KERNEL_HEAP_END)
+            continue;
+
+        if (pmm_get_free_blocks() <= SHRINKER_HIGH_WATERMARK ||
+            __atomic_load_n(&fa_count, __ATOMIC_RELAXED) == PF_FAULT_AROUND_TRACKED)
+            break;
+
+        if (vmm_is_mapped(addr))
+            continue;
+
+        if (!pf_map_zero_page(addr))
+            break;
+
+        spin_lock(&pf_lock);
+        if (fa_count < PF_FAULT_AROUND_TRACKED)
+            fa_pages[fa_count++] = addr;
+        spin_unlock(&pf_lock);
+        mapped++;
+    }
+
+    return mapped;
+}
+
+/* ================================================================
+ * FAULT-AROUND RECLAIM
+ * ================================================================ */
+
+static uint32_t fa_count_objects(shrinker_t *s)
+{
+    (void)s;
+    return __atomic_load_n(&fa_count, __ATOMIC_RELAXED);
+}
+
+/* Unmap pre-mapped pages nobody has touched. Once a page has been
+ * accessed it may hold data someone relies on, so it can no longer be
+ * dropped: it is forgotten and stays mapped like any page that took
+ * its own fault. */
+static uint32_t fa_scan_objects(shrinker_t *s, uint32_t nr_to_scan)
+{
+    uint32_t freed = 0;
+    (void)s;
+
+    uint32_t flags = spin_lock_irqsave(&pf_lock);
+
+    uint32_t i = fa_count;
+    while (i-- > 0 && freed < nr_to_scan)
+    {
+        uint32_t pte_flags = vmm_get_flags(fa_pages[i]);
+
+        /* Page table not visible from this address space: try later */
+        if (!(pte_flags & VMM_PRESENT))
+            continue;
+
+        if (!(pte_flags & VMM_ACCESSED))
+        {
+            vmm_unmap_page(fa_pages[i]);
+            freed++;
+        }
+
+        fa_pages[i] = fa_pages[--fa_count];
+    }
+
+    pf_stats.fa_reclaimed += freed;
+    spin_unlock_irqrestore(&pf_lock, flags);
+
+    return freed;
+}
+
+static shrinker_t fa_shrinker = {
+    .name = "fault-around",
+    .count_objects = fa_count_objects,
+    .scan_objects = fa_scan_objects,
+    .seeks = 1,  /* Zero pages, free to rebuild */
+};
+
+void pagefault_init(void)
+{
+    register_shrinker(&fa_shrinker);
+}
+
+/* Full diagnostic dump for a fault we cannot handle */
+static void pf_report(uint32_t *stack_ptr, uint32_t fault_addr, const char *reason)
+{
     uint32_t err_code = STACK_ERRCODE(stack_ptr);
-    uint32_t eip = STACK_EIP(stack_ptr);
     uint32_t cs = STACK_CS(stack_ptr);
 
-    /* For user-mode faults, the ISR stub pushes registers before calling us.
-     * The full stack layout is (using isr_stack.h definitions):
-     * [sp + 0]  = GS
-     * [sp + 1]  = FS
-     * [sp + 2]  = ES
-     * [sp + 3]  = DS
-     * [sp + 4]  = EDI (from pusha)
-     * [sp + 5]  = ESI
-     * [sp + 6]  = EBP
-     * [sp + 7]  = ESP (dummy from pusha)
-     * [sp + 8]  = EBX
-     * [sp + 9]  = EDX
-     * [sp + 10] = ECX
-     * [sp + 11] = EAX
-     * [sp + 12] = Error code
-     * [sp + 13] = Int number (pushed by ISR stub)
-     * [sp + 14] = EIP
-     * [sp + 15] = CS
-     * [sp + 16] = EFLAGS
-     * [sp + 17] = User ESP  ← Only present for user-mode faults (CPL change)
-     * [sp + 18] = User SS   ← Only present for user-mode faults (CPL change)
-     */
+    /* For user-mode faults the CPU also pushed the user ESP/SS:
+     * [sp + 17] = User ESP, [sp + 18] = User SS (see isr_stack.h) */
     uint32_t user_esp = 0;
     uint32_t user_ss = 0;
 
-    /* Only read user ESP/SS if fault came from user mode (RPL=3 in CS) */
-    if ((cs & 0x3) == 3) {
+    if ((cs & 0x3) == 3)
+    {
         user_esp = stack_ptr[17];
         user_ss = stack_ptr[18];
     }
 
-    terminal_writestring("Fault address: 0x");
-    terminal_write_hex(fault_addr);
-    terminal_writestring("\n");
-
-    terminal_writestring("Saved user ESP: 0x");
-    terminal_write_hex(user_esp); // ← FIX THIS LINE
-    terminal_writestring("\n");
+    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
+    terminal_writestring("\n=== PAGE FAULT ===\n");
+    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 
-    terminal_writestring("Saved user SS: 0x");
+    terminal_writestring("Fault address: ");
+    terminal_write_hex(fault_addr);
+    terminal_writestring("\nSaved user ESP: ");
+    terminal_write_hex(user_esp);
+    terminal_writestring("\nSaved user SS: ");
     terminal_write_hex(user_ss);
-    terminal_writestring("\n");
-
-    terminal_writestring("Error code: 0x");
+    terminal_writestring("\nError code: ");
     terminal_write_hex(err_code);
     terminal_writestring("\n");
 
-    terminal_writestring("EIP: 0x");
-    terminal_write_hex(eip);
-    terminal_writestring("\n");
-
     /* Decode fault type */
     terminal_writestring("Type: ");
     if (err_code & PF_PRESENT)
@@ -104,66 +210,78 @@ void page_fault_handler(uint32_t *stack_ptr)
         terminal_writestring(" [kernel]");
     terminal_writestring("\n");
 
-    /* ============================================================
-     * Attempt recovery: non-present page only
-     * ============================================================ */
+    terminal_writestring("Reason: ");
+    terminal_writestring(reason);
+    terminal_writestring("\n");
+}
+
+/* ================================================================
+ * PAGE FAULT HANDLER
+ * ================================================================ */
+
+void page_fault_handler(uint32_t *stack_ptr)
+{
+    /* Interrupt gate: IF is already clear, and iret restores it */
+    uint64_t start = rdtsc();
+
+    uint32_t fault_addr;
+    asm volatile("mov %%cr2, %0" : "=r"(fault_addr));
+
+    /* Use STACK_* macros - stack_ptr is already the direct stack pointer */
+    uint32_t err_code = STACK_ERRCODE(stack_ptr);
+    uint32_t eip = STACK_EIP(stack_ptr);
+    const char *reason = "address outside any demand-paged region";
+
+    spin_lock(&pf_lock);
+    pf_stats.total++;
+    if (err_code & PF_USER)
+        pf_stats.user++;
+    spin_unlock(&pf_lock);
+
     if (!(err_code & PF_PRESENT))
     {
         uint32_t page_addr = fault_addr & ~0xFFF;
 
-        terminal_writestring("\nAttempting recovery for address 0x");
-        terminal_write_hex(page_addr);
-        terminal_writestring("...\n");
-
-        /* Kernel heap */
+        /* Kernel heap: demand zero-fill plus fault-around */
         if (fault_addr >= KERNEL_HEAP_START && fault_addr < KERNEL_HEAP_END)
         {
-            terminal_writestring("Step 1: Allocating physical page...\n");
-            void *phys = pmm_alloc_block();
-
-            if (!phys)
+            if (pf_map_zero_page(page_addr))
             {
-                terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
-                terminal_writestring("ERROR: pmm_alloc_block() returned NULL!\n");
-                goto unrecoverable;
+                uint32_t around = pf_fault_around(page_addr);
+
+                spin_lock(&pf_lock);
+                pf_stats.kernel_heap++;
+                pf_stats.minor++;
+                pf_stats.fault_around += around;
+                pf_account_latency(start);
+                spin_unlock(&pf_lock);
+                return;
             }
-
-            terminal_writestring("Step 2: Got physical page at 0x");
-            terminal_write_hex((uint32_t)phys);
-            terminal_writestring("\n");
-
-            terminal_writestring("Step 3: Calling vmm_map_page()...\n");
-
-            /* CRITICAL: Make sure vmm_map_page doesn't trigger another fault! */
-            vmm_map_page(page_addr, (uint32_t)phys, VMM_PRESENT | VMM_WRITE);
-
-            terminal_writestring("Step 4: vmm_map_page() returned successfully\n");
-
-            terminal_writestring("Step 5: Calling memset() to zero page...\n");
-
-            /* CRITICAL: This memset might trigger another fault if mapping didn't work! */
-            memset((void *)page_addr, 0, PAGE_SIZE);
-
-            terminal_writestring("Step 6: memset() completed successfully\n");
-
-            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
-            terminal_writestring("\n[SUCCESS] Page fault recovered! Returning to program...\n");
-            terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-
-            /* Re-enable interrupts before returning */
-            __asm__ volatile("sti");
-            return;
+            reason = "out of physical memory";
         }
-
-        /* User space */
-        if (fault_addr >= 0x10000000 && fault_addr < 0xC0000000)
+        else if (fault_addr >= 0x10000000 && fault_addr < 0xC0000000)
         {
-            terminal_writestring("User space fault - not implemented yet\n");
-            goto unrecoverable;
+            reason = "user space demand paging not implemented";
         }
     }
+    else if (err_code & PF_WRITE)
+    {
+        /* No copy-on-write mappings exist yet: fork copies eagerly */
+        reason = "write to read-only page (no COW mapping)";
+    }
+    else
+    {
+        reason = "protection violation";
+    }
+
+    spin_lock(&pf_lock);
+    pf_stats.unrecoverable++;
+    if ((err_code & PF_PRESENT) && (err_code & PF_WRITE))
+        pf_stats.wp_fatal++;
+    spin_unlock(&pf_lock);
+
+    pf_report(stack_ptr, fault_addr, reason);
 
-unrecoverable:
     /* ============================================================
      * UNRECOVERABLE FAULT
      * ============================================================ */
@@ -173,7 +291,7 @@ unrecoverable:
     terminal_writestring("╚══════════════════════════════════════════════════════════╝\n");
 
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-    terminal_writestring("\nEIP: 0x");
+    terminal_writestring("\nEIP: ");
     terminal_write_hex(eip);
     terminal_writestring("\nSystem halted.\n");
 
@@ -181,6 +299,26 @@ unrecoverable:
         __asm__ volatile("cli; hlt");
 }
 
+/* ================================================================
+ * STATISTICS
+ * ================================================================ */
+
+pf_stats_t pagefault_get_stats(void)
+{
+    uint32_t flags = spin_lock_irqsave(&pf_lock);
+    pf_stats_t copy = pf_stats;
+    spin_unlock_irqrestore(&pf_lock, flags);
+
+    return copy;
+}
+
+void pagefault_reset_stats(void)
+{
+    uint32_t flags = spin_lock_irqsave(&pf_lock);
+    memset(&pf_stats, 0, sizeof(pf_stats));
+    spin_unlock_irqrestore(&pf_lock, flags);
+}
+
 /* Test function for page fault recovery - callable from shell */
 void test_page_fault_recovery(void)
 {
@@ -5,7 +5,38 @@
 
 #include <stdint.h>
 
+/* Fault-around: map up to this many pages around a demand-paged fault */
+#define PF_FAULT_AROUND_PAGES 8
+
+/* Pre-mapped pages remembered for reclaim; fault-around stops when full */
+#define PF_FAULT_AROUND_TRACKED 256
+
+/* Latency histogram: bucket i counts faults taking < 2^(i + PF_LATENCY_SHIFT)
+ * cycles (the last bucket collects everything slower) */
+#define PF_LATENCY_BUCKETS 16
+#define PF_LATENCY_SHIFT 9
+
+/* Page fault statistics */
+typedef struct
+{
+    uint32_t total;         /* All page faults taken */
+    uint32_t minor;         /* Resolved without I/O (zero-fill, cached) */
+    uint32_t major;         /* Resolved with I/O (file-backed) */
+    uint32_t wp_fatal;      /* Write to a present, read-only page (no COW) */
+    uint32_t kernel_heap;   /* Demand-paged kernel heap faults */
+    uint32_t user;          /* Faults raised from ring 3 */
+    uint32_t fault_around;  /* Extra pages mapped by fault-around */
+    uint32_t fa_reclaimed;  /* ... unmapped again, never touched */
+    uint32_t unrecoverable; /* Faults that ended in a panic */
+    uint32_t latency[PF_LATENCY_BUCKETS];
+} pf_stats_t;
+
+void pagefault_init(void);  /* Registers the fault-around shrinker */
 void page_fault_handler(uint32_t *stack_ptr);
 void test_page_fault_recovery(void);  /* Test function for shell */
 
-#endif /* PAGEFAULT_H */
\ No newline at end of file
+/* Statistics */
+pf_stats_t pagefault_get_stats(void);
+void pagefault_reset_stats(void);
+
+#endif /* PAGEFAULT_H */
@@ -0,0 +1,412 @@
+/* kernel/acpi.c - Multiprocessor Configuration Discovery
+ *
+ * Only the tables needed to bring up the other CPUs are parsed: RSDP ->
+ * RSDT/XSDT -> MADT, or the MP floating pointer -> MP configuration
+ * table. Firmware tables normally live in low memory or near the top of
+ * RAM; anything above the identity-mapped region is mapped on demand.
+ */
+
+#include "acpi.h"
+#include "kernel.h"
+#include "../mm/vmm.h"
+#include "../drivers/apic.h"
+
+/* ================================================================
+ * TABLE LAYOUTS
+ * ================================================================ */
+
+typedef struct
+{
+    char signature[8];        /* "RSD PTR " */
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;         /* 0 = ACPI 1.0, 2 = ACPI 2.0+ */
+    uint32_t rsdt_address;
+    /* ACPI 2.0+ */
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct
+{
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct
+{
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+    uint8_t entries[];
+} __attribute__((packed)) acpi_madt_t;
+
+#define MADT_LAPIC           0
+#define MADT_IOAPIC          1
+#define MADT_ISO             2   /* Interrupt source override */
+#define MADT_LAPIC_OVERRIDE  5
+
+#define MADT_LAPIC_ENABLED   0x1
+#define MADT_LAPIC_ONLINE_CAPABLE 0x2
+
+typedef struct
+{
+    char signature[4];        /* "_MP_" */
+    uint32_t config_table;
+    uint8_t length;           /* In 16-byte units */
+    uint8_t spec_rev;
+    uint8_t checksum;
+    uint8_t features[5];      /* features[0] != 0: default config, no table */
+} __attribute__((packed)) mp_floating_t;
+
+typedef struct
+{
+    char signature[4];        /* "PCMP" */
+    uint16_t base_length;
+    uint8_t spec_rev;
+    uint8_t checksum;
+    char oem_id[8];
+    char product_id[12];
+    uint32_t oem_table;
+    uint16_t oem_table_size;
+    uint16_t entry_count;
+    uint32_t lapic_address;
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} __attribute__((packed)) mp_config_table_t;
+
+#define MP_ENTRY_PROCESSOR   0   /* 20 bytes, every other entry is 8 */
+#define MP_ENTRY_BUS         1
+#define MP_ENTRY_IOAPIC      2
+#define MP_ENTRY_IO_INT      3
+#define MP_ENTRY_LOCAL_INT   4
+
+#define MP_CPU_ENABLED       0x1
+#define MP_IOAPIC_ENABLED    0x1
+#define MP_INT_TYPE_INT      0   /* Vectored interrupt (not NMI/SMI/ExtINT) */
+
+/* ================================================================
+ * HELPERS
+ * ================================================================ */
+
+/* Make sure [phys, phys + length) is reachable through the identity map */
+static void acpi_map(uint32_t phys, uint32_t length)
+{
+    uint32_t page = phys & ~(PAGE_SIZE - 1);
+    uint32_t end = phys + length;
+
+    for (; page < end && page >= MEMORY_LIMIT; page += PAGE_SIZE) {
+        if (!vmm_is_mapped(page))
+            vmm_map_page(page, page, VMM_PRESENT);
+    }
+}
+
+static bool checksum_ok(const void *data, uint32_t length)
+{
+    const uint8_t *bytes = data;
+    uint8_t sum = 0;
+
+    for (uint32_t i = 0; i < length; i++)
+        sum += bytes[i];
+    return sum == 0;
+}
+
+static void add_cpu(mp_config_t *config, uint8_t apic_id)
+{
+    if (config->nr_cpus < SMP_MAX_CPUS)
+        config->apic_ids[config->nr_cpus++] = apic_id;
+    else
+        config->cpus_ignored++;
+}
+
+/* Scan [start, start + length) on 16-byte boundaries for a signature */
+static void *scan_for(uint32_t start, uint32_t length, const char *signature, uint32_t sig_len)
+{
+    for (uint32_t addr = start; addr + 16 <= start + length; addr += 16) {
+        if (memcmp((void *)addr, signature, sig_len) == 0)
+            return (void *)addr;
+    }
+    return NULL;
+}
+
+/* Extended BIOS data area segment, from the BIOS data area */
+static uint32_t ebda_base(void)
+{
+    /* Hide the constant from GCC, which takes low addresses for NULL
+     * plus an offset and warns about the dereference */
+    uint32_t bda = 0x40E;
+    __asm__("" : "+r"(bda));
+    return (uint32_t)(*(volatile uint16_t *)bda) << 4;
+}
+
+/* ================================================================
+ * ACPI
+ * ================================================================ */
+
+static acpi_rsdp_t *find_rsdp(void)
+{
+    uint32_t ebda = ebda_base();
+    uint32_t regions[2][2] = {
+        { ebda, 1024 },              /* First KB of the EBDA */
+        { 0xE0000, 0x20000 },        /* BIOS read-only area */
+    };
+
+    for (int r = 0; r < 2; r++) {
+        if (!regions[r][0])
+            continue;
+
+        uint32_t start = regions[r][0];
+        uint32_t end = start + regions[r][1];
+
+        while (start < end) {
+            acpi_rsdp_t *rsdp = scan_for(start, end - start, "RSD PTR ", 8);
+            if (!rsdp)
+                break;
+            if (checksum_ok(rsdp, 20))
+                return rsdp;
+            start = (uint32_t)rsdp + 16;
+        }
+    }
+
+    return NULL;
+}
+
+static acpi_sdt_header_t *map_table(uint32_t phys)
+{
+    acpi_map(phys, sizeof(acpi_sdt_header_t));
+    acpi_sdt_header_t *header = (acpi_sdt_header_t *)phys;
+    acpi_map(phys, header->length);
+    return header;
+}
+
+static acpi_madt_t *find_madt(void)
+{
+    acpi_rsdp_t *rsdp = find_rsdp();
+    if (!rsdp)
+        return NULL;
+
+    /* Prefer the XSDT on ACPI 2.0+, as long as it is below 4GB */
+    bool xsdt = rsdp->revision >= 2 && rsdp->xsdt_address &&
+                (rsdp->xsdt_address >> 32) == 0;
+    uint32_t root_phys = xsdt ? (uint32_t)rsdp->xsdt_address : rsdp->rsdt_address;
+    if (!root_phys)
+        return NULL;
+
+    acpi_sdt_header_t *root = map_table(root_phys);
+    if (!checksum_ok(root, root->length))
+        return NULL;
+
+    uint32_t entry_size = xsdt ? 8 : 4;
+    uint32_t count = (root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    uint8_t *entries = (uint8_t *)root + sizeof(acpi_sdt_header_t);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys;
+        if (xsdt)
+            memcpy(&phys, entries + i * 8, 8);
+        else
+            phys = *(uint32_t *)(entries + i * 4);
+
+        if (!phys || (phys >> 32))
+            continue;
+
+        acpi_sdt_header_t *table = map_table((uint32_t)phys);
+        if (memcmp(table->signature, "APIC", 4) == 0 &&
+            checksum_ok(table, table->length))
+            return (acpi_madt_t *)table;
+    }
+
+    return NULL;
+}
+
+static bool parse_madt(mp_config_t *config)
+{
+    acpi_madt_t *madt = find_madt();
+    if (!madt)
+        return false;
+
+    config->source = "ACPI MADT";
+    config->lapic_base = madt->lapic_address;
+
+    uint8_t *entry = madt->entries;
+    uint8_t *end = (uint8_t *)madt + madt->header.length;
+
+    while (entry + 2 <= end && entry[1] >= 2 && entry + entry[1] <= end) {
+        switch (entry[0]) {
+            case MADT_LAPIC: {
+                uint8_t apic_id = entry[3];
+                uint32_t flags;
+                memcpy(&flags, entry + 4, 4);
+                if (flags & MADT_LAPIC_ENABLED)
+                    add_cpu(config, apic_id);
+                break;
+            }
+            case MADT_IOAPIC:
+                if (!config->has_ioapic) {
+                    config->has_ioapic = true;
+                    config->ioapic_id = entry[2];
+                    memcpy(&config->ioapic_base, entry + 4, 4);
+                    memcpy(&config->ioapic_gsi_base, entry + 8, 4);
+                }
+                break;
+            case MADT_ISO: {
+                uint8_t irq = entry[3];
+                uint32_t gsi;
+                uint16_t flags;
+                memcpy(&gsi, entry + 4, 4);
+                memcpy(&flags, entry + 8, 2);
+                if (entry[2] == 0 && irq < MP_ISA_IRQS) {
+                    config->isa_gsi[irq] = gsi;
+                    config->isa_flags[irq] = flags;
+                }
+                break;
+            }
+            case MADT_LAPIC_OVERRIDE: {
+                uint64_t addr;
+                memcpy(&addr, entry + 4, 8);
+                if (!(addr >> 32))
+                    config->lapic_base = (uint32_t)addr;
+                break;
+            }
+            default:
+                break;
+        }
+        entry += entry[1];
+    }
+
+    return config->nr_cpus > 0;
+}
+
+/* ================================================================
+ * MP SPECIFICATION TABLE
+ * ================================================================ */
+
+static mp_floating_t *find_mp_floating(void)
+{
+    uint32_t ebda = ebda_base();
+    uint32_t regions[3][2] = {
+        { ebda, 1024 },              /* First KB of the EBDA */
+        { 0x9FC00, 1024 },           /* Last KB of base memory */
+        { 0xF0000, 0x10000 },        /* BIOS ROM */
+    };
+
+    for (int r = 0; r < 3; r++) {
+        if (!regions[r][0])
+            continue;
+
+        uint32_t start = regions[r][0];
+        uint32_t end = start + regions[r][1];
+
+        while (start < end) {
+            mp_floating_t *mp = scan_for(start, end - start, "_MP_", 4);
+            if (!mp)
+                break;
+            if (checksum_ok(mp, mp->length * 16))
+                return mp;
+            start = (uint32_t)mp + 16;
+        }
+    }
+
+    return NULL;
+}
+
+static bool parse_mp_table(mp_config_t *config)
+{
+    mp_floating_t *mp = find_mp_floating();
+
+    /* Default configurations (no table) are pre-APIC-era dual boards */
+    if (!mp || !mp->config_table || mp->features[0])
+        return false;
+
+    acpi_map(mp->config_table, sizeof(mp_config_table_t));
+    mp_config_table_t *table = (mp_config_table_t *)mp->config_table;
+    acpi_map(mp->config_table, table->base_length);
+
+    if (memcmp(table->signature, "PCMP", 4) != 0 ||
+        !checksum_ok(table, table->base_length))
+        return false;
+
+    config->source = "MP table";
+    config->lapic_base = table->lapic_address;
+
+    int isa_bus = -1;
+    uint8_t *entry = (uint8_t *)table + sizeof(mp_config_table_t);
+    uint8_t *end = (uint8_t *)table + table->base_length;
+
+    for (uint32_t i = 0; i < table->entry_count && entry < end; i++) {
+        switch (entry[0]) {
+            case MP_ENTRY_PROCESSOR:
+                if (entry[3] & MP_CPU_ENABLED)
+                    add_cpu(config, entry[1]);
+                entry += 20;
+                break;
+            case MP_ENTRY_BUS:
+                if (memcmp(entry + 2, "ISA", 3) == 0)
+                    isa_bus = entry[1];
+                entry += 8;
+                break;
+            case MP_ENTRY_IOAPIC:
+                if (!config->has_ioapic && (entry[3] & MP_IOAPIC_ENABLED)) {
+                    config->has_ioapic = true;
+                    config->ioapic_id = entry[1];
+                    memcpy(&config->ioapic_base, entry + 4, 4);
+                    config->ioapic_gsi_base = 0;
+                }
+                entry += 8;
+                break;
+            case MP_ENTRY_IO_INT: {
+                uint16_t flags;
+                memcpy(&flags, entry + 2, 2);
+                uint8_t bus = entry[4], irq = entry[5];
+                uint8_t ioapic_id = entry[6], pin = entry[7];
+
+                /* Bus entries precede interrupt entries */
+                if (entry[1] == MP_INT_TYPE_INT && bus == isa_bus &&
+                    irq < MP_ISA_IRQS && config->has_ioapic &&
+                    ioapic_id == config->ioapic_id) {
+                    config->isa_gsi[irq] = pin;
+                    config->isa_flags[irq] = flags;
+                }
+                entry += 8;
+                break;
+            }
+            default:
+                entry += 8;
+                break;
+        }
+    }
+
+    return config->nr_cpus > 0;
+}
+
+/* ================================================================
+ * PUBLIC API
+ * ================================================================ */
+
+bool mp_discover(mp_config_t *config)
+{
+    memset(config, 0, sizeof(*config));
+
+    /* Identity ISA wiring unless an override says otherwise */
+    for (uint32_t irq = 0; irq < MP_ISA_IRQS; irq++)
+        config->isa_gsi[irq] = irq;
+
+    if (parse_madt(config))
+        return true;
+
+    memset(config, 0, sizeof(*config));
+    for (uint32_t irq = 0; irq < MP_ISA_IRQS; irq++)
+        config->isa_gsi[irq] = irq;
+
+    return parse_mp_table(config);
+}
@@ -0,0 +1,43 @@
+/* kernel/acpi.h - Multiprocessor Configuration Discovery
+ *
+ * Finds the CPUs and interrupt controllers of the machine. The ACPI
+ * MADT ("APIC" table) is tried first; firmware without ACPI usually
+ * still provides an Intel MultiProcessor Specification table, which is
+ * used as the fallback. Both describe the same things: the local APIC
+ * address, one local APIC per CPU, the I/O APIC(s) and how ISA IRQs
+ * are wired to I/O APIC inputs.
+ */
+
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "smp.h"
+
+#define MP_ISA_IRQS 16
+
+typedef struct
+{
+    const char *source;                    /* "ACPI MADT" or "MP table" */
+    uint32_t lapic_base;
+    uint32_t nr_cpus;                      /* Usable CPUs found */
+    uint8_t apic_ids[SMP_MAX_CPUS];        /* Local APIC ID per CPU */
+    uint32_t cpus_ignored;                 /* Beyond SMP_MAX_CPUS */
+
+    bool has_ioapic;
+    uint8_t ioapic_id;
+    uint32_t ioapic_base;
+    uint32_t ioapic_gsi_base;
+
+    /* ISA IRQ n arrives on I/O APIC input isa_gsi[n]; polarity and
+     * trigger mode in isa_flags[n] (APIC_IRQ_* in drivers/apic.h) */
+    uint32_t isa_gsi[MP_ISA_IRQS];
+    uint16_t isa_flags[MP_ISA_IRQS];
+} mp_config_t;
+
+/* Fill config from the MADT, or the MP table if there is no MADT.
+ * Returns false if neither was found (uniprocessor PC). */
+bool mp_discover(mp_config_t *config);
+
+#endif /* ACPI_H */
@@ -0,0 +1,86 @@
+/* kernel/ap_trampoline.s - Application Processor startup code
+ *
+ * An AP leaves INIT-SIPI-SIPI in 16-bit real mode at CS:IP = 0x0800:0,
+ * i.e. physical AP_TRAMPOLINE_ADDR. smp.c copies everything between
+ * ap_trampoline_start and ap_trampoline_end there and fills in the
+ * three variables at the end. The code switches to protected mode with
+ * a temporary flat GDT, turns on paging with the kernel page directory,
+ * loads the idle task's stack and calls ap_trampoline_entry (ap_main).
+ *
+ * CRITICAL: The code runs at the copy, not where it was linked - every
+ * absolute address is computed relative to TRAMPOLINE_BASE.
+ */
+
+.set TRAMPOLINE_BASE, 0x8000    /* AP_TRAMPOLINE_ADDR in smp.h */
+
+.section .text
+.global ap_trampoline_start
+.global ap_trampoline_end
+.global ap_trampoline_cr3
+.global ap_trampoline_stack
+.global ap_trampoline_entry
+
+.code16
+ap_trampoline_start:
+    cli
+    cld
+    xor %ax, %ax
+    mov %ax, %ds
+
+    /* Temporary GDT, then protected mode */
+    lgdtl TRAMPOLINE_BASE + (ap_gdt_ptr - ap_trampoline_start)
+    mov %cr0, %eax
+    or $0x1, %eax               /* PE */
+    mov %eax, %cr0
+
+    ljmpl $0x08, $(TRAMPOLINE_BASE + (ap_protected - ap_trampoline_start))
+
+.code32
+ap_protected:
+    mov $0x10, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+    mov %ax, %ss
+
+    /* Kernel address space (identity maps this page too) */
+    mov TRAMPOLINE_BASE + (ap_trampoline_cr3 - ap_trampoline_start), %eax
+    mov %eax, %cr3
+    mov %cr0, %eax
+    or $0x80000000, %eax        /* PG */
+    mov %eax, %cr0
+
+    /* Idle task stack, then into C - never returns */
+    mov TRAMPOLINE_BASE + (ap_trampoline_stack - ap_trampoline_start), %esp
+    xor %ebp, %ebp
+    mov TRAMPOLINE_BASE + (ap_trampoline_entry - ap_trampoline_start), %eax
+    call *%eax
+
+1:
+    cli
+    hlt
+    jmp 1b
+
+/* Flat code (0x08) and data (0x10) segments, same as the kernel's */
+.align 8
+ap_gdt:
+    .quad 0x0000000000000000
+    .quad 0x00CF9A000000FFFF
+    .quad 0x00CF92000000FFFF
+ap_gdt_ptr:
+    .word ap_gdt_ptr - ap_gdt - 1
+    .long TRAMPOLINE_BASE + (ap_gdt - ap_trampoline_start)
+
+/* Filled in by smp.c for each AP */
+.align 4
+ap_trampoline_cr3:
+    .long 0
+ap_trampoline_stack:
+    .long 0
+ap_trampoline_entry:
+    .long 0
+
+ap_trampoline_end:
+
+.section .note.GNU-stack,"",@progbits
@@ -0,0 +1,107 @@
+/* kernel/clocksource.c - Clock Sources and Monotonic Time
+ *
+ * The PIT clocksource is in place from the start, so ktime_get_ns()
+ * works before clocksource_init(). Switching to the TSC carries the
+ * time over: the TSC count is taken relative to the moment of the
+ * switch and added to the tick time reached by then.
+ */
+
+#include "clocksource.h"
+#include "kernel.h"
+#include "vvar.h"
+
+#define CPUID_EDX_TSC (1u << 4)
+
+/* ================================================================
+ * CLOCKSOURCES
+ * ================================================================ */
+
+static uint64_t pit_read(void)
+{
+    return timer_get_ticks64();
+}
+
+static uint64_t tsc_read(void)
+{
+    return rdtsc();
+}
+
+static clocksource_t clocksource_pit = {
+    .name = "pit",
+    .read = pit_read,
+    .mult = NSEC_PER_MSEC,
+    .shift = 0,
+    .resolution_ns = NSEC_PER_MSEC,
+};
+
+static clocksource_t clocksource_tsc = {
+    .name = "tsc",
+    .read = tsc_read,
+};
+
+/* ================================================================
+ * TIMEKEEPING
+ * ================================================================ */
+
+static clocksource_t *clock = &clocksource_pit;
+static uint64_t clock_base_count = 0;  /* clock->read() at the switch */
+static uint64_t clock_base_ns = 0;     /* Time at the switch */
+
+static bool cpu_has_tsc(void)
+{
+    uint32_t eax = 1, ebx, ecx = 0, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+    return (edx & CPUID_EDX_TSC) != 0;
+}
+
+/* Largest shift (finest mult) that keeps mult within 32 bits */
+static void tsc_calc_mult_shift(uint32_t khz)
+{
+    uint32_t shift = 32;
+    uint64_t mult;
+
+    while ((mult = div_u64((uint64_t)NSEC_PER_MSEC << shift, khz)) > 0xFFFFFFFFu)
+        shift--;
+
+    clocksource_tsc.mult = (uint32_t)mult;
+    clocksource_tsc.shift = shift;
+    clocksource_tsc.resolution_ns = (uint32_t)mul_u64_u32_shr(1, (uint32_t)mult, shift);
+    if (!clocksource_tsc.resolution_ns)
+        clocksource_tsc.resolution_ns = 1;
+}
+
+void clocksource_init(void)
+{
+    uint32_t khz = timer_tsc_khz();
+
+    if (cpu_has_tsc() && khz) {
+        tsc_calc_mult_shift(khz);
+
+        uint32_t flags = irq_save();
+        clock_base_ns = ktime_get_ns();
+        clock_base_count = clocksource_tsc.read();
+        clock = &clocksource_tsc;
+        irq_restore(flags);
+    }
+
+    /* User space converts the same way, without a system call */
+    vvar_update_clock(clock == &clocksource_tsc ? VVAR_CLOCK_TSC : VVAR_CLOCK_TICKS,
+                      clock->mult, clock->shift, clock_base_count, clock_base_ns);
+
+    terminal_writestring("[CLOCK] Clocksource ");
+    terminal_writestring(clock->name);
+    terminal_writestring(", resolution ");
+    terminal_write_dec(clock->resolution_ns);
+    terminal_writestring(" ns\n");
+}
+
+const clocksource_t *clocksource_current(void)
+{
+    return clock;
+}
+
+uint64_t ktime_get_ns(void)
+{
+    uint64_t delta = clock->read() - clock_base_count;
+    return clock_base_ns + mul_u64_u32_shr(delta, clock->mult, clock->shift);
+}
@@ -0,0 +1,54 @@
+/* kernel/clocksource.h - Clock Sources and Monotonic Time
+ *
+ * A clocksource is a free-running counter plus the factors that turn
+ * its count into nanoseconds: ns = (count * mult) >> shift. The best
+ * one available is chosen at boot:
+ *
+ * - "tsc": the time-stamp counter, calibrated against the PIT by
+ *   timer_init(). One rdtsc and two multiplies per read.
+ * - "pit": the 1ms timer tick in 64 bits, for CPUs without a usable
+ *   TSC. Millisecond resolution.
+ *
+ * ktime_get_ns() counts from boot, never goes backwards on a CPU and
+ * does not wrap for centuries. With the TSC, reads on different CPUs
+ * agree as far as their TSCs do (fine under QEMU and on any CPU with
+ * an invariant TSC).
+ */
+
+#ifndef CLOCKSOURCE_H
+#define CLOCKSOURCE_H
+
+#include <stdint.h>
+
+#define NSEC_PER_USEC 1000u
+#define NSEC_PER_MSEC 1000000u
+#define NSEC_PER_SEC  1000000000u
+
+typedef struct clocksource
+{
+    const char *name;
+    uint64_t (*read)(void);          /* Free-running count */
+    uint32_t mult;                   /* ns = (count * mult) >> shift */
+    uint32_t shift;
+    uint32_t resolution_ns;          /* One count */
+} clocksource_t;
+
+/* (a * mul) >> shift without a 64x64 multiply, for shift <= 32 */
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift)
+{
+    uint64_t lo = (uint64_t)(uint32_t)a * mul;
+    uint64_t hi = (uint64_t)(uint32_t)(a >> 32) * mul;
+
+    return (hi << (32 - shift)) + (lo >> shift);
+}
+
+/* Pick the clocksource (after timer_init() has calibrated the TSC) */
+void clocksource_init(void);
+
+/* The clocksource in use */
+const clocksource_t *clocksource_current(void);
+
+/* Nanoseconds since boot */
+uint64_t ktime_get_ns(void);
+
+#endif /* CLOCKSOURCE_H */
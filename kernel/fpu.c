@@ -1,6 +1,99 @@
+/* kernel/fpu.c - x87/SSE initialization, lazy state switching and
+ * floating-point exception handlers
+ *
+ * Save areas are 512-byte FXSAVE images carved out of whole PMM pages,
+ * eight to a page, so they are 16-byte aligned as FXSAVE requires.
+ * Pages are never returned; freed areas go back on fpu_free_list.
+ */
+
 #include <stdint.h>
 #include "../kernel/kernel.h"
+#include "../kernel/klog.h"
+#include "../kernel/spinlock.h"
+#include "../kernel/preempt.h"
+#include "../kernel/task.h"
+#include "../kernel/fpu.h"
+#include "../mm/pmm.h"
 #include "../drivers/terminal.h"
+#include "../interrupts/isr_stack.h"
+
+#define FPU_STATES_PER_PAGE (PAGE_SIZE / sizeof(fpu_state_t))
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+/* Register image right after fpu_init(): what a task starts with */
+static fpu_state_t fpu_initial_state;
+
+static bool fpu_has_sse2 = false;
+
+static fpu_state_t *fpu_free_list = NULL;
+static spinlock_t fpu_pool_lock = SPINLOCK_INIT("fpu_pool", LOCK_ORDER_FPU);
+
+static inline void fpu_clts(void)
+{
+    asm volatile("clts");
+}
+
+static inline void fpu_stts(void)
+{
+    uint32_t cr0;
+    asm volatile("mov %%cr0, %0" : "=r"(cr0));
+    asm volatile("mov %0, %%cr0" ::"r"(cr0 | (1 << 3))); // TS = 1
+}
+
+static inline void fpu_save(fpu_state_t *state)
+{
+    asm volatile("fxsave %0" : "=m"(*state));
+}
+
+static inline void fpu_restore(const fpu_state_t *state)
+{
+    asm volatile("fxrstor %0" ::"m"(*state));
+}
+
+/* ================================================================
+ * SAVE AREA POOL
+ * ================================================================ */
+
+static fpu_state_t *fpu_state_alloc(void)
+{
+    uint32_t flags = spin_lock_irqsave(&fpu_pool_lock);
+    fpu_state_t *state = fpu_free_list;
+    if (state)
+        fpu_free_list = *(fpu_state_t **)state;
+    spin_unlock_irqrestore(&fpu_pool_lock, flags);
+
+    if (state)
+        return state;
+
+    /* Pool empty: carve up a fresh page (outside the pool lock) */
+    fpu_state_t *page = pmm_alloc_block();
+    if (!page)
+        return NULL;
+
+    flags = spin_lock_irqsave(&fpu_pool_lock);
+    for (uint32_t i = 1; i < FPU_STATES_PER_PAGE; i++) {
+        *(fpu_state_t **)&page[i] = fpu_free_list;
+        fpu_free_list = &page[i];
+    }
+    spin_unlock_irqrestore(&fpu_pool_lock, flags);
+
+    return &page[0];
+}
+
+static void fpu_state_free(fpu_state_t *state)
+{
+    uint32_t flags = spin_lock_irqsave(&fpu_pool_lock);
+    *(fpu_state_t **)state = fpu_free_list;
+    fpu_free_list = state;
+    spin_unlock_irqrestore(&fpu_pool_lock, flags);
+}
+
+/* ================================================================
+ * INITIALIZATION
+ * ================================================================ */
 
 void fpu_init(void)
 {
@@ -31,19 +124,248 @@ void fpu_init(void)
     /* --- SSE init --- */
     uint32_t mxcsr = 0x1F80; // mask all SSE exceptions
     asm volatile("ldmxcsr %0" ::"m"(mxcsr));
+
+    /* The boot CPU keeps the clean image as every task's initial state */
+    if (smp_processor_id() == 0) {
+        uint32_t eax = 1, ebx, ecx = 0, edx;
+        asm volatile("cpuid" : "+a"(eax), "=b"(ebx), "+c"(ecx), "=d"(edx));
+        fpu_has_sse2 = (edx >> 26) & 1;
+
+        fpu_save(&fpu_initial_state);
+    }
+
+    /* Nobody owns the registers yet: the first user traps */
+    this_cpu()->fpu_owner = NULL;
+    fpu_stts();
 }
 
-/* Called from the isr wrapper for vector 7 (Device Not Available / #NM) */
+/* ================================================================
+ * LAZY SWITCHING
+ * ================================================================ */
+
+void fpu_switch(task_t *prev, task_t *next)
+{
+    cpu_t *cpu = this_cpu();
+
+    /* Don't leave prev's registers here if it may run elsewhere next */
+    if (prev && cpu->fpu_owner == prev && (cpu->id != 0 || smp_sched_enabled)) {
+        fpu_clts();
+        fpu_save(prev->fpu_state);
+        cpu->fpu_owner = NULL;
+    }
+
+    if (next && cpu->fpu_owner == next)
+        fpu_clts();
+    else
+        fpu_stts();
+}
+
+void fpu_flush(void)
+{
+    uint32_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+
+    if (cpu->fpu_owner) {
+        fpu_clts();
+        fpu_save(cpu->fpu_owner->fpu_state);
+        cpu->fpu_owner = NULL;
+    }
+    fpu_stts();
+
+    irq_restore(flags);
+}
+
+int fpu_fork(task_t *parent, task_t *child)
+{
+    child->fpu_state = NULL;
+    if (!parent->fpu_state)
+        return 0;
+
+    child->fpu_state = fpu_state_alloc();
+    if (!child->fpu_state)
+        return -1;
+
+    /* The parent's latest state may still be in the registers */
+    uint32_t flags = irq_save();
+    if (this_cpu()->fpu_owner == parent) {
+        fpu_clts();
+        fpu_save(parent->fpu_state);
+    }
+    memcpy(child->fpu_state, parent->fpu_state, sizeof(fpu_state_t));
+    irq_restore(flags);
+
+    return 0;
+}
+
+void fpu_task_free(task_t *task)
+{
+    uint32_t flags = irq_save();
+
+    /* Its registers are not worth saving anywhere */
+    for (uint32_t i = 0; i < SMP_MAX_CPUS; i++) {
+        task_t *owner = task;
+        __atomic_compare_exchange_n(&cpus[i].fpu_owner, &owner, NULL, false,
+                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    }
+
+    if (task == current_task)
+        fpu_stts();
+    irq_restore(flags);
+
+    if (task->fpu_state) {
+        fpu_state_free(task->fpu_state);
+        task->fpu_state = NULL;
+    }
+}
+
+/* ================================================================
+ * KERNEL SIMD SECTIONS
+ * ================================================================ */
+
+/* Preemption is off for the whole section, so the registers cannot be
+ * switched away under it. Interrupts are only off while the owner's
+ * state is put away; a handler arriving later sees in_kernel_fpu and
+ * keeps its hands off the registers (kernel_fpu_usable()). */
+void kernel_fpu_begin(void)
+{
+    preempt_disable();
+
+    uint32_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+
+    if (cpu->in_kernel_fpu) {
+        /* The outer section's registers would be clobbered */
+        klog_err(KLOG_CORE, "kernel_fpu_begin() nested on CPU %u", cpu->id);
+    }
+
+    cpu->in_kernel_fpu = true;
+
+    /* Whatever is loaded belongs to a task: put it away first */
+    fpu_clts();
+    if (cpu->fpu_owner) {
+        fpu_save(cpu->fpu_owner->fpu_state);
+        cpu->fpu_owner = NULL;
+    }
+    irq_restore(flags);
+}
+
+void kernel_fpu_end(void)
+{
+    uint32_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+
+    /* The registers hold kernel scratch now: the task's next use traps */
+    cpu->in_kernel_fpu = false;
+    fpu_stts();
+    irq_restore(flags);
+
+    preempt_enable();
+}
+
+bool kernel_fpu_usable(void)
+{
+    uint32_t flags = irq_save();
+    bool busy = this_cpu()->in_kernel_fpu;
+    irq_restore(flags);
+
+    return fpu_has_sse2 && !busy;
+}
+
+void clear_page(void *page)
+{
+    if (!kernel_fpu_usable()) {
+        memset(page, 0, PAGE_SIZE);
+        return;
+    }
+
+    kernel_fpu_begin();
+    asm volatile("pxor %%xmm0, %%xmm0" ::: "memory");
+    for (uint8_t *p = page, *end = p + PAGE_SIZE; p < end; p += 64) {
+        asm volatile(
+            "movntdq %%xmm0, 0(%0)\n"
+            "movntdq %%xmm0, 16(%0)\n"
+            "movntdq %%xmm0, 32(%0)\n"
+            "movntdq %%xmm0, 48(%0)\n"
+            :: "r"(p) : "memory");
+    }
+    asm volatile("sfence" ::: "memory");
+    kernel_fpu_end();
+}
+
+void copy_page(void *dst, const void *src)
+{
+    if (!kernel_fpu_usable()) {
+        memcpy(dst, src, PAGE_SIZE);
+        return;
+    }
+
+    kernel_fpu_begin();
+    const uint8_t *s = src;
+    for (uint8_t *d = dst, *end = d + PAGE_SIZE; d < end; d += 64, s += 64) {
+        asm volatile(
+            "movdqa 0(%1), %%xmm0\n"
+            "movdqa 16(%1), %%xmm1\n"
+            "movdqa 32(%1), %%xmm2\n"
+            "movdqa 48(%1), %%xmm3\n"
+            "movntdq %%xmm0, 0(%0)\n"
+            "movntdq %%xmm1, 16(%0)\n"
+            "movntdq %%xmm2, 32(%0)\n"
+            "movntdq %%xmm3, 48(%0)\n"
+            :: "r"(d), "r"(s) : "memory");
+    }
+    asm volatile("sfence" ::: "memory");
+    kernel_fpu_end();
+}
+
+/* Called from the isr wrapper for vector 7 (Device Not Available / #NM):
+ * a task used the FPU with CR0.TS set, i.e. its registers are not the
+ * ones loaded. Swap them in and return to the faulting instruction. */
 void isr_device_not_available(uint32_t *stack_ptr)
 {
-    /* Allow FPU/SSE usage by clearing TS, then init FPU state.
-       Later, implement lazy FPU switching with fxsave/fxrstor per task. */
-    (void)stack_ptr; // explicitly mark unused
+    cpu_t *cpu = this_cpu();
+    task_t *task = current_task;
+
+#if KERNEL_FPU_DEBUG
+    /* Kernel code must bracket FPU/SSE use with kernel_fpu_begin/end */
+    static uint32_t last_warned_eip = 0;
+    uint32_t eip = STACK_EIP(stack_ptr);
+    if ((STACK_CS(stack_ptr) & 3) == 0 && eip != last_warned_eip) {
+        last_warned_eip = eip;
+        klog_warn(KLOG_CORE, "FPU/SSE used by kernel code at %08x outside kernel_fpu_begin()",
+                  eip);
+    }
+#else
+    (void)stack_ptr;
+#endif
+
+    fpu_clts();
+    if (cpu->fpu_owner == task)
+        return;
+
+    if (cpu->fpu_owner) {
+        fpu_save(cpu->fpu_owner->fpu_state);
+        cpu->fpu_owner = NULL;
+    }
+
+    if (task && !task->fpu_state) {
+        task->fpu_state = fpu_state_alloc();
+        if (task->fpu_state) {
+            memcpy(task->fpu_state, &fpu_initial_state, sizeof(fpu_state_t));
+        } else {
+            klog_warn(KLOG_TASK, "PID %u: no memory for FPU state, not preserved",
+                      task->pid);
+        }
+    }
 
-    asm volatile("clts");   // clear task-switched
-    asm volatile("fninit"); // initialize x87 FPU state
+    /* Before the first task (or without a save area) the state is
+     * just the initial image, valid until the next switch */
+    if (!task || !task->fpu_state) {
+        fpu_restore(&fpu_initial_state);
+        return;
+    }
 
-    /* Return to the faulting instruction so it can run with FPU now. */
+    fpu_restore(task->fpu_state);
+    cpu->fpu_owner = task;
 }
 
 /* Called from the isr wrapper for vector 16 (#MF)
@@ -1,8 +1,65 @@
+/* kernel/fpu.h - x87/SSE state management
+ *
+ * FPU state is switched lazily. Every context switch sets CR0.TS unless
+ * the incoming task's registers are still loaded; the first FPU or SSE
+ * instruction a task executes then traps (#NM), and only that handler
+ * saves the previous owner's registers (FXSAVE) and loads the task's
+ * own (FXRSTOR). Tasks that never touch the FPU never trap and never
+ * get a save area.
+ *
+ * While tasks may move between CPUs (the APs, or AP scheduling on) a
+ * task's live state is saved when it is switched out instead, so it is
+ * never left behind in another CPU's registers.
+ *
+ * Kernel code may only use x87/SSE registers between kernel_fpu_begin()
+ * and kernel_fpu_end(). The section saves the owner's registers first
+ * and runs with preemption off, so it must stay short and must not
+ * sleep; interrupt handlers meanwhile fall back to integer code. With KERNEL_FPU_DEBUG, a #NM raised by kernel code outside a
+ * section is logged with its EIP.
+ */
+
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
+
+#define KERNEL_FPU_DEBUG 1
+
+struct task;
+
+/* One FXSAVE/FXRSTOR image */
+typedef struct fpu_state
+{
+    uint8_t data[512];
+} __attribute__((aligned(16))) fpu_state_t;
 
 void fpu_init(void);
 
+/* Context switch hook (interrupts off): saves or keeps the outgoing
+ * task's state and sets CR0.TS for the incoming one */
+void fpu_switch(struct task *prev, struct task *next);
+
+/* Save this CPU's live state to its owner before tasks may migrate */
+void fpu_flush(void);
+
+/* Give a forked child a copy of the parent's state */
+int fpu_fork(struct task *parent, struct task *child);
+
+/* Kernel SIMD sections (not nestable; see kernel_fpu_usable()) */
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+/* False inside a section or without SSE2: take the scalar path */
+bool kernel_fpu_usable(void);
+
+/* Page-sized (4KB, 16-byte aligned) SSE2 helpers; fall back to
+ * memset/memcpy when kernel_fpu_usable() is false */
+void clear_page(void *page);
+void copy_page(void *dst, const void *src);
+
+/* Release a task's save area (task_destroy, exec); its next FPU use
+ * starts again from the initial state */
+void fpu_task_free(struct task *task);
+
 void isr_device_not_available(uint32_t *stack_ptr);
 void isr_x87_fpu_fault(uint32_t *stack_ptr);
 void isr_simd_fp_exception(uint32_t *stack_ptr);
@@ -0,0 +1,153 @@
+/* kernel/futex.c - Fast User-space Mutexes
+ *
+ * Sleepers hang off a hash table indexed by the futex's physical
+ * address. Each bucket has its own lock, which FUTEX_WAIT holds from
+ * reading the user word until it is queued and marked blocked - so a
+ * FUTEX_WAKE after the user changed the word always finds it.
+ *
+ * A sleeper's queue entry lives on its kernel stack. The waker unlinks
+ * it under the bucket lock, and the sleeper only returns after checking
+ * under the same lock that it is gone.
+ */
+
+#include "futex.h"
+#include "kernel.h"
+#include "task.h"
+#include "scheduler.h"
+#include "spinlock.h"
+#include "wait.h"
+#include "../mm/vmm.h"
+
+/* ================================================================
+ * HASH TABLE
+ * ================================================================ */
+
+typedef struct futex_q
+{
+    task_t *task;
+    uint32_t key;                    /* Physical address of the word */
+    struct futex_q *next;
+} futex_q_t;
+
+typedef struct futex_bucket
+{
+    spinlock_t lock;
+    futex_q_t *head;                 /* FIFO: wakes go oldest first */
+    futex_q_t *tail;
+} futex_bucket_t;
+
+static futex_bucket_t futex_table[FUTEX_HASH_BUCKETS];
+
+static futex_bucket_t *futex_bucket(uint32_t key)
+{
+    return &futex_table[(key >> 2) & (FUTEX_HASH_BUCKETS - 1)];
+}
+
+void futex_init(void)
+{
+    for (uint32_t i = 0; i < FUTEX_HASH_BUCKETS; i++) {
+        spin_lock_init(&futex_table[i].lock, "futex", LOCK_ORDER_SLEEP);
+        futex_table[i].head = NULL;
+        futex_table[i].tail = NULL;
+    }
+}
+
+/* Key for a user address of the current task, 0 if it cannot be one */
+static uint32_t futex_key(uint32_t *uaddr)
+{
+    uint32_t addr = (uint32_t)uaddr;
+
+    if (!current_task || addr >= 0xC0000000 || (addr & 3))
+        return 0;
+    return vmm_user_to_phys(current_task->address_space, addr);
+}
+
+/* Unlink q if it is still queued (bucket lock held) */
+static bool futex_unqueue(futex_bucket_t *bucket, futex_q_t *q)
+{
+    futex_q_t *prev = NULL;
+
+    for (futex_q_t *cur = bucket->head; cur; prev = cur, cur = cur->next) {
+        if (cur != q)
+            continue;
+
+        if (prev)
+            prev->next = q->next;
+        else
+            bucket->head = q->next;
+        if (bucket->tail == q)
+            bucket->tail = prev;
+        q->next = NULL;
+        return true;
+    }
+    return false;
+}
+
+/* ================================================================
+ * OPERATIONS
+ * ================================================================ */
+
+int futex_wait(uint32_t *uaddr, uint32_t val)
+{
+    uint32_t key = futex_key(uaddr);
+    if (!key)
+        return -1;
+
+    futex_bucket_t *bucket = futex_bucket(key);
+    futex_q_t q = {current_task, key, NULL};
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+
+    /* The page is mapped (futex_key() found it), so this cannot fault */
+    if (*(volatile uint32_t *)uaddr != val) {
+        spin_unlock_irqrestore(&bucket->lock, flags);
+        return -1;
+    }
+
+    if (bucket->tail)
+        bucket->tail->next = &q;
+    else
+        bucket->head = &q;
+    bucket->tail = &q;
+    current_task->state = TASK_BLOCKED;
+
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    wait_schedule();
+
+    /* Normally the waker has unlinked us already */
+    flags = spin_lock_irqsave(&bucket->lock);
+    futex_unqueue(bucket, &q);
+    current_task->state = TASK_RUNNING;
+    spin_unlock_irqrestore(&bucket->lock, flags);
+
+    return 0;
+}
+
+int futex_wake(uint32_t *uaddr, uint32_t n)
+{
+    uint32_t key = futex_key(uaddr);
+    if (!key)
+        return -1;
+
+    futex_bucket_t *bucket = futex_bucket(key);
+    uint32_t flags = spin_lock_irqsave(&bucket->lock);
+    int woken = 0;
+
+    futex_q_t *q = bucket->head;
+    while (q && (uint32_t)woken < n) {
+        futex_q_t *next = q->next;
+
+        if (q->key == key) {
+            task_t *task = q->task;
+
+            futex_unqueue(bucket, q);
+            if (task->state == TASK_BLOCKED)
+                scheduler_wake_task(task);
+            woken++;
+        }
+        q = next;
+    }
+
+    spin_unlock_irqrestore(&bucket->lock, flags);
+    return woken;
+}
@@ -0,0 +1,37 @@
+/* kernel/futex.h - Fast User-space Mutexes
+ *
+ * A futex is a 32-bit word in user memory that user code updates with
+ * atomic instructions; the kernel only gets involved when a task has
+ * to sleep or wake somebody. FUTEX_WAIT sleeps only if the word still
+ * holds the value the caller saw, which closes the window between the
+ * caller's check and its sleep. FUTEX_WAKE wakes up to n sleepers on
+ * the word.
+ *
+ * Sleepers are keyed by the physical address of the word, so processes
+ * that share the page (vmm_map_shared() memory inherited over fork())
+ * meet on the same futex, while the same virtual address in two
+ * unrelated processes does not.
+ *
+ * user/ulib.h builds its mutex and condition variable on this.
+ */
+
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <stdint.h>
+
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+#define FUTEX_HASH_BUCKETS 64        /* Power of two */
+
+void futex_init(void);
+
+/* Sleep while *uaddr == val. Returns 0 once woken, -1 if the value
+ * differed or uaddr is not a mapped, aligned user address. */
+int futex_wait(uint32_t *uaddr, uint32_t val);
+
+/* Wake up to n tasks sleeping on uaddr. Returns how many were woken. */
+int futex_wake(uint32_t *uaddr, uint32_t n);
+
+#endif /* FUTEX_H */
@@ -1,87 +1,76 @@
 /* kernel/gdt.c - Global Descriptor Table and TSS for User Mode
- * 
+ *
  * Sets up proper segmentation for Ring 0 (kernel) and Ring 3 (user)
- * 
+ *
  * FIXED: TSS selector must be 0x28, NOT 0x2B!
+ *
+ * SMP: every CPU has its own GDT. The flat segments are the same in all
+ * of them; CPU n's TSS descriptor lives at index 5 + n, so the TSS
+ * selector it loads (TSS_SEL + 8n) tells which CPU is running.
  */
 
 #include "kernel.h"
-#include "tss.h"
-
-
-/* GDT entry structure */
-struct gdt_entry {
-    uint16_t limit_low;
-    uint16_t base_low;
-    uint8_t  base_middle;
-    uint8_t  access;
-    uint8_t  granularity;
-    uint8_t  base_high;
-} __attribute__((packed));
-
-/* GDT pointer structure */
-struct gdt_ptr {
-    uint16_t limit;
-    uint32_t base;
-} __attribute__((packed));
-
+#include "gdt.h"
+#include "smp.h"
 
-/* GDT with 6 entries:
+/* GDT layout (per CPU):
  * 0: Null descriptor
  * 1: Kernel code segment (0x08)
  * 2: Kernel data segment (0x10)
  * 3: User code segment   (0x18)
  * 4: User data segment   (0x20)
- * 5: TSS                 (0x28)
+ * 5+n: TSS of CPU n      (0x28 + 8n)
  */
-static struct gdt_entry gdt[6];
-static struct gdt_ptr gdt_ptr;
-static struct tss_entry tss;
+static struct gdt_entry gdt[SMP_MAX_CPUS][GDT_ENTRIES];
+static struct gdt_ptr gdt_ptr[SMP_MAX_CPUS];
+
+/* Fill in one descriptor */
+static void gdt_encode(struct gdt_entry *entry, uint32_t base, uint32_t limit,
+                       uint8_t access, uint8_t gran)
+{
+    entry->base_low    = (base & 0xFFFF);
+    entry->base_middle = (base >> 16) & 0xFF;
+    entry->base_high   = (base >> 24) & 0xFF;
+
+    entry->limit_low   = (limit & 0xFFFF);
+    entry->granularity = (limit >> 16) & 0x0F;
+    entry->granularity |= gran & 0xF0;
+    entry->access      = access;
+}
 
 /* Set a GDT entry */
-static void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
-    gdt[num].base_low    = (base & 0xFFFF);
-    gdt[num].base_middle = (base >> 16) & 0xFF;
-    gdt[num].base_high   = (base >> 24) & 0xFF;
-    
-    gdt[num].limit_low   = (limit & 0xFFFF);
-    gdt[num].granularity = (limit >> 16) & 0x0F;
-    gdt[num].granularity |= gran & 0xF0;
-    gdt[num].access      = access;
+void gdt_set_gate(int num, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt_encode(&gdt[0][num], base, limit, access, gran);
 }
 
-/* Initialize GDT and TSS */
-void gdt_init(void) {
-    gdt_ptr.limit = (sizeof(struct gdt_entry) * 6) - 1;
-    gdt_ptr.base  = (uint32_t)&gdt;
-    
+/* Build and load the GDT of one CPU */
+void gdt_init_cpu(uint32_t cpu) {
+    struct gdt_entry *table = gdt[cpu];
+
+    memset(table, 0, sizeof(gdt[cpu]));
+    gdt_ptr[cpu].limit = sizeof(gdt[cpu]) - 1;
+    gdt_ptr[cpu].base  = (uint32_t)table;
+
     /* Null descriptor */
-    gdt_set_gate(0, 0, 0, 0, 0);
-    
+    gdt_encode(&table[0], 0, 0, 0, 0);
+
     /* Kernel code segment: base=0, limit=4GB, access=9A (exec/read), gran=CF (4KB pages) */
-    gdt_set_gate(1, 0, 0xFFFFFFFF, 0x9A, 0xCF);
-    
+    gdt_encode(&table[1], 0, 0xFFFFFFFF, 0x9A, 0xCF);
+
     /* Kernel data segment: base=0, limit=4GB, access=92 (read/write), gran=CF */
-    gdt_set_gate(2, 0, 0xFFFFFFFF, 0x92, 0xCF);
-    
+    gdt_encode(&table[2], 0, 0xFFFFFFFF, 0x92, 0xCF);
+
     /* User code segment: base=0, limit=4GB, access=FA (exec/read, DPL=3), gran=CF */
-    gdt_set_gate(3, 0, 0xFFFFFFFF, 0xFA, 0xCF);
-    
+    gdt_encode(&table[3], 0, 0xFFFFFFFF, 0xFA, 0xCF);
+
     /* User data segment: base=0, limit=4GB, access=F2 (read/write, DPL=3), gran=CF */
-    gdt_set_gate(4, 0, 0xFFFFFFFF, 0xF2, 0xCF);
-    
-    /* TSS: access=89 (present, executable, accessed), gran=00 (byte granularity) */
-    memset(&tss, 0, sizeof(tss));
-    tss.ss0 = 0x10;  /* Kernel data segment */
-    tss.esp0 = 0;    /* Will be set when entering user mode */
-    
-    uint32_t tss_base = (uint32_t)&tss;
-    uint32_t tss_limit = sizeof(tss);
-    gdt_set_gate(5, tss_base, tss_limit, 0x89, 0x00);
-    
+    gdt_encode(&table[4], 0, 0xFFFFFFFF, 0xF2, 0xCF);
+
+    /* The TSS slot is filled in by tss_init_cpu() */
+
     /* Load GDT */
-    __asm__ volatile("lgdt %0" : : "m"(gdt_ptr));
-    
+    __asm__ volatile("lgdt %0" : : "m"(gdt_ptr[cpu]));
+
     /* Reload segment registers */
     __asm__ volatile(
         "mov $0x10, %%ax\n"
@@ -94,19 +83,13 @@ void gdt_init(void) {
         "1:\n"
         : : : "eax"
     );
-    
-    /* Load TSS - CRITICAL FIX: Use 0x28, NOT 0x2B!
-     * 
-     * TSS selector MUST be Ring 0 (no RPL bits).
-     * The TSS is a kernel structure used for privilege transitions.
-     * 
-     * 0x28 = GDT index 5, RPL=0 ✓
-     * 0x2B = GDT index 5, RPL=3 ✗ WRONG!
-     */
-    __asm__ volatile("ltr %%ax" : : "a"(0x28));
-    
+}
+
+/* Initialize the boot CPU's GDT */
+void gdt_init(void) {
+    gdt_init_cpu(0);
+
     terminal_writestring("[GDT] Global Descriptor Table initialized\n");
-    terminal_writestring("[GDT] TSS loaded at selector 0x28\n");
 }
 
 /* Install TSS descriptor into the GDT
@@ -114,9 +97,9 @@ void gdt_init(void) {
  * This function is REQUIRED because it is declared in gdt.h
  * and called from tss.c. It must NOT be static.
  */
-void gdt_set_tss(uint32_t tss_base, uint32_t tss_limit)
+void gdt_set_tss(uint32_t cpu, uint32_t tss_base, uint32_t tss_limit)
 {
-    /* GDT entry 5 = TSS (selector 0x28)
+    /* GDT entry 5 + cpu = TSS (selector 0x28 + 8 * cpu)
      *
      * Access byte 0x89:
      *  - Present
@@ -126,11 +109,11 @@ void gdt_set_tss(uint32_t tss_base, uint32_t tss_limit)
      *
      * Granularity must be 0 for TSS (byte granularity)
      */
-    gdt_set_gate(
-        5,              /* GDT index */
+    gdt_encode(
+        &gdt[cpu][GDT_TSS_BASE + cpu], /* GDT index */
         tss_base,       /* Base address of TSS */
         tss_limit,      /* Size of TSS */
         0x89,           /* Access byte */
         0x00            /* Granularity */
     );
-}
\ No newline at end of file
+}
@@ -7,7 +7,10 @@
  * GDT CONSTANTS
  * ==================================================================== */
 
-#define GDT_ENTRIES 6
+/* Entries 0-4 are the flat segments, then one TSS slot per CPU
+ * (SMP_MAX_CPUS comes from smp.h) */
+#define GDT_TSS_BASE 5
+#define GDT_ENTRIES  (GDT_TSS_BASE + SMP_MAX_CPUS)
 
 /* Access byte flags */
 #define GDT_PRESENT  0x80
@@ -28,7 +31,9 @@
 #define KERNEL_DS    0x10
 #define USER_CS      0x18
 #define USER_DS      0x20
-#define TSS_SEL      0x28
+#define TSS_SEL      0x28    /* CPU 0; CPU n uses TSS_SEL_CPU(n) */
+
+#define TSS_SEL_CPU(cpu) (TSS_SEL + ((cpu) << 3))
 
 /* ====================================================================
  * GDT ENTRY STRUCTURES
@@ -56,15 +61,18 @@ struct gdt_ptr
  * FUNCTION PROTOTYPES
  * ==================================================================== */
 
-/* Initialize GDT */
+/* Initialize GDT (boot CPU) */
 void gdt_init(void);
 
-/* Set individual GDT entry */
+/* Build and load the GDT of an application processor */
+void gdt_init_cpu(uint32_t cpu);
+
+/* Set individual GDT entry (boot CPU's table) */
 void gdt_set_gate(int num, uint32_t base, uint32_t limit,
                   uint8_t access, uint8_t gran);
 
-/* Install TSS entry */
-void gdt_set_tss(uint32_t tss_base, uint32_t tss_limit);
+/* Install a CPU's TSS entry in its own GDT */
+void gdt_set_tss(uint32_t cpu, uint32_t tss_base, uint32_t tss_limit);
 
 /* Assembly function to load GDT */
 extern void gdt_flush(uint32_t gdt_ptr);
@@ -7,10 +7,17 @@
 #include "fpu.h"
 #include "task.h"
 #include "scheduler.h"
+#include "smp.h"
+#include "softirq.h"
+#include "workqueue.h"
+#include "futex.h"
+#include "clocksource.h"
+#include "ktimer.h"
 #include "../fs/vfs.h"
 #include "../fs/ramfs.h"
 #include "../fs/tarfs.h"
 #include "../fs/fat.h"
+#include "../interrupts/pagefault.h"
 
 /* Linker symbols */
 extern uint8_t kernel_start;
@@ -99,6 +106,8 @@ void kernel_main(void)
      * ========================================================= */
     terminal_writestring("[IDT] Initializing interrupt table...\n");
     idt_init();
+    softirq_init();
+    pagefault_init();
     terminal_writestring("[IDT] Interrupt table ready\n");
 
     /* =========================================================
@@ -114,6 +123,8 @@ void kernel_main(void)
     terminal_writestring("[DRIVERS] Initializing device drivers...\n");
     keyboard_init();
     timer_init();
+    clocksource_init();
+    ktimer_init();
     ata_init();
     terminal_writestring("[DRIVERS] All drivers initialized\n");
 
@@ -141,8 +152,18 @@ void kernel_main(void)
     task_init();
     scheduler_init();
     syscall_init();
+    futex_init();
+    workqueue_init();
+    task_reaper_init();
     terminal_writestring("[KERNEL] Multitasking ready\n\n");
 
+    /* =========================================================
+     * Step 10.5: Other processors (needs the scheduler for the
+     * AP idle tasks and the PIT for timing the startup)
+     * ========================================================= */
+    smp_init();
+    terminal_writestring("\n");
+
     /* =========================================================
      * Step 11: Virtual File System
      * ========================================================= */
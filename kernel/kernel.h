@@ -14,9 +14,22 @@
 #include "syscall.h"
 
 /* Timer */
+typedef struct
+{
+    uint32_t stops;          /* Times the periodic tick was stopped */
+    uint32_t ticks_avoided;  /* Tick interrupts that never had to fire */
+} timer_nohz_stats_t;
+
 void timer_init(void);
 uint32_t timer_get_ticks(void);
+uint64_t timer_get_ticks64(void);
 void timer_sleep(uint32_t ms);
+void timer_nohz_enter(void);
+void timer_nohz_exit(void);
+void timer_nohz_kick(void);
+timer_nohz_stats_t timer_get_nohz_stats(void);
+uint32_t timer_tsc_khz(void);
+uint64_t timer_cycles_to_us(uint64_t cycles);
 
 /* ==================================================================
  * CORE CONSTANTS
@@ -78,6 +91,50 @@ static inline void outb(uint16_t port, uint8_t data)
     __asm__ volatile("outb %0, %1" : : "a"(data), "Nd"(port));
 }
 
+/* ==================================================================
+ * CPU HELPERS
+ * ================================================================== */
+
+/* Read the time-stamp counter (raw CPU cycles since reset) */
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/* 64-by-32 division with two divl (no libgcc in the kernel) */
+static inline uint64_t div_u64_rem(uint64_t n, uint32_t d, uint32_t *rem)
+{
+    uint32_t hi = (uint32_t)(n >> 32), lo = (uint32_t)n;
+    uint32_t q_hi = hi / d, r = hi % d, q_lo;
+
+    __asm__("divl %2" : "=a"(q_lo), "+d"(r) : "rm"(d), "0"(lo));
+    if (rem)
+        *rem = r;
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+static inline uint64_t div_u64(uint64_t n, uint32_t d)
+{
+    return div_u64_rem(n, d, 0);
+}
+
+/* Disable interrupts, returning the previous EFLAGS for irq_restore() */
+static inline uint32_t irq_save(void)
+{
+    uint32_t flags;
+    __asm__ volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+/* Re-enable interrupts only if they were enabled before irq_save() */
+static inline void irq_restore(uint32_t flags)
+{
+    if (flags & 0x200)
+        __asm__ volatile("sti" : : : "memory");
+}
+
 /* ==================================================================
  * INTERRUPT HANDLING
  * ================================================================== */
@@ -113,6 +170,7 @@ struct idt_ptr
 typedef void (*interrupt_handler_t)(void);
 
 void idt_init(void);
+void idt_load(void);
 void idt_set_gate(uint8_t num, uint32_t handler, uint16_t selector, uint8_t flags);
 void irq_install_handler(uint8_t irq, interrupt_handler_t handler);
 void irq_uninstall_handler(uint8_t irq);
@@ -145,6 +203,10 @@ void pic_send_eoi(uint8_t irq);
 
 void keyboard_init(void);
 void keyboard_handler(void);
+bool keyboard_has_data(void);
+char keyboard_buffer_pop(void);
+void keyboard_wait_for_data(void);
+size_t keyboard_read(char *buf, size_t len);
 
 /* ==================================================================
  * ATA DISK DRIVER
@@ -221,6 +283,9 @@ char *strtrim(char *str);
 void itoa(int n, char *str);
 void utoa(uint32_t n, char *str, int base);
 
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args);
+int ksnprintf(char *buf, size_t size, const char *fmt, ...);
+
 /* Heap-based string functions */
 char *strdup(const char *s);
 char *strndup(const char *s, size_t n);
@@ -0,0 +1,165 @@
+/* kernel/klog.c - Kernel Log
+ *
+ * Fixed-size ring of formatted messages. Writers format into the slot
+ * they claim with interrupts disabled, so IRQ handlers may log too;
+ * the oldest messages are overwritten once the ring is full.
+ */
+
+#include "klog.h"
+#include "kernel.h"
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+_Static_assert((KLOG_ENTRIES & (KLOG_ENTRIES - 1)) == 0,
+               "KLOG_ENTRIES must be a power of two");
+
+static klog_entry_t klog_ring[KLOG_ENTRIES];
+static uint32_t klog_seq = 0;   /* Messages ever logged */
+
+static int klog_level = KLOG_DEFAULT_LEVEL;
+static int klog_console_level = KLOG_DEFAULT_CONSOLE;
+
+static const char *level_names[] = {"err", "warn", "notice", "info", "debug"};
+static const char *subsys_names[KLOG_NR_SUBSYS] = {
+    "core", "sched", "task", "mm", "fs", "syscall", "irq", "driver"
+};
+
+/* ================================================================
+ * LOGGING
+ * ================================================================ */
+
+static void klog_print_entry(const klog_entry_t *e)
+{
+    char prefix[40];
+
+    ksnprintf(prefix, sizeof(prefix), "[%6u] %s: ", e->tick, subsys_names[e->subsys]);
+
+    if (e->level == KLOG_ERR)
+        terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+    else if (e->level == KLOG_WARN)
+        terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK));
+    else if (e->level == KLOG_DEBUG)
+        terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
+
+    terminal_writestring(prefix);
+    terminal_writestring(e->msg);
+    terminal_writestring("\n");
+    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+}
+
+void klog_write(int level, klog_subsys_t subsys, const char *fmt, ...)
+{
+    if (level > klog_level && level > klog_console_level)
+        return;
+    if ((unsigned)subsys >= KLOG_NR_SUBSYS)
+        subsys = KLOG_CORE;
+
+    uint32_t flags = irq_save();
+
+    klog_entry_t *e = &klog_ring[klog_seq & (KLOG_ENTRIES - 1)];
+    e->seq = ++klog_seq;
+    e->tick = timer_get_ticks();
+    e->level = (uint8_t)level;
+    e->subsys = (uint8_t)subsys;
+
+    va_list args;
+    va_start(args, fmt);
+    kvsnprintf(e->msg, sizeof(e->msg), fmt, args);
+    va_end(args);
+
+    /* Only stored if it passes the record threshold */
+    if (level > klog_level)
+        e->seq = 0;
+
+    if (level <= klog_console_level)
+        klog_print_entry(e);
+
+    irq_restore(flags);
+}
+
+/* ================================================================
+ * CONTROL AND OUTPUT
+ * ================================================================ */
+
+void klog_set_level(int level)
+{
+    klog_level = level;
+}
+
+void klog_set_console_level(int level)
+{
+    klog_console_level = level;
+}
+
+int klog_get_level(void)
+{
+    return klog_level;
+}
+
+int klog_get_console_level(void)
+{
+    return klog_console_level;
+}
+
+void klog_dump(klog_subsys_t subsys)
+{
+    uint32_t end = klog_seq;
+    uint32_t start = end > KLOG_ENTRIES ? end - KLOG_ENTRIES : 0;
+
+    for (uint32_t i = start; i < end; i++) {
+        klog_entry_t e = klog_ring[i & (KLOG_ENTRIES - 1)];
+
+        if (e.seq != i + 1)
+            continue;  /* Filtered out or overwritten meanwhile */
+        if (subsys != KLOG_NR_SUBSYS && e.subsys != subsys)
+            continue;
+
+        klog_print_entry(&e);
+    }
+}
+
+void klog_clear(void)
+{
+    uint32_t flags = irq_save();
+    memset(klog_ring, 0, sizeof(klog_ring));
+    klog_seq = 0;
+    irq_restore(flags);
+}
+
+const char *klog_level_name(int level)
+{
+    if (level < KLOG_ERR || level > KLOG_DEBUG)
+        return "?";
+    return level_names[level];
+}
+
+const char *klog_subsys_name(klog_subsys_t subsys)
+{
+    if ((unsigned)subsys >= KLOG_NR_SUBSYS)
+        return "?";
+    return subsys_names[subsys];
+}
+
+int klog_parse_level(const char *name)
+{
+    for (int i = KLOG_ERR; i <= KLOG_DEBUG; i++) {
+        if (strcmp(name, level_names[i]) == 0)
+            return i;
+    }
+
+    if (name[0] >= '0' && name[0] <= '4' && name[1] == '\0')
+        return name[0] - '0';
+
+    return -1;
+}
+
+int klog_parse_subsys(const char *name)
+{
+    for (int i = 0; i < KLOG_NR_SUBSYS; i++) {
+        if (strcmp(name, subsys_names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
@@ -0,0 +1,109 @@
+/* kernel/klog.h - Kernel Log
+ *
+ * Leveled, per-subsystem kernel messages:
+ *
+ *     klog_info(KLOG_FS, "mounted %s at %s", dev, path);
+ *     klog_debug(KLOG_SCHED, "switch to PID %u", pid);
+ *
+ * Messages above KLOG_COMPILE_LEVEL are removed by the compiler
+ * entirely (arguments are not even evaluated), so debug statements in
+ * hot paths cost nothing in release builds. Messages that survive are
+ * filtered again against a runtime level and stored in an in-memory
+ * ring buffer, read with the "dmesg" shell command. Only messages at or
+ * above the console level (warnings by default) are echoed to VGA.
+ */
+
+#ifndef KLOG_H
+#define KLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* ================================================================
+ * LEVELS AND SUBSYSTEMS
+ * ================================================================ */
+
+#define KLOG_ERR     0
+#define KLOG_WARN    1
+#define KLOG_NOTICE  2
+#define KLOG_INFO    3
+#define KLOG_DEBUG   4
+
+/* Build with -DKLOG_COMPILE_LEVEL=KLOG_DEBUG to keep debug messages */
+#ifndef KLOG_COMPILE_LEVEL
+#define KLOG_COMPILE_LEVEL KLOG_INFO
+#endif
+
+#define KLOG_DEFAULT_LEVEL    KLOG_INFO   /* Recorded in the ring */
+#define KLOG_DEFAULT_CONSOLE  KLOG_WARN   /* Also printed to VGA */
+
+typedef enum
+{
+    KLOG_CORE = 0,
+    KLOG_SCHED,
+    KLOG_TASK,
+    KLOG_MM,
+    KLOG_FS,
+    KLOG_SYSCALL,
+    KLOG_IRQ,
+    KLOG_DRIVER,
+    KLOG_NR_SUBSYS
+} klog_subsys_t;
+
+/* ================================================================
+ * RING BUFFER
+ * ================================================================ */
+
+#define KLOG_ENTRIES 256   /* Must be a power of two */
+#define KLOG_MSG_LEN 96
+
+typedef struct
+{
+    uint32_t seq;       /* Message number (0 = empty) */
+    uint32_t tick;      /* Scheduler tick when logged */
+    uint8_t level;
+    uint8_t subsys;
+    char msg[KLOG_MSG_LEN];
+} klog_entry_t;
+
+/* ================================================================
+ * LOGGING
+ * ================================================================ */
+
+void klog_write(int level, klog_subsys_t subsys, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define klog(level, subsys, ...)                          \
+    do {                                                  \
+        if ((level) <= KLOG_COMPILE_LEVEL)                \
+            klog_write((level), (subsys), __VA_ARGS__);   \
+    } while (0)
+
+#define klog_err(subsys, ...)    klog(KLOG_ERR, subsys, __VA_ARGS__)
+#define klog_warn(subsys, ...)   klog(KLOG_WARN, subsys, __VA_ARGS__)
+#define klog_notice(subsys, ...) klog(KLOG_NOTICE, subsys, __VA_ARGS__)
+#define klog_info(subsys, ...)   klog(KLOG_INFO, subsys, __VA_ARGS__)
+#define klog_debug(subsys, ...)  klog(KLOG_DEBUG, subsys, __VA_ARGS__)
+
+/* ================================================================
+ * CONTROL AND OUTPUT
+ * ================================================================ */
+
+/* Runtime thresholds (messages with level <= threshold pass) */
+void klog_set_level(int level);
+void klog_set_console_level(int level);
+int klog_get_level(void);
+int klog_get_console_level(void);
+
+/* Print the ring buffer oldest first (optionally one subsystem only,
+ * pass KLOG_NR_SUBSYS for all) */
+void klog_dump(klog_subsys_t subsys);
+void klog_clear(void);
+
+/* Name lookup for the shell ("sched", "fs", ...); -1 if unknown */
+const char *klog_level_name(int level);
+const char *klog_subsys_name(klog_subsys_t subsys);
+int klog_parse_level(const char *name);
+int klog_parse_subsys(const char *name);
+
+#endif /* KLOG_H */
@@ -0,0 +1,342 @@
+/* kernel/ktimer.c - Kernel Timers on a Hierarchical Timer Wheel
+ *
+ * The wheel has five levels. Level 0 has a bucket for each of the next
+ * 256 ticks; levels 1-4 have 64 buckets each, every one covering 64
+ * times the span of a bucket one level down, so together they reach
+ * 2^32 ticks ahead. A timer goes into the bucket its expiry falls in
+ * and is unlinked in O(1) through its pprev pointer.
+ *
+ * clk is the next tick to process. Processing a tick empties one level
+ * 0 bucket. Each time level 0 wraps, the next bucket of level 1 is
+ * "cascaded": its timers are re-added and fall into level 0 (and so on
+ * up when level 1 wraps). A timer is therefore touched at most once
+ * per level on its way to expiry, and the tick itself never scans.
+ *
+ * There is one wheel, driven from CPU 0's tick. base.lock guards it;
+ * callbacks run with the lock dropped and base.running set, which is
+ * what del_timer_sync() waits on. The bucket being run is moved to a
+ * list on the stack first, so a timer deleted or re-armed by another
+ * CPU meanwhile is simply unlinked from there.
+ */
+
+#include "ktimer.h"
+#include "kernel.h"
+#include "softirq.h"
+#include "spinlock.h"
+#include "smp.h"
+
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1u << TVR_BITS)
+#define TVN_SIZE (1u << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4
+
+/* Bucket of level n (1..4) that tick t falls in */
+#define TVN_INDEX(t, n) (((t) >> (TVR_BITS + ((n) - 1) * TVN_BITS)) & TVN_MASK)
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+static struct
+{
+    spinlock_t lock;
+    uint32_t clk;                          /* Next tick to process */
+    ktimer_t *tv1[TVR_SIZE];
+    ktimer_t *tvn[TVN_LEVELS][TVN_SIZE];
+    ktimer_t *volatile running;            /* Callback in progress */
+    uint32_t pending;                      /* Timers on the wheel */
+} base;
+
+static struct
+{
+    uint32_t added;
+    uint32_t fired;
+    uint32_t deleted;                      /* Disarmed while pending */
+    uint32_t cascaded;                     /* Moves down a level */
+    uint32_t max_pending;
+    uint32_t max_late;                     /* Ticks past expiry at run */
+    uint64_t total_late;
+    uint64_t callback_cycles;
+} ktimer_stats;
+
+/* ================================================================
+ * WHEEL (base.lock held)
+ * ================================================================ */
+
+static void bucket_insert(ktimer_t **bucket, ktimer_t *timer)
+{
+    timer->next = *bucket;
+    if (*bucket)
+        (*bucket)->pprev = &timer->next;
+    *bucket = timer;
+    timer->pprev = bucket;
+}
+
+static void bucket_remove(ktimer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+static void wheel_add(ktimer_t *timer)
+{
+    uint32_t expires = timer->expires;
+    uint32_t delta = expires - base.clk;
+    ktimer_t **bucket;
+
+    if ((int32_t)delta < 0) {
+        /* Already due: the bucket processed next */
+        bucket = &base.tv1[base.clk & TVR_MASK];
+    } else if (delta < TVR_SIZE) {
+        bucket = &base.tv1[expires & TVR_MASK];
+    } else {
+        uint32_t n = 1;
+        while (n < TVN_LEVELS && delta >= 1u << (TVR_BITS + n * TVN_BITS))
+            n++;
+        bucket = &base.tvn[n - 1][TVN_INDEX(expires, n)];
+    }
+
+    bucket_insert(bucket, timer);
+    base.pending++;
+    if (base.pending > ktimer_stats.max_pending)
+        ktimer_stats.max_pending = base.pending;
+}
+
+static void wheel_remove(ktimer_t *timer)
+{
+    bucket_remove(timer);
+    base.pending--;
+}
+
+/* Re-add the timers of bucket index of level n (1..4). Returns index,
+ * so the caller goes on up only when this level wrapped too. */
+static uint32_t cascade(uint32_t n, uint32_t index)
+{
+    ktimer_t *timer = base.tvn[n - 1][index];
+    base.tvn[n - 1][index] = NULL;
+
+    while (timer) {
+        ktimer_t *next = timer->next;
+
+        timer->next = NULL;
+        timer->pprev = NULL;
+        base.pending--;
+        wheel_add(timer);
+        ktimer_stats.cascaded++;
+
+        timer = next;
+    }
+    return index;
+}
+
+/* ================================================================
+ * TIMER SOFTIRQ
+ * ================================================================ */
+
+static void run_timers(void)
+{
+    uint32_t flags = spin_lock_irqsave(&base.lock);
+    uint32_t now = timer_get_ticks();
+
+    while (time_after_eq(now, base.clk)) {
+        uint32_t index = base.clk & TVR_MASK;
+
+        if (!index &&
+            !cascade(1, TVN_INDEX(base.clk, 1)) &&
+            !cascade(2, TVN_INDEX(base.clk, 2)) &&
+            !cascade(3, TVN_INDEX(base.clk, 3)))
+            cascade(4, TVN_INDEX(base.clk, 4));
+
+        base.clk++;
+
+        /* Off the wheel onto our stack before any callback runs */
+        ktimer_t *list = base.tv1[index];
+        base.tv1[index] = NULL;
+        if (list)
+            list->pprev = &list;
+
+        while (list) {
+            ktimer_t *timer = list;
+            void (*func)(uint32_t) = timer->func;
+            uint32_t data = timer->data;
+            uint32_t late = now - timer->expires;
+
+            bucket_remove(timer);
+            base.pending--;
+            base.running = timer;
+
+            ktimer_stats.fired++;
+            ktimer_stats.total_late += late;
+            if (late > ktimer_stats.max_late)
+                ktimer_stats.max_late = late;
+
+            spin_unlock_irqrestore(&base.lock, flags);
+
+            uint64_t start = rdtsc();
+            func(data);
+            uint64_t cycles = rdtsc() - start;
+
+            flags = spin_lock_irqsave(&base.lock);
+            ktimer_stats.callback_cycles += cycles;
+            base.running = NULL;
+        }
+    }
+
+    spin_unlock_irqrestore(&base.lock, flags);
+}
+
+void ktimer_tick(uint32_t now)
+{
+    /* Unlocked peek: a timer added meanwhile is picked up next tick */
+    if (base.pending && time_after_eq(now, base.clk))
+        raise_softirq(SOFTIRQ_TIMER);
+}
+
+uint32_t ktimer_next_event(uint32_t now, uint32_t max)
+{
+    uint32_t flags = spin_lock_irqsave(&base.lock);
+    uint32_t ticks = max;
+
+    if (!base.pending)
+        goto out;
+
+    if (time_after_eq(now, base.clk)) {
+        ticks = 0;
+        goto out;
+    }
+
+    /* Level 0 holds everything due before the next cascade, and a
+     * cascade is itself a reason to tick (which level it would take
+     * timers from is not worth tracking: it costs one tick in 256) */
+    for (uint32_t t = base.clk; t - now < max; t++) {
+        uint32_t index = t & TVR_MASK;
+
+        if (base.tv1[index] || !index) {
+            ticks = t - now;
+            break;
+        }
+    }
+
+out:
+    spin_unlock_irqrestore(&base.lock, flags);
+    return ticks;
+}
+
+/* ================================================================
+ * TIMER API
+ * ================================================================ */
+
+void setup_timer(ktimer_t *timer, void (*func)(uint32_t data), uint32_t data)
+{
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->func = func;
+    timer->data = data;
+}
+
+bool mod_timer(ktimer_t *timer, uint32_t expires)
+{
+    uint32_t flags = spin_lock_irqsave(&base.lock);
+
+    bool was_pending = timer_pending(timer);
+    if (was_pending)
+        wheel_remove(timer);
+
+    /* An empty wheel may have fallen behind while nobody ticked it */
+    if (!base.pending)
+        base.clk = timer_get_ticks();
+
+    timer->expires = expires;
+    wheel_add(timer);
+    ktimer_stats.added++;
+
+    spin_unlock_irqrestore(&base.lock, flags);
+
+    /* The tick may be stopped until later than this */
+    timer_nohz_kick();
+    return was_pending;
+}
+
+void add_timer(ktimer_t *timer)
+{
+    mod_timer(timer, timer->expires);
+}
+
+bool del_timer(ktimer_t *timer)
+{
+    if (!timer_pending(timer))
+        return false;
+
+    uint32_t flags = spin_lock_irqsave(&base.lock);
+
+    bool was_pending = timer_pending(timer);
+    if (was_pending) {
+        wheel_remove(timer);
+        ktimer_stats.deleted++;
+    }
+
+    spin_unlock_irqrestore(&base.lock, flags);
+    return was_pending;
+}
+
+bool del_timer_sync(ktimer_t *timer)
+{
+    for (;;) {
+        uint32_t flags = spin_lock_irqsave(&base.lock);
+
+        if (base.running != timer) {
+            bool was_pending = timer_pending(timer);
+            if (was_pending) {
+                wheel_remove(timer);
+                ktimer_stats.deleted++;
+            }
+            spin_unlock_irqrestore(&base.lock, flags);
+            return was_pending;
+        }
+
+        spin_unlock_irqrestore(&base.lock, flags);
+        __asm__ volatile("pause");
+    }
+}
+
+/* ================================================================
+ * INITIALIZATION
+ * ================================================================ */
+
+void ktimer_init(void)
+{
+    spin_lock_init(&base.lock, "ktimer", LOCK_ORDER_TIMER);
+    base.clk = timer_get_ticks();
+    open_softirq(SOFTIRQ_TIMER, run_timers);
+}
+
+/* ================================================================
+ * STATISTICS
+ * ================================================================ */
+
+void ktimer_show_stats(void)
+{
+    char line[96];
+    uint32_t fired = ktimer_stats.fired;
+
+    ksnprintf(line, sizeof(line), "Pending    : %u (peak %u)\n",
+              base.pending, ktimer_stats.max_pending);
+    terminal_writestring(line);
+    ksnprintf(line, sizeof(line), "Armed      : %u, deleted %u, cascaded %u\n",
+              ktimer_stats.added, ktimer_stats.deleted, ktimer_stats.cascaded);
+    terminal_writestring(line);
+    ksnprintf(line, sizeof(line), "Fired      : %u, late avg %llu max %u ticks\n",
+              fired, fired ? div_u64(ktimer_stats.total_late, fired) : 0,
+              ktimer_stats.max_late);
+    terminal_writestring(line);
+    ksnprintf(line, sizeof(line), "Callbacks  : %llu us in total\n",
+              timer_cycles_to_us(ktimer_stats.callback_cycles));
+    terminal_writestring(line);
+}
@@ -0,0 +1,98 @@
+/* kernel/ktimer.h - Kernel Timers
+ *
+ * "Call this function in 50ms": a timer holds a callback and the tick
+ * at which it is due. Callbacks run in the TIMER softirq on CPU 0, the
+ * CPU that owns the PIT - in interrupt context, so they must not sleep.
+ * A callback that needs to block queues work (see workqueue.h).
+ *
+ * Ticks are milliseconds; expiry times are absolute, so a timeout of
+ * 50ms is armed with timer_get_ticks() + 50.
+ *
+ * Pending timers sit on a hierarchical timer wheel: adding or deleting
+ * one is O(1) however many are pending, and the tick only looks at one
+ * bucket. Far-off timers move down a level every 256, 16384, ... ticks.
+ *
+ * Typical use:
+ *
+ *     static void timeout_fn(uint32_t data) { ... }
+ *     static DEFINE_TIMER(timeout, timeout_fn, 0);
+ *
+ *     mod_timer(&timeout, timer_get_ticks() + 50);
+ *     ...
+ *     del_timer_sync(&timeout);
+ */
+
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* ================================================================
+ * TYPES
+ * ================================================================ */
+
+typedef struct ktimer
+{
+    struct ktimer *next;
+    struct ktimer **pprev;            /* Link pointing at us, NULL if idle */
+    uint32_t expires;                 /* Tick the callback is due */
+    void (*func)(uint32_t data);
+    uint32_t data;
+} ktimer_t;
+
+#define DEFINE_TIMER(name, fn, arg) \
+    ktimer_t name = { NULL, NULL, 0, (fn), (arg) }
+
+/* a is later than b, across tick counter wraps */
+#define time_after(a, b)     ((int32_t)((b) - (a)) < 0)
+#define time_after_eq(a, b)  ((int32_t)((a) - (b)) >= 0)
+
+/* ================================================================
+ * FUNCTIONS
+ * ================================================================ */
+
+/* Set up the wheel and the TIMER softirq */
+void ktimer_init(void);
+
+void setup_timer(ktimer_t *timer, void (*func)(uint32_t data), uint32_t data);
+
+static inline bool timer_pending(const ktimer_t *timer)
+{
+    return timer->pprev != NULL;
+}
+
+/* Arm timer for timer->expires. An expiry in the past fires on the next
+ * tick. */
+void add_timer(ktimer_t *timer);
+
+/* (Re)arm timer for expires. Returns true if it was pending. Safe from
+ * any context, including the timer's own callback. */
+bool mod_timer(ktimer_t *timer, uint32_t expires);
+
+/* Disarm timer. Returns true if it was pending. The callback may still
+ * be running on CPU 0 when this returns. */
+bool del_timer(ktimer_t *timer);
+
+/* Disarm timer and wait for a running callback to finish. Not from
+ * the callback itself or any other softirq. */
+bool del_timer_sync(ktimer_t *timer);
+
+/* ================================================================
+ * TICK HOOKS (drivers/timer.c, CPU 0)
+ * ================================================================ */
+
+/* The tick count has reached now: raise the softirq if a bucket is due */
+void ktimer_tick(uint32_t now);
+
+/* Ticks from now until the wheel next needs the tick, at most max */
+uint32_t ktimer_next_event(uint32_t now, uint32_t max);
+
+/* ================================================================
+ * STATISTICS
+ * ================================================================ */
+
+void ktimer_show_stats(void);
+
+#endif /* KTIMER_H */
@@ -0,0 +1,281 @@
+/* kernel/mutex.c - Sleeping Mutexes with Priority Inheritance
+ *
+ * The owner word holds the owning task, with MUTEX_HAS_WAITERS set
+ * while anybody sleeps on the mutex. The fast paths only swap 0 and
+ * the current task; once the bit is set both lock and unlock go
+ * through pi_lock, which guards every waiter list, every task's
+ * pi_mutexes list and blocked_on. The owner therefore cannot let go
+ * while a new waiter is being queued.
+ *
+ * Unlocking a contended mutex hands it to the first waiter directly
+ * rather than letting everybody race for it: the waiter was the most
+ * important one, and with inheritance the old owner would otherwise
+ * win again right after losing its boost.
+ *
+ * pi_lock nests outside the scheduler lock (scheduler_pi_setprio() is
+ * called under it).
+ */
+
+#include "mutex.h"
+#include "kernel.h"
+#include "task.h"
+#include "scheduler.h"
+#include "spinlock.h"
+#include "wait.h"
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+static spinlock_t pi_lock = SPINLOCK_INIT("mutex_pi", LOCK_ORDER_SLEEP);
+
+static bool pi_enabled = true;
+static uint32_t pi_boosts = 0;
+
+static inline task_t *owner_task(uint32_t owner)
+{
+    return (task_t *)(owner & ~(uint32_t)MUTEX_HAS_WAITERS);
+}
+
+/* ================================================================
+ * WAITER LISTS (pi_lock held)
+ * ================================================================ */
+
+/* Behind the waiters of equal priority, so those are served in order */
+static void waiter_insert(mutex_t *mutex, mutex_waiter_t *waiter)
+{
+    mutex_waiter_t **link = &mutex->waiters;
+
+    while (*link && (*link)->prio <= waiter->prio)
+        link = &(*link)->next;
+
+    waiter->next = *link;
+    *link = waiter;
+}
+
+static mutex_waiter_t *waiter_remove(mutex_t *mutex, task_t *task)
+{
+    mutex_waiter_t **link = &mutex->waiters;
+
+    while (*link && (*link)->task != task)
+        link = &(*link)->next;
+
+    mutex_waiter_t *waiter = *link;
+    if (waiter)
+        *link = waiter->next;
+    return waiter;
+}
+
+static void pi_list_remove(task_t *task, mutex_t *mutex)
+{
+    mutex_t **link = &task->pi_mutexes;
+
+    while (*link && *link != mutex)
+        link = &(*link)->pi_next;
+    if (*link)
+        *link = mutex->pi_next;
+    mutex->pi_next = NULL;
+}
+
+/* ================================================================
+ * PRIORITY INHERITANCE (pi_lock held)
+ * ================================================================ */
+
+/* Most important waiter over all the mutexes task holds */
+static uint32_t pi_top_waiter(task_t *task)
+{
+    uint32_t prio = PI_PRIO_NONE;
+
+    if (!pi_enabled)
+        return prio;
+
+    for (mutex_t *mutex = task->pi_mutexes; mutex; mutex = mutex->pi_next) {
+        if (mutex->waiters &&
+            (prio == PI_PRIO_NONE || mutex->waiters->prio < prio))
+            prio = mutex->waiters->prio;
+    }
+    return prio;
+}
+
+/* Recompute task's inherited priority and pass a change down the chain
+ * of owners it is blocked behind */
+static void pi_propagate(task_t *task)
+{
+    for (int depth = 0; task && depth < MUTEX_PI_DEPTH; depth++) {
+        uint32_t prio = pi_top_waiter(task);
+        if (prio == task->pi_prio)
+            return;
+
+        bool was_boosted = task->pi_boosted;
+        scheduler_pi_setprio(task, prio);
+        if (!was_boosted && task->pi_boosted)
+            pi_boosts++;
+
+        /* Its place among the waiters of the next mutex moves too */
+        mutex_t *mutex = task->blocked_on;
+        if (!mutex)
+            return;
+
+        mutex_waiter_t *waiter = waiter_remove(mutex, task);
+        if (!waiter)
+            return;
+        waiter->prio = scheduler_prio_key(task);
+        waiter_insert(mutex, waiter);
+
+        task = owner_task(mutex->owner);
+    }
+}
+
+/* ================================================================
+ * LOCKING
+ * ================================================================ */
+
+void mutex_init(mutex_t *mutex, const char *name)
+{
+    mutex->owner = 0;
+    mutex->waiters = NULL;
+    mutex->pi_next = NULL;
+    mutex->name = name;
+    mutex->contended = 0;
+}
+
+bool mutex_trylock(mutex_t *mutex)
+{
+    uint32_t expected = 0;
+    return __atomic_compare_exchange_n(&mutex->owner, &expected,
+                                       (uint32_t)current_task, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void mutex_lock_slow(mutex_t *mutex)
+{
+    task_t *self = current_task;
+    uint32_t flags = spin_lock_irqsave(&pi_lock);
+
+    /* Set the waiters bit - or take the mutex if it was let go in the
+     * meantime. With the bit set the owner cannot unlock without
+     * pi_lock. */
+    uint32_t owner = mutex->owner;
+    for (;;) {
+        if (!owner) {
+            if (__atomic_compare_exchange_n(&mutex->owner, &owner, (uint32_t)self,
+                                            false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                spin_unlock_irqrestore(&pi_lock, flags);
+                return;
+            }
+            continue;
+        }
+        if ((owner & MUTEX_HAS_WAITERS) ||
+            __atomic_compare_exchange_n(&mutex->owner, &owner, owner | MUTEX_HAS_WAITERS,
+                                        false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+
+    task_t *holder = owner_task(owner);
+    mutex_waiter_t waiter = {self, scheduler_prio_key(self), NULL};
+
+    /* The first waiter puts the mutex on the owner's list, which is
+     * what its inherited priority is computed from */
+    if (!mutex->waiters) {
+        mutex->pi_next = holder->pi_mutexes;
+        holder->pi_mutexes = mutex;
+    }
+    waiter_insert(mutex, &waiter);
+    self->blocked_on = mutex;
+    mutex->contended++;
+
+    pi_propagate(holder);
+
+    /* mutex_unlock() makes us the owner before waking us */
+    while (owner_task(mutex->owner) != self) {
+        self->state = TASK_BLOCKED;
+        spin_unlock_irqrestore(&pi_lock, flags);
+        wait_schedule();
+        flags = spin_lock_irqsave(&pi_lock);
+    }
+
+    self->state = TASK_RUNNING;
+    self->blocked_on = NULL;
+    spin_unlock_irqrestore(&pi_lock, flags);
+}
+
+void mutex_lock(mutex_t *mutex)
+{
+    if (!mutex_trylock(mutex))
+        mutex_lock_slow(mutex);
+}
+
+static void mutex_unlock_slow(mutex_t *mutex)
+{
+    task_t *self = current_task;
+    uint32_t flags = spin_lock_irqsave(&pi_lock);
+
+    mutex_waiter_t *waiter = mutex->waiters;
+    pi_list_remove(self, mutex);
+
+    if (!waiter) {
+        __atomic_store_n(&mutex->owner, 0, __ATOMIC_RELEASE);
+        spin_unlock_irqrestore(&pi_lock, flags);
+        return;
+    }
+
+    /* Hand over to the most important waiter, along with the rest */
+    task_t *next = waiter->task;
+    mutex->waiters = waiter->next;
+    if (mutex->waiters) {
+        mutex->pi_next = next->pi_mutexes;
+        next->pi_mutexes = mutex;
+    }
+    next->blocked_on = NULL;
+    __atomic_store_n(&mutex->owner,
+                     (uint32_t)next | (mutex->waiters ? MUTEX_HAS_WAITERS : 0),
+                     __ATOMIC_RELEASE);
+
+    /* Drop what we inherited through this mutex; the new owner inherits
+     * from whoever still waits */
+    pi_propagate(self);
+    pi_propagate(next);
+
+    if (next->state == TASK_BLOCKED)
+        scheduler_wake_task(next);
+
+    spin_unlock_irqrestore(&pi_lock, flags);
+}
+
+void mutex_unlock(mutex_t *mutex)
+{
+    uint32_t expected = (uint32_t)current_task;
+
+    if (!__atomic_compare_exchange_n(&mutex->owner, &expected, 0, false,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        mutex_unlock_slow(mutex);
+}
+
+/* ================================================================
+ * QUERIES
+ * ================================================================ */
+
+bool mutex_is_locked(mutex_t *mutex)
+{
+    return mutex->owner != 0;
+}
+
+struct task *mutex_owner(mutex_t *mutex)
+{
+    return owner_task(mutex->owner);
+}
+
+void mutex_set_pi(bool enabled)
+{
+    pi_enabled = enabled;
+}
+
+bool mutex_pi_enabled(void)
+{
+    return pi_enabled;
+}
+
+uint32_t mutex_pi_boosts(void)
+{
+    return pi_boosts;
+}
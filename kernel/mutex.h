@@ -0,0 +1,88 @@
+/* kernel/mutex.h - Sleeping Mutexes
+ *
+ * A mutex is a lock whose waiters sleep instead of spinning, so it may
+ * be held across anything that blocks. Only tasks can use it - never
+ * an interrupt handler - and only the task that locked it may unlock
+ * it.
+ *
+ * An uncontended lock or unlock is a single compare-and-swap on the
+ * owner word. Contended waiters queue in priority order and the owner
+ * hands the mutex straight to the most important one when it unlocks.
+ *
+ * Priority inheritance: while a task holds a mutex that a more
+ * important task waits for, it runs at that task's priority (see
+ * scheduler_pi_setprio()). This follows chains - A waits for B, which
+ * waits for C - so a low priority holder cannot keep a high priority
+ * task waiting behind a medium priority one.
+ *
+ * Typical use:
+ *
+ *     static mutex_t table_mutex = MUTEX_INIT("table");
+ *
+ *     mutex_lock(&table_mutex);
+ *     ...
+ *     mutex_unlock(&table_mutex);
+ */
+
+#ifndef MUTEX_H
+#define MUTEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MUTEX_HAS_WAITERS 0x1        /* Owner word: unlock takes the slow path */
+#define MUTEX_PI_DEPTH    8          /* Longest blocking chain followed */
+
+struct task;
+
+/* ================================================================
+ * TYPES
+ * ================================================================ */
+
+/* One per sleeping task, on its stack */
+typedef struct mutex_waiter
+{
+    struct task *task;
+    uint32_t prio;                   /* scheduler_prio_key() of the task */
+    struct mutex_waiter *next;
+} mutex_waiter_t;
+
+typedef struct mutex
+{
+    volatile uint32_t owner;         /* task_t * | MUTEX_HAS_WAITERS, 0 if free */
+    mutex_waiter_t *waiters;         /* Most important first */
+    struct mutex *pi_next;           /* Owner's list of mutexes with waiters */
+    const char *name;
+    uint32_t contended;              /* Lock attempts that had to sleep */
+} mutex_t;
+
+#define MUTEX_INIT(name) {0, NULL, NULL, (name), 0}
+
+/* ================================================================
+ * MUTEX FUNCTIONS
+ * ================================================================ */
+
+void mutex_init(mutex_t *mutex, const char *name);
+
+/* Sleep until the mutex is ours */
+void mutex_lock(mutex_t *mutex);
+
+/* Take the mutex if it is free. Returns true on success. */
+bool mutex_trylock(mutex_t *mutex);
+
+void mutex_unlock(mutex_t *mutex);
+
+bool mutex_is_locked(mutex_t *mutex);
+
+/* Task holding the mutex, or NULL */
+struct task *mutex_owner(mutex_t *mutex);
+
+/* Priority inheritance on/off (on by default), for comparisons. Only
+ * switch while no mutex is contended. */
+void mutex_set_pi(bool enabled);
+bool mutex_pi_enabled(void);
+
+/* Times a holder has been boosted above its own priority */
+uint32_t mutex_pi_boosts(void);
+
+#endif /* MUTEX_H */
@@ -0,0 +1,135 @@
+/* kernel/pid.c - PID allocator and PID hash
+ *
+ * The bitmap is searched a word at a time from last_pid onwards, so an
+ * allocation costs at most PID_MAX / 32 word checks and usually one.
+ * Hash chains go through task->pid_next.
+ *
+ * pid_lock nests inside the scheduler lock (scheduler_setscheduler()
+ * looks tasks up under it), so it is taken with interrupts off like
+ * the scheduler's.
+ */
+
+#include "pid.h"
+#include "kernel.h"
+#include "task.h"
+#include "spinlock.h"
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+static spinlock_t pid_lock = SPINLOCK_INIT("pid", LOCK_ORDER_PID);
+
+static uint32_t pid_bitmap[PID_MAX / 32] = { 1 };  /* PID 0: idle */
+static uint32_t last_pid = 0;      /* Search starts after this one */
+static uint32_t nr_pids = 0;
+
+static struct task *pid_hash[PID_HASH_BUCKETS];
+
+static inline uint32_t pid_hashfn(uint32_t pid)
+{
+    return pid & (PID_HASH_BUCKETS - 1);
+}
+
+/* ================================================================
+ * ALLOCATION
+ * ================================================================ */
+
+/* First clear bit at or after pid, or 0 if there is none */
+static uint32_t find_free_from(uint32_t pid)
+{
+    for (uint32_t word = pid / 32; word < PID_MAX / 32; word++) {
+        uint32_t free = ~pid_bitmap[word];
+
+        /* Ignore the bits below pid in its own word */
+        if (word == pid / 32)
+            free &= ~0u << (pid % 32);
+        if (free)
+            return word * 32 + (uint32_t)__builtin_ctz(free);
+    }
+    return 0;
+}
+
+int pid_alloc(void)
+{
+    uint32_t flags = spin_lock_irqsave(&pid_lock);
+
+    uint32_t start = last_pid + 1 < PID_MAX ? last_pid + 1 : 1;
+    uint32_t pid = find_free_from(start);
+
+    /* Nothing above the last one: wrap around (PID 0 stays reserved) */
+    if (!pid)
+        pid = find_free_from(1);
+
+    if (pid) {
+        pid_bitmap[pid / 32] |= 1u << (pid % 32);
+        last_pid = pid;
+        nr_pids++;
+    }
+
+    spin_unlock_irqrestore(&pid_lock, flags);
+    return pid ? (int)pid : -1;
+}
+
+void pid_free(uint32_t pid)
+{
+    if (!pid || pid >= PID_MAX)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&pid_lock);
+    if (pid_bitmap[pid / 32] & (1u << (pid % 32))) {
+        pid_bitmap[pid / 32] &= ~(1u << (pid % 32));
+        nr_pids--;
+    }
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+uint32_t pid_count(void)
+{
+    return nr_pids;
+}
+
+/* ================================================================
+ * HASH
+ * ================================================================ */
+
+void pid_hash_add(struct task *task)
+{
+    if (!task || !task->pid)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&pid_lock);
+    uint32_t bucket = pid_hashfn(task->pid);
+    task->pid_next = pid_hash[bucket];
+    pid_hash[bucket] = task;
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+void pid_hash_remove(struct task *task)
+{
+    if (!task || !task->pid)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&pid_lock);
+    struct task **link = &pid_hash[pid_hashfn(task->pid)];
+    while (*link && *link != task)
+        link = &(*link)->pid_next;
+    if (*link)
+        *link = task->pid_next;
+    task->pid_next = NULL;
+    spin_unlock_irqrestore(&pid_lock, flags);
+}
+
+struct task *find_task_by_pid(uint32_t pid)
+{
+    if (!pid || pid >= PID_MAX)
+        return NULL;
+
+    uint32_t flags = spin_lock_irqsave(&pid_lock);
+    struct task *task = pid_hash[pid_hashfn(pid)];
+    while (task && task->pid != pid)
+        task = task->pid_next;
+    spin_unlock_irqrestore(&pid_lock, flags);
+
+    return task;
+}
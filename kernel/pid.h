@@ -0,0 +1,43 @@
+/* kernel/pid.h - Process IDs
+ *
+ * One allocator hands out every PID, whether the task comes from
+ * task_create(), task_create_user() or fork(). Free PIDs are tracked in
+ * a bitmap and handed out in increasing order from the last one given,
+ * wrapping around at PID_MAX, so a PID is not reused until the whole
+ * range has cycled. PID 0 belongs to the idle tasks and is never
+ * allocated.
+ *
+ * Live tasks are also hashed by PID, so a lookup costs O(1) instead of
+ * a walk over every task.
+ */
+
+#ifndef PID_H
+#define PID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define PID_MAX 32768                /* PIDs are 1 .. PID_MAX - 1 */
+#define PID_HASH_BUCKETS 256         /* Power of two */
+
+struct task;
+
+/* Reserve an unused PID. Returns -1 when all of them are taken. */
+int pid_alloc(void);
+
+/* Give a PID back (after its task has left the hash) */
+void pid_free(uint32_t pid);
+
+/* Make task findable by its PID / stop that */
+void pid_hash_add(struct task *task);
+void pid_hash_remove(struct task *task);
+
+/* Task with this PID, or NULL. The pointer stays valid only as long as
+ * something keeps the task from being freed - the scheduler lock, or
+ * being its parent. */
+struct task *find_task_by_pid(uint32_t pid);
+
+/* PIDs currently allocated */
+uint32_t pid_count(void);
+
+#endif /* PID_H */
@@ -0,0 +1,87 @@
+/* kernel/preempt.h - Kernel Preemption
+ *
+ * A task running kernel code may be switched out whenever its preempt
+ * count is zero: on the way out of an interrupt (irq_handler_c()), or
+ * when preempt_enable() brings the count back to zero. The tick and
+ * wakeups only set need_resched; the switch happens at one of those
+ * points.
+ *
+ * spin_lock() raises the count, so a task is never switched out while
+ * it holds a spinlock - otherwise the next task could spin forever on
+ * a lock its own CPU holds. Interrupts do not need to be off for that.
+ *
+ * The count belongs to the task and travels with it. Before the boot
+ * CPU has a task there is nothing to switch to, and the calls do
+ * nothing.
+ */
+
+#ifndef PREEMPT_H
+#define PREEMPT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel.h"
+#include "task.h"
+
+#define PREEMPT_EFLAGS_IF 0x200
+
+/* ================================================================
+ * SCHEDULER HOOKS (scheduler.c)
+ * ================================================================ */
+
+/* preempt_enable() dropped the count to zero with a switch due */
+void preempt_schedule(void);
+
+/* Preemption point with interrupts off: interrupt exit, end of the
+ * softirqs. Switches only if the count is zero. */
+void preempt_schedule_irq(void);
+
+/* ================================================================
+ * PREEMPT COUNT
+ * ================================================================ */
+
+static inline uint32_t preempt_count(void)
+{
+    task_t *task = current_task;
+    return task ? task->preempt_count : 0;
+}
+
+/* An interrupt in the middle of the increment does its own balanced
+ * disable/enable on the same task, so no atomics are needed */
+static inline void preempt_disable(void)
+{
+    task_t *task = current_task;
+    if (task)
+        task->preempt_count++;
+    __asm__ volatile("" : : : "memory");
+}
+
+/* Drop the count without switching: for callers about to switch
+ * anyway, or with interrupts off */
+static inline void preempt_enable_no_resched(void)
+{
+    __asm__ volatile("" : : : "memory");
+    task_t *task = current_task;
+    if (task)
+        task->preempt_count--;
+}
+
+static inline void preempt_enable(void)
+{
+    __asm__ volatile("" : : : "memory");
+    uint32_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    task_t *task = cpu->current;
+    bool resched = false;
+
+    /* With interrupts off the caller is still atomic: the next
+     * interrupt exit or preempt_enable() catches the switch */
+    if (task && !--task->preempt_count)
+        resched = cpu->need_resched && (flags & PREEMPT_EFLAGS_IF);
+    irq_restore(flags);
+
+    if (resched)
+        preempt_schedule();
+}
+
+#endif /* PREEMPT_H */
@@ -0,0 +1,236 @@
+/* kernel/schedtrace.c - Scheduler Event Tracer
+ *
+ * One ring of SCHEDTRACE_EVENTS events per CPU. head only ever grows;
+ * event i lives in slot i % SCHEDTRACE_EVENTS and carries seq = i + 1
+ * once fully written, so readers can skip slots that are being
+ * rewritten underneath them. A CPU only ever writes its own ring, so
+ * timestamps within a ring come from one TSC; dumps and exports cover
+ * the smp_num_cpus CPUs that came online.
+ */
+
+#include "schedtrace.h"
+#include "kernel.h"
+#include "../fs/vfs.h"
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+typedef struct
+{
+    volatile uint32_t head;  /* Events ever recorded on this CPU */
+    trace_event_t events[SCHEDTRACE_EVENTS];
+} trace_cpu_buffer_t;
+
+_Static_assert(sizeof(trace_event_t) == 24, "trace_event_t is part of the export format");
+_Static_assert((SCHEDTRACE_EVENTS & (SCHEDTRACE_EVENTS - 1)) == 0,
+               "SCHEDTRACE_EVENTS must be a power of two");
+
+static trace_cpu_buffer_t trace_buffers[SCHEDTRACE_MAX_CPUS];
+
+volatile bool schedtrace_on = true;
+
+/* ================================================================
+ * RECORDING
+ * ================================================================ */
+
+void schedtrace_record(uint8_t type, uint32_t pid, uint32_t arg, uint8_t state)
+{
+    uint32_t cpu = smp_processor_id();
+    trace_cpu_buffer_t *buf = &trace_buffers[cpu];
+
+    /* Claim a slot - an IRQ arriving mid-record just takes the next one */
+    uint32_t idx = __atomic_fetch_add(&buf->head, 1, __ATOMIC_RELAXED);
+    trace_event_t *ev = &buf->events[idx & (SCHEDTRACE_EVENTS - 1)];
+
+    ev->seq = 0;
+    __asm__ volatile("" : : : "memory");
+
+    ev->tsc = rdtsc();
+    ev->pid = pid;
+    ev->arg = arg;
+    ev->type = type;
+    ev->cpu = (uint8_t)cpu;
+    ev->state = state;
+    ev->reserved = 0;
+
+    __asm__ volatile("" : : : "memory");
+    ev->seq = idx + 1;
+}
+
+/* ================================================================
+ * CONTROL
+ * ================================================================ */
+
+void schedtrace_enable(bool on)
+{
+    schedtrace_on = on;
+}
+
+void schedtrace_clear(void)
+{
+    uint32_t flags = irq_save();
+
+    for (uint32_t cpu = 0; cpu < SCHEDTRACE_MAX_CPUS; cpu++) {
+        trace_buffers[cpu].head = 0;
+        memset(trace_buffers[cpu].events, 0, sizeof(trace_buffers[cpu].events));
+    }
+
+    irq_restore(flags);
+}
+
+/* Index of the oldest event still in the ring */
+static inline uint32_t trace_oldest(uint32_t head)
+{
+    return head > SCHEDTRACE_EVENTS ? head - SCHEDTRACE_EVENTS : 0;
+}
+
+/* ================================================================
+ * DUMP
+ * ================================================================ */
+
+static const char *trace_type_name(uint8_t type)
+{
+    switch (type) {
+        case TRACE_SWITCH: return "switch";
+        case TRACE_WAKEUP: return "wakeup";
+        case TRACE_BLOCK:  return "block ";
+        case TRACE_SLEEP:  return "sleep ";
+        case TRACE_IRQ:    return "irq   ";
+        default:           return "?     ";
+    }
+}
+
+void schedtrace_dump(uint32_t count)
+{
+    for (uint32_t cpu = 0; cpu < smp_num_cpus; cpu++) {
+        trace_cpu_buffer_t *buf = &trace_buffers[cpu];
+        uint32_t head = buf->head;
+        uint32_t start = trace_oldest(head);
+
+        if (head - start > count)
+            start = head - count;
+
+        terminal_writestring("CPU ");
+        terminal_write_dec(cpu);
+        terminal_writestring(": ");
+        terminal_write_dec(head);
+        terminal_writestring(" events recorded, ");
+        terminal_write_dec(trace_oldest(head));
+        terminal_writestring(" overwritten\n");
+
+        uint64_t first_tsc = 0;
+        bool have_first = false;
+
+        for (uint32_t i = start; i != head; i++) {
+            trace_event_t ev = buf->events[i & (SCHEDTRACE_EVENTS - 1)];
+            if (ev.seq != i + 1)
+                continue;  /* Torn or already overwritten */
+
+            if (!have_first) {
+                first_tsc = ev.tsc;
+                have_first = true;
+            }
+
+            char delta[32];
+            ksnprintf(delta, sizeof(delta), "  +%llu cyc  ", ev.tsc - first_tsc);
+            terminal_writestring(delta);
+            terminal_writestring(trace_type_name(ev.type));
+            terminal_writestring("  pid ");
+            terminal_write_dec(ev.pid);
+
+            switch (ev.type) {
+                case TRACE_SWITCH:
+                    terminal_writestring(" -> ");
+                    terminal_write_dec(ev.arg);
+                    terminal_writestring(" (prev state ");
+                    terminal_write_dec(ev.state);
+                    terminal_writestring(")");
+                    break;
+                case TRACE_WAKEUP:
+                    terminal_writestring(" by ");
+                    terminal_write_dec(ev.arg);
+                    break;
+                case TRACE_SLEEP:
+                    terminal_writestring(" for ");
+                    terminal_write_dec(ev.arg);
+                    terminal_writestring(" ticks");
+                    break;
+                case TRACE_IRQ:
+                    terminal_writestring(" irq ");
+                    terminal_write_dec(ev.arg);
+                    break;
+                default:
+                    break;
+            }
+            terminal_writestring("\n");
+        }
+    }
+}
+
+/* ================================================================
+ * EXPORT
+ * ================================================================ */
+
+int schedtrace_export(const char *path)
+{
+    /* Freeze the buffer so the export is a consistent snapshot */
+    bool was_on = schedtrace_on;
+    schedtrace_on = false;
+
+    trace_header_t header;
+    header.magic = SCHEDTRACE_MAGIC;
+    header.version = SCHEDTRACE_VERSION;
+    header.event_size = sizeof(trace_event_t);
+    header.nr_cpus = smp_num_cpus;
+    header.nr_events = 0;
+    header.tsc_khz = timer_tsc_khz();
+    header.dropped = 0;
+
+    for (uint32_t cpu = 0; cpu < header.nr_cpus; cpu++) {
+        uint32_t head = trace_buffers[cpu].head;
+        header.nr_events += head - trace_oldest(head);
+        header.dropped += trace_oldest(head);
+    }
+
+    int fd = vfs_open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        schedtrace_on = was_on;
+        return -1;
+    }
+
+    int written = vfs_write(fd, &header, sizeof(header));
+    if (written != (int)sizeof(header))
+        goto fail;
+
+    for (uint32_t cpu = 0; cpu < header.nr_cpus; cpu++) {
+        trace_cpu_buffer_t *buf = &trace_buffers[cpu];
+        uint32_t head = buf->head;
+        uint32_t start = trace_oldest(head);
+        uint32_t first = start & (SCHEDTRACE_EVENTS - 1);
+        uint32_t n = head - start;
+
+        /* Oldest first: the tail of the array, then the wrapped part */
+        uint32_t chunk = n < SCHEDTRACE_EVENTS - first ? n : SCHEDTRACE_EVENTS - first;
+        uint32_t bytes = chunk * sizeof(trace_event_t);
+        if (vfs_write(fd, &buf->events[first], bytes) != (int)bytes)
+            goto fail;
+        written += bytes;
+
+        bytes = (n - chunk) * sizeof(trace_event_t);
+        if (bytes) {
+            if (vfs_write(fd, &buf->events[0], bytes) != (int)bytes)
+                goto fail;
+            written += bytes;
+        }
+    }
+
+    vfs_close(fd);
+    schedtrace_on = was_on;
+    return written;
+
+fail:
+    vfs_close(fd);
+    schedtrace_on = was_on;
+    return -1;
+}
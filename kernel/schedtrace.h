@@ -0,0 +1,122 @@
+/* kernel/schedtrace.h - Scheduler Event Tracer
+ *
+ * Records scheduler events (context switches, wakeups, blocks, sleeps,
+ * IRQs) with rdtsc timestamps into a per-CPU ring buffer. Recording is
+ * lock-free: a writer claims a slot with an atomic increment of the
+ * CPU's head, so an IRQ interrupting a half-written event simply takes
+ * the next slot. Old events are overwritten once the ring wraps.
+ *
+ * The buffer can be dumped from the shell or exported as a binary file
+ * (see tools/schedtrace.c) for offline latency analysis.
+ */
+
+#ifndef SCHEDTRACE_H
+#define SCHEDTRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "task.h"
+#include "smp.h"
+
+/* ================================================================
+ * CONFIGURATION
+ * ================================================================ */
+
+#define SCHEDTRACE_EVENTS 4096   /* Per CPU, must be a power of two */
+#define SCHEDTRACE_MAX_CPUS SMP_MAX_CPUS
+
+/* Export file format */
+#define SCHEDTRACE_MAGIC 0x43525453  /* "STRC" */
+#define SCHEDTRACE_VERSION 1
+
+/* ================================================================
+ * EVENTS
+ * ================================================================ */
+
+typedef enum
+{
+    TRACE_SWITCH = 1,  /* pid -> arg (next pid), state = prev state */
+    TRACE_WAKEUP = 2,  /* pid woken, arg = waker pid */
+    TRACE_BLOCK  = 3,  /* pid blocked on a wait queue */
+    TRACE_SLEEP  = 4,  /* pid went to sleep, arg = ticks */
+    TRACE_IRQ    = 5,  /* IRQ arg interrupted pid */
+} trace_event_type_t;
+
+typedef struct
+{
+    uint64_t tsc;     /* rdtsc at the time of the event */
+    uint32_t pid;     /* Task the event is about */
+    uint32_t arg;     /* Event specific (see above) */
+    uint8_t type;     /* trace_event_type_t */
+    uint8_t cpu;
+    uint8_t state;    /* Task state at the time of the event */
+    uint8_t reserved;
+    uint32_t seq;     /* Slot sequence + 1, written last (0 = torn/empty) */
+} trace_event_t;
+
+/* Header of an exported trace; events follow, oldest first per CPU */
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t event_size;
+    uint32_t nr_cpus;
+    uint32_t nr_events;
+    uint32_t tsc_khz;  /* 0 if not calibrated */
+    uint32_t dropped;  /* Events overwritten before export */
+} __attribute__((packed)) trace_header_t;
+
+/* ================================================================
+ * RECORDING
+ * ================================================================ */
+
+extern volatile bool schedtrace_on;
+
+void schedtrace_record(uint8_t type, uint32_t pid, uint32_t arg, uint8_t state);
+
+static inline void trace_sched_switch(task_t *prev, task_t *next)
+{
+    if (schedtrace_on)
+        schedtrace_record(TRACE_SWITCH, prev ? prev->pid : 0, next->pid,
+                          prev ? (uint8_t)prev->state : 0);
+}
+
+static inline void trace_sched_wakeup(task_t *task, task_t *waker)
+{
+    if (schedtrace_on)
+        schedtrace_record(TRACE_WAKEUP, task->pid, waker ? waker->pid : 0,
+                          (uint8_t)task->state);
+}
+
+static inline void trace_sched_block(task_t *task)
+{
+    if (schedtrace_on)
+        schedtrace_record(TRACE_BLOCK, task->pid, 0, (uint8_t)task->state);
+}
+
+static inline void trace_sched_sleep(task_t *task, uint32_t ticks)
+{
+    if (schedtrace_on)
+        schedtrace_record(TRACE_SLEEP, task->pid, ticks, (uint8_t)task->state);
+}
+
+static inline void trace_irq(uint32_t irq, task_t *task)
+{
+    if (schedtrace_on)
+        schedtrace_record(TRACE_IRQ, task ? task->pid : 0, irq, 0);
+}
+
+/* ================================================================
+ * CONTROL AND OUTPUT
+ * ================================================================ */
+
+void schedtrace_enable(bool on);
+void schedtrace_clear(void);
+
+/* Print the most recent count events of every CPU */
+void schedtrace_dump(uint32_t count);
+
+/* Write the whole buffer to a file, returns bytes written or -1 */
+int schedtrace_export(const char *path);
+
+#endif /* SCHEDTRACE_H */
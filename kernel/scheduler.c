@@ -1,12 +1,68 @@
-/* kernel/scheduler.c - Round-Robin Task Scheduler
+/* kernel/scheduler.c - Task Scheduler
  *
- * Manages task execution order using round-robin algorithm.
- * Each task gets an equal time slice (10ms by default).
+ * Two interchangeable policies for normal tasks:
+ *
+ * PRIO - Ready tasks are kept in one FIFO run queue per priority level
+ * (0 = highest). A bitmap records which levels are non-empty, so
+ * picking the next task is a single find-first-set regardless of how
+ * many tasks exist. Tasks at the same level share the CPU round-robin
+ * with SCHEDULER_TIME_SLICE_MS slices. A task that gives up the CPU
+ * voluntarily (blocks or sleeps) earns a temporary priority boost when
+ * it wakes; burning a full slice decays it again.
+ *
+ * FAIR - Every task accumulates virtual runtime: real CPU time scaled
+ * by SCHED_NICE_0_WEIGHT / weight, where the weight comes from the
+ * priority (the usual ~1.25x per level table). Ready tasks sit in a
+ * red-black tree ordered by vruntime and the leftmost one runs next.
+ * Each task's slice is its weighted share of SCHED_LATENCY_MS, so every
+ * runnable task gets on the CPU once per period and CPU time converges
+ * to the weight ratios. Waking tasks are placed slightly behind
+ * min_vruntime, which lets interactive tasks preempt CPU hogs without
+ * letting a long sleeper monopolise the CPU.
+ *
+ * Real-time classes are picked before either policy gets a look in:
+ *
+ * DEADLINE - a task reserves runtime every period, due deadline ticks
+ * after the period starts. Ready deadline tasks sit in a tree ordered
+ * by absolute deadline and the earliest runs (EDF). A task that uses up
+ * its budget is throttled - parked in the sleep queue until its next
+ * period - so it cannot take more than it reserved; a task waking too
+ * late to finish its budget before the deadline gets a fresh period
+ * (the constant bandwidth server rule). Reservations are admitted only
+ * while their total stays below SCHED_DL_BW_LIMIT of one CPU.
+ *
+ * FIFO / RR - fixed levels with their own bitmap and queues, laid out
+ * like PRIO. FIFO tasks keep the CPU until they block, yield or are
+ * preempted by a higher class or level; RR tasks also give way to
+ * their level every SCHED_RR_SLICE_MS. Neither gets boosts.
+ *
+ * In all cases blocked tasks are not queued anywhere, and each CPU's
+ * idle task (kernel_task - the shell/idle loop - on CPU 0) is the
+ * fallback when nothing else is ready. Sleeping tasks sit in a binary
+ * min-heap keyed by wake tick, so a tick only looks at the heap root
+ * and costs O(expired sleepers) rather than O(all tasks).
+ *
+ * SMP - every CPU has its own run queue (both policies' structures).
+ * A new or waking task goes to the least loaded CPU; a CPU whose queue
+ * runs dry steals from the busiest one, and a tick on a CPU with tasks
+ * waiting kicks an idle CPU over to steal. One lock, sched_lock, covers
+ * all scheduler state. CPU 0 owns the sleep queue and the global tick;
+ * the APs only run a local APIC tick while they have a task to slice.
+ *
+ * Preemption - the tick, wakeups and IPIs only set cpu->need_resched.
+ * The running task is switched out on its way out of the interrupt, or
+ * in preempt_enable() if it was holding a spinlock at the time (see
+ * preempt.h), so kernel code is preemptible wherever it holds no lock.
  */
 
 #include "scheduler.h"
 #include "kernel.h"
 #include "task.h"
+#include "smp.h"
+#include "spinlock.h"
+#include "preempt.h"
+#include "pid.h"
+#include "schedtrace.h"
 
 /* ================================================================
  * GLOBAL STATE
@@ -14,18 +70,79 @@
 
 static scheduler_stats_t stats = {0};
 static bool scheduler_running = false;
+static sched_policy_t sched_policy = SCHED_POLICY_PRIO;
+
+/* Protects everything below, the task_t scheduling fields and
+ * cpus[].current. Helpers without a lock of their own expect it held. */
+static spinlock_t sched_lock = SPINLOCK_INIT("sched", LOCK_ORDER_SCHED);
+
+/* Per-priority FIFO run queue (idle tasks are never queued) */
+typedef struct
+{
+    task_t *head;
+    task_t *tail;
+} run_queue_t;
+
+/* Everything one CPU picks from */
+typedef struct
+{
+    run_queue_t queues[SCHEDULER_PRIO_LEVELS];
+    uint32_t bitmap;                /* Non-empty priority levels */
+
+    /* Fair class: vruntime-ordered tree with a cached leftmost node */
+    struct rb_root fair_tree;
+    struct rb_node *fair_leftmost;
+    uint32_t fair_nr_running;
+    uint32_t fair_load;
+    uint64_t min_vruntime;
+
+    /* FIFO/RR levels and the deadline tree (cached earliest node) */
+    run_queue_t rt_queues[SCHED_RT_PRIO_LEVELS];
+    uint32_t rt_bitmap;
+    struct rb_root dl_tree;
+    struct rb_node *dl_leftmost;
+
+    uint32_t nr_running;            /* Queued tasks (not the running one) */
+    uint32_t steals;                /* Tasks pulled from other CPUs */
+} sched_rq_t;
 
-/* Ready queue - circular linked list of tasks (NOT including kernel_task) */
-static task_t *ready_queue = NULL;
-static task_t *ready_queue_tail = NULL;
+static sched_rq_t runqueues[SMP_MAX_CPUS];
 
-/* External references */
-extern task_t *current_task;
-extern task_t *kernel_task;
+/* Sleeping tasks: min-heap ordered by wake_time (grows with kmalloc) */
+#define SLEEP_HEAP_INITIAL 16
+
+static task_t **sleep_heap = NULL;
+static uint32_t sleep_heap_size = 0;
+static uint32_t sleep_heap_capacity = 0;
+
+/* Every task known to the scheduler, runnable or not */
+static task_t *sched_tasks = NULL;
+
+/* Sum of admitted deadline reservations (ppm of one CPU) */
+static uint32_t dl_total_bw = 0;
+
+/* Ticks since the load averages were last updated */
+static uint32_t load_ticks = 0;
 
 /* Forward declarations */
 static void update_statistics(void);
-static task_t* get_next_ready_task(void);
+static void dequeue_task(task_t *task);
+static void pi_unboost(task_t *task);
+static void pi_boost(task_t *task);
+
+/* Priority level -> load weight. Level 16 is the default weight of
+ * 1024; each level up or down is ~1.25x, i.e. ~10% CPU between two
+ * competing tasks one level apart. (Linux nice -16..+15.) */
+static const uint32_t prio_to_weight[SCHEDULER_PRIO_LEVELS] = {
+    /*  0 */ 36291, 29154, 23254, 18705,
+    /*  4 */ 14949, 11916,  9548,  7620,
+    /*  8 */  6100,  4904,  3906,  3121,
+    /* 12 */  2501,  1991,  1586,  1277,
+    /* 16 */  1024,   820,   655,   526,
+    /* 20 */   423,   335,   272,   215,
+    /* 24 */   172,   137,   110,    87,
+    /* 28 */    70,    56,    45,    36,
+};
 
 /* ================================================================
  * INITIALIZATION
@@ -37,9 +154,14 @@ void scheduler_init(void)
     terminal_writestring("[SCHEDULER] Initializing scheduler...\n");
 
     memset(&stats, 0, sizeof(stats));
+    memset(runqueues, 0, sizeof(runqueues));
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        runqueues[cpu].fair_tree = RB_ROOT;
+        runqueues[cpu].dl_tree = RB_ROOT;
+    }
 
-    ready_queue = NULL;
-    ready_queue_tail = NULL;
+    sched_tasks = NULL;
     scheduler_running = true;
 
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -48,205 +170,1929 @@ void scheduler_init(void)
 }
 
 /* ================================================================
- * TASK QUEUE MANAGEMENT
+ * PRIORITY RUN QUEUES
  * ================================================================ */
 
-void scheduler_add_task(task_t *task)
+/* Effective priority level: static priority minus the I/O boost */
+static inline uint32_t task_prio_level(task_t *task)
 {
-    if (!task) return;
+    uint32_t level = task->priority;
 
-    /* Never add kernel_task to ready_queue */
-    if (task == kernel_task) return;
+    if (level >= SCHEDULER_PRIO_LEVELS)
+        level = SCHEDULER_PRIO_LEVELS - 1;
 
-    /* Don't add if already in queue */
-    if (ready_queue) {
-        task_t *curr = ready_queue;
-        do {
-            if (curr == task) return;
-            curr = curr->next;
-        } while (curr && curr != ready_queue);
-    }
+    return level > task->sched_boost ? level - task->sched_boost : 0;
+}
 
-    /* Add to ready queue */
-    if (!ready_queue) {
-        ready_queue = task;
-        ready_queue_tail = task;
-        task->next = task;
-    } else {
-        ready_queue_tail->next = task;
-        ready_queue_tail = task;
-        task->next = ready_queue;
-    }
+/* Append to the FIFO of one level; shared by PRIO and FIFO/RR */
+static void enqueue_level(run_queue_t *queues, uint32_t *bitmap, task_t *task,
+                          uint32_t level)
+{
+    run_queue_t *rq = &queues[level];
 
-    task->state = TASK_READY;
-    stats.total_tasks++;
+    task->rq_level = level;
+    task->rq_next = NULL;
+    task->rq_prev = rq->tail;
+
+    if (rq->tail)
+        rq->tail->rq_next = task;
+    else
+        rq->head = task;
+    rq->tail = task;
+
+    *bitmap |= (1u << level);
 }
 
-void scheduler_remove_task(task_t *task)
+static void dequeue_level(run_queue_t *queues, uint32_t *bitmap, task_t *task)
+{
+    run_queue_t *rq = &queues[task->rq_level];
+
+    if (task->rq_prev)
+        task->rq_prev->rq_next = task->rq_next;
+    else
+        rq->head = task->rq_next;
+
+    if (task->rq_next)
+        task->rq_next->rq_prev = task->rq_prev;
+    else
+        rq->tail = task->rq_prev;
+
+    if (!rq->head)
+        *bitmap &= ~(1u << task->rq_level);
+
+    task->rq_next = NULL;
+    task->rq_prev = NULL;
+}
+
+static void enqueue_prio(sched_rq_t *srq, task_t *task)
+{
+    enqueue_level(srq->queues, &srq->bitmap, task, task_prio_level(task));
+}
+
+static void dequeue_prio(sched_rq_t *srq, task_t *task)
+{
+    dequeue_level(srq->queues, &srq->bitmap, task);
+}
+
+/* ================================================================
+ * FAIR CLASS
+ * ================================================================ */
+
+/* vruntime comparison that survives wraparound */
+static inline bool vruntime_before(uint64_t a, uint64_t b)
+{
+    return (int64_t)(a - b) < 0;
+}
+
+uint32_t scheduler_task_weight(task_t *task)
+{
+    uint32_t level = task->priority;
+
+    if (level >= SCHEDULER_PRIO_LEVELS)
+        level = SCHEDULER_PRIO_LEVELS - 1;
+
+    return prio_to_weight[level];
+}
+
+/* Virtual time for ticks of real CPU time at the task's weight */
+static inline uint32_t calc_delta_vruntime(uint32_t ticks, task_t *task)
+{
+    return ticks * 1000 * SCHED_NICE_0_WEIGHT / scheduler_task_weight(task);
+}
+
+static void enqueue_fair(sched_rq_t *rq, task_t *task)
 {
-    if (!task || !ready_queue) return;
+    struct rb_node **link = &rq->fair_tree.node;
+    struct rb_node *parent = NULL;
+    bool leftmost = true;
 
-    /* Find and remove from queue */
-    if (ready_queue == task) {
-        /* Removing head */
-        if (ready_queue == ready_queue_tail) {
-            /* Only task in queue */
-            ready_queue = NULL;
-            ready_queue_tail = NULL;
+    while (*link) {
+        parent = *link;
+        task_t *entry = rb_entry(parent, task_t, run_node);
+
+        /* Equal keys go right so same-vruntime tasks stay FIFO */
+        if (vruntime_before(task->vruntime, entry->vruntime)) {
+            link = &parent->left;
         } else {
-            ready_queue_tail->next = task->next;
-            ready_queue = task->next;
-        }
-    } else {
-        /* Find previous task */
-        task_t *prev = ready_queue;
-        while (prev->next != task && prev->next != ready_queue) {
-            prev = prev->next;
+            link = &parent->right;
+            leftmost = false;
         }
+    }
 
-        if (prev->next == task) {
-            prev->next = task->next;
-            if (task == ready_queue_tail) {
-                ready_queue_tail = prev;
-            }
-        }
+    rb_link_node(&task->run_node, parent, link);
+    rb_insert_color(&task->run_node, &rq->fair_tree);
+
+    if (leftmost)
+        rq->fair_leftmost = &task->run_node;
+
+    rq->fair_nr_running++;
+    rq->fair_load += scheduler_task_weight(task);
+}
+
+static void dequeue_fair(sched_rq_t *rq, task_t *task)
+{
+    if (rq->fair_leftmost == &task->run_node)
+        rq->fair_leftmost = rb_next(&task->run_node);
+
+    rb_erase(&task->run_node, &rq->fair_tree);
+
+    rq->fair_nr_running--;
+    rq->fair_load -= scheduler_task_weight(task);
+}
+
+/* min_vruntime only moves forward; it tracks the smallest vruntime of
+ * the CPU's running task and its tree */
+static void update_min_vruntime(uint32_t cpu)
+{
+    sched_rq_t *rq = &runqueues[cpu];
+    task_t *curr = cpus[cpu].current;
+    uint64_t vruntime = rq->min_vruntime;
+    bool have = false;
+
+    if (curr && !curr->is_idle && curr->state == TASK_RUNNING &&
+        curr->sched_class == SCHED_NORMAL) {
+        vruntime = curr->vruntime;
+        have = true;
     }
 
-    task->next = NULL;
-    if (stats.total_tasks > 0) stats.total_tasks--;
+    if (rq->fair_leftmost) {
+        task_t *left = rb_entry(rq->fair_leftmost, task_t, run_node);
+        if (!have || vruntime_before(left->vruntime, vruntime))
+            vruntime = left->vruntime;
+        have = true;
+    }
+
+    if (have && vruntime_before(rq->min_vruntime, vruntime))
+        rq->min_vruntime = vruntime;
+}
+
+/* Each CPU's fair clock runs on its own: carry a task's lead over to
+ * the clock of the queue it moves to */
+static void migrate_vruntime(task_t *task, uint32_t from, uint32_t to)
+{
+    if (from == to)
+        return;
+
+    task->vruntime = task->vruntime - runqueues[from].min_vruntime +
+                     runqueues[to].min_vruntime;
+}
+
+/* Place a new or waking task relative to min_vruntime. Sleepers get up
+ * to half a latency period of credit, never more - a task must not
+ * bank CPU time by sleeping for a long while. */
+static void place_task(sched_rq_t *rq, task_t *task, bool initial)
+{
+    uint64_t vruntime = rq->min_vruntime;
+
+    if (initial) {
+        task->vruntime = vruntime;
+        return;
+    }
+
+    vruntime -= (SCHED_LATENCY_MS * 1000) / 2;
+    if (vruntime_before(task->vruntime, vruntime))
+        task->vruntime = vruntime;
+}
+
+/* Weighted share of the latency period, in ticks */
+static uint32_t fair_slice(sched_rq_t *rq, task_t *task)
+{
+    uint32_t nr = rq->fair_nr_running + 1;
+    uint32_t load = rq->fair_load + scheduler_task_weight(task);
+    uint32_t period = SCHED_LATENCY_MS;
+
+    if (nr > SCHED_LATENCY_MS / SCHED_MIN_GRANULARITY_MS)
+        period = nr * SCHED_MIN_GRANULARITY_MS;
+
+    uint32_t slice = period * scheduler_task_weight(task) / load;
+    return slice < SCHED_MIN_GRANULARITY_MS ? SCHED_MIN_GRANULARITY_MS : slice;
 }
 
 /* ================================================================
- * TASK SELECTION
+ * REAL-TIME CLASSES
  * ================================================================ */
 
-static task_t* get_next_ready_task(void)
+/* Tick comparison that survives the 49-day wraparound */
+static inline bool tick_before(uint32_t a, uint32_t b)
 {
-    if (!ready_queue) {
-        return kernel_task;
-    }
+    return (int32_t)(a - b) < 0;
+}
+
+static inline bool task_is_rt(task_t *task)
+{
+    return task->sched_class == SCHED_FIFO || task->sched_class == SCHED_RR;
+}
 
-    /* Scan the ready queue for a READY task */
-    task_t *task = ready_queue;
-    task_t *first = ready_queue;
+/* Deadline first, then FIFO/RR, then normal tasks */
+static inline uint32_t class_rank(task_t *task)
+{
+    if (task->sched_class == SCHED_DEADLINE)
+        return 0;
+    return task_is_rt(task) ? 1 : 2;
+}
 
-    do {
-        if (task->state == TASK_READY) {
-            return task;
+static void enqueue_rt(sched_rq_t *rq, task_t *task)
+{
+    uint32_t level = task->rt_priority < SCHED_RT_PRIO_LEVELS ?
+                     task->rt_priority : SCHED_RT_PRIO_LEVELS - 1;
+    enqueue_level(rq->rt_queues, &rq->rt_bitmap, task, level);
+}
+
+static void dequeue_rt(sched_rq_t *rq, task_t *task)
+{
+    dequeue_level(rq->rt_queues, &rq->rt_bitmap, task);
+}
+
+static void enqueue_dl(sched_rq_t *rq, task_t *task)
+{
+    struct rb_node **link = &rq->dl_tree.node;
+    struct rb_node *parent = NULL;
+    bool leftmost = true;
+
+    while (*link) {
+        parent = *link;
+        task_t *entry = rb_entry(parent, task_t, run_node);
+
+        if (tick_before(task->dl_abs_deadline, entry->dl_abs_deadline)) {
+            link = &parent->left;
+        } else {
+            link = &parent->right;
+            leftmost = false;
         }
-        task = task->next;
-    } while (task && task != first);
+    }
+
+    rb_link_node(&task->run_node, parent, link);
+    rb_insert_color(&task->run_node, &rq->dl_tree);
 
-    return kernel_task;
+    if (leftmost)
+        rq->dl_leftmost = &task->run_node;
 }
 
-task_t* scheduler_pick_next(void)
+static void dequeue_dl(sched_rq_t *rq, task_t *task)
 {
-    update_statistics();
+    if (rq->dl_leftmost == &task->run_node)
+        rq->dl_leftmost = rb_next(&task->run_node);
 
-    /* Get next ready task */
-    task_t *next = get_next_ready_task();
+    rb_erase(&task->run_node, &rq->dl_tree);
+}
 
-    /* Reset time slice */
-    next->time_slice = SCHEDULER_TIME_SLICE_MS;
+/* Start a new period at now: full budget, deadline relative to now */
+static void dl_new_period(task_t *task, uint32_t now)
+{
+    task->dl_budget = task->dl_runtime;
+    task->dl_abs_deadline = now + task->dl_deadline;
+    task->dl_next_period = now + task->dl_period;
+    task->dl_throttled = false;
+}
 
-    return next;
+/* A deadline task becomes ready. Keep its period if the budget left
+ * still fits before the deadline at the reserved rate; otherwise it
+ * would eat into other reservations, so it starts a new one. */
+static void dl_wakeup(task_t *task, uint32_t now)
+{
+    if (!tick_before(now, task->dl_abs_deadline)) {
+        dl_new_period(task, now);
+        return;
+    }
+
+    uint64_t left = (uint64_t)(task->dl_abs_deadline - now) * task->dl_runtime;
+    if ((uint64_t)task->dl_budget * task->dl_period > left)
+        dl_new_period(task, now);
+}
+
+/* Reservation of runtime per period in ppm of a CPU (rounded up) */
+static uint32_t dl_bandwidth(uint32_t runtime, uint32_t period)
+{
+    return (uint32_t)div_u64((uint64_t)runtime * 1000000 + period - 1, period);
 }
 
 /* ================================================================
- * SCHEDULING
+ * SLEEP QUEUE
  * ================================================================ */
 
-void scheduler_tick(void)
+static inline void sleep_heap_set(uint32_t index, task_t *task)
 {
-    if (!scheduler_running) return;
+    sleep_heap[index] = task;
+    task->sleep_slot = index + 1;
+}
 
-    stats.total_ticks++;
-
-    /* Update sleeping tasks */
-    if (ready_queue) {
-        task_t *task = ready_queue;
-        task_t *first = ready_queue;
-        do {
-            if (task->state == TASK_SLEEPING) {
-                if (task->wake_time > 0 && stats.total_ticks >= task->wake_time) {
-                    task->state = TASK_READY;
-                    task->wake_time = 0;
-                }
-            }
-            task = task->next;
-        } while (task && task != first);
+static void sleep_heap_sift_up(uint32_t index)
+{
+    task_t *task = sleep_heap[index];
+
+    while (index > 0) {
+        uint32_t parent = (index - 1) / 2;
+        if (!tick_before(task->wake_time, sleep_heap[parent]->wake_time))
+            break;
+        sleep_heap_set(index, sleep_heap[parent]);
+        index = parent;
     }
 
-    /* Decrement current task's time slice */
-    if (current_task && current_task->state == TASK_RUNNING) {
-        if (current_task->time_slice > 0) {
-            current_task->time_slice--;
-            current_task->total_time++;
-        }
+    sleep_heap_set(index, task);
+}
 
-        /* Time slice expired? */
-        if (current_task->time_slice == 0) {
-            scheduler_schedule();
-        }
+static void sleep_heap_sift_down(uint32_t index)
+{
+    task_t *task = sleep_heap[index];
+
+    for (;;) {
+        uint32_t child = 2 * index + 1;
+        if (child >= sleep_heap_size)
+            break;
+        if (child + 1 < sleep_heap_size &&
+            tick_before(sleep_heap[child + 1]->wake_time, sleep_heap[child]->wake_time))
+            child++;
+        if (!tick_before(sleep_heap[child]->wake_time, task->wake_time))
+            break;
+        sleep_heap_set(index, sleep_heap[child]);
+        index = child;
     }
+
+    sleep_heap_set(index, task);
 }
 
-void scheduler_schedule(void)
+static bool sleep_heap_grow(void)
 {
-    if (!scheduler_running) return;
+    uint32_t capacity = sleep_heap_capacity ? sleep_heap_capacity * 2 : SLEEP_HEAP_INITIAL;
+    task_t **heap = kmalloc(capacity * sizeof(task_t *));
+
+    if (!heap)
+        return false;
 
-    /* Mark current task as READY before picking next */
-    if (current_task && current_task->state == TASK_RUNNING) {
-        current_task->state = TASK_READY;
+    if (sleep_heap) {
+        memcpy(heap, sleep_heap, sleep_heap_size * sizeof(task_t *));
+        kfree(sleep_heap);
     }
 
-    /* Pick next task */
-    task_t *next = scheduler_pick_next();
+    sleep_heap = heap;
+    sleep_heap_capacity = capacity;
+    return true;
+}
 
-    if (!next || next == current_task) {
-        if (current_task) {
-            current_task->state = TASK_RUNNING;
-            current_task->time_slice = SCHEDULER_TIME_SLICE_MS;
-        }
+static void sleep_heap_remove(task_t *task)
+{
+    if (!task->sleep_slot)
+        return;
+
+    uint32_t index = task->sleep_slot - 1;
+    task->sleep_slot = 0;
+
+    task_t *last = sleep_heap[--sleep_heap_size];
+    if (index == sleep_heap_size)
         return;
+
+    /* Move the last entry into the hole and restore heap order */
+    sleep_heap_set(index, last);
+    if (index > 0 && tick_before(last->wake_time, sleep_heap[(index - 1) / 2]->wake_time))
+        sleep_heap_sift_up(index);
+    else
+        sleep_heap_sift_down(index);
+}
+
+/* Queue a task (not on a run queue) to be woken at wake_time */
+static bool sleep_heap_insert(task_t *task, uint32_t wake_time)
+{
+    if (task->sleep_slot)
+        sleep_heap_remove(task);
+
+    if (sleep_heap_size == sleep_heap_capacity && !sleep_heap_grow())
+        return false;
+
+    task->wake_time = wake_time;
+    task->state = TASK_SLEEPING;
+
+    sleep_heap[sleep_heap_size] = task;
+    sleep_heap_sift_up(sleep_heap_size++);
+    return true;
+}
+
+bool scheduler_sleep_task(task_t *task, uint32_t ticks)
+{
+    if (!task)
+        return false;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    if (task->sleep_slot)
+        sleep_heap_remove(task);
+
+    if (sleep_heap_size == sleep_heap_capacity && !sleep_heap_grow()) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return false;
     }
 
-    stats.context_switches++;
-    task_switch(next);
+    dequeue_task(task);
+    trace_sched_sleep(task, ticks);
+    sleep_heap_insert(task, stats.total_ticks + ticks);
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    /* The stopped tick may be armed past this wake time */
+    timer_nohz_kick();
+    return true;
+}
+
+/* Park a deadline task that used up its budget until its next period.
+ * False if the sleep queue could not grow - it then just stays ready. */
+static bool dl_throttle(task_t *task)
+{
+    if (!sleep_heap_insert(task, task->dl_next_period))
+        return false;
+
+    stats.dl_throttles++;
+    return true;
 }
 
 /* ================================================================
- * STATISTICS
+ * QUEUE DISPATCH
  * ================================================================ */
 
-static void update_statistics(void)
+static void enqueue_task(task_t *task, uint32_t cpu)
 {
-    stats.ready_tasks = 0;
-    stats.blocked_tasks = 0;
+    if (task->on_rq || task->is_idle)
+        return;
 
-    if (!ready_queue) return;
+    sched_rq_t *rq = &runqueues[cpu];
 
-    task_t *task = ready_queue;
-    task_t *first = ready_queue;
-    do {
-        switch (task->state) {
-            case TASK_READY:
-                stats.ready_tasks++;
-                break;
-            case TASK_BLOCKED:
-            case TASK_SLEEPING:
-                stats.blocked_tasks++;
-                break;
-            default:
-                break;
+    if (task->sched_class == SCHED_DEADLINE)
+        enqueue_dl(rq, task);
+    else if (task_is_rt(task))
+        enqueue_rt(rq, task);
+    else if (sched_policy == SCHED_POLICY_FAIR)
+        enqueue_fair(rq, task);
+    else
+        enqueue_prio(rq, task);
+
+    task->cpu = cpu;
+    task->on_rq = true;
+    rq->nr_running++;
+}
+
+static void dequeue_task(task_t *task)
+{
+    if (!task->on_rq)
+        return;
+
+    sched_rq_t *rq = &runqueues[task->cpu];
+
+    if (task->sched_class == SCHED_DEADLINE)
+        dequeue_dl(rq, task);
+    else if (task_is_rt(task))
+        dequeue_rt(rq, task);
+    else if (sched_policy == SCHED_POLICY_FAIR)
+        dequeue_fair(rq, task);
+    else
+        dequeue_prio(rq, task);
+
+    task->on_rq = false;
+    rq->nr_running--;
+}
+
+/* Make cpu run its scheduler soon: at its next tick, or right away
+ * through an IPI if it is another CPU */
+static void resched_cpu(uint32_t cpu)
+{
+    cpus[cpu].need_resched = true;
+    smp_send_resched(cpu);
+}
+
+/* Should a task that just became ready preempt the one running on its
+ * CPU? A CPU whose task is not running is in the middle of switching
+ * away and may already have picked - poke it too. */
+static void check_preempt(task_t *task)
+{
+    task_t *curr = cpus[task->cpu].current;
+
+    if (!curr || curr->is_idle || curr->state != TASK_RUNNING) {
+        resched_cpu(task->cpu);
+        return;
+    }
+
+    /* A higher class always wins; within a class deadlines or levels
+     * decide */
+    if (class_rank(task) != class_rank(curr)) {
+        if (class_rank(task) < class_rank(curr))
+            resched_cpu(task->cpu);
+        return;
+    }
+
+    if (task->sched_class == SCHED_DEADLINE) {
+        if (tick_before(task->dl_abs_deadline, curr->dl_abs_deadline))
+            resched_cpu(task->cpu);
+    } else if (task_is_rt(task)) {
+        if (task->rt_priority < curr->rt_priority)
+            resched_cpu(task->cpu);
+    } else if (sched_policy == SCHED_POLICY_FAIR) {
+        if (vruntime_before(task->vruntime + SCHED_WAKEUP_GRANULARITY_US,
+                            curr->vruntime))
+            resched_cpu(task->cpu);
+    } else if (task_prio_level(task) < task_prio_level(curr)) {
+        resched_cpu(task->cpu);
+    }
+}
+
+/* ================================================================
+ * CPU SELECTION
+ * ================================================================ */
+
+/* Queued tasks plus the running one, if it is not the idle task */
+static uint32_t cpu_load(uint32_t cpu)
+{
+    task_t *curr = cpus[cpu].current;
+    return runqueues[cpu].nr_running + (curr && !curr->is_idle ? 1 : 0);
+}
+
+/* Run queue for a task that became ready. A task another CPU is still
+ * switching away from stays there (it cannot run anywhere else until
+ * that CPU is off its stack); otherwise the least loaded CPU wins, with
+ * ties going to the one it last ran on. */
+static uint32_t select_task_rq(task_t *task)
+{
+    if (task->on_cpu)
+        return task->cpu;
+
+    if (!smp_sched_enabled)
+        return 0;
+
+    uint32_t best = (task->cpu < SMP_MAX_CPUS && cpus[task->cpu].online) ? task->cpu : 0;
+    uint32_t best_load = cpu_load(best);
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!cpus[cpu].online || cpu == best)
+            continue;
+
+        uint32_t load = cpu_load(cpu);
+        if (load < best_load) {
+            best = cpu;
+            best_load = load;
         }
-        task = task->next;
-    } while (task && task != first);
+    }
+
+    return best;
 }
 
-scheduler_stats_t scheduler_get_stats(void)
+/* Move a queued task to another CPU's run queue */
+static void migrate_task(task_t *task, uint32_t cpu)
 {
-    update_statistics();
-    return stats;
+    uint32_t from = task->cpu;
+
+    dequeue_task(task);
+    if (task->sched_class == SCHED_NORMAL && sched_policy == SCHED_POLICY_FAIR)
+        migrate_vruntime(task, from, cpu);
+    enqueue_task(task, cpu);
+}
+
+/* A CPU with tasks waiting: get an idle CPU to come and steal one */
+static void kick_idle_cpu(uint32_t busy)
+{
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (cpu == busy || !cpus[cpu].online || cpus[cpu].need_resched)
+            continue;
+
+        task_t *curr = cpus[cpu].current;
+        if (curr && curr->is_idle) {
+            resched_cpu(cpu);
+            return;
+        }
+    }
+}
+
+/* ================================================================
+ * TASK QUEUE MANAGEMENT
+ * ================================================================ */
+
+void scheduler_add_task(task_t *task)
+{
+    if (!task) return;
+
+    /* Never add kernel_task to the run queues */
+    if (task == kernel_task) return;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    /* Don't add if already known */
+    for (task_t *curr = sched_tasks; curr; curr = curr->sched_next) {
+        if (curr == task) {
+            spin_unlock_irqrestore(&sched_lock, flags);
+            return;
+        }
+    }
+
+    task->sched_next = sched_tasks;
+    sched_tasks = task;
+
+    /* Fresh queue state (fork copies the parent's task_t wholesale) */
+    task->on_rq = false;
+    task->on_cpu = 0;
+    task->preempt_count = 0;
+    task->is_idle = false;
+    task->rq_next = NULL;
+    task->rq_prev = NULL;
+    task->sched_boost = 0;
+
+    /* A reservation is not inherited: a forked child starts normal */
+    if (task->sched_class == SCHED_DEADLINE) {
+        task->sched_class = SCHED_NORMAL;
+        task->dl_bw = 0;
+        task->dl_throttled = false;
+    }
+
+    uint32_t cpu = select_task_rq(task);
+    place_task(&runqueues[cpu], task, true);
+
+    task->state = TASK_READY;
+    enqueue_task(task, cpu);
+    check_preempt(task);
+    stats.total_tasks++;
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    if (cpu == 0)
+        timer_nohz_kick();
+}
+
+void scheduler_remove_task(task_t *task)
+{
+    if (!task) return;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    dequeue_task(task);
+    sleep_heap_remove(task);
+
+    /* Give back its deadline reservation */
+    if (task->sched_class == SCHED_DEADLINE) {
+        dl_total_bw -= task->dl_bw;
+        task->dl_bw = 0;
+        task->sched_class = SCHED_NORMAL;
+    }
+
+    /* Unlink from the list of known tasks */
+    task_t **pp = &sched_tasks;
+    while (*pp) {
+        if (*pp == task) {
+            *pp = task->sched_next;
+            task->sched_next = NULL;
+            if (stats.total_tasks > 0) stats.total_tasks--;
+            break;
+        }
+        pp = &(*pp)->sched_next;
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+/* Returns the CPU the task will run on */
+static uint32_t wake_task(task_t *task)
+{
+    /* A throttled deadline task stays parked until its next period,
+     * whatever woke it; the sleep queue brings it back then */
+    if (task->sched_class == SCHED_DEADLINE && task->dl_throttled &&
+        tick_before(stats.total_ticks, task->dl_next_period)) {
+        if (task->sleep_slot || dl_throttle(task))
+            return task->cpu;
+    }
+
+    /* Woken early (or by the tick): leave the sleep queue */
+    sleep_heap_remove(task);
+    trace_sched_wakeup(task, current_task);
+
+    /* Idle tasks are never queued; kernel_task waits in place (see
+     * wait_schedule()) and only needs its state flipped back - and its
+     * CPU woken from hlt if that is not us */
+    if (task->is_idle) {
+        bool running = task == cpus[task->cpu].current;
+        task->state = running ? TASK_RUNNING : TASK_READY;
+        smp_send_resched(task->cpu);
+        return task->cpu;
+    }
+
+    if (task->sched_class == SCHED_DEADLINE)
+        dl_wakeup(task, stats.total_ticks);
+
+    /* Blocking or sleeping voluntarily earns an interactivity boost
+     * (PRIO) or sleeper credit (FAIR) */
+    if (task->sched_class == SCHED_NORMAL && task->sched_boost < SCHEDULER_MAX_BOOST)
+        task->sched_boost++;
+
+    uint32_t cpu = select_task_rq(task);
+
+    if (task->sched_class == SCHED_NORMAL && sched_policy == SCHED_POLICY_FAIR) {
+        migrate_vruntime(task, task->cpu, cpu);
+        place_task(&runqueues[cpu], task, false);
+    }
+
+    task->state = TASK_READY;
+    enqueue_task(task, cpu);
+    check_preempt(task);
+    return cpu;
+}
+
+void scheduler_wake_task(task_t *task)
+{
+    if (!task) return;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    uint32_t cpu = wake_task(task);
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    if (cpu == 0)
+        timer_nohz_kick();
+}
+
+/* ================================================================
+ * POLICY SELECTION
+ * ================================================================ */
+
+void scheduler_set_policy(sched_policy_t policy)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    if (policy == sched_policy) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return;
+    }
+
+    /* Move every queued task over to the other structure */
+    for (task_t *task = sched_tasks; task; task = task->sched_next) {
+        if (task->on_rq) {
+            dequeue_task(task);
+            task->on_rq = true;
+        }
+    }
+
+    sched_policy = policy;
+
+    if (policy == SCHED_POLICY_FAIR) {
+        /* Start everybody level: history from the other policy would
+         * only skew the first few periods */
+        for (task_t *task = sched_tasks; task; task = task->sched_next)
+            task->vruntime = runqueues[task->cpu].min_vruntime;
+    }
+
+    for (task_t *task = sched_tasks; task; task = task->sched_next) {
+        if (task->on_rq) {
+            task->on_rq = false;
+            enqueue_task(task, task->cpu);
+        }
+    }
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (cpus[cpu].online)
+            resched_cpu(cpu);
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+/* ================================================================
+ * SCHEDULING CLASSES
+ * ================================================================ */
+
+static bool sched_attr_valid(const sched_attr_t *attr)
+{
+    switch (attr->policy) {
+        case SCHED_NORMAL:
+            return attr->priority < SCHEDULER_PRIO_LEVELS;
+        case SCHED_FIFO:
+        case SCHED_RR:
+            return attr->priority < SCHED_RT_PRIO_LEVELS;
+        case SCHED_DEADLINE:
+            return attr->runtime && attr->runtime <= attr->deadline &&
+                   attr->deadline <= attr->period;
+        default:
+            return false;
+    }
+}
+
+int scheduler_setscheduler(uint32_t pid, const sched_attr_t *attr)
+{
+    if (!attr || !sched_attr_valid(attr))
+        return -1;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    task_t *task = pid ? find_task_by_pid(pid) : current_task;
+
+    /* Idle tasks (kernel_task included) always stay normal */
+    if (!task || task->is_idle || task->state == TASK_ZOMBIE) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return -1;
+    }
+
+    /* A PI mutex owner cannot become a deadline task: the reservation
+     * would not survive losing the boost */
+    if (attr->policy == SCHED_DEADLINE && (task->pi_boosted || task->pi_mutexes)) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return -1;
+    }
+
+    /* Admission control: the new reservation replaces the old one */
+    uint32_t old_bw = task->sched_class == SCHED_DEADLINE ? task->dl_bw : 0;
+    uint32_t new_bw = 0;
+    if (attr->policy == SCHED_DEADLINE) {
+        new_bw = dl_bandwidth(attr->runtime, attr->period);
+        if (dl_total_bw - old_bw + new_bw > SCHED_DL_BW_LIMIT) {
+            spin_unlock_irqrestore(&sched_lock, flags);
+            return -1;
+        }
+    }
+
+    /* Off the queue of the old class while the fields change; the
+     * new parameters are the task's own, any boost goes on top */
+    bool queued = task->on_rq;
+    dequeue_task(task);
+    pi_unboost(task);
+
+    dl_total_bw = dl_total_bw - old_bw + new_bw;
+    task->sched_class = (uint8_t)attr->policy;
+    task->dl_bw = new_bw;
+    task->dl_throttled = false;
+
+    switch (attr->policy) {
+        case SCHED_NORMAL:
+            task->priority = attr->priority;
+            if (sched_policy == SCHED_POLICY_FAIR)
+                place_task(&runqueues[task->cpu], task, true);
+            break;
+        case SCHED_FIFO:
+        case SCHED_RR:
+            task->rt_priority = attr->priority;
+            task->time_slice = SCHED_RR_SLICE_MS;
+            break;
+        case SCHED_DEADLINE:
+            task->dl_runtime = attr->runtime;
+            task->dl_deadline = attr->deadline;
+            task->dl_period = attr->period;
+            dl_new_period(task, stats.total_ticks);
+            break;
+    }
+
+    pi_boost(task);
+
+    if (queued) {
+        enqueue_task(task, task->cpu);
+        check_preempt(task);
+    } else if (task->state == TASK_RUNNING) {
+        /* Possibly lowered below something queued on its CPU */
+        resched_cpu(task->cpu);
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return 0;
+}
+
+/* ================================================================
+ * PRIORITY INHERITANCE
+ * ================================================================ */
+
+uint32_t scheduler_prio_key(task_t *task)
+{
+    if (task->sched_class == SCHED_DEADLINE)
+        return PI_PRIO_DEADLINE;
+    if (task_is_rt(task))
+        return PI_PRIO_RT_BASE + (task->rt_priority < SCHED_RT_PRIO_LEVELS ?
+                                  task->rt_priority : SCHED_RT_PRIO_LEVELS - 1);
+    return PI_PRIO_NORMAL_BASE + (task->priority < SCHEDULER_PRIO_LEVELS ?
+                                  task->priority : SCHEDULER_PRIO_LEVELS - 1);
+}
+
+/* Back to the task's own parameters (dequeued, sched_lock held) */
+static void pi_unboost(task_t *task)
+{
+    if (!task->pi_boosted)
+        return;
+
+    bool was_normal = task->sched_class == SCHED_NORMAL;
+
+    task->sched_class = task->pi_base_class;
+    task->priority = task->pi_base_priority;
+    task->rt_priority = task->pi_base_rt_priority;
+    task->pi_boosted = false;
+
+    /* Back from FIFO into the fair tree: no credit for the time away */
+    if (!was_normal && task->sched_class == SCHED_NORMAL &&
+        sched_policy == SCHED_POLICY_FAIR)
+        place_task(&runqueues[task->cpu], task, false);
+}
+
+/* Raise the task to pi_prio if that beats its own parameters
+ * (dequeued, unboosted, sched_lock held) */
+static void pi_boost(task_t *task)
+{
+    uint32_t key = task->pi_prio;
+
+    if (key == PI_PRIO_NONE || key >= scheduler_prio_key(task))
+        return;
+
+    task->pi_base_class = task->sched_class;
+    task->pi_base_priority = task->priority;
+    task->pi_base_rt_priority = task->rt_priority;
+    task->pi_boosted = true;
+
+    if (key < PI_PRIO_NORMAL_BASE) {
+        /* A deadline cannot be lent, its urgency can: top RT level */
+        if (!task_is_rt(task))
+            task->sched_class = SCHED_FIFO;
+        task->rt_priority = key > PI_PRIO_RT_BASE ? key - PI_PRIO_RT_BASE : 0;
+    } else {
+        task->priority = key - PI_PRIO_NORMAL_BASE;
+    }
+}
+
+void scheduler_pi_setprio(task_t *task, uint32_t pi_prio)
+{
+    if (!task || task->is_idle)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    if (pi_prio == task->pi_prio) {
+        spin_unlock_irqrestore(&sched_lock, flags);
+        return;
+    }
+
+    bool queued = task->on_rq;
+    dequeue_task(task);
+
+    pi_unboost(task);
+    task->pi_prio = pi_prio;
+    pi_boost(task);
+
+    if (queued) {
+        enqueue_task(task, task->cpu);
+        check_preempt(task);
+    } else if (task->state == TASK_RUNNING) {
+        /* Possibly lowered below something queued on its CPU */
+        resched_cpu(task->cpu);
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+/* Busiest other CPU with a task we could take, or -1 */
+static int find_busiest_cpu(uint32_t cpu)
+{
+    int busiest = -1;
+    uint32_t most = 0;
+
+    for (uint32_t other = 0; other < SMP_MAX_CPUS; other++) {
+        if (other == cpu || !cpus[other].online)
+            continue;
+        if (runqueues[other].nr_running > most) {
+            most = runqueues[other].nr_running;
+            busiest = (int)other;
+        }
+    }
+
+    return busiest;
+}
+
+bool scheduler_has_ready(void)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    uint32_t cpu = smp_processor_id();
+
+    bool ready = runqueues[cpu].nr_running != 0 ||
+                 (smp_sched_enabled && find_busiest_cpu(cpu) >= 0);
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return ready;
+}
+
+void scheduler_set_smp(bool enabled)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+
+    smp_sched_enabled = enabled;
+
+    /* Switching off: the APs hand their tasks back to CPU 0 the next
+     * time they schedule (see scheduler_schedule()) */
+    if (!enabled) {
+        for (uint32_t cpu = 1; cpu < SMP_MAX_CPUS; cpu++) {
+            if (cpus[cpu].online)
+                resched_cpu(cpu);
+        }
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+sched_policy_t scheduler_get_policy(void)
+{
+    return sched_policy;
+}
+
+/* ================================================================
+ * TASK SELECTION
+ * ================================================================ */
+
+/* Can cpu run this queued task? Not while another CPU is still on its
+ * stack - it was requeued there and has not been switched out yet. */
+static inline bool task_can_run(task_t *task, uint32_t cpu)
+{
+    return !task->on_cpu || task == cpus[cpu].current;
+}
+
+/* First runnable task of a set of level queues */
+static task_t *peek_level(run_queue_t *queues, uint32_t bitmap, uint32_t cpu)
+{
+    while (bitmap) {
+        uint32_t level = __builtin_ctz(bitmap);
+        for (task_t *task = queues[level].head; task; task = task->rq_next) {
+            if (task_can_run(task, cpu))
+                return task;
+        }
+        bitmap &= bitmap - 1;
+    }
+
+    return NULL;
+}
+
+/* First runnable task of a run queue, left queued */
+static task_t *peek_task(sched_rq_t *rq, uint32_t cpu)
+{
+    for (struct rb_node *node = rq->dl_leftmost; node; node = rb_next(node)) {
+        task_t *task = rb_entry(node, task_t, run_node);
+        if (task_can_run(task, cpu))
+            return task;
+    }
+
+    task_t *rt = peek_level(rq->rt_queues, rq->rt_bitmap, cpu);
+    if (rt)
+        return rt;
+
+    if (sched_policy == SCHED_POLICY_FAIR) {
+        for (struct rb_node *node = rq->fair_leftmost; node; node = rb_next(node)) {
+            task_t *task = rb_entry(node, task_t, run_node);
+            if (task_can_run(task, cpu))
+                return task;
+        }
+        return NULL;
+    }
+
+    return peek_level(rq->queues, rq->bitmap, cpu);
+}
+
+/* Idle balancing: pull the next task off the busiest run queue */
+static task_t *steal_task(uint32_t cpu)
+{
+    int busiest = find_busiest_cpu(cpu);
+    if (busiest < 0)
+        return NULL;
+
+    task_t *task = peek_task(&runqueues[busiest], cpu);
+    if (!task)
+        return NULL;
+
+    dequeue_task(task);
+    if (task->sched_class == SCHED_NORMAL && sched_policy == SCHED_POLICY_FAIR)
+        migrate_vruntime(task, (uint32_t)busiest, cpu);
+    task->cpu = cpu;
+    runqueues[cpu].steals++;
+
+    return task;
+}
+
+static task_t *pick_next_task(uint32_t cpu)
+{
+    sched_rq_t *rq = &runqueues[cpu];
+    task_t *next = peek_task(rq, cpu);
+
+    if (next)
+        dequeue_task(next);
+    else if (smp_sched_enabled)
+        next = steal_task(cpu);
+
+    if (!next) {
+        next = cpus[cpu].idle;
+        if (next)
+            next->time_slice = SCHEDULER_TIME_SLICE_MS;
+        return next;
+    }
+
+    /* Reset time slice (FIFO and DEADLINE tasks are not sliced) */
+    if (next->sched_class == SCHED_RR)
+        next->time_slice = SCHED_RR_SLICE_MS;
+    else if (next->sched_class == SCHED_NORMAL && sched_policy == SCHED_POLICY_FAIR)
+        next->time_slice = fair_slice(rq, next);
+    else
+        next->time_slice = SCHEDULER_TIME_SLICE_MS;
+
+    return next;
+}
+
+task_t* scheduler_pick_next(void)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    task_t *next = pick_next_task(smp_processor_id());
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    return next;
+}
+
+/* ================================================================
+ * LOAD AVERAGE
+ * ================================================================ */
+
+static uint32_t rq_hist_bucket(uint32_t len)
+{
+    if (len < 4)
+        return len;
+
+    /* 4-7, 8-15, ... by the highest set bit */
+    uint32_t bucket = 31 - (uint32_t)__builtin_clz(len) + 2;
+    return bucket < SCHED_RQ_HIST_BUCKETS ? bucket : SCHED_RQ_HIST_BUCKETS - 1;
+}
+
+/* One decay step towards active tasks */
+static uint32_t calc_load(uint32_t load, uint32_t exp, uint32_t active)
+{
+    uint32_t target = active << LOAD_FSHIFT;
+    uint32_t next = load * exp + target * (LOAD_FIXED_1 - exp);
+
+    /* Round up while rising, so a steady load is reached, not only
+     * approached */
+    if (target >= load)
+        next += LOAD_FIXED_1 - 1;
+    return next >> LOAD_FSHIFT;
+}
+
+/* Sample every CPU's run queue length for ticks ticks. A stopped tick
+ * means nothing changed in between (the CPU was idle, or one task ran
+ * alone), so the missed load periods all see the current count. */
+static void update_load(uint32_t ticks)
+{
+    uint32_t active = 0;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!cpus[cpu].online)
+            continue;
+
+        uint32_t len = cpu_load(cpu);
+        stats.rq_hist[rq_hist_bucket(len)] += ticks;
+        active += len;
+    }
+
+    load_ticks += ticks;
+    while (load_ticks >= LOAD_FREQ) {
+        load_ticks -= LOAD_FREQ;
+        stats.loadavg[0] = calc_load(stats.loadavg[0], LOAD_EXP_1, active);
+        stats.loadavg[1] = calc_load(stats.loadavg[1], LOAD_EXP_5, active);
+        stats.loadavg[2] = calc_load(stats.loadavg[2], LOAD_EXP_15, active);
+    }
+}
+
+/* ================================================================
+ * SCHEDULING
+ * ================================================================ */
+
+/* CPU 0: advance the scheduler clock by ticks and wake expired
+ * sleepers. Never switches tasks itself. */
+static void advance_clock(uint32_t ticks)
+{
+    stats.total_ticks += ticks;
+    update_load(ticks);
+
+    /* Wake expired sleepers - only the heap root needs checking */
+    while (sleep_heap_size &&
+           !tick_before(stats.total_ticks, sleep_heap[0]->wake_time)) {
+        task_t *task = sleep_heap[0];
+        sleep_heap_remove(task);
+        task->wake_time = 0;
+        if (task->state == TASK_SLEEPING)
+            wake_task(task);
+    }
+}
+
+/* Charge a deadline task's budget; running out throttles it at the
+ * next switch */
+static void charge_dl(uint32_t cpu, task_t *curr, uint32_t ticks)
+{
+    if (!tick_before(stats.total_ticks, curr->dl_abs_deadline) && curr->dl_budget)
+        stats.dl_misses++;
+
+    if (curr->dl_budget > ticks) {
+        curr->dl_budget -= ticks;
+        return;
+    }
+
+    curr->dl_budget = 0;
+    curr->dl_throttled = true;
+    cpus[cpu].need_resched = true;
+}
+
+/* Charge ticks to the task running on cpu. An expired slice only sets
+ * need_resched. */
+static void charge_current(uint32_t cpu, uint32_t ticks)
+{
+    task_t *curr = cpus[cpu].current;
+
+    /* Decrement current task's time slice */
+    if (curr && curr->state == TASK_RUNNING) {
+        curr->total_time += ticks;
+
+        switch (curr->sched_class) {
+            case SCHED_FIFO:
+                /* Runs until it blocks, yields or is preempted */
+                break;
+
+            case SCHED_DEADLINE:
+                charge_dl(cpu, curr, ticks);
+                break;
+
+            case SCHED_RR:
+                /* Next in line at its level, if there is one */
+                if (curr->time_slice > ticks) {
+                    curr->time_slice -= ticks;
+                } else {
+                    curr->time_slice = 0;
+                    cpus[cpu].need_resched = true;
+                }
+                break;
+
+            default:
+                if (!curr->is_idle) {
+                    curr->vruntime += calc_delta_vruntime(ticks, curr);
+                    update_min_vruntime(cpu);
+                }
+
+                /* Time slice expired? A CPU hog loses its boost. */
+                if (curr->time_slice > ticks) {
+                    curr->time_slice -= ticks;
+                } else {
+                    curr->time_slice = 0;
+                    if (curr->sched_boost > 0)
+                        curr->sched_boost--;
+                    cpus[cpu].need_resched = true;
+                }
+                break;
+        }
+    }
+
+    /* Tasks waiting here while another CPU idles */
+    if (smp_sched_enabled && runqueues[cpu].nr_running)
+        kick_idle_cpu(cpu);
+}
+
+/* Should this CPU switch tasks now? (lock held) */
+static bool resched_due(uint32_t cpu)
+{
+    task_t *curr = cpus[cpu].current;
+    return cpus[cpu].need_resched && curr && curr->state == TASK_RUNNING;
+}
+
+void scheduler_tick(void)
+{
+    scheduler_tick_n(1);
+}
+
+void scheduler_tick_n(uint32_t ticks)
+{
+    if (!scheduler_running) return;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    advance_clock(ticks);
+    charge_current(0, ticks);
+    bool resched = resched_due(0);
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    /* Slice expired or a wakeup asked for the CPU: irq_handler_c()
+     * preempts on the way out. Otherwise this may be the last tick for
+     * a while - idle, or one task alone on the CPU. */
+    if (!resched)
+        timer_nohz_enter();
+}
+
+void scheduler_tick_local(void)
+{
+    if (!scheduler_running) return;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    charge_current(smp_processor_id(), 1);
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+void scheduler_resched_ipi(void)
+{
+    if (!scheduler_running) return;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    cpus[smp_processor_id()].resched_ipis++;
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+void scheduler_catch_up(uint32_t ticks)
+{
+    if (!scheduler_running) return;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    advance_clock(ticks);
+    charge_current(0, ticks);
+    spin_unlock_irqrestore(&sched_lock, flags);
+}
+
+uint32_t scheduler_next_event(void)
+{
+    if (!scheduler_running)
+        return 1;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    sched_rq_t *rq = &runqueues[0];
+    task_t *curr = cpus[0].current;
+    uint32_t ticks = 1;
+
+    /* Somebody is waiting for the CPU - keep slicing */
+    if (cpus[0].need_resched || rq->nr_running)
+        goto out;
+
+    if (!curr || (!curr->is_idle && curr->state != TASK_RUNNING))
+        goto out;
+
+    /* A deadline task's budget is charged by the tick */
+    if (curr->sched_class == SCHED_DEADLINE)
+        goto out;
+
+    if (!sleep_heap_size) {
+        ticks = UINT32_MAX;
+    } else {
+        int32_t delta = (int32_t)(sleep_heap[0]->wake_time - stats.total_ticks);
+        ticks = delta > 1 ? (uint32_t)delta : 1;
+    }
+
+out:
+    spin_unlock_irqrestore(&sched_lock, flags);
+    return ticks;
+}
+
+/* Why do_schedule() was called */
+#define SWITCH_VOLUNTARY   0   /* Blocking, sleeping or yielding */
+#define SWITCH_PREEMPT_IRQ 1   /* Preempted on interrupt exit */
+#define SWITCH_PREEMPT     2   /* Preempted in preempt_enable() */
+
+/* Drop sched_lock on a path that does not switch. A preemption check
+ * here would only come straight back. */
+static void sched_unlock(uint32_t flags)
+{
+    spin_unlock_no_resched(&sched_lock);
+    preempt_enable_no_resched();
+    irq_restore(flags);
+}
+
+static void do_schedule(uint32_t why)
+{
+    if (!scheduler_running) return;
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    uint32_t cpu = smp_processor_id();
+    task_t *prev = cpus[cpu].current;
+
+    /* A softirq is running below us: softirq_run() switches when done */
+    if (cpus[cpu].in_softirq) {
+        cpus[cpu].need_resched = true;
+        sched_unlock(flags);
+        return;
+    }
+
+    if (why != SWITCH_VOLUNTARY) {
+        /* Only a running task is preempted. One that already set its
+         * state to go to sleep is about to switch by itself, and taking
+         * it off the CPU before it checks its wait condition could lose
+         * the wakeup. */
+        if (!resched_due(cpu)) {
+            sched_unlock(flags);
+            return;
+        }
+        if (why == SWITCH_PREEMPT_IRQ)
+            stats.preempt_irq++;
+        else
+            stats.preempt_sync++;
+    }
+
+    cpus[cpu].need_resched = false;
+
+    /* Requeue the current task behind its peers - or park it until its
+     * next period if it used up its deadline budget */
+    if (prev && prev->state == TASK_RUNNING) {
+        if (!(prev->dl_throttled && prev->sched_class == SCHED_DEADLINE &&
+              dl_throttle(prev))) {
+            prev->state = TASK_READY;
+            enqueue_task(prev, cpu);
+        }
+    }
+
+    /* Tasks only run on CPU 0 while AP scheduling is off: hand back
+     * whatever is queued here */
+    if (cpu != 0 && !smp_sched_enabled && runqueues[cpu].nr_running) {
+        task_t *task;
+        while ((task = peek_task(&runqueues[cpu], cpu)))
+            migrate_task(task, 0);
+        resched_cpu(0);
+    }
+
+    /* Pick next task */
+    task_t *next = pick_next_task(cpu);
+
+    if (!next || next == prev) {
+        if (prev)
+            prev->state = TASK_RUNNING;
+        sched_unlock(flags);
+        return;
+    }
+
+    /* Ours now: no other CPU may pick it until we switch away again */
+    next->on_cpu = 1;
+    next->cpu = cpu;
+
+    stats.context_switches++;
+    if (prev && prev->state == TASK_READY)
+        stats.involuntary_switches++;
+    if (prev && prev->state == TASK_BLOCKED)
+        trace_sched_block(prev);
+    trace_sched_switch(prev, next);
+
+    /* Interrupts stay off until task_switch_asm() is done. prev's
+     * count goes back to zero here, and next's already is. */
+    spin_unlock_no_resched(&sched_lock);
+    preempt_enable_no_resched();
+
+    /* The APs only need their tick while they have a task to slice */
+    if (cpu != 0)
+        smp_set_tick(!next->is_idle);
+
+    task_switch(next);
+    irq_restore(flags);
+}
+
+void scheduler_schedule(void)
+{
+    do_schedule(SWITCH_VOLUNTARY);
+}
+
+void preempt_schedule(void)
+{
+    /* Inside a softirq the switch waits for softirq_run() */
+    uint32_t flags = irq_save();
+    bool softirq = this_cpu()->in_softirq;
+    irq_restore(flags);
+
+    if (!softirq)
+        do_schedule(SWITCH_PREEMPT);
+}
+
+void preempt_schedule_irq(void)
+{
+    cpu_t *cpu = this_cpu();
+
+    if (cpu->need_resched && !cpu->in_softirq &&
+        cpu->current && !cpu->current->preempt_count)
+        do_schedule(SWITCH_PREEMPT_IRQ);
+}
+
+/* ================================================================
+ * STATISTICS
+ * ================================================================ */
+
+static void update_statistics(void)
+{
+    stats.ready_tasks = 0;
+    stats.blocked_tasks = 0;
+    stats.runqueue_bitmap = 0;
+    stats.policy = sched_policy;
+    stats.fair_load = 0;
+    stats.min_vruntime = runqueues[0].min_vruntime;
+    stats.sleeping_tasks = sleep_heap_size;
+
+    stats.rt_tasks = 0;
+    stats.dl_tasks = 0;
+    stats.dl_bw = dl_total_bw;
+
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        stats.runqueue_bitmap |= runqueues[cpu].bitmap;
+        stats.fair_load += runqueues[cpu].fair_load;
+    }
+    stats.nohz = timer_get_nohz_stats();
+
+    for (task_t *task = sched_tasks; task; task = task->sched_next) {
+        if (task->sched_class == SCHED_DEADLINE)
+            stats.dl_tasks++;
+        else if (task_is_rt(task))
+            stats.rt_tasks++;
+
+        switch (task->state) {
+            case TASK_READY:
+                stats.ready_tasks++;
+                break;
+            case TASK_BLOCKED:
+            case TASK_SLEEPING:
+                stats.blocked_tasks++;
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+scheduler_stats_t scheduler_get_stats(void)
+{
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    update_statistics();
+    scheduler_stats_t copy = stats;
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    return copy;
+}
+
+static uint32_t cycles_to_ms(uint64_t cycles)
+{
+    return (uint32_t)div_u64(timer_cycles_to_us(cycles), 1000);
+}
+
+int scheduler_get_info(uint32_t pid, sched_info_t *info)
+{
+    memset(info, 0, sizeof(*info));
+
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    update_statistics();
+
+    uint64_t idle_cycles = 0;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!cpus[cpu].online)
+            continue;
+        info->nr_running += cpu_load(cpu);
+        idle_cycles += cpus[cpu].idle_cycles;
+    }
+
+    for (int i = 0; i < 3; i++)
+        info->loadavg[i] = stats.loadavg[i];
+    info->nr_tasks = stats.total_tasks;
+    info->nr_cpus = smp_num_cpus;
+    info->uptime_ms = stats.total_ticks;
+    info->context_switches = stats.context_switches;
+    info->involuntary_switches = stats.involuntary_switches;
+    for (int i = 0; i < SCHED_RQ_HIST_BUCKETS; i++)
+        info->rq_hist[i] = stats.rq_hist[i];
+
+    task_t *task = pid ? find_task_by_pid(pid) : current_task;
+    if (task) {
+        info->pid = task->pid;
+        info->nvcsw = task->nvcsw;
+        info->nivcsw = task->nivcsw;
+        info->run_ms = task->total_time;
+    }
+
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    info->idle_ms = cycles_to_ms(idle_cycles);
+    return task ? 0 : -1;
+}
+
+/* One line of the per-task table in scheduler_show_load() */
+typedef struct
+{
+    uint32_t pid;
+    char name[32];
+    uint32_t nvcsw;
+    uint32_t nivcsw;
+    uint32_t run_ms;
+} load_row_t;
+
+void scheduler_show_load(void)
+{
+    static const char *const hist_labels[SCHED_RQ_HIST_BUCKETS] = {
+        "0", "1", "2", "3", "4-7", "8-15", "16-31", "32+"
+    };
+    sched_info_t info;
+    char line[96];
+
+    scheduler_get_info(0, &info);
+
+    /* Two decimals, rounded (LOAD_FIXED_1 / 200 is half of 0.01) */
+    terminal_writestring("Load average      :");
+    for (int i = 0; i < 3; i++) {
+        uint32_t load = info.loadavg[i] + LOAD_FIXED_1 / 200;
+        ksnprintf(line, sizeof(line), " %u.%02u", load >> LOAD_FSHIFT,
+                  ((load & (LOAD_FIXED_1 - 1)) * 100) >> LOAD_FSHIFT);
+        terminal_writestring(line);
+    }
+    ksnprintf(line, sizeof(line), "  (%u runnable of %u tasks)\n",
+              info.nr_running, info.nr_tasks);
+    terminal_writestring(line);
+
+    uint32_t cpu_ms = info.uptime_ms * (info.nr_cpus ? info.nr_cpus : 1);
+    ksnprintf(line, sizeof(line), "Idle              : %u of %u CPU-ms (%u%%)\n",
+              info.idle_ms, cpu_ms,
+              cpu_ms ? (uint32_t)div_u64((uint64_t)info.idle_ms * 100, cpu_ms) : 0);
+    terminal_writestring(line);
+
+    ksnprintf(line, sizeof(line), "Context switches  : %u (%u involuntary)\n\n",
+              info.context_switches, info.involuntary_switches);
+    terminal_writestring(line);
+
+    uint32_t samples = 0;
+    for (int i = 0; i < SCHED_RQ_HIST_BUCKETS; i++)
+        samples += info.rq_hist[i];
+
+    terminal_writestring("RUNNABLE  CPU-TICKS   SHARE\n");
+    for (int i = 0; i < SCHED_RQ_HIST_BUCKETS; i++) {
+        ksnprintf(line, sizeof(line), "%-8s  %10u  %4u%%\n", hist_labels[i],
+                  info.rq_hist[i],
+                  samples ? (uint32_t)div_u64((uint64_t)info.rq_hist[i] * 100, samples) : 0);
+        terminal_writestring(line);
+    }
+
+    /* Copy the rows under the lock: a task that exits meanwhile is
+     * freed and its task_t reused */
+    load_row_t *rows = kmalloc(SCHEDULER_MAX_TASKS * sizeof(load_row_t));
+    if (!rows)
+        return;
+
+    uint32_t nr_rows = 0, more = 0;
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    for (task_t *task = sched_tasks; task; task = task->sched_next) {
+        if (nr_rows == SCHEDULER_MAX_TASKS) {
+            more++;
+            continue;
+        }
+
+        load_row_t *row = &rows[nr_rows++];
+        row->pid = task->pid;
+        strcpy(row->name, task->name);
+        row->nvcsw = task->nvcsw;
+        row->nivcsw = task->nivcsw;
+        row->run_ms = task->total_time;
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    terminal_writestring("\nPID  NAME             VOLUNTARY  INVOLUNTARY  RUN(ms)\n");
+    terminal_writestring("---  ---------------  ---------  -----------  -------\n");
+    for (uint32_t i = 0; i < nr_rows; i++) {
+        ksnprintf(line, sizeof(line), "%-4u %-16s %9u  %11u  %7u\n", rows[i].pid,
+                  rows[i].name, rows[i].nvcsw, rows[i].nivcsw, rows[i].run_ms);
+        terminal_writestring(line);
+    }
+    if (more) {
+        ksnprintf(line, sizeof(line), "(%u more)\n", more);
+        terminal_writestring(line);
+    }
+
+    kfree(rows);
+}
+
+/* One line of scheduler_show_fairness() */
+typedef struct
+{
+    uint32_t pid;
+    char name[32];
+    uint32_t priority;
+    uint32_t weight;
+    uint32_t run_ms;
+    bool runnable;
+    int32_t lag_ms;
+} fair_row_t;
+
+void scheduler_show_fairness(void)
+{
+    uint32_t total_time = 0;
+    uint32_t runnable_load = 0;
+    char buf[16];
+
+    /* Copied under the lock, like scheduler_show_load() */
+    fair_row_t *rows = kmalloc(SCHEDULER_MAX_TASKS * sizeof(fair_row_t));
+    if (!rows)
+        return;
+
+    uint32_t nr_rows = 0;
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    for (task_t *task = sched_tasks; task; task = task->sched_next) {
+        bool runnable = task->state == TASK_READY || task->state == TASK_RUNNING;
+        uint32_t weight = scheduler_task_weight(task);
+
+        total_time += task->total_time;
+        if (runnable)
+            runnable_load += weight;
+
+        if (nr_rows == SCHEDULER_MAX_TASKS)
+            continue;
+
+        fair_row_t *row = &rows[nr_rows++];
+        row->pid = task->pid;
+        strcpy(row->name, task->name);
+        row->priority = task->priority;
+        row->weight = weight;
+        row->run_ms = task->total_time;
+        row->runnable = runnable;
+        /* Lag: how far ahead of its CPU's fair clock this task has run */
+        row->lag_ms = (int32_t)(task->vruntime - runqueues[task->cpu].min_vruntime) / 1000;
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    terminal_writestring("PID  NAME             PRIO  WEIGHT  CPU(ms)  SHARE  FAIR  LAG(ms)\n");
+    terminal_writestring("---  ---------------  ----  ------  -------  -----  ----  -------\n");
+
+    for (uint32_t r = 0; r < nr_rows; r++) {
+        fair_row_t *row = &rows[r];
+
+        itoa(row->pid, buf);
+        terminal_writestring(buf);
+        for (size_t i = strlen(buf); i < 5; i++) terminal_putchar(' ');
+
+        terminal_writestring(row->name);
+        for (size_t i = strlen(row->name); i < 17; i++) terminal_putchar(' ');
+
+        itoa(row->priority, buf);
+        terminal_writestring(buf);
+        for (size_t i = strlen(buf); i < 6; i++) terminal_putchar(' ');
+
+        itoa(row->weight, buf);
+        terminal_writestring(buf);
+        for (size_t i = strlen(buf); i < 8; i++) terminal_putchar(' ');
+
+        itoa(row->run_ms, buf);
+        terminal_writestring(buf);
+        for (size_t i = strlen(buf); i < 9; i++) terminal_putchar(' ');
+
+        /* Actual share of all CPU time handed to scheduled tasks */
+        itoa(total_time ? (uint32_t)div_u64((uint64_t)row->run_ms * 100, total_time) : 0, buf);
+        terminal_writestring(buf);
+        terminal_putchar('%');
+        for (size_t i = strlen(buf) + 1; i < 7; i++) terminal_putchar(' ');
+
+        /* Share its weight entitles it to among runnable tasks */
+        if (row->runnable && runnable_load) {
+            itoa(row->weight * 100 / runnable_load, buf);
+            terminal_writestring(buf);
+            terminal_putchar('%');
+            for (size_t i = strlen(buf) + 1; i < 6; i++) terminal_putchar(' ');
+        } else {
+            terminal_writestring("-     ");
+        }
+
+        itoa(row->lag_ms, buf);
+        terminal_writestring(buf);
+        terminal_writestring("\n");
+    }
+
+    kfree(rows);
+}
+
+/* One line of scheduler_show_classes() */
+typedef struct
+{
+    uint32_t pid;
+    char name[32];
+    uint8_t sched_class;
+    uint32_t rt_priority;
+    uint32_t dl_runtime;
+    uint32_t dl_deadline;
+    uint32_t dl_period;
+    uint32_t dl_budget;
+    bool dl_throttled;
+} class_row_t;
+
+void scheduler_show_classes(void)
+{
+    static const char *const class_names[] = { "normal", "fifo", "rr", "deadline" };
+    char line[96];
+
+    /* Copied under the lock, like scheduler_show_load() */
+    class_row_t *rows = kmalloc(SCHEDULER_MAX_TASKS * sizeof(class_row_t));
+    if (!rows)
+        return;
+
+    uint32_t nr_rows = 0;
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    for (task_t *task = sched_tasks; task && nr_rows < SCHEDULER_MAX_TASKS;
+         task = task->sched_next) {
+        if (task->sched_class == SCHED_NORMAL)
+            continue;
+
+        class_row_t *row = &rows[nr_rows++];
+        row->pid = task->pid;
+        strcpy(row->name, task->name);
+        row->sched_class = task->sched_class;
+        row->rt_priority = task->rt_priority;
+        row->dl_runtime = task->dl_runtime;
+        row->dl_deadline = task->dl_deadline;
+        row->dl_period = task->dl_period;
+        row->dl_budget = task->dl_budget;
+        row->dl_throttled = task->dl_throttled;
+    }
+    uint32_t bw = dl_total_bw;
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    terminal_writestring("PID  NAME             CLASS     PRIO  RUNTIME  DEADLINE  PERIOD  BUDGET\n");
+    for (uint32_t r = 0; r < nr_rows; r++) {
+        class_row_t *row = &rows[r];
+
+        if (row->sched_class == SCHED_DEADLINE) {
+            ksnprintf(line, sizeof(line), "%-4u %-16s %-9s %4s  %7u  %8u  %6u  %6u%s\n",
+                      row->pid, row->name, class_names[row->sched_class], "-",
+                      row->dl_runtime, row->dl_deadline, row->dl_period,
+                      row->dl_budget, row->dl_throttled ? " (throttled)" : "");
+        } else {
+            ksnprintf(line, sizeof(line), "%-4u %-16s %-9s %4u  %7s  %8s  %6s  %6s\n",
+                      row->pid, row->name, class_names[row->sched_class],
+                      row->rt_priority, "-", "-", "-", "-");
+        }
+        terminal_writestring(line);
+    }
+    kfree(rows);
+
+    if (!nr_rows)
+        terminal_writestring("(all tasks are in the normal class)\n");
+
+    ksnprintf(line, sizeof(line), "Deadline bandwidth reserved: %u.%u%% of %u.%u%%\n",
+              bw / 10000, (bw / 1000) % 10,
+              SCHED_DL_BW_LIMIT / 10000, (SCHED_DL_BW_LIMIT / 1000) % 10);
+    terminal_writestring(line);
+}
+
+/* One line of scheduler_show_cpus() */
+typedef struct
+{
+    uint32_t cpu;
+    uint32_t queued;
+    uint32_t steals;
+    uint32_t ipis;
+    bool tick;
+    uint32_t idle_ms;
+    bool has_current;
+    uint32_t pid;
+    char name[32];
+} cpu_row_t;
+
+void scheduler_show_cpus(void)
+{
+    cpu_row_t rows[SMP_MAX_CPUS];
+    uint32_t nr_rows = 0;
+    char buf[16];
+
+    /* Remote CPUs switch tasks meanwhile, and a task that exits is
+     * freed: copy what is printed under the lock */
+    uint32_t flags = spin_lock_irqsave(&sched_lock);
+    uint32_t total_ticks = stats.total_ticks;
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!cpus[cpu].online)
+            continue;
+
+        cpu_row_t *row = &rows[nr_rows++];
+        task_t *curr = cpus[cpu].current;
+
+        row->cpu = cpu;
+        row->queued = runqueues[cpu].nr_running;
+        row->steals = runqueues[cpu].steals;
+        row->ipis = cpus[cpu].resched_ipis;
+        /* CPU 0 runs the global tick (stopped only by dynamic tick) */
+        row->tick = cpu == 0 || cpus[cpu].tick_running;
+        row->idle_ms = cycles_to_ms(cpus[cpu].idle_cycles);
+        row->has_current = curr != NULL;
+        if (curr) {
+            row->pid = curr->pid;
+            strcpy(row->name, curr->name);
+        }
+    }
+    spin_unlock_irqrestore(&sched_lock, flags);
+
+    terminal_writestring("CPU  QUEUED  STOLEN  IPIS    TICK  IDLE  CURRENT\n");
+    terminal_writestring("---  ------  ------  ------  ----  ----  -------\n");
+
+    for (uint32_t r = 0; r < nr_rows; r++) {
+        cpu_row_t *row = &rows[r];
+
+        itoa(row->cpu, buf);
+        terminal_writestring(buf);
+        for (size_t i = strlen(buf); i < 5; i++) terminal_putchar(' ');
+
+        itoa(row->queued, buf);
+        terminal_writestring(buf);
+        for (size_t i = strlen(buf); i < 8; i++) terminal_putchar(' ');
+
+        itoa(row->steals, buf);
+        terminal_writestring(buf);
+        for (size_t i = strlen(buf); i < 8; i++) terminal_putchar(' ');
+
+        itoa(row->ipis, buf);
+        terminal_writestring(buf);
+        for (size_t i = strlen(buf); i < 8; i++) terminal_putchar(' ');
+
+        terminal_writestring(row->tick ? "on    " : "off   ");
+
+        /* Share of the time since the scheduler started */
+        itoa(total_ticks ? (uint32_t)div_u64((uint64_t)row->idle_ms * 100, total_ticks) : 0, buf);
+        terminal_writestring(buf);
+        terminal_putchar('%');
+        for (size_t i = strlen(buf) + 1; i < 6; i++) terminal_putchar(' ');
+
+        if (row->has_current) {
+            itoa(row->pid, buf);
+            terminal_writestring(buf);
+            terminal_writestring(" (");
+            terminal_writestring(row->name);
+            terminal_writestring(")");
+        } else {
+            terminal_writestring("-");
+        }
+        terminal_writestring("\n");
+    }
 }
@@ -1,12 +1,29 @@
 /* kernel/scheduler.h - Task Scheduler
- * 
- * The scheduler decides which task runs when.
- * We use a simple round-robin algorithm with priorities.
+ *
+ * The scheduler decides which task runs when. Two policies are
+ * available for normal tasks, selectable at runtime:
+ *
+ * - SCHED_POLICY_PRIO: per-priority FIFO run queues; a bitmap of
+ *   non-empty levels makes picking the next task a find-first-set.
+ * - SCHED_POLICY_FAIR: tasks are ordered by weighted virtual runtime
+ *   in a red-black tree; the task that has received the least CPU
+ *   relative to its weight runs next, with slices derived from a
+ *   target latency.
+ *
+ * Above the normal tasks sit two real-time classes, chosen per task
+ * with scheduler_setscheduler():
+ *
+ * - SCHED_DEADLINE: earliest deadline first among tasks that reserved
+ *   runtime per period; admission control keeps the reserved total
+ *   below SCHED_DL_BW_LIMIT.
+ * - SCHED_FIFO / SCHED_RR: fixed real-time levels, FIFO runs until it
+ *   blocks or yields, RR takes turns within a level.
  */
 
 #ifndef SCHEDULER_H
 #define SCHEDULER_H
 
+#include "kernel.h"
 #include "task.h"
 
 /* ================================================================
@@ -15,6 +32,84 @@
 
 #define SCHEDULER_TIME_SLICE_MS 10    /* Each task gets 10ms */
 #define SCHEDULER_MAX_TASKS 64        /* Maximum concurrent tasks */
+#define SCHEDULER_PRIO_LEVELS 32      /* Run queue levels (0 = highest) */
+#define SCHEDULER_MAX_BOOST 4         /* Max levels gained by blocking on I/O */
+
+/* Fair class tuning */
+#define SCHED_LATENCY_MS 20           /* Every runnable task runs once per period */
+#define SCHED_MIN_GRANULARITY_MS 2    /* Shortest slice handed out */
+#define SCHED_WAKEUP_GRANULARITY_US 1000 /* vruntime lead needed to preempt on wakeup */
+#define SCHED_NICE_0_WEIGHT 1024      /* Weight of priority level 16 */
+
+/* Real-time classes */
+#define SCHED_RT_PRIO_LEVELS 32       /* FIFO/RR levels (0 = highest) */
+#define SCHED_RR_SLICE_MS 10          /* Turn length within an RR level */
+#define SCHED_DL_BW_LIMIT 950000      /* Deadline reservations, ppm of a CPU */
+
+/* Load average: exponentially decayed number of runnable tasks, in
+ * fixed point with LOAD_FSHIFT fraction bits, sampled every LOAD_FREQ
+ * ticks. LOAD_EXP_n = LOAD_FIXED_1 / e^(LOAD_FREQ / n minutes). */
+#define LOAD_FSHIFT 11
+#define LOAD_FIXED_1 (1 << LOAD_FSHIFT)
+#define LOAD_FREQ (5 * 1000 + 1)      /* 5s, off the beat of periodic work */
+#define LOAD_EXP_1 1884
+#define LOAD_EXP_5 2014
+#define LOAD_EXP_15 2037
+
+/* Run queue length histogram: 0, 1, 2, 3, 4-7, 8-15, 16-31, 32+ */
+#define SCHED_RQ_HIST_BUCKETS 8
+
+/* Scheduling class of a task, highest last (sched_attr_t.policy) */
+#define SCHED_NORMAL   0              /* PRIO or FAIR, whichever is selected */
+#define SCHED_FIFO     1
+#define SCHED_RR       2
+#define SCHED_DEADLINE 3
+
+/* Priority keys (scheduler_prio_key()) put every class on one scale,
+ * lower = more important: DEADLINE, then FIFO/RR levels, then normal
+ * priority levels. 0 means none (nothing inherited). */
+#define PI_PRIO_NONE 0
+#define PI_PRIO_DEADLINE 1
+#define PI_PRIO_RT_BASE 2                                   /* + rt_priority */
+#define PI_PRIO_NORMAL_BASE (PI_PRIO_RT_BASE + SCHED_RT_PRIO_LEVELS) /* + priority */
+
+/* scheduler_setscheduler() / SYS_SCHED_SETSCHEDULER argument (same
+ * layout in user/ulib.h). Times are in milliseconds (ticks). */
+typedef struct
+{
+    uint32_t policy;       /* SCHED_* */
+    uint32_t priority;     /* NORMAL: 0-31 priority, FIFO/RR: 0-31 level */
+    uint32_t runtime;      /* DEADLINE: CPU time reserved per period */
+    uint32_t deadline;     /* DEADLINE: due this long after period start */
+    uint32_t period;       /* DEADLINE: reservation repeats every period */
+} sched_attr_t;
+
+/* scheduler_get_info() / SYS_SCHED_GETINFO result (same layout in
+ * user/ulib.h) */
+typedef struct
+{
+    uint32_t loadavg[3];   /* 1, 5 and 15 minutes; LOAD_FIXED_1 = 1.0 */
+    uint32_t nr_running;   /* Runnable tasks on all CPUs, running included */
+    uint32_t nr_tasks;
+    uint32_t nr_cpus;
+    uint32_t uptime_ms;    /* Since the scheduler started */
+    uint32_t idle_ms;      /* Halted time, summed over the CPUs */
+    uint32_t context_switches;
+    uint32_t involuntary_switches; /* Switches away from a runnable task */
+    uint32_t rq_hist[SCHED_RQ_HIST_BUCKETS]; /* CPU-ticks at each length */
+
+    /* The task asked about */
+    uint32_t pid;
+    uint32_t nvcsw;        /* Voluntary context switches */
+    uint32_t nivcsw;       /* Involuntary context switches */
+    uint32_t run_ms;       /* Ticks spent running */
+} sched_info_t;
+
+typedef enum
+{
+    SCHED_POLICY_PRIO = 0, /* Strict priority, round-robin within a level */
+    SCHED_POLICY_FAIR = 1  /* Weighted fair share (vruntime) */
+} sched_policy_t;
 
 /* ================================================================
  * SCHEDULER FUNCTIONS
@@ -29,24 +124,113 @@ void scheduler_add_task(task_t *task);
 /* Remove a task from the scheduler */
 void scheduler_remove_task(task_t *task);
 
+/* Make a blocked or sleeping task runnable again */
+void scheduler_wake_task(task_t *task);
+
+/* Put a task to sleep for the given number of ticks (the caller then
+ * yields). Returns false if the sleep queue could not grow. */
+bool scheduler_sleep_task(task_t *task, uint32_t ticks);
+
+/* Is any task (other than the idle fallback) waiting for this CPU,
+ * or one it could steal? */
+bool scheduler_has_ready(void);
+
 /* Pick the next task to run (called by timer interrupt) */
 task_t* scheduler_pick_next(void);
 
-/* Perform a context switch (called by timer interrupt) */
+/* Give up the CPU to the next task, if any. The tick and wakeups only
+ * set need_resched; preemption happens through preempt.h. */
 void scheduler_schedule(void);
 
 /* Timer tick - called every millisecond */
 void scheduler_tick(void);
 
+/* Dynamic tick: the timer handler reports how many ticks passed since
+ * the last interrupt (more than one after a stopped tick) */
+void scheduler_tick_n(uint32_t ticks);
+
+/* Local APIC tick of an application processor: charge its task */
+void scheduler_tick_local(void);
+
+/* Reschedule IPI from another CPU (new work or a preemption request) */
+void scheduler_resched_ipi(void);
+
+/* Account ticks that passed while the tick was stopped, without
+ * switching tasks (used when leaving one-shot mode early) */
+void scheduler_catch_up(uint32_t ticks);
+
+/* Ticks until the scheduler next needs a timer interrupt (1 = keep the
+ * periodic tick, UINT32_MAX = no deadline) */
+uint32_t scheduler_next_event(void);
+
+/* Select the policy used for normal tasks (requeues every ready task) */
+void scheduler_set_policy(sched_policy_t policy);
+sched_policy_t scheduler_get_policy(void);
+
+/* Let the application processors run tasks (off: they hand their
+ * tasks back to CPU 0) */
+void scheduler_set_smp(bool enabled);
+
+/* Change the class and parameters of task pid (0 = the caller). Returns
+ * 0, or -1 for bad parameters, an unknown pid or a deadline reservation
+ * that does not fit. */
+int scheduler_setscheduler(uint32_t pid, const sched_attr_t *attr);
+
+/* Priority key of a task's current (possibly inherited) parameters */
+uint32_t scheduler_prio_key(task_t *task);
+
+/* Priority inheritance: run task at least at priority key pi_prio
+ * (PI_PRIO_NONE = its own parameters again). An RT or deadline key
+ * lifts a normal task into SCHED_FIFO; deadline donors give level 0. */
+void scheduler_pi_setprio(task_t *task, uint32_t pi_prio);
+
+/* Load averages, idle time, switch counts and the run queue length
+ * histogram, plus the switch counts of task pid (0 = the caller).
+ * Returns -1 for an unknown pid. */
+int scheduler_get_info(uint32_t pid, sched_info_t *info);
+
+/* Fair-class load weight of a task (derived from its priority) */
+uint32_t scheduler_task_weight(task_t *task);
+
 /* Get scheduler statistics */
 typedef struct {
     uint32_t total_tasks;
     uint32_t ready_tasks;
     uint32_t blocked_tasks;
+    uint32_t sleeping_tasks;   /* Tasks waiting in the sleep queue */
     uint32_t context_switches;
     uint32_t total_ticks;
+    uint32_t runqueue_bitmap;  /* Bit n set = level n has ready tasks */
+    sched_policy_t policy;
+    uint32_t fair_load;        /* Sum of weights queued in the fair tree */
+    uint64_t min_vruntime;     /* Fair-class clock (microseconds) */
+    timer_nohz_stats_t nohz;   /* Dynamic tick: stops and ticks avoided */
+    uint32_t rt_tasks;         /* Tasks in FIFO/RR */
+    uint32_t dl_tasks;         /* Tasks in DEADLINE */
+    uint32_t dl_bw;            /* Reserved deadline bandwidth (ppm) */
+    uint32_t dl_throttles;     /* Budget used up before the period ended */
+    uint32_t dl_misses;        /* Still running past the deadline */
+    uint32_t preempt_irq;      /* Tasks preempted on interrupt exit */
+    uint32_t preempt_sync;     /* ... or in preempt_enable() */
+    uint32_t involuntary_switches; /* Switches away from a runnable task */
+    uint32_t loadavg[3];       /* 1/5/15 min, LOAD_FIXED_1 = 1.0 */
+    uint32_t rq_hist[SCHED_RQ_HIST_BUCKETS]; /* CPU-ticks per run queue length */
 } scheduler_stats_t;
 
 scheduler_stats_t scheduler_get_stats(void);
 
-#endif /* SCHEDULER_H */
\ No newline at end of file
+/* Print per-task fair share: weight, expected vs. actual CPU, lag */
+void scheduler_show_fairness(void);
+
+/* Print the tasks in the real-time classes and their parameters */
+void scheduler_show_classes(void);
+
+/* Print the load averages, run queue length histogram and each task's
+ * voluntary and involuntary switches */
+void scheduler_show_load(void);
+
+/* Print each CPU's run queue length, steals, IPIs, idle share and
+ * current task */
+void scheduler_show_cpus(void);
+
+#endif /* SCHEDULER_H */
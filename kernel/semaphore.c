@@ -0,0 +1,137 @@
+/* kernel/semaphore.c - Counting and Reader-Writer Semaphores
+ *
+ * Waiters sleep on wait queues. The count is checked and the waiter
+ * queued under the semaphore's lock, so an up() between the check and
+ * the sleep finds the waiter and wakes it. Waits are exclusive: one
+ * unit wakes one task, not all of them. A woken task re-checks the
+ * count, since somebody who never slept may have taken the unit first.
+ */
+
+#include "semaphore.h"
+#include "kernel.h"
+#include "task.h"
+
+/* ================================================================
+ * COUNTING SEMAPHORES
+ * ================================================================ */
+
+void sema_init(semaphore_t *sem, const char *name, int32_t count)
+{
+    spin_lock_init(&sem->lock, name, LOCK_ORDER_SLEEP);
+    sem->count = count;
+    wait_queue_init(&sem->wait);
+}
+
+void down(semaphore_t *sem)
+{
+    DEFINE_WAIT(wait);
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+
+    while (sem->count <= 0) {
+        prepare_to_wait_exclusive(&sem->wait, &wait);
+        spin_unlock_irqrestore(&sem->lock, flags);
+        wait_schedule();
+        flags = spin_lock_irqsave(&sem->lock);
+    }
+    sem->count--;
+    finish_wait(&sem->wait, &wait);
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+}
+
+bool down_trylock(semaphore_t *sem)
+{
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+
+    bool taken = sem->count > 0;
+    if (taken)
+        sem->count--;
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+    return taken;
+}
+
+void up(semaphore_t *sem)
+{
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+
+    sem->count++;
+    wake_up(&sem->wait);
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+}
+
+/* ================================================================
+ * READER-WRITER SEMAPHORES
+ * ================================================================ */
+
+void init_rwsem(rw_semaphore_t *sem, const char *name)
+{
+    spin_lock_init(&sem->lock, name, LOCK_ORDER_SLEEP);
+    sem->readers = 0;
+    sem->writers_waiting = 0;
+    wait_queue_init(&sem->read_wait);
+    wait_queue_init(&sem->write_wait);
+}
+
+void down_read(rw_semaphore_t *sem)
+{
+    DEFINE_WAIT(wait);
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+
+    /* Writers first, including ones that are only waiting */
+    while (sem->readers < 0 || sem->writers_waiting) {
+        prepare_to_wait(&sem->read_wait, &wait);
+        spin_unlock_irqrestore(&sem->lock, flags);
+        wait_schedule();
+        flags = spin_lock_irqsave(&sem->lock);
+    }
+    sem->readers++;
+    finish_wait(&sem->read_wait, &wait);
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+}
+
+void up_read(rw_semaphore_t *sem)
+{
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+
+    if (--sem->readers == 0)
+        wake_up(&sem->write_wait);
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+}
+
+void down_write(rw_semaphore_t *sem)
+{
+    DEFINE_WAIT(wait);
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+
+    sem->writers_waiting++;
+    while (sem->readers != 0) {
+        prepare_to_wait_exclusive(&sem->write_wait, &wait);
+        spin_unlock_irqrestore(&sem->lock, flags);
+        wait_schedule();
+        flags = spin_lock_irqsave(&sem->lock);
+    }
+    sem->writers_waiting--;
+    sem->readers = -1;
+    finish_wait(&sem->write_wait, &wait);
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+}
+
+void up_write(rw_semaphore_t *sem)
+{
+    uint32_t flags = spin_lock_irqsave(&sem->lock);
+
+    sem->readers = 0;
+
+    /* The next writer, or else every reader held back */
+    if (sem->writers_waiting)
+        wake_up(&sem->write_wait);
+    else
+        wake_up_all(&sem->read_wait);
+
+    spin_unlock_irqrestore(&sem->lock, flags);
+}
@@ -0,0 +1,84 @@
+/* kernel/semaphore.h - Counting and Reader-Writer Semaphores
+ *
+ * A semaphore counts units of some resource: down() takes one, sleeping
+ * while there are none, and up() gives one back. Unlike a mutex anybody
+ * may call up(), including an interrupt handler, which makes it the
+ * tool for "wait until the IRQ says the data is there".
+ *
+ * A reader-writer semaphore lets any number of readers in at once, or
+ * one writer. A waiting writer keeps new readers out, so a steady
+ * stream of readers cannot starve it.
+ *
+ * Neither inherits priority; use a mutex where that matters.
+ *
+ * Typical use:
+ *
+ *     static semaphore_t slots = SEMAPHORE_INIT("slots", 4);
+ *
+ *     down(&slots);
+ *     ...
+ *     up(&slots);
+ */
+
+#ifndef SEMAPHORE_H
+#define SEMAPHORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+#include "wait.h"
+
+/* ================================================================
+ * TYPES
+ * ================================================================ */
+
+typedef struct semaphore
+{
+    spinlock_t lock;
+    int32_t count;                   /* Units available */
+    wait_queue_t wait;
+} semaphore_t;
+
+#define SEMAPHORE_INIT(name, count) \
+    {SPINLOCK_INIT(name, LOCK_ORDER_SLEEP), (count), WAIT_QUEUE_INIT}
+
+typedef struct rw_semaphore
+{
+    spinlock_t lock;
+    int32_t readers;                 /* Readers inside, -1 for a writer */
+    uint32_t writers_waiting;
+    wait_queue_t read_wait;
+    wait_queue_t write_wait;
+} rw_semaphore_t;
+
+#define RWSEM_INIT(name) \
+    {SPINLOCK_INIT(name, LOCK_ORDER_SLEEP), 0, 0, WAIT_QUEUE_INIT, WAIT_QUEUE_INIT}
+
+/* ================================================================
+ * COUNTING SEMAPHORES
+ * ================================================================ */
+
+void sema_init(semaphore_t *sem, const char *name, int32_t count);
+
+/* Take a unit, sleeping until one is available (tasks only) */
+void down(semaphore_t *sem);
+
+/* Take a unit if one is available. Returns true on success. */
+bool down_trylock(semaphore_t *sem);
+
+/* Give a unit back and wake a waiter. Safe from interrupt handlers. */
+void up(semaphore_t *sem);
+
+/* ================================================================
+ * READER-WRITER SEMAPHORES
+ * ================================================================ */
+
+void init_rwsem(rw_semaphore_t *sem, const char *name);
+
+void down_read(rw_semaphore_t *sem);
+void up_read(rw_semaphore_t *sem);
+
+void down_write(rw_semaphore_t *sem);
+void up_write(rw_semaphore_t *sem);
+
+#endif /* SEMAPHORE_H */
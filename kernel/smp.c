@@ -0,0 +1,280 @@
+/* kernel/smp.c - Symmetric Multiprocessing
+ *
+ * Boot sequence, run on the BSP once the scheduler is up:
+ *   1. Find CPUs and I/O APIC (ACPI MADT, else the MP table)
+ *   2. Enable the BSP's local APIC, move device IRQs from the 8259 to
+ *      the I/O APIC (same vectors, all delivered to the BSP)
+ *   3. Calibrate the local APIC timer against the PIT
+ *   4. Start each AP: copy the trampoline below 1MB, hand it an idle
+ *      task stack, INIT-SIPI-SIPI and wait for it to check in
+ *
+ * An AP sets up its own GDT, TSS, IDT, FPU and local APIC in ap_main()
+ * and then becomes its idle task. The PIT stays with CPU 0, which also
+ * owns the global tick and the sleep queue; an AP arms its local APIC
+ * timer only while it has a task to slice.
+ *
+ * Running tasks on the APs is off by default ("smp sched on" in the
+ * shell, or SMP_SCHED_DEFAULT): the terminal and several drivers still
+ * assume a single CPU. With it off the APs boot, take IPIs and halt;
+ * CPU 0 does all the work.
+ */
+
+#include "smp.h"
+#include "kernel.h"
+#include "acpi.h"
+#include "task.h"
+#include "tss.h"
+#include "fpu.h"
+#include "scheduler.h"
+#include "../drivers/apic.h"
+
+#define AP_BOOT_TIMEOUT_MS 100
+#define TIMER_HZ 1000           /* Same rate as the PIT tick */
+
+#define PIC1_DATA 0x21
+#define PIC2_DATA 0xA1
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+cpu_t cpus[SMP_MAX_CPUS];
+uint32_t smp_num_cpus = 1;
+volatile bool smp_sched_enabled = false;
+
+static mp_config_t mp_config;
+static bool mp_found = false;
+
+/* Trampoline (kernel/ap_trampoline.s) */
+extern uint8_t ap_trampoline_start[];
+extern uint8_t ap_trampoline_end[];
+extern uint32_t ap_trampoline_cr3;
+extern uint32_t ap_trampoline_stack;
+extern uint32_t ap_trampoline_entry;
+
+/* A trampoline variable in the copy at AP_TRAMPOLINE_ADDR */
+#define TRAMPOLINE_VAR(sym) \
+    (*(volatile uint32_t *)(AP_TRAMPOLINE_ADDR + ((uint32_t)&(sym) - (uint32_t)ap_trampoline_start)))
+
+/* CPU number the AP being started should take */
+static volatile uint32_t ap_booting_cpu = 0;
+
+/* ================================================================
+ * APPLICATION PROCESSOR ENTRY
+ * ================================================================ */
+
+static void ap_main(void)
+{
+    uint32_t cpu = ap_booting_cpu;
+
+    /* Order matters: the TSS selector identifies the CPU, so nothing
+     * below may use this_cpu() before tss_init_cpu() */
+    gdt_init_cpu(cpu);
+    tss_init_cpu(cpu);
+    idt_load();
+    fpu_init();
+    lapic_enable();
+
+    cpus[cpu].current = cpus[cpu].idle;
+    __atomic_add_fetch(&smp_num_cpus, 1, __ATOMIC_SEQ_CST);
+    cpus[cpu].online = true;
+
+    /* Idle loop: the scheduler runs from the reschedule IPI handler
+     * (and from the local tick while a task is on this CPU) */
+    for (;;) {
+        if (smp_sched_enabled)
+            scheduler_schedule();
+
+        uint64_t halt_start = rdtsc();
+        __asm__ volatile("sti; hlt");
+        cpus[cpu].idle_cycles += rdtsc() - halt_start;
+    }
+}
+
+/* ================================================================
+ * INTERRUPT ROUTING
+ * ================================================================ */
+
+/* Hand the ISA IRQs to the I/O APIC: same vectors, all to the BSP,
+ * masked exactly as the 8259 had them */
+static void smp_route_irqs(void)
+{
+    uint32_t flags = irq_save();
+    uint16_t pic_mask = inb(PIC1_DATA) | (inb(PIC2_DATA) << 8);
+
+    ioapic_init(mp_config.ioapic_base, mp_config.ioapic_gsi_base);
+
+    for (uint32_t irq = 0; irq < MP_ISA_IRQS; irq++) {
+        if (irq == 2)
+            continue;  /* 8259 cascade, not a device */
+        ioapic_route(mp_config.isa_gsi[irq], 32 + irq, cpus[0].apic_id,
+                     mp_config.isa_flags[irq], (pic_mask >> irq) & 1);
+    }
+
+    /* Silence the 8259 for good; the BSP's LINT0 is masked as well */
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+
+    apic_irq_routing = true;
+    lapic_enable();
+
+    irq_restore(flags);
+}
+
+/* ================================================================
+ * AP STARTUP
+ * ================================================================ */
+
+static bool smp_boot_ap(uint32_t cpu, uint8_t apic_id)
+{
+    task_t *idle = task_create_idle(cpu);
+    if (!idle)
+        return false;
+
+    cpus[cpu].id = cpu;
+    cpus[cpu].apic_id = apic_id;
+    cpus[cpu].idle = idle;
+
+    memcpy((void *)AP_TRAMPOLINE_ADDR, ap_trampoline_start,
+           (uint32_t)(ap_trampoline_end - ap_trampoline_start));
+    TRAMPOLINE_VAR(ap_trampoline_cr3) = (uint32_t)kernel_task->page_directory;
+    TRAMPOLINE_VAR(ap_trampoline_stack) = idle->kernel_stack + 4096;
+    TRAMPOLINE_VAR(ap_trampoline_entry) = (uint32_t)ap_main;
+    ap_booting_cpu = cpu;
+
+    lapic_start_ap(apic_id, AP_TRAMPOLINE_ADDR);
+
+    uint32_t start = timer_get_ticks();
+    while (!cpus[cpu].online && timer_get_ticks() - start < AP_BOOT_TIMEOUT_MS)
+        __asm__ volatile("pause");
+
+    return cpus[cpu].online;
+}
+
+/* ================================================================
+ * INITIALIZATION
+ * ================================================================ */
+
+void smp_init(void)
+{
+    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
+    terminal_writestring("[SMP] Looking for processors...\n");
+
+    cpus[0].id = 0;
+    cpus[0].online = true;
+
+    mp_found = mp_discover(&mp_config);
+    if (!mp_found || !lapic_supported()) {
+        terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK));
+        terminal_writestring("[SMP] No MP configuration - uniprocessor, 8259 PIC\n");
+        terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+        mp_found = false;
+        return;
+    }
+
+    lapic_init(mp_config.lapic_base);
+    cpus[0].apic_id = lapic_id();
+
+    if (mp_config.has_ioapic)
+        smp_route_irqs();
+
+    lapic_timer_calibrate();
+
+    uint32_t cpu = 1;
+    for (uint32_t i = 0; i < mp_config.nr_cpus && cpu < SMP_MAX_CPUS; i++) {
+        uint8_t apic_id = mp_config.apic_ids[i];
+        if (apic_id == cpus[0].apic_id)
+            continue;
+
+        if (smp_boot_ap(cpu, apic_id)) {
+            cpu++;
+        } else {
+            terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+            terminal_writestring("[SMP] CPU with APIC ID ");
+            terminal_write_dec(apic_id);
+            terminal_writestring(" did not start\n");
+        }
+    }
+
+    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
+    terminal_writestring("[SMP] ");
+    terminal_write_dec(smp_num_cpus);
+    terminal_writestring(" CPU(s) online (");
+    terminal_writestring(mp_config.source);
+    terminal_writestring(apic_irq_routing ? ", I/O APIC" : ", 8259 PIC");
+    terminal_writestring(")\n");
+    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+
+    if (SMP_SCHED_DEFAULT)
+        smp_set_sched(true);
+}
+
+/* ================================================================
+ * RUNTIME
+ * ================================================================ */
+
+void smp_send_resched(uint32_t cpu)
+{
+    if (cpu >= SMP_MAX_CPUS || !cpus[cpu].online || cpu == smp_processor_id())
+        return;
+
+    lapic_send_ipi(cpus[cpu].apic_id, APIC_RESCHED_VECTOR);
+}
+
+void smp_set_sched(bool enabled)
+{
+    if (enabled && smp_num_cpus < 2)
+        return;
+
+    /* CPU 0 keeps FPU state in its registers only while no task can
+     * migrate: write it back before that changes */
+    uint32_t flags = irq_save();
+    if (enabled)
+        fpu_flush();
+    scheduler_set_smp(enabled);
+    irq_restore(flags);
+}
+
+void smp_set_tick(bool running)
+{
+    cpu_t *cpu = this_cpu();
+
+    if (cpu->id == 0 || cpu->tick_running == running)
+        return;
+
+    if (running)
+        lapic_timer_start(TIMER_HZ);
+    else
+        lapic_timer_stop();
+    cpu->tick_running = running;
+}
+
+void smp_show(void)
+{
+    char buf[16];
+
+    terminal_writestring("Source:      ");
+    terminal_writestring(mp_found ? mp_config.source : "none (uniprocessor)");
+    terminal_writestring("\nCPUs online: ");
+    itoa(smp_num_cpus, buf);
+    terminal_writestring(buf);
+    if (mp_found && mp_config.cpus_ignored) {
+        terminal_writestring(" (");
+        itoa(mp_config.cpus_ignored, buf);
+        terminal_writestring(buf);
+        terminal_writestring(" more ignored)");
+    }
+    terminal_writestring("\nIRQs:        ");
+    terminal_writestring(apic_irq_routing ? "I/O APIC" : "8259 PIC");
+    if (lapic_available()) {
+        terminal_writestring("\nLAPIC timer: ");
+        itoa(lapic_timer_ticks_per_ms(), buf);
+        terminal_writestring(buf);
+        terminal_writestring(" counts/ms");
+    }
+    terminal_writestring("\nAP tasks:    ");
+    terminal_writestring(smp_sched_enabled ? "on" : "off");
+    terminal_writestring("\n\n");
+
+    scheduler_show_cpus();
+}
@@ -0,0 +1,102 @@
+/* kernel/smp.h - Symmetric Multiprocessing
+ *
+ * CPU 0 is the bootstrap processor (BSP) that runs kernel_main(); the
+ * other CPUs (application processors, APs) are found through the ACPI
+ * MADT or the MP table and started with INIT-SIPI-SIPI. Every CPU has
+ * its own GDT and TSS, its own current task and idle task, and its own
+ * run queue in the scheduler.
+ *
+ * The CPU number is recovered from the task register: CPU n loads the
+ * TSS selector TSS_SEL + 8n, so "str" yields it in one instruction with
+ * no memory access and no segment register tricks.
+ */
+
+#ifndef SMP_H
+#define SMP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "gdt.h"
+
+/* ================================================================
+ * CONFIGURATION
+ * ================================================================ */
+
+#define SMP_MAX_CPUS 8
+
+/* Run tasks on the APs from boot instead of after "smp sched on". Off
+ * while the terminal, the keyboard buffer, ramfs/tarfs and ATA access
+ * outside FAT still assume one CPU; define it to 1 to try anyway. */
+#ifndef SMP_SCHED_DEFAULT
+#define SMP_SCHED_DEFAULT 0
+#endif
+
+/* Physical page the APs start executing at (real mode, below 1MB) */
+#define AP_TRAMPOLINE_ADDR 0x8000
+
+/* ================================================================
+ * PER-CPU DATA
+ * ================================================================ */
+
+struct task;
+
+typedef struct cpu
+{
+    uint32_t id;              /* Logical CPU number (0 = BSP) */
+    uint8_t apic_id;          /* Local APIC ID */
+    volatile bool online;     /* Booted and taking interrupts */
+    bool tick_running;        /* Local APIC timer armed (APs only) */
+    struct task *current;     /* Task running on this CPU */
+    struct task *idle;        /* Runs when nothing else is ready */
+    struct task *fpu_owner;   /* Task whose FPU state is in the registers */
+    bool in_kernel_fpu;       /* Inside kernel_fpu_begin()/end() */
+    uint64_t acct_stamp;      /* rdtsc of the last accounting boundary */
+    uint8_t acct_mode;        /* ACCT_* the current task is in */
+    volatile uint32_t softirq_pending; /* Raised SOFTIRQ_* bits */
+    bool in_softirq;          /* Running softirq handlers (softirq.c) */
+    volatile bool need_resched; /* Current task should give up the CPU */
+    uint32_t resched_ipis;    /* Reschedule IPIs received */
+    uint64_t idle_cycles;     /* Halted for lack of work (IRQs included) */
+} cpu_t;
+
+extern cpu_t cpus[SMP_MAX_CPUS];
+extern uint32_t smp_num_cpus;     /* CPUs online */
+
+/* Scheduling on the APs (off by default, see smp.c) */
+extern volatile bool smp_sched_enabled;
+
+static inline uint32_t smp_processor_id(void)
+{
+    uint16_t tr;
+    __asm__ volatile("str %0" : "=r"(tr));
+
+    /* TR is 0 until the boot CPU loads its TSS */
+    return tr >= TSS_SEL ? (uint32_t)(tr - TSS_SEL) >> 3 : 0;
+}
+
+static inline cpu_t *this_cpu(void)
+{
+    return &cpus[smp_processor_id()];
+}
+
+/* ================================================================
+ * FUNCTIONS
+ * ================================================================ */
+
+/* Discover CPUs, switch IRQs to the I/O APIC and start the APs. Call
+ * once the scheduler is up, with interrupts enabled. */
+void smp_init(void);
+
+/* Ask another CPU to run its scheduler (no-op for the calling CPU) */
+void smp_send_resched(uint32_t cpu);
+
+/* Enable/disable running tasks on the APs */
+void smp_set_sched(bool enabled);
+
+/* Arm or stop the calling AP's local timer (the BSP uses the PIT) */
+void smp_set_tick(bool running);
+
+/* Print CPUs, interrupt routing and per-CPU state */
+void smp_show(void);
+
+#endif /* SMP_H */
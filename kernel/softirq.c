@@ -0,0 +1,258 @@
+/* kernel/softirq.c - Softirqs and Tasklets
+ *
+ * Pending softirqs are a bitmask in cpu_t. irq_handler_c() calls
+ * softirq_run() after the handler, which clears the mask, re-enables
+ * interrupts and calls each raised handler; an interrupt arriving in
+ * the meantime may raise more, which the loop picks up on its next
+ * round. Nested interrupts see in_softirq and leave the work to the
+ * outer loop, so handlers never nest.
+ *
+ * While in_softirq is set the scheduler only notes that a switch was
+ * wanted (need_resched); softirq_run() offers the CPU once the handlers
+ * are done, if the code it interrupted can be preempted. That keeps a
+ * softirq on the CPU that raised it and keeps its per-CPU state
+ * consistent without disabling interrupts.
+ *
+ * Each CPU has two tasklet lists, one per tasklet softirq. Interrupts
+ * are off whenever a list is touched, and a list only belongs to its
+ * CPU, so they need no lock.
+ */
+
+#include "softirq.h"
+#include "kernel.h"
+#include "task.h"
+#include "smp.h"
+#include "scheduler.h"
+#include "preempt.h"
+
+#define EFLAGS_IF 0x200
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+static softirq_handler_t softirq_handlers[NR_SOFTIRQS];
+
+static const char *const softirq_names[NR_SOFTIRQS] = {
+    "HI", "TIMER", "TASKLET",
+};
+
+typedef struct
+{
+    uint32_t count[NR_SOFTIRQS];   /* Handler invocations */
+    uint64_t cycles[NR_SOFTIRQS];  /* Time spent in each handler */
+    uint32_t overruns;             /* Still pending after the restart limit */
+} softirq_stats_t;
+
+typedef struct
+{
+    tasklet_t *head;
+    tasklet_t *tail;
+} tasklet_list_t;
+
+static softirq_stats_t softirq_stats[SMP_MAX_CPUS];
+static tasklet_list_t tasklet_lists[SMP_MAX_CPUS][2];  /* [cpu][HI/normal] */
+
+/* ================================================================
+ * SOFTIRQS
+ * ================================================================ */
+
+void open_softirq(uint32_t nr, softirq_handler_t handler)
+{
+    if (nr < NR_SOFTIRQS)
+        softirq_handlers[nr] = handler;
+}
+
+bool in_interrupt(void)
+{
+    uint32_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    bool ret = cpu->in_softirq || cpu->acct_mode == ACCT_IRQ;
+    irq_restore(flags);
+    return ret;
+}
+
+void raise_softirq(uint32_t nr)
+{
+    if (nr >= NR_SOFTIRQS)
+        return;
+
+    uint32_t flags = irq_save();
+    this_cpu()->softirq_pending |= 1u << nr;
+    irq_restore(flags);
+
+    /* No interrupt exit is coming to run it: do it now */
+    if ((flags & EFLAGS_IF) && !in_interrupt())
+        softirq_run();
+}
+
+void softirq_run(void)
+{
+    uint32_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+
+    if (cpu->in_softirq || !cpu->softirq_pending) {
+        irq_restore(flags);
+        return;
+    }
+
+    softirq_stats_t *stats = &softirq_stats[cpu->id];
+    uint32_t rounds = SOFTIRQ_MAX_RESTART;
+    uint32_t pending;
+
+    cpu->in_softirq = true;
+
+    while (rounds-- && (pending = cpu->softirq_pending)) {
+        cpu->softirq_pending = 0;
+        __asm__ volatile("sti");
+
+        for (uint32_t nr = 0; pending; nr++, pending >>= 1) {
+            if (!(pending & 1) || !softirq_handlers[nr])
+                continue;
+
+            uint64_t start = rdtsc();
+            softirq_handlers[nr]();
+            stats->count[nr]++;
+            stats->cycles[nr] += rdtsc() - start;
+        }
+
+        __asm__ volatile("cli");
+    }
+
+    if (cpu->softirq_pending)
+        stats->overruns++;
+
+    cpu->in_softirq = false;
+
+    /* Handlers may have woken somebody more important */
+    preempt_schedule_irq();
+    irq_restore(flags);
+}
+
+/* ================================================================
+ * TASKLETS
+ * ================================================================ */
+
+void tasklet_init(tasklet_t *t, void (*func)(uint32_t data), uint32_t data)
+{
+    t->next = NULL;
+    t->state = 0;
+    t->func = func;
+    t->data = data;
+    t->runs = 0;
+}
+
+static void tasklet_enqueue(tasklet_list_t *list, tasklet_t *t)
+{
+    t->next = NULL;
+    if (list->tail)
+        list->tail->next = t;
+    else
+        list->head = t;
+    list->tail = t;
+}
+
+static void tasklet_schedule_on(tasklet_t *t, uint32_t nr)
+{
+    /* Already queued somewhere: it will see whatever the caller did */
+    if (__atomic_fetch_or(&t->state, TASKLET_STATE_SCHED, __ATOMIC_ACQ_REL) &
+        TASKLET_STATE_SCHED)
+        return;
+
+    uint32_t flags = irq_save();
+    tasklet_enqueue(&tasklet_lists[smp_processor_id()][nr], t);
+    irq_restore(flags);
+
+    raise_softirq(nr);
+}
+
+void tasklet_schedule(tasklet_t *t)
+{
+    tasklet_schedule_on(t, SOFTIRQ_TASKLET);
+}
+
+void tasklet_hi_schedule(tasklet_t *t)
+{
+    tasklet_schedule_on(t, SOFTIRQ_HI);
+}
+
+static void tasklet_action_common(uint32_t nr)
+{
+    uint32_t flags = irq_save();
+    tasklet_list_t *list = &tasklet_lists[smp_processor_id()][nr];
+    tasklet_t *t = list->head;
+    list->head = list->tail = NULL;
+    irq_restore(flags);
+
+    while (t) {
+        tasklet_t *next = t->next;
+
+        if (__atomic_fetch_or(&t->state, TASKLET_STATE_RUN, __ATOMIC_ACQUIRE) &
+            TASKLET_STATE_RUN) {
+            /* Still running on another CPU: try again next round */
+            flags = irq_save();
+            tasklet_enqueue(&tasklet_lists[smp_processor_id()][nr], t);
+            this_cpu()->softirq_pending |= 1u << nr;
+            irq_restore(flags);
+        } else {
+            /* Clear SCHED first so the tasklet can requeue itself */
+            __atomic_and_fetch(&t->state, ~TASKLET_STATE_SCHED, __ATOMIC_ACQ_REL);
+            t->func(t->data);
+            t->runs++;
+            __atomic_and_fetch(&t->state, ~TASKLET_STATE_RUN, __ATOMIC_RELEASE);
+        }
+
+        t = next;
+    }
+}
+
+static void tasklet_hi_action(void)
+{
+    tasklet_action_common(SOFTIRQ_HI);
+}
+
+static void tasklet_action(void)
+{
+    tasklet_action_common(SOFTIRQ_TASKLET);
+}
+
+/* ================================================================
+ * INITIALIZATION
+ * ================================================================ */
+
+void softirq_init(void)
+{
+    open_softirq(SOFTIRQ_HI, tasklet_hi_action);
+    open_softirq(SOFTIRQ_TASKLET, tasklet_action);
+}
+
+/* ================================================================
+ * STATISTICS
+ * ================================================================ */
+
+void softirq_show_stats(void)
+{
+    char line[96];
+
+    terminal_writestring("CPU  Softirq     Runs  Avg (us)  Total (ms)\n");
+    for (uint32_t cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (!cpus[cpu].online)
+            continue;
+
+        softirq_stats_t *s = &softirq_stats[cpu];
+        for (uint32_t nr = 0; nr < NR_SOFTIRQS; nr++) {
+            uint64_t avg = s->count[nr] ? div_u64(s->cycles[nr], s->count[nr]) : 0;
+
+            ksnprintf(line, sizeof(line), "%3u  %-8s %8u  %8llu  %10llu\n",
+                      cpu, softirq_names[nr], s->count[nr],
+                      timer_cycles_to_us(avg),
+                      div_u64(timer_cycles_to_us(s->cycles[nr]), 1000));
+            terminal_writestring(line);
+        }
+        if (s->overruns) {
+            ksnprintf(line, sizeof(line), "%3u  %u round(s) left pending for the next IRQ\n",
+                      cpu, s->overruns);
+            terminal_writestring(line);
+        }
+    }
+}
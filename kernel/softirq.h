@@ -0,0 +1,86 @@
+/* kernel/softirq.h - Softirqs and Tasklets (bottom halves)
+ *
+ * An IRQ handler should only do what cannot wait: talk to the device,
+ * grab the data and acknowledge it. Everything else is deferred:
+ *
+ *   softirq  - a small fixed set of handlers, raised from an IRQ handler
+ *              and run on the same CPU on the way out of irq_handler_c(),
+ *              with interrupts enabled
+ *   tasklet  - a function queued onto the tasklet softirq; a tasklet
+ *              scheduled several times before it runs runs once, and
+ *              never on two CPUs at the same time
+ *   work     - see workqueue.h: runs in a kernel thread and may sleep
+ *
+ * Softirq handlers and tasklets run in interrupt context: they must not
+ * sleep, and the CPU will not switch tasks until they are done.
+ */
+
+#ifndef SOFTIRQ_H
+#define SOFTIRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* ================================================================
+ * SOFTIRQS
+ * ================================================================ */
+
+#define SOFTIRQ_HI        0   /* High-priority tasklets */
+#define SOFTIRQ_TIMER     1   /* Expired kernel timers (ktimer.h) */
+#define SOFTIRQ_TASKLET   2   /* Normal tasklets */
+#define NR_SOFTIRQS       3
+
+/* Rounds of raised softirqs handled per IRQ exit; whatever is raised
+ * after that waits for the next interrupt on this CPU */
+#define SOFTIRQ_MAX_RESTART 10
+
+typedef void (*softirq_handler_t)(void);
+
+void softirq_init(void);
+
+/* Install the handler for softirq nr */
+void open_softirq(uint32_t nr, softirq_handler_t handler);
+
+/* Mark softirq nr pending on this CPU. From task context (interrupts
+ * enabled) the pending softirqs run before this returns. */
+void raise_softirq(uint32_t nr);
+
+/* Run pending softirqs (called on IRQ exit) */
+void softirq_run(void);
+
+/* Inside an IRQ handler or a softirq on this CPU */
+bool in_interrupt(void);
+
+/* ================================================================
+ * TASKLETS
+ * ================================================================ */
+
+#define TASKLET_STATE_SCHED 0x1   /* Queued, not yet started */
+#define TASKLET_STATE_RUN   0x2   /* Running on some CPU */
+
+typedef struct tasklet
+{
+    struct tasklet *next;
+    volatile uint32_t state;          /* TASKLET_STATE_* */
+    void (*func)(uint32_t data);
+    uint32_t data;
+    uint32_t runs;                    /* Times func has been called */
+} tasklet_t;
+
+#define DECLARE_TASKLET(name, fn, arg) \
+    tasklet_t name = { NULL, 0, (fn), (arg), 0 }
+
+void tasklet_init(tasklet_t *t, void (*func)(uint32_t data), uint32_t data);
+
+/* Queue t on this CPU (no-op if it is already queued) */
+void tasklet_schedule(tasklet_t *t);
+void tasklet_hi_schedule(tasklet_t *t);
+
+/* ================================================================
+ * STATISTICS
+ * ================================================================ */
+
+/* Print per-CPU softirq counts and time spent in them */
+void softirq_show_stats(void);
+
+#endif /* SOFTIRQ_H */
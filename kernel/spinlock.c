@@ -0,0 +1,204 @@
+/* kernel/spinlock.c - Spinlock slow path, lock ordering and statistics
+ *
+ * Lockdep-lite: each CPU keeps a small stack of the locks it holds.
+ * Preemption is off while any lock is held, so the stack never moves
+ * between CPUs. A lock taken at an order not above the top of the stack
+ * is reported once per lock; a lock the CPU already holds would spin
+ * forever, so that stops the kernel with the lock name on screen instead.
+ *
+ * Statistics are updated by the CPU holding the lock, so they need no
+ * locking of their own. A lock joins the lockstat list the first time
+ * it is taken.
+ */
+
+#include "spinlock.h"
+#include "kernel.h"
+#include "klog.h"
+#include "smp.h"
+
+#define LOCKDEP_DEPTH 8
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+#if LOCKDEP
+typedef struct
+{
+    uint32_t depth;
+    spinlock_t *held[LOCKDEP_DEPTH];
+} held_locks_t;
+
+static held_locks_t held_locks[SMP_MAX_CPUS];
+#endif
+
+#if SPINLOCK_STATS
+static spinlock_t *stats_list = NULL;
+#endif
+
+/* ================================================================
+ * SLOW PATH
+ * ================================================================ */
+
+void spin_lock_wait(spinlock_t *lock, uint16_t ticket)
+{
+#if SPINLOCK_STATS
+    uint64_t start = rdtsc();
+#endif
+
+    /* Spin on a plain read so the cache line stays shared */
+    while (__atomic_load_n(&lock->ticket.owner, __ATOMIC_ACQUIRE) != ticket)
+        __asm__ volatile("pause");
+
+#if SPINLOCK_STATS
+    /* Ours now, so the counters are safe to touch */
+    lock->stats.contended++;
+    lock->stats.spin_cycles += rdtsc() - start;
+#endif
+}
+
+/* ================================================================
+ * LOCKDEP
+ * ================================================================ */
+
+#if LOCKDEP
+static void lockdep_fatal(spinlock_t *lock)
+{
+    __asm__ volatile("cli");
+    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_RED, VGA_COLOR_BLACK));
+    terminal_writestring("\n[LOCKDEP] Recursive acquisition of lock '");
+    terminal_writestring(lock->name ? lock->name : "?");
+    terminal_writestring("' on CPU ");
+    terminal_write_dec(smp_processor_id());
+    terminal_writestring(" - system halted\n");
+
+    for (;;)
+        __asm__ volatile("hlt");
+}
+#endif
+
+void spin_lock_acquire_check(spinlock_t *lock)
+{
+#if LOCKDEP
+    uint32_t cpu = smp_processor_id();
+    held_locks_t *held = &held_locks[cpu];
+
+    if (lock->holder == cpu + 1)
+        lockdep_fatal(lock);
+
+    if (!held->depth || lock->order == LOCK_ORDER_NONE || lock->order_warned)
+        return;
+
+    spinlock_t *top = held->held[held->depth - 1];
+    if (top->order != LOCK_ORDER_NONE && lock->order <= top->order) {
+        lock->order_warned = true;
+        klog_warn(KLOG_CORE, "lock order: '%s' (%u) taken while holding '%s' (%u)",
+                  lock->name, lock->order, top->name, top->order);
+    }
+#else
+    (void)lock;
+#endif
+}
+
+/* ================================================================
+ * ACQUIRE / RELEASE HOOKS
+ * ================================================================ */
+
+#if SPINLOCK_STATS
+static void stats_register(spinlock_t *lock)
+{
+    spinlock_t *head = __atomic_load_n(&stats_list, __ATOMIC_RELAXED);
+    do {
+        lock->stats_next = head;
+    } while (!__atomic_compare_exchange_n(&stats_list, &head, lock, false,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    lock->registered = true;
+}
+#endif
+
+void spin_lock_acquired(spinlock_t *lock)
+{
+#if LOCKDEP
+    uint32_t cpu = smp_processor_id();
+    held_locks_t *held = &held_locks[cpu];
+
+    lock->holder = (uint16_t)(cpu + 1);
+    if (held->depth < LOCKDEP_DEPTH)
+        held->held[held->depth] = lock;
+    held->depth++;
+#endif
+
+#if SPINLOCK_STATS
+    if (!lock->registered)
+        stats_register(lock);
+    lock->stats.acquisitions++;
+    lock->stats.acquired_at = rdtsc();
+#endif
+}
+
+void spin_lock_released(spinlock_t *lock)
+{
+#if SPINLOCK_STATS
+    uint64_t hold = rdtsc() - lock->stats.acquired_at;
+    lock->stats.hold_cycles += hold;
+    if (hold > lock->stats.max_hold)
+        lock->stats.max_hold = hold;
+#endif
+
+#if LOCKDEP
+    held_locks_t *held = &held_locks[smp_processor_id()];
+
+    lock->holder = 0;
+    if (!held->depth)
+        return;
+
+    /* Usually the top entry; unlocking out of order is allowed */
+    uint32_t top = held->depth < LOCKDEP_DEPTH ? held->depth : LOCKDEP_DEPTH;
+    for (uint32_t i = top; i-- > 0;) {
+        if (held->held[i] == lock) {
+            for (uint32_t j = i; j + 1 < top; j++)
+                held->held[j] = held->held[j + 1];
+            break;
+        }
+    }
+    held->depth--;
+#endif
+}
+
+/* ================================================================
+ * LOCKSTAT
+ * ================================================================ */
+
+void spinlock_show_stats(void)
+{
+#if SPINLOCK_STATS
+    char line[96];
+
+    terminal_writestring("Lock         Acquired  Contended  Avg spin  Avg hold  Max hold (cycles)\n");
+    for (spinlock_t *lock = stats_list; lock; lock = lock->stats_next) {
+        spinlock_stats_t s = lock->stats;
+        uint64_t avg_spin = s.contended ? div_u64(s.spin_cycles, s.contended) : 0;
+        uint64_t avg_hold = s.acquisitions ? div_u64(s.hold_cycles, s.acquisitions) : 0;
+
+        ksnprintf(line, sizeof(line), "%-12s %8u  %9u  %8llu  %8llu  %8llu\n",
+                  lock->name ? lock->name : "?", s.acquisitions, s.contended,
+                  avg_spin, avg_hold, s.max_hold);
+        terminal_writestring(line);
+    }
+#else
+    terminal_writestring("Lock statistics are disabled (SPINLOCK_STATS)\n");
+#endif
+}
+
+void spinlock_reset_stats(void)
+{
+#if SPINLOCK_STATS
+    for (spinlock_t *lock = stats_list; lock; lock = lock->stats_next) {
+        uint32_t flags = irq_save();
+        uint64_t acquired_at = lock->stats.acquired_at;
+        memset(&lock->stats, 0, sizeof(lock->stats));
+        lock->stats.acquired_at = acquired_at;
+        irq_restore(flags);
+    }
+#endif
+}
@@ -0,0 +1,130 @@
+/* kernel/spinlock.h - Spinlocks
+ *
+ * Busy-wait locks for data shared between CPUs. Disabling interrupts
+ * only protects against the local CPU; once application processors run
+ * kernel code, structures they touch need one of these as well.
+ *
+ * Ticket locks: a CPU takes the next ticket and spins until the owner
+ * counter reaches it, so waiters get the lock in arrival order and no
+ * CPU can be starved by a faster neighbour.
+ *
+ * Holding a spinlock disables preemption (preempt.h), so the holder is
+ * never switched out for a task that would spin on the same lock. The
+ * _irqsave variants also disable interrupts on the local CPU, and must
+ * be used for any lock that an interrupt handler can take - otherwise
+ * the handler would spin forever on a lock its own CPU holds. Locks
+ * only ever taken by tasks can use plain spin_lock() and leave
+ * interrupts on.
+ *
+ * Debugging (spinlock.c):
+ *   LOCKDEP         - every lock has an order; taking a lock whose
+ *                     order is not above the last one this CPU holds is
+ *                     reported once, taking a lock this CPU already
+ *                     holds stops the kernel
+ *   SPINLOCK_STATS  - per-lock acquisition, contention and hold-time
+ *                     counters (rdtsc), shown by "lockstat"
+ */
+
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "kernel.h"
+#include "preempt.h"
+#include "spinlock_types.h"
+
+/* ================================================================
+ * SLOW PATH AND DEBUG HOOKS (spinlock.c)
+ * ================================================================ */
+
+void spin_lock_wait(spinlock_t *lock, uint16_t ticket);
+void spin_lock_acquire_check(spinlock_t *lock);
+void spin_lock_acquired(spinlock_t *lock);
+void spin_lock_released(spinlock_t *lock);
+
+/* Print the per-lock statistics / clear them */
+void spinlock_show_stats(void);
+void spinlock_reset_stats(void);
+
+/* ================================================================
+ * LOCKING
+ * ================================================================ */
+
+static inline void spin_lock_init(spinlock_t *lock, const char *name, uint16_t order)
+{
+    spinlock_t init = SPINLOCK_INIT(name, order);
+    *lock = init;
+}
+
+static inline void spin_lock(spinlock_t *lock)
+{
+    preempt_disable();
+#if LOCKDEP
+    spin_lock_acquire_check(lock);
+#endif
+    uint16_t ticket = __atomic_fetch_add(&lock->ticket.next, 1, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&lock->ticket.owner, __ATOMIC_ACQUIRE) != ticket)
+        spin_lock_wait(lock, ticket);
+#if LOCKDEP || SPINLOCK_STATS
+    spin_lock_acquired(lock);
+#endif
+}
+
+/* Take the lock only if it is free right now */
+static inline bool spin_trylock(spinlock_t *lock)
+{
+    preempt_disable();
+    uint32_t old = lock->val;
+    if ((uint16_t)old != (uint16_t)(old >> 16) ||
+        !__atomic_compare_exchange_n(&lock->val, &old, old + 0x10000, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        preempt_enable();
+        return false;
+    }
+#if LOCKDEP || SPINLOCK_STATS
+    spin_lock_acquired(lock);
+#endif
+    return true;
+}
+
+/* Release without the preemption check (preempt_enable_no_resched()
+ * still has to follow) */
+static inline void spin_unlock_no_resched(spinlock_t *lock)
+{
+#if LOCKDEP || SPINLOCK_STATS
+    spin_lock_released(lock);
+#endif
+    __atomic_store_n(&lock->ticket.owner, (uint16_t)(lock->ticket.owner + 1),
+                     __ATOMIC_RELEASE);
+}
+
+static inline void spin_unlock(spinlock_t *lock)
+{
+    spin_unlock_no_resched(lock);
+    preempt_enable();
+}
+
+static inline bool spin_is_locked(spinlock_t *lock)
+{
+    uint32_t val = lock->val;
+    return (uint16_t)val != (uint16_t)(val >> 16);
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t *lock)
+{
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+/* Interrupts come back on before the preemption check, so a switch
+ * that became due while the lock was held happens right here */
+static inline void spin_unlock_irqrestore(spinlock_t *lock, uint32_t flags)
+{
+    spin_unlock_no_resched(lock);
+    irq_restore(flags);
+    preempt_enable();
+}
+
+#endif /* SPINLOCK_H */
@@ -0,0 +1,87 @@
+/* kernel/spinlock_types.h - Spinlock Type and Lock Orders
+ *
+ * Split from spinlock.h so that structures embedding a lock (wait
+ * queues, which task_t embeds in turn) can be declared without pulling
+ * in preempt.h and task.h.
+ */
+
+#ifndef SPINLOCK_TYPES_H
+#define SPINLOCK_TYPES_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define LOCKDEP 1
+#define SPINLOCK_STATS 1
+
+/* ================================================================
+ * LOCK ORDER
+ *
+ * A CPU may only take locks in increasing order. Locks that are never
+ * nested with others can use LOCK_ORDER_NONE, which is not checked.
+ * ================================================================ */
+
+#define LOCK_ORDER_NONE   0
+#define LOCK_ORDER_VFS    10   /* File descriptor table */
+#define LOCK_ORDER_WQ     25   /* Workqueue item lists */
+#define LOCK_ORDER_TASKS  28   /* Task list, parent/child links */
+#define LOCK_ORDER_SLEEP  29   /* Mutex PI, semaphores, futex buckets */
+#define LOCK_ORDER_WAITQ  30   /* Wait queue lists */
+#define LOCK_ORDER_SCHED  31   /* Run queues and sleep heap */
+#define LOCK_ORDER_PID    35   /* PID bitmap and hash */
+#define LOCK_ORDER_HEAP   40   /* Kernel heap free list */
+#define LOCK_ORDER_TIMER  45   /* Timer wheel */
+#define LOCK_ORDER_FAULT  48   /* Page fault statistics, fault-around list */
+#define LOCK_ORDER_PMM    50   /* Physical frame bitmap */
+#define LOCK_ORDER_SHRINKER 55 /* Shrinker list (never held across callbacks) */
+#define LOCK_ORDER_FPU    60   /* FXSAVE area pool */
+
+/* ================================================================
+ * TYPES
+ * ================================================================ */
+
+typedef struct spinlock_stats
+{
+    uint32_t acquisitions;
+    uint32_t contended;       /* Acquisitions that had to wait */
+    uint64_t spin_cycles;     /* Total cycles spent waiting */
+    uint64_t hold_cycles;     /* Total cycles held */
+    uint64_t max_hold;        /* Longest single hold */
+    uint64_t acquired_at;     /* rdtsc of the current acquisition */
+} spinlock_stats_t;
+
+typedef struct spinlock
+{
+    union {
+        volatile uint32_t val;
+        struct {
+            volatile uint16_t owner;  /* Ticket being served */
+            volatile uint16_t next;   /* Next ticket to hand out */
+        } ticket;
+    };
+    const char *name;
+    uint16_t order;               /* LOCK_ORDER_* */
+    volatile uint16_t holder;     /* CPU + 1, 0 when free (LOCKDEP) */
+    bool order_warned;            /* Order violation already reported */
+#if SPINLOCK_STATS
+    bool registered;              /* On the lockstat list */
+    spinlock_stats_t stats;
+    struct spinlock *stats_next;
+#endif
+} spinlock_t;
+
+#define SPINLOCK_INIT(lock_name, lock_order) \
+    { .val = 0, .name = (lock_name), .order = (lock_order) }
+
+/* For locks embedded in objects that get freed (a task's wait queue):
+ * they never go on the lockstat list, which would keep pointing at
+ * them afterwards. */
+#if SPINLOCK_STATS
+#define SPINLOCK_INIT_UNTRACKED(lock_name, lock_order) \
+    { .val = 0, .name = (lock_name), .order = (lock_order), .registered = true }
+#else
+#define SPINLOCK_INIT_UNTRACKED(lock_name, lock_order) \
+    SPINLOCK_INIT(lock_name, lock_order)
+#endif
+
+#endif /* SPINLOCK_TYPES_H */
@@ -5,8 +5,11 @@
 
 .section .text
 .global task_switch_asm
+.global task_user_entry
+.global task_fork_return
 
 .set CONTEXT_OFFSET, 44
+.set ON_CPU_OFFSET, CONTEXT_OFFSET+68  /* task_t.on_cpu, right after context */
 
 /* void task_switch_asm(task_t *old_task, task_t *new_task) */
 task_switch_asm:
@@ -67,6 +70,9 @@ task_switch_asm:
     pop %ecx
     mov %ecx, CONTEXT_OFFSET+56(%eax)  /* eflags */
     
+    /* Old task fully saved: another CPU may run it from here on */
+    movl $0, ON_CPU_OFFSET(%eax)
+    
 .load_new:
     /* ====== LOAD NEW TASK ====== */
     /* edx contains new_task */
@@ -102,7 +108,36 @@ task_switch_asm:
     mov CONTEXT_OFFSET+28(%edx), %eax
     mov CONTEXT_OFFSET+20(%edx), %edx
     
-    sti                         /* Re-enable interrupts */
+    /* No sti: EFLAGS above is exactly what the task had (IF clear for a
+     * task that switched away, set for a new kernel task) */
     ret                         /* Jump to saved EIP */
 
+/* First entry of a user task: task_switch() points the context here
+ * with ESP at the IRET frame from task_setup_user_context(). Clear
+ * every register so nothing leaks from the kernel into ring 3. */
+task_user_entry:
+    cli
+    mov $0x23, %ax
+    mov %ax, %ds
+    mov %ax, %es
+    mov %ax, %fs
+    mov %ax, %gs
+    xor %eax, %eax
+    xor %ebx, %ebx
+    xor %ecx, %ecx
+    xor %edx, %edx
+    xor %esi, %esi
+    xor %edi, %edi
+    xor %ebp, %ebp
+    iret
+
+/* First run of a forked child: sys_fork() points the context here with
+ * ESP at a copy of the parent's syscall frame (struct registers, EAX 0)
+ * on top of the child's kernel stack. Leave the way syscall_stub does. */
+task_fork_return:
+    pop %ds
+    popa
+    add $8, %esp                /* int_no, err_code */
+    iret
+
 .section .note.GNU-stack,"",@progbits
\ No newline at end of file
@@ -8,6 +8,12 @@
 #include "scheduler.h"
 #include "task.h"
 #include "elf.h"
+#include "klog.h"
+#include "fpu.h"
+#include "pid.h"
+#include "futex.h"
+#include "clocksource.h"
+#include "vvar.h"
 #include "../fs/vfs.h"
 #include "../mm/vmm.h"
 #include "../mm/pmm.h"
@@ -16,80 +22,8 @@
  * HELPER FUNCTIONS
  * ================================================================ */
 
-/* Clone a page directory for fork() */
-static uint32_t *clone_page_directory(uint32_t *src_pd)
-{
-    /* Allocate new page directory - use PMM for page-aligned allocation */
-    uint32_t *new_pd = (uint32_t *)pmm_alloc_block();
-    if (!new_pd)
-    {
-        terminal_writestring("[FORK] Failed to allocate page directory\n");
-        return NULL;
-    }
-
-    /* Clear it */
-    memset(new_pd, 0, 4096);
-
-    /* Copy kernel mappings (upper 1GB) - these are shared */
-    for (int i = 768; i < 1024; i++)
-    {
-        new_pd[i] = src_pd[i];
-    }
-
-    /* Clone user space mappings (lower 3GB) */
-    for (int i = 0; i < 768; i++)
-    {
-        if (!(src_pd[i] & 0x1))
-            continue; /* Not present, skip */
-
-        /* Get source page table */
-        uint32_t *src_pt = (uint32_t *)(src_pd[i] & ~0xFFF);
-
-        /* Allocate new page table - use PMM for page-aligned allocation */
-        uint32_t *new_pt = (uint32_t *)pmm_alloc_block();
-        if (!new_pt)
-        {
-            terminal_writestring("[FORK] Failed to allocate page table\n");
-            /* TODO: proper cleanup on failure */
-            return NULL;
-        }
-
-        /* Copy page table entries */
-        for (int j = 0; j < 1024; j++)
-        {
-            if (!(src_pt[j] & 0x1))
-                continue; /* Not present, skip */
-
-            /* Allocate new physical page */
-            uint32_t new_phys = (uint32_t)pmm_alloc_block();
-            if (!new_phys)
-            {
-                terminal_writestring("[FORK] Failed to allocate physical page\n");
-                /* TODO: proper cleanup */
-                return NULL;
-            }
-
-            /* Get source physical page */
-            uint32_t src_phys = src_pt[j] & ~0xFFF;
-
-            /* Copy page contents - need to map both temporarily */
-            /* For simplicity, assuming we can access them directly */
-            memcpy((void *)new_phys, (void *)src_phys, 4096);
-
-            /* Set page table entry with same flags */
-            new_pt[j] = new_phys | (src_pt[j] & 0xFFF);
-        }
-
-        /* Set page directory entry with same flags */
-        new_pd[i] = ((uint32_t)new_pt) | (src_pd[i] & 0xFFF);
-    }
-
-    return new_pd;
-}
-
-/* Note: Child's context is copied from parent's task structure in sys_fork(),
- * not from the interrupt registers. The child will resume with the same
- * context as the parent had when fork() was called. */
+/* First instructions of a forked child (switch.s) */
+extern void task_fork_return(void);
 
 /* ================================================================
  * SYSCALL IMPLEMENTATIONS
@@ -132,10 +66,12 @@ int sys_write(const char *msg)
 
 int sys_read(char *buf, size_t len)
 {
-    /* TODO: Implement keyboard read */
-    (void)buf;
-    (void)len;
-    return -1;
+    /* Validate pointer */
+    if (!buf || (uint32_t)buf >= 0xC0000000 || len > 0xC0000000 - (uint32_t)buf)
+        return -1;
+
+    /* Keyboard input; sleeps on the keyboard wait queue until a key arrives */
+    return (int)keyboard_read(buf, len);
 }
 
 void sys_yield(void)
@@ -153,74 +89,81 @@ void sys_sleep(uint32_t ms)
     task_sleep(ms);
 }
 
-int sys_fork(void)
+int sys_fork(struct registers *regs)
 {
-    if (!current_task)
+    task_t *parent = current_task;
+
+    if (!parent || !parent->address_space)
     {
-        terminal_writestring("[FORK] ERROR: No current task\n");
+        terminal_writestring("[FORK] ERROR: Only user tasks can fork\n");
         return -1;
     }
 
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
     terminal_writestring("[FORK] Parent PID ");
-    terminal_write_dec(current_task->pid);
+    terminal_write_dec(parent->pid);
     terminal_writestring(" is forking...\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 
-    /* Create child task structure */
-    task_t *child = (task_t *)kmalloc(sizeof(task_t));
+    /* Create child task structure: a copy of the parent owning nothing */
+    task_t *child = task_dup(parent);
     if (!child)
     {
         terminal_writestring("[FORK] ERROR: Failed to allocate child task\n");
         return -1;
     }
 
-    /* Copy parent's entire task structure */
-    memcpy(child, current_task, sizeof(task_t));
-
-    /* Assign new PID */
-    static uint32_t next_fork_pid = 100; /* Start fork PIDs at 100 */
-    child->pid = next_fork_pid++;
+    ksnprintf(child->name, sizeof(child->name), "%s-child", parent->name);
 
-    /* Update name */
-    strcat(child->name, "-child");
+    /* From here on task_destroy() frees whatever the child got */
+    int pid = pid_alloc();
+    if (pid < 0)
+    {
+        terminal_writestring("[FORK] ERROR: Out of PIDs\n");
+        goto fail;
+    }
+    child->pid = (uint32_t)pid;
 
-    /* Set up parent-child relationship */
-    task_add_child(current_task, child);
+    /* Own copy of the FPU state, not the parent's save area */
+    if (fpu_fork(parent, child) < 0)
+    {
+        terminal_writestring("[FORK] ERROR: Failed to allocate FPU state\n");
+        goto fail;
+    }
 
-    /* Clone page directory (deep copy of memory) */
-    child->page_directory = clone_page_directory(current_task->page_directory);
-    if (!child->page_directory)
+    /* Deep copy of user memory (the user stack included) */
+    child->address_space = vmm_clone_as(parent->address_space);
+    if (!child->address_space)
     {
-        terminal_writestring("[FORK] ERROR: Failed to clone page directory\n");
-        kfree(child);
-        return -1;
+        terminal_writestring("[FORK] ERROR: Failed to clone address space\n");
+        goto fail;
     }
+    child->page_directory = child->address_space->page_dir;
+    vvar_set_pid(child->address_space, child->pid);
 
-    /* Allocate new kernel stack */
-    child->kernel_stack = (uint32_t)kmalloc(4096);
-    if (!child->kernel_stack)
+    if (task_alloc_kernel_stack(child) < 0)
     {
         terminal_writestring("[FORK] ERROR: Failed to allocate kernel stack\n");
-        /* TODO: free page directory */
-        kfree(child);
-        return -1;
+        goto fail;
     }
 
-    /* NOTE: User stack is already cloned as part of page directory */
-
-    /* Child starts in READY state */
+    /* The child returns from this same system call, with 0: its first
+     * switch lands in task_fork_return(), which unwinds a copy of our
+     * syscall frame from the top of its own kernel stack */
+    struct registers *frame = (struct registers *)(child->kernel_stack + 4096) - 1;
+    *frame = *regs;
+    frame->eax = 0;
+
+    child->context.esp = (uint32_t)frame;
+    child->context.eip = (uint32_t)task_fork_return;
+    child->context.eflags = 0x002;
+    child->context.ds = child->context.es = 0x10;
+    child->context.fs = child->context.gs = 0x10;
+    child->first_run = false;
+    child->acct_mode = ACCT_USER;
     child->state = TASK_READY;
-    child->exit_code = 0;
-    child->waited = false;
-    child->first_child = NULL;
-    child->next_sibling = NULL;
 
-    /* CRITICAL: Set child's EAX to 0 so it knows it's the child */
-    child->context.eax = 0;
-
-    /* Add to scheduler queue */
-    extern void scheduler_add_task(task_t * task);
+    task_register(child, parent);
     scheduler_add_task(child);
 
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -229,81 +172,87 @@ int sys_fork(void)
     terminal_writestring("\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 
-    /* Return child PID to parent, 0 to child */
+    /* Return child PID to parent */
     return child->pid;
+
+fail:
+    task_destroy(child);
+    return -1;
 }
 
 int sys_wait(int *status)
 {
-    if (!current_task)
+    task_t *parent = current_task;
+
+    if (!parent)
     {
         return -1;
     }
 
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BLUE, VGA_COLOR_BLACK));
     terminal_writestring("[WAIT] Parent PID ");
-    terminal_write_dec(current_task->pid);
+    terminal_write_dec(parent->pid);
     terminal_writestring(" waiting for children...\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 
-    /* Check if we have any children */
-    if (!current_task->first_child)
-    {
-        terminal_writestring("[WAIT] No children to wait for\n");
-        return -1; /* No children */
-    }
+    /* Look for zombie children; task_exit() wakes child_exit_wq */
+    DEFINE_WAIT(wait);
+    task_t *child;
 
-    /* Look for zombie children */
     while (1)
     {
-        task_t *child = current_task->first_child;
+        prepare_to_wait(&parent->child_exit_wq, &wait);
 
-        while (child)
+        bool has_children;
+        child = task_take_zombie(parent, &has_children);
+        if (child)
+            break;
+
+        /* Check if we have any children */
+        if (!has_children)
         {
-            if (child->state == TASK_ZOMBIE && !child->waited)
-            {
-                /* Found a zombie child! */
-                int pid = child->pid;
-                int exit_code = child->exit_code;
-
-                /* Mark as waited */
-                child->waited = true;
-
-                /* Copy exit status if pointer valid */
-                if (status && (uint32_t)status < 0xC0000000)
-                {
-                    *status = exit_code;
-                }
-
-                terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
-                terminal_writestring("[WAIT] ✓ Parent ");
-                terminal_write_dec(current_task->pid);
-                terminal_writestring(" reaped child ");
-                terminal_write_dec(pid);
-                terminal_writestring(" (exit code: ");
-                terminal_write_dec(exit_code);
-                terminal_writestring(")\n");
-                terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-
-                /* Remove from children list and clean up */
-                task_remove_child(current_task, child);
-
-                /* TODO: Free child's memory properly */
-                /* For now, just mark it for cleanup */
-
-                return pid;
-            }
-
-            child = child->next_sibling;
+            finish_wait(&parent->child_exit_wq, &wait);
+            terminal_writestring("[WAIT] No children to wait for\n");
+            return -1; /* No children */
         }
 
-        /* No zombie children found - block and wait */
+        /* No zombie children found - sleep until one exits */
         terminal_writestring("[WAIT] Blocking until child exits...\n");
-        task_block();
-        task_yield();
+        wait_schedule();
 
         /* When we wake up, check again */
     }
+
+    finish_wait(&parent->child_exit_wq, &wait);
+
+    int pid = child->pid;
+    int exit_code = child->exit_code;
+
+    /* Its CPU time now counts towards RUSAGE_CHILDREN */
+    parent->child_utime += child->utime + child->child_utime;
+    parent->child_stime += child->stime + child->child_stime;
+    parent->child_irq_time += child->irq_time + child->child_irq_time;
+
+    /* Copy exit status if pointer valid */
+    if (status && (uint32_t)status < 0xC0000000)
+    {
+        *status = exit_code;
+    }
+
+    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
+    terminal_writestring("[WAIT] ✓ Parent ");
+    terminal_write_dec(parent->pid);
+    terminal_writestring(" reaped child ");
+    terminal_write_dec(pid);
+    terminal_writestring(" (exit code: ");
+    terminal_write_dec(exit_code);
+    terminal_writestring(")\n");
+    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+
+    /* Gone for good: memory, kernel stack and PID */
+    task_destroy(child);
+
+    return pid;
 }
 
 int sys_exec(const char *path)
@@ -350,25 +299,9 @@ int sys_exec(const char *path)
         return -1;
     }
 
-    terminal_writestring("[EXEC] Read ");
-    terminal_write_dec(bytes_read);
-    terminal_writestring(" bytes\n");
-
-    /* DEBUG: Verify ELF data at offset 0x1000 */
-    terminal_writestring("[EXEC_DEBUG] ELF magic: ");
     uint8_t *elf_bytes = (uint8_t *)elf_data;
-    for (int i = 0; i < 4; i++) {
-        terminal_write_hex(elf_bytes[i]);
-        terminal_putchar(' ');
-    }
-    terminal_writestring("\n");
-
-    terminal_writestring("[EXEC_DEBUG] Data at offset 0x1000: ");
-    for (int i = 0; i < 8; i++) {
-        terminal_write_hex(elf_bytes[0x1000 + i]);
-        terminal_putchar(' ');
-    }
-    terminal_writestring("\n");
+    klog_debug(KLOG_SYSCALL, "exec %s: read %d bytes, magic %02x %02x %02x %02x",
+               path, bytes_read, elf_bytes[0], elf_bytes[1], elf_bytes[2], elf_bytes[3]);
 
     /* If we're in kernel mode (shell), create a NEW user task */
     if (!current_task || current_task->ring == 0)
@@ -409,6 +342,9 @@ int sys_exec(const char *path)
 
     kfree(elf_data);
 
+    /* The new program starts with clean FPU registers */
+    fpu_task_free(current_task);
+
     terminal_writestring("[EXEC] ELF loaded, entry point: 0x");
     terminal_write_hex(current_task->entry_point);
     terminal_writestring("\n");
@@ -424,18 +360,127 @@ int sys_exec(const char *path)
     return 0;
 }
 
+static void cycles_to_timeval(uint64_t cycles, k_timeval_t *tv)
+{
+    uint32_t usec;
+    uint64_t us = timer_cycles_to_us(cycles);
+
+    tv->tv_sec = (uint32_t)div_u64_rem(us, 1000000, &usec);
+    tv->tv_usec = usec;
+}
+
+int sys_getrusage(int who, rusage_t *usage)
+{
+    if (!current_task || !usage || (uint32_t)usage >= 0xC0000000)
+    {
+        return -1;
+    }
+
+    /* Bring the running interval up to date first */
+    acct_enter(ACCT_KERNEL);
+
+    task_t *task = current_task;
+    rusage_t ru;
+    memset(&ru, 0, sizeof(ru));
+
+    if (who == RUSAGE_SELF)
+    {
+        cycles_to_timeval(task->utime, &ru.ru_utime);
+        cycles_to_timeval(task->stime, &ru.ru_stime);
+        cycles_to_timeval(task->irq_time, &ru.ru_irqtime);
+        ru.ru_nvcsw = task->nvcsw;
+        ru.ru_nivcsw = task->nivcsw;
+    }
+    else if (who == RUSAGE_CHILDREN)
+    {
+        cycles_to_timeval(task->child_utime, &ru.ru_utime);
+        cycles_to_timeval(task->child_stime, &ru.ru_stime);
+        cycles_to_timeval(task->child_irq_time, &ru.ru_irqtime);
+    }
+    else
+    {
+        return -1;
+    }
+
+    memcpy(usage, &ru, sizeof(ru));
+    return 0;
+}
+
+int sys_sched_setscheduler(uint32_t pid, const void *attr)
+{
+    if (!attr || (uint32_t)attr >= 0xC0000000)
+    {
+        return -1;
+    }
+
+    sched_attr_t kattr;
+    memcpy(&kattr, attr, sizeof(kattr));
+    return scheduler_setscheduler(pid, &kattr);
+}
+
+int sys_futex(uint32_t *uaddr, int op, uint32_t val)
+{
+    switch (op)
+    {
+    case FUTEX_WAIT:
+        return futex_wait(uaddr, val);
+    case FUTEX_WAKE:
+        return futex_wake(uaddr, val);
+    default:
+        return -1;
+    }
+}
+
+/* Zeroed pages that a fork()ed child shares with its parent instead of
+ * getting a copy. Returns the address, or -1. */
+uint32_t sys_mmap_shared(uint32_t size)
+{
+    if (!current_task || !current_task->address_space || !size)
+    {
+        return (uint32_t)-1;
+    }
+
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    uint32_t addr = vmm_map_shared(current_task->address_space, pages);
+    return addr ? addr : (uint32_t)-1;
+}
+
+int sys_sched_getinfo(uint32_t pid, void *info)
+{
+    if (!info || (uint32_t)info >= 0xC0000000)
+    {
+        return -1;
+    }
+
+    sched_info_t kinfo;
+    int ret = scheduler_get_info(pid, &kinfo);
+    memcpy(info, &kinfo, sizeof(kinfo));
+    return ret;
+}
+
+int sys_clock_gettime(int clock_id, k_timespec_t *ts)
+{
+    if (clock_id != CLOCK_MONOTONIC || !ts || (uint32_t)ts >= 0xC0000000)
+    {
+        return -1;
+    }
+
+    uint32_t nsec;
+    k_timespec_t kts;
+    kts.tv_sec = (uint32_t)div_u64_rem(ktime_get_ns(), NSEC_PER_SEC, &nsec);
+    kts.tv_nsec = nsec;
+    memcpy(ts, &kts, sizeof(kts));
+    return 0;
+}
+
 /* ================================================================
  * SYSCALL DISPATCHER
  * ================================================================ */
 
-void syscall_handler(struct registers *regs)
+static void syscall_dispatch(struct registers *regs)
 {
-    /* Debug output (can be removed later) */
-    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_MAGENTA, VGA_COLOR_BLACK));
-    terminal_writestring("[SYSCALL] Number=");
-    terminal_write_dec(regs->eax);
-    terminal_writestring("\n");
-    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    klog_debug(KLOG_SYSCALL, "syscall %u from PID %u", regs->eax,
+               current_task ? current_task->pid : 0);
 
     uint32_t syscall_num = regs->eax;
 
@@ -482,29 +527,9 @@ void syscall_handler(struct registers *regs)
         break;
 
     case SYS_FORK:
-    {
-        int child_pid = sys_fork();
-
-        if (child_pid > 0)
-        {
-            /* Parent process */
-            regs->eax = child_pid;
-        }
-        else if (child_pid == 0)
-        {
-            /* This shouldn't happen in parent */
-            regs->eax = 0;
-        }
-        else
-        {
-            /* Error */
-            regs->eax = (uint32_t)-1;
-        }
-
-        /* IMPORTANT: Child task needs EAX=0 when it starts */
-        /* This will be set when the child is scheduled */
-    }
-    break;
+        /* The child gets 0 from its own copy of the frame */
+        regs->eax = (uint32_t)sys_fork(regs);
+        break;
 
     case SYS_EXEC:
         regs->eax = sys_exec((const char *)regs->ebx);
@@ -514,12 +539,58 @@ void syscall_handler(struct registers *regs)
         regs->eax = sys_wait((int *)regs->ebx);
         break;
 
+    case SYS_GETRUSAGE:
+        regs->eax = sys_getrusage((int)regs->ebx, (rusage_t *)regs->ecx);
+        break;
+
+    case SYS_SCHED_SETSCHEDULER:
+        regs->eax = sys_sched_setscheduler(regs->ebx, (const void *)regs->ecx);
+        break;
+
+    case SYS_FUTEX:
+        regs->eax = sys_futex((uint32_t *)regs->ebx, (int)regs->ecx, regs->edx);
+        break;
+
+    case SYS_MMAP_SHARED:
+        regs->eax = sys_mmap_shared(regs->ebx);
+        break;
+
+    case SYS_SCHED_GETINFO:
+        regs->eax = sys_sched_getinfo(regs->ebx, (void *)regs->ecx);
+        break;
+
+    case SYS_CLOCK_GETTIME:
+        regs->eax = sys_clock_gettime((int)regs->ebx, (k_timespec_t *)regs->ecx);
+        break;
+
     default:
         regs->eax = (uint32_t)-1;
         break;
     }
 }
 
+/* Time between entry and exit is the caller's kernel time */
+void syscall_handler(struct registers *regs)
+{
+    bool from_user = (regs->cs & 3) == 3;
+
+    if (from_user)
+        acct_enter(ACCT_KERNEL);
+
+    /* The gate cleared IF. A system call is preemptible kernel code
+     * like any other, so give the caller's interrupt state back for the
+     * duration (fork and exec can run for a long time). */
+    if (regs->eflags & 0x200)
+        __asm__ volatile("sti" : : : "memory");
+
+    syscall_dispatch(regs);
+
+    __asm__ volatile("cli" : : : "memory");
+
+    if (from_user)
+        acct_enter(ACCT_USER);
+}
+
 /* ================================================================
  * INITIALIZATION
  * ================================================================ */
@@ -530,5 +601,5 @@ void syscall_init(void)
     idt_set_gate(0x80, (uint32_t)syscall_stub, 0x08, 0xEE);
 
     terminal_writestring("[SYSCALL] System call interface initialized\n");
-    terminal_writestring("[SYSCALL] Available: exit, write, read, yield, getpid, sleep, fork, exec, wait\n");
+    terminal_writestring("[SYSCALL] Available: exit, write, read, yield, getpid, sleep, fork, exec, wait, getrusage, sched_setscheduler, futex, mmap_shared, sched_getinfo, clock_gettime\n");
 }
\ No newline at end of file
@@ -22,8 +22,50 @@ struct registers;
 #define SYS_FORK    6
 #define SYS_EXEC    7
 #define SYS_WAIT    8
+/* 9-11 reserved for open/close/fread (user/ulib.h) */
+#define SYS_GETRUSAGE 12
+#define SYS_SCHED_SETSCHEDULER 13
+#define SYS_FUTEX   14
+#define SYS_MMAP_SHARED 15
+#define SYS_SCHED_GETINFO 16
+#define SYS_CLOCK_GETTIME 17
 
-#define SYSCALL_MAX 9
+#define SYSCALL_MAX 18
+
+/* ================================================================
+ * SYSCALL DATA
+ * ================================================================ */
+
+/* SYS_GETRUSAGE: who */
+#define RUSAGE_SELF      0
+#define RUSAGE_CHILDREN  (-1)   /* Reaped children only */
+
+typedef struct
+{
+    uint32_t tv_sec;
+    uint32_t tv_usec;
+} k_timeval_t;
+
+/* SYS_GETRUSAGE: result (same layout in user/ulib.h) */
+typedef struct
+{
+    k_timeval_t ru_utime;     /* User mode */
+    k_timeval_t ru_stime;     /* Kernel on the task's behalf */
+    k_timeval_t ru_irqtime;   /* Interrupts taken while it ran */
+    uint32_t ru_nvcsw;        /* Voluntary context switches */
+    uint32_t ru_nivcsw;       /* Involuntary context switches */
+} rusage_t;
+
+/* SYS_CLOCK_GETTIME: clock_id */
+#define CLOCK_REALTIME   0      /* No RTC yet: always fails */
+#define CLOCK_MONOTONIC  1      /* Since boot, from ktime_get_ns() */
+
+/* SYS_CLOCK_GETTIME: result (same layout in user/ulib.h) */
+typedef struct
+{
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+} k_timespec_t;
 
 /* ================================================================
  * INITIALIZATION
@@ -48,8 +90,14 @@ int      sys_read(char *buf, size_t len);
 void     sys_yield(void);
 uint32_t sys_getpid(void);
 void     sys_sleep(uint32_t ms);
-int      sys_fork(void);
+int      sys_fork(struct registers *regs);
 int      sys_exec(const char *path);
 int      sys_wait(int *status);
+int      sys_getrusage(int who, rusage_t *usage);
+int      sys_sched_setscheduler(uint32_t pid, const void *attr);
+int      sys_futex(uint32_t *uaddr, int op, uint32_t val);
+uint32_t sys_mmap_shared(uint32_t size);
+int      sys_sched_getinfo(uint32_t pid, void *info);
+int      sys_clock_gettime(int clock_id, k_timespec_t *ts);
 
 #endif /* SYSCALL_H */
\ No newline at end of file
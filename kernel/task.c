@@ -10,6 +10,12 @@
 #include "../mm/vmm.h"
 #include "../mm/pmm.h"
 #include "scheduler.h"
+#include "klog.h"
+#include "tss.h"
+#include "fpu.h"
+#include "pid.h"
+#include "spinlock.h"
+#include "vvar.h"
 
 /* ================================================================
  * USER MODE MEMORY LAYOUT
@@ -22,16 +28,131 @@
 /* ================================================================
  * GLOBAL STATE
  * ================================================================ */
-task_t *current_task = NULL;
-static uint32_t next_pid = 1;
 task_t *kernel_task = NULL;
 static task_t *task_list_head = NULL;
 
+/* Protects task_list_head and every parent/child link */
+static spinlock_t tasklist_lock = SPINLOCK_INIT("tasklist", LOCK_ORDER_TASKS);
+
+/* Adopts orphans and frees them when they exit (task_reaper_init()) */
+static task_t *reaper_task = NULL;
+
 /* ================================================================
  * FORWARD DECLARATIONS
  * ================================================================ */
 static void task_setup_kernel_stack(task_t *task, void (*entry_point)(void));
 extern void task_switch_asm(task_t *old_task, task_t *new_task);
+extern void task_user_entry(void);
+
+/* switch.s clears on_cpu at a fixed offset, right after the context */
+_Static_assert(offsetof(task_t, on_cpu) == 112, "switch.s ON_CPU_OFFSET");
+
+/* ================================================================
+ * TASK CACHE
+ * Freed task_t's and kernel stacks are kept for the next task instead
+ * of going back to the heap, so a steady fork/exit loop does not touch
+ * it at all.
+ * ================================================================ */
+#define TASK_CACHE_MAX 32
+#define KSTACK_ALLOC_SIZE (4096 + 4096) /* One page, aligned up inside */
+
+static spinlock_t task_cache_lock = SPINLOCK_INIT("task_cache", LOCK_ORDER_NONE);
+static task_t *task_cache[TASK_CACHE_MAX];
+static uint32_t kstack_cache[TASK_CACHE_MAX]; /* kmalloc() pointers */
+static task_cache_stats_t cache_stats;
+
+task_t *task_alloc(void)
+{
+    task_t *task = NULL;
+
+    spin_lock(&task_cache_lock);
+    if (cache_stats.cached_tasks)
+    {
+        task = task_cache[--cache_stats.cached_tasks];
+        cache_stats.task_hits++;
+    }
+    else
+    {
+        cache_stats.task_misses++;
+    }
+    spin_unlock(&task_cache_lock);
+
+    if (!task)
+        task = kmalloc(sizeof(task_t));
+    if (task)
+        memset(task, 0, sizeof(task_t));
+    return task;
+}
+
+static void task_free(task_t *task)
+{
+    spin_lock(&task_cache_lock);
+    if (cache_stats.cached_tasks < TASK_CACHE_MAX)
+    {
+        task_cache[cache_stats.cached_tasks++] = task;
+        task = NULL;
+    }
+    spin_unlock(&task_cache_lock);
+
+    if (task)
+        kfree(task);
+}
+
+int task_alloc_kernel_stack(task_t *task)
+{
+    uint32_t raw = 0;
+
+    spin_lock(&task_cache_lock);
+    if (cache_stats.cached_stacks)
+    {
+        raw = kstack_cache[--cache_stats.cached_stacks];
+        cache_stats.stack_hits++;
+    }
+    else
+    {
+        cache_stats.stack_misses++;
+    }
+    spin_unlock(&task_cache_lock);
+
+    if (!raw)
+        raw = (uint32_t)kmalloc(KSTACK_ALLOC_SIZE);
+    if (!raw)
+        return -1;
+
+    /* Keep the original pointer for freeing, run on the aligned page */
+    task->kernel_stack_alloc = raw;
+    task->kernel_stack = (raw + 0xFFF) & ~0xFFF;
+    return 0;
+}
+
+static void task_free_kernel_stack(task_t *task)
+{
+    uint32_t raw = task->kernel_stack_alloc;
+
+    if (!raw)
+        return;
+    task->kernel_stack_alloc = 0;
+    task->kernel_stack = 0;
+
+    spin_lock(&task_cache_lock);
+    if (cache_stats.cached_stacks < TASK_CACHE_MAX)
+    {
+        kstack_cache[cache_stats.cached_stacks++] = raw;
+        raw = 0;
+    }
+    spin_unlock(&task_cache_lock);
+
+    if (raw)
+        kfree((void *)raw);
+}
+
+task_cache_stats_t task_get_cache_stats(void)
+{
+    spin_lock(&task_cache_lock);
+    task_cache_stats_t stats = cache_stats;
+    spin_unlock(&task_cache_lock);
+    return stats;
+}
 
 /* ================================================================
  * INITIALIZATION
@@ -76,6 +197,9 @@ void task_init(void)
     kernel_task->next_sibling = NULL;
     kernel_task->next = NULL;
     kernel_task->waited = false;
+    kernel_task->cpu = 0;
+    kernel_task->is_idle = true;
+    kernel_task->on_cpu = 1;
 
     /* Allocate kernel stack for idle task */
     uint32_t raw_kstack = (uint32_t)kmalloc(4096 + 4096);
@@ -93,7 +217,8 @@ void task_init(void)
     /* Setup stack with idle loop as entry point */
     task_setup_kernel_stack(kernel_task, kernel_idle_loop);
 
-    current_task = kernel_task;
+    cpus[0].idle = kernel_task;
+    cpus[0].current = kernel_task;
     task_list_head = kernel_task;
 
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -101,25 +226,53 @@ void task_init(void)
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 }
 
+/* Idle task of an application processor. The AP is already running on
+ * its stack when it enters ap_main(), so only the first switch away
+ * fills in the context. Not on the task list: it is not a process. */
+task_t *task_create_idle(uint32_t cpu)
+{
+    task_t *idle = kmalloc(sizeof(task_t));
+    if (!idle)
+        return NULL;
+
+    memset(idle, 0, sizeof(task_t));
+
+    uint32_t raw_kstack = (uint32_t)kmalloc(4096 + 4096);
+    if (!raw_kstack)
+    {
+        kfree(idle);
+        return NULL;
+    }
+
+    idle->pid = 0;
+    ksnprintf(idle->name, sizeof(idle->name), "idle/%u", cpu);
+    idle->state = TASK_RUNNING;
+    idle->priority = 255;
+    idle->ring = 0;
+    idle->page_directory = kernel_task->page_directory;
+    idle->kernel_stack_alloc = raw_kstack;
+    idle->kernel_stack = (raw_kstack + 0xFFF) & ~0xFFF;
+    idle->cpu = cpu;
+    idle->is_idle = true;
+    idle->on_cpu = 1;
+
+    return idle;
+}
+
 /* ================================================================
  * PROCESS HIERARCHY MANAGEMENT
+ * The links below are all changed under tasklist_lock.
  * ================================================================ */
-void task_add_child(task_t *parent, task_t *child)
+static void link_child(task_t *parent, task_t *child)
 {
-    if (!parent || !child)
-        return;
-
     child->parent = parent;
     child->parent_pid = parent->pid;
     child->next_sibling = parent->first_child;
     parent->first_child = child;
 }
 
-void task_remove_child(task_t *parent, task_t *child)
+static void unlink_child(task_t *parent, task_t *child)
 {
-    if (!parent || !child)
-        return;
-
     task_t *prev = NULL;
     task_t *curr = parent->first_child;
 
@@ -144,22 +297,112 @@ void task_remove_child(task_t *parent, task_t *child)
     }
 }
 
+void task_add_child(task_t *parent, task_t *child)
+{
+    if (!parent || !child)
+        return;
+
+    spin_lock(&tasklist_lock);
+    link_child(parent, child);
+    spin_unlock(&tasklist_lock);
+}
+
+void task_remove_child(task_t *parent, task_t *child)
+{
+    if (!parent || !child)
+        return;
+
+    spin_lock(&tasklist_lock);
+    unlink_child(parent, child);
+    spin_unlock(&tasklist_lock);
+}
+
+void task_register(task_t *task, task_t *parent)
+{
+    spin_lock(&tasklist_lock);
+    if (parent)
+        link_child(parent, task);
+    task->next = task_list_head;
+    task_list_head = task;
+    spin_unlock(&tasklist_lock);
+
+    pid_hash_add(task);
+}
+
+/* Hand task's children to the reaper. Returns true if one of them is
+ * already a zombie (the reaper must be woken for it). */
+static bool reparent_children(task_t *task)
+{
+    bool zombies = false;
+
+    if (!reaper_task || task == reaper_task)
+        return false;
+
+    task_t *child = task->first_child;
+    while (child)
+    {
+        task_t *next = child->next_sibling;
+
+        if (child->state == TASK_ZOMBIE && !child->waited)
+            zombies = true;
+        link_child(reaper_task, child);
+        child = next;
+    }
+    task->first_child = NULL;
+
+    return zombies;
+}
+
+task_t *task_take_zombie(task_t *parent, bool *has_children)
+{
+    task_t *zombie = NULL;
+
+    spin_lock(&tasklist_lock);
+
+    if (has_children)
+        *has_children = parent->first_child != NULL;
+
+    for (task_t *child = parent->first_child; child; child = child->next_sibling)
+    {
+        if (child->state == TASK_ZOMBIE && !child->waited)
+        {
+            zombie = child;
+            break;
+        }
+    }
+
+    if (zombie)
+    {
+        zombie->waited = true;
+        unlink_child(parent, zombie);
+    }
+
+    spin_unlock(&tasklist_lock);
+    return zombie;
+}
+
 /* ================================================================
  * KERNEL TASK CREATION
  * ================================================================ */
 task_t *task_create(const char *name, void (*entry_point)(void), uint32_t priority)
 {
-    task_t *task = kmalloc(sizeof(task_t));
+    task_t *task = task_alloc();
     if (!task)
     {
         terminal_writestring("[TASK] ERROR: Failed to allocate task structure\n");
         return NULL;
     }
 
-    memset(task, 0, sizeof(task_t));
+    int pid = pid_alloc();
+    if (pid < 0)
+    {
+        terminal_writestring("[TASK] ERROR: Out of PIDs\n");
+        task_free(task);
+        return NULL;
+    }
 
     /* Basic properties */
-    task->pid = next_pid++;
+    task->pid = (uint32_t)pid;
     strncpy(task->name, name, 31);
     task->name[31] = '\0';
     task->state = TASK_READY;
@@ -176,27 +419,23 @@ task_t *task_create(const char *name, void (*entry_point)(void), uint32_t priori
     task->first_child = NULL;
     task->next_sibling = NULL;
 
-    /* Allocate kernel stack: produce a page-aligned stack and keep original pointer */
-    uint32_t raw_kstack = (uint32_t)kmalloc(4096 + 4096);
-    if (!raw_kstack)
+    /* Allocate kernel stack (page-aligned) */
+    if (task_alloc_kernel_stack(task) < 0)
     {
         terminal_writestring("[TASK] ERROR: Failed to allocate kernel stack\n");
-        kfree(task);
+        pid_free(task->pid);
+        task_free(task);
         return NULL;
     }
-    /* Align up to the next 4KB boundary */
-    task->kernel_stack_alloc = raw_kstack; /* new field to store original pointer */
-    task->kernel_stack = (raw_kstack + 0xFFF) & ~0xFFF;
 
     /* Allocate user stack */
     task->user_stack = (uint32_t)kmalloc(4096);
     if (!task->user_stack)
     {
         terminal_writestring("[TASK] ERROR: Failed to allocate user stack\n");
-        if (task->kernel_stack_alloc)
-            kfree((void *)task->kernel_stack_alloc);
-        ;
-        kfree(task);
+        task_free_kernel_stack(task);
+        pid_free(task->pid);
+        task_free(task);
         return NULL;
     }
 
@@ -206,15 +445,8 @@ task_t *task_create(const char *name, void (*entry_point)(void), uint32_t priori
     /* Setup initial stack */
     task_setup_kernel_stack(task, entry_point);
 
-    /* Set parent to current task */
-    if (current_task)
-    {
-        task_add_child(current_task, task);
-    }
-
-    /* Add to task list */
-    task->next = task_list_head;
-    task_list_head = task;
+    /* Child of the current task, on the task list */
+    task_register(task, current_task);
 
     /* Debug output */
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
@@ -237,14 +469,19 @@ task_t *task_create_user(const char *name, void *elf_data, uint32_t priority)
 {
     terminal_writestring("[TASK_CREATE_USER] Allocating task structure...\n");
 
-    task_t *task = kmalloc(sizeof(task_t));
+    task_t *task = task_alloc();
     if (!task)
         return NULL;
 
-    memset(task, 0, sizeof(task_t));
+    int pid = pid_alloc();
+    if (pid < 0)
+    {
+        task_free(task);
+        return NULL;
+    }
 
     /* Basic properties */
-    task->pid = next_pid++;
+    task->pid = (uint32_t)pid;
     strncpy(task->name, name, 31);
     task->name[31] = '\0';
     task->state = TASK_READY;
@@ -252,6 +489,7 @@ task_t *task_create_user(const char *name, void *elf_data, uint32_t priority)
     task->ring = 3; /* USER MODE */
     task->time_slice = 10;
     task->first_run = true;
+    task->acct_mode = ACCT_USER; /* First run irets straight to ring 3 */
 
     /* ------------------------------------------------------------
      * Create a new address space
@@ -259,13 +497,23 @@ task_t *task_create_user(const char *name, void *elf_data, uint32_t priority)
     struct vmm_address_space *as = vmm_create_as();
     if (!as)
     {
-        kfree(task);
+        pid_free(task->pid);
+        task_free(task);
         return NULL;
     }
 
     task->address_space = as;
     task->page_directory = as->page_dir;
 
+    /* Time and PID pages that getpid() and clock_gettime() read */
+    if (vvar_map(as, task->pid) < 0)
+    {
+        vmm_destroy_as(as);
+        pid_free(task->pid);
+        task_free(task);
+        return NULL;
+    }
+
     terminal_writestring("[TASK_CREATE_USER] Page directory: 0x");
     terminal_write_hex((uint32_t)task->page_directory);
     terminal_writestring("\n");
@@ -273,17 +521,14 @@ task_t *task_create_user(const char *name, void *elf_data, uint32_t priority)
     /* ------------------------------------------------------------
      * Allocate kernel stack (page-aligned)
      * ------------------------------------------------------------ */
-    uint32_t raw_kstack = (uint32_t)kmalloc(4096 + 4096);
-    if (!raw_kstack)
+    if (task_alloc_kernel_stack(task) < 0)
     {
         vmm_destroy_as(as);
-        kfree(task);
+        pid_free(task->pid);
+        task_free(task);
         return NULL;
     }
 
-    task->kernel_stack_alloc = raw_kstack;
-    task->kernel_stack = (raw_kstack + 0xFFF) & ~0xFFF;
-
     terminal_writestring("[TASK_CREATE_USER] Kernel stack: 0x");
     terminal_write_hex(task->kernel_stack);
     terminal_writestring("\n");
@@ -294,9 +539,10 @@ task_t *task_create_user(const char *name, void *elf_data, uint32_t priority)
     uint32_t ustack_phys = (uint32_t)pmm_alloc_block();
     if (!ustack_phys)
     {
-        kfree((void *)raw_kstack);
+        task_free_kernel_stack(task);
         vmm_destroy_as(as);
-        kfree(task);
+        pid_free(task->pid);
+        task_free(task);
         return NULL;
     }
 
@@ -329,9 +575,10 @@ task_t *task_create_user(const char *name, void *elf_data, uint32_t priority)
     {
         vmm_unmap_page_in_as(task->address_space, USER_STACK_TOP - PAGE_SIZE);
         pmm_free_block((void *)ustack_phys);
-        kfree((void *)raw_kstack);
+        task_free_kernel_stack(task);
         vmm_destroy_as(as);
-        kfree(task);
+        pid_free(task->pid);
+        task_free(task);
         return NULL;
     }
 
@@ -347,11 +594,7 @@ task_t *task_create_user(const char *name, void *elf_data, uint32_t priority)
     /* ------------------------------------------------------------
      * Parent / task list
      * ------------------------------------------------------------ */
-    if (current_task)
-        task_add_child(current_task, task);
-
-    task->next = task_list_head;
-    task_list_head = task;
+    task_register(task, current_task);
 
     terminal_writestring("[TASK_CREATE_USER] ✓ User task created\n");
     return task;
@@ -379,6 +622,9 @@ static void task_setup_kernel_stack(task_t *task, void (*entry_point)(void))
 
     task->context.esp = (uint32_t)stack;
     task->context.eip = (uint32_t)entry_point;
+    task->context.eflags = 0x202;       /* First run starts with IRQs on */
+    task->context.ds = task->context.es = 0x10;
+    task->context.fs = task->context.gs = 0x10;
 }
 
 /* ================================================================
@@ -404,237 +650,124 @@ void task_setup_user_context(task_t *task)
     task->context.eip = task->entry_point;
 }
 
+/* ================================================================
+ * CPU TIME ACCOUNTING
+ * ================================================================ */
+
+static void acct_charge(cpu_t *cpu, task_t *task)
+{
+    uint64_t now = rdtsc();
+    uint64_t delta = now - cpu->acct_stamp;
+    bool first = cpu->acct_stamp == 0;
+
+    cpu->acct_stamp = now;
+    if (!task || first)
+        return;
+
+    switch (cpu->acct_mode)
+    {
+    case ACCT_USER:
+        task->utime += delta;
+        break;
+    case ACCT_IRQ:
+        task->irq_time += delta;
+        break;
+    default:
+        task->stime += delta;
+        break;
+    }
+}
+
+uint8_t acct_enter(uint8_t mode)
+{
+    uint32_t flags = irq_save();
+    cpu_t *cpu = this_cpu();
+    uint8_t prev = cpu->acct_mode;
+
+    acct_charge(cpu, cpu->current);
+    cpu->acct_mode = mode;
+
+    irq_restore(flags);
+    return prev;
+}
+
+/* Close prev's interval and continue in whatever mode next left off */
+static void acct_switch(task_t *prev, task_t *next)
+{
+    cpu_t *cpu = this_cpu();
+
+    acct_charge(cpu, prev);
+    if (prev)
+    {
+        prev->acct_mode = cpu->acct_mode;
+        if (prev->state == TASK_READY)
+            prev->nivcsw++;
+        else
+            prev->nvcsw++;
+    }
+    cpu->acct_mode = next->acct_mode;
+}
+
 /* ================================================================
  * TASK SWITCHING
  * ================================================================ */
 void task_switch(task_t *new_task)
 {
-    __asm__ volatile("cli");
+    /* Callers normally have interrupts off already; the resumed task
+     * gets its own EFLAGS back and its caller restores IF from there */
+    uint32_t flags = irq_save();
 
     if (!new_task || new_task == current_task)
     {
-        __asm__ volatile("sti"); // Re-enable if returning early
+        irq_restore(flags);
         return;
     }
 
     task_t *old_task = current_task;
 
+    acct_switch(old_task, new_task);
+
     /* Update states */
     if (old_task && old_task->state == TASK_RUNNING)
         old_task->state = TASK_READY;
 
     new_task->state = TASK_RUNNING;
-    current_task = new_task;
-
-    /* Debug output */
-    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_MAGENTA, VGA_COLOR_BLACK));
-    terminal_writestring("[SWITCH] Switching to PID ");
-    terminal_write_dec(new_task->pid);
-    terminal_writestring(" (");
-    terminal_writestring(new_task->name);
-    terminal_writestring(")\n");
-    terminal_writestring("[SWITCH] Ring=");
-    terminal_write_dec(new_task->ring);
-    terminal_writestring(", EIP=0x");
-    terminal_write_hex(new_task->context.eip);
-    terminal_writestring(", Entry=0x");
-    terminal_write_hex(new_task->entry_point);
-    terminal_writestring("\n");
-    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    this_cpu()->current = new_task;
 
-    /* ADD DELAY so you can read it */
-    for (volatile int i = 0; i < 10000000; i++)
-        ;
+    klog_debug(KLOG_SCHED, "switch to PID %u (%s) ring %u eip %08x",
+               new_task->pid, new_task->name, new_task->ring, new_task->context.eip);
 
     /* Switch page directory if different */
     if (new_task->page_directory &&
         (!old_task || new_task->page_directory != old_task->page_directory))
     {
-        terminal_writestring("[SWITCH] Loading page directory 0x");
-        terminal_write_hex((uint32_t)new_task->page_directory);
-        terminal_writestring("\n");
-
-        for (volatile int i = 0; i < 10000000; i++)
-            ;
-
         uint32_t phys = (uint32_t)new_task->page_directory;
         __asm__ volatile("mov %0, %%cr3" ::"r"(phys));
-
-        terminal_writestring("[SWITCH] Page directory loaded\n");
-        for (volatile int i = 0; i < 10000000; i++)
-            ;
     }
 
     /* Update TSS */
-    extern void tss_set_kernel_stack(uint32_t stack);
     tss_set_kernel_stack(new_task->kernel_stack + 4096);
 
-    /* USER MODE: Always IRET for ring 3 */
+    /* FPU registers follow lazily on the first #NM */
+    fpu_switch(old_task, new_task);
+
+    /* USER MODE: the first run enters ring 3 through the IRET frame
+     * built by task_setup_user_context(). task_switch_asm() still saves
+     * the old task and releases it (on_cpu) before jumping there. */
     if (new_task->ring == 3 && new_task->first_run)
     {
-        terminal_writestring("[SWITCH] User mode - using IRET\n");
-        terminal_writestring("[SWITCH] ESP=0x");
-        terminal_write_hex(new_task->context.esp);
-        terminal_writestring("\n");
-
-        /* CRITICAL DEBUG: Show what's IN the IRET frame */
         uint32_t *iret_frame = (uint32_t *)new_task->context.esp;
-        terminal_writestring("[IRET_FRAME] EIP=0x");
-        terminal_write_hex(iret_frame[0]);
-        terminal_writestring("\n");
-        terminal_writestring("[IRET_FRAME] CS=0x");
-        terminal_write_hex(iret_frame[1]);
-        terminal_writestring("\n");
-        terminal_writestring("[IRET_FRAME] EFLAGS=0x");
-        terminal_write_hex(iret_frame[2]);
-        terminal_writestring("\n");
-        terminal_writestring("[IRET_FRAME] User ESP=0x");
-        terminal_write_hex(iret_frame[3]);
-        terminal_writestring("\n");
-        terminal_writestring("[IRET_FRAME] SS=0x");
-        terminal_write_hex(iret_frame[4]);
-        terminal_writestring("\n");
-
-        for (volatile int i = 0; i < 50000000; i++)
-            ;
-
-        /* ========== NEW DEBUG: Verify stack is mapped ========== */
-        uint32_t stack_page = 0xBFFFF000; // The stack page
-        uint32_t pd_idx = stack_page >> 22;
-        uint32_t pt_idx = (stack_page >> 12) & 0x3FF;
-
-        terminal_writestring("[DEBUG] Checking stack page 0xBFFFF000\n");
-        terminal_writestring("[DEBUG] PD index: ");
-        terminal_write_dec(pd_idx);
-        terminal_writestring(", PT index: ");
-        terminal_write_dec(pt_idx);
-        terminal_writestring("\n");
-
-        uint32_t *check_pd = new_task->page_directory;
-        terminal_writestring("[DEBUG] PD entry for stack: 0x");
-        terminal_write_hex(check_pd[pd_idx]);
-        terminal_writestring("\n");
-
-        if (check_pd[pd_idx] & VMM_PRESENT)
-        {
-            uint32_t *pt = (uint32_t *)(check_pd[pd_idx] & ~0xFFF);
-            terminal_writestring("[DEBUG] PT entry for stack: 0x");
-            terminal_write_hex(pt[pt_idx]);
-            terminal_writestring("\n");
-        }
-        else
-        {
-            terminal_writestring("[ERROR] Stack page directory entry NOT PRESENT!\n");
-        }
-
-        /* Check current CS to verify we're in Ring 0 */
-        uint16_t current_cs;
-        __asm__ volatile("mov %%cs, %0" : "=r"(current_cs));
-        terminal_writestring("[DEBUG] Current CS before IRET: 0x");
-        terminal_write_hex(current_cs);
-        terminal_writestring("\n");
-
-        /* Also check if interrupts are disabled */
-        uint32_t eflags;
-        __asm__ volatile("pushf; pop %0" : "=r"(eflags));
-        terminal_writestring("[DEBUG] EFLAGS: 0x");
-        terminal_write_hex(eflags);
-        terminal_writestring("\n");
-
-        uint16_t current_ss;
-        __asm__ volatile("mov %%ss, %0" : "=r"(current_ss));
-        terminal_writestring("[DEBUG] Current SS before IRET: 0x");
-        terminal_write_hex(current_ss);
-        terminal_writestring("\n");
-
-        for (volatile int i = 0; i < 50000000; i++)
-            ;
-
-        /* ========== DEBUG: Dump first bytes at entry point ========== */
-        uint32_t entry = iret_frame[0];  /* EIP from IRET frame */
-        terminal_writestring("[DEBUG] Verifying code at entry point 0x");
-        terminal_write_hex(entry);
-        terminal_writestring(":\n");
-
-        /* Check code page mapping */
-        uint32_t code_pd_idx = entry >> 22;
-        uint32_t code_pt_idx = (entry >> 12) & 0x3FF;
-        terminal_writestring("[DEBUG] Code PD index: ");
-        terminal_write_dec(code_pd_idx);
-        terminal_writestring(", PT index: ");
-        terminal_write_dec(code_pt_idx);
-        terminal_writestring("\n");
-
-        terminal_writestring("[DEBUG] Code PD entry: 0x");
-        terminal_write_hex(check_pd[code_pd_idx]);
-        terminal_writestring("\n");
-
-        if (check_pd[code_pd_idx] & VMM_PRESENT)
-        {
-            uint32_t *code_pt = (uint32_t *)(check_pd[code_pd_idx] & ~0xFFF);
-            terminal_writestring("[DEBUG] Code PT entry: 0x");
-            terminal_write_hex(code_pt[code_pt_idx]);
-            terminal_writestring("\n");
-
-            /* Get physical address and read from there via identity map */
-            uint32_t code_phys = code_pt[code_pt_idx] & ~0xFFF;
-            terminal_writestring("[DEBUG] Code physical addr: 0x");
-            terminal_write_hex(code_phys);
-            terminal_writestring("\n");
-
-            /* Read from physical address (identity mapped) */
-            uint8_t *phys_code_ptr = (uint8_t *)code_phys;
-            terminal_writestring("[DEBUG] First 16 bytes (via phys): ");
-            for (int i = 0; i < 16; i++) {
-                terminal_write_hex(phys_code_ptr[i]);
-                terminal_putchar(' ');
-            }
-            terminal_writestring("\n");
-        }
-        else
-        {
-            terminal_writestring("[ERROR] Code page directory entry NOT PRESENT!\n");
-        }
-
-        /* Also try reading through virtual address after CR3 switch */
-        uint8_t *code_ptr = (uint8_t *)entry;
-        terminal_writestring("[DEBUG] First 16 bytes (via virt): ");
-        for (int i = 0; i < 16; i++) {
-            terminal_write_hex(code_ptr[i]);
-            terminal_putchar(' ');
-        }
-        terminal_writestring("\n");
-
-        for (volatile int i = 0; i < 50000000; i++)
-            ;
+        klog_debug(KLOG_SCHED, "first run of PID %u: iret to %08x cs %x eflags %08x esp %08x ss %x",
+                   new_task->pid, iret_frame[0], iret_frame[1], iret_frame[2],
+                   iret_frame[3], iret_frame[4]);
 
         new_task->first_run = false;
-        uint32_t esp_val = new_task->context.esp;
-
-        /* Zero all general purpose registers before IRET to avoid garbage */
-        __asm__ volatile(
-            "movl %[esp_val], %%esp\n\t"
-            "xorl %%eax, %%eax\n\t"
-            "xorl %%ebx, %%ebx\n\t"
-            "xorl %%ecx, %%ecx\n\t"
-            "xorl %%edx, %%edx\n\t"
-            "xorl %%esi, %%esi\n\t"
-            "xorl %%edi, %%edi\n\t"
-            "xorl %%ebp, %%ebp\n\t"
-            "iret\n\t"
-            : /* no outputs */
-            : [esp_val] "r"(esp_val)
-            : "memory");
-
-        // This should never execute if IRET works
-        terminal_writestring("[ERROR] IRET returned to kernel mode!\n");
-        while (1)
-            __asm__ volatile("hlt");
-    }
-    /* Kernel mode */
-    terminal_writestring("[SWITCH] Kernel mode - using task_switch_asm\n");
-    for (volatile int i = 0; i < 10000000; i++)
-        ;
+        new_task->context.eip = (uint32_t)task_user_entry;
+        new_task->context.eflags = 0x002;
+        new_task->context.ds = new_task->context.es = 0x10;
+        new_task->context.fs = new_task->context.gs = 0x10;
+    }
+
     task_switch_asm(old_task, new_task);
 }
 
@@ -651,17 +784,16 @@ task_t *task_current(void)
  * ================================================================ */
 void task_exit(int exit_code)
 {
-    if (!current_task || current_task == kernel_task)
+    task_t *task = current_task;
+
+    if (!task || task == kernel_task)
     {
         return;
     }
 
-    current_task->state = TASK_ZOMBIE;
-    current_task->exit_code = exit_code;
-
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_BROWN, VGA_COLOR_BLACK));
     terminal_writestring("[TASK] Task '");
-    terminal_writestring(current_task->name);
+    terminal_writestring(task->name);
     terminal_writestring("' exited with code ");
     char buf[16];
     itoa(exit_code, buf);
@@ -669,12 +801,37 @@ void task_exit(int exit_code)
     terminal_writestring("\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 
-    /* Wake up parent if it's waiting */
-    if (current_task->parent && current_task->parent->state == TASK_BLOCKED)
+    spin_lock(&tasklist_lock);
+
+    /* Our children outlive us: the reaper adopts them */
+    bool wake_reaper = reparent_children(task);
+
+    /* Nobody would ever wait for a task without a parent, nor for one
+     * whose parent is an idle task (the shell runs as kernel_task and
+     * never calls wait()): hand it to the reaper instead. */
+    if (reaper_task && task != reaper_task &&
+        (!task->parent || task->parent->is_idle))
     {
-        task_unblock(current_task->parent);
+        if (task->parent)
+            unlink_child(task->parent, task);
+        link_child(reaper_task, task);
     }
 
+    /* Zombie under the lock, so a parent scanning its children sees
+     * the exit code with it. No longer RUNNING, so nothing preempts
+     * us before task_yield() below. */
+    task->exit_code = exit_code;
+    task->state = TASK_ZOMBIE;
+
+    /* Wake up parent if it's waiting in sys_wait(). The lock keeps it
+     * from exiting (and being freed) in the meantime. */
+    if (task->parent)
+        wake_up(&task->parent->child_exit_wq);
+    if (wake_reaper)
+        wake_up(&reaper_task->child_exit_wq);
+
+    spin_unlock(&tasklist_lock);
+
     task_yield();
 
     while (1)
@@ -700,7 +857,7 @@ void task_unblock(task_t *task)
 {
     if (task && task->state == TASK_BLOCKED)
     {
-        task->state = TASK_READY;
+        scheduler_wake_task(task);
     }
 }
 
@@ -709,86 +866,200 @@ void task_sleep(uint32_t ms)
     if (!current_task)
         return;
 
-    extern scheduler_stats_t scheduler_get_stats(void);
-    scheduler_stats_t stats = scheduler_get_stats();
+    /* One tick per millisecond */
+    if (!scheduler_sleep_task(current_task, ms))
+        return;
 
-    current_task->wake_time = stats.total_ticks + ms;
-    current_task->state = TASK_SLEEPING;
+    /* The idle task can't be switched out for good: it waits in place
+     * until the tick drops it from the sleep queue */
+    if (current_task == kernel_task)
+    {
+        for (;;)
+        {
+            uint32_t flags = irq_save();
+            if (!current_task->sleep_slot)
+            {
+                irq_restore(flags);
+                break;
+            }
+            current_task->state = TASK_SLEEPING;
+            irq_restore(flags);
+
+            wait_schedule();
+        }
+        current_task->state = TASK_RUNNING;
+        return;
+    }
 
     task_yield();
 }
 
 void task_destroy(task_t *task)
 {
-    if (!task || task == kernel_task)
+    if (!task || task == kernel_task || task->is_idle)
     {
         return;
     }
 
+    /* A zombie's CPU may still be switching away on its kernel stack;
+     * switch.s clears on_cpu once it is done with it */
+    while (task->on_cpu)
+        __asm__ volatile("pause");
+
+    spin_lock(&tasklist_lock);
+
     /* Remove from parent's child list */
     if (task->parent)
     {
-        task_remove_child(task->parent, task);
+        unlink_child(task->parent, task);
     }
 
-    /* Remove from scheduler list */
-    if (task_list_head == task)
+    /* Children left behind (no reaper yet) have nobody to report to */
+    for (task_t *child = task->first_child; child;)
     {
-        task_list_head = task->next;
+        task_t *next = child->next_sibling;
+        child->parent = NULL;
+        child->next_sibling = NULL;
+        child = next;
     }
-    else
+    task->first_child = NULL;
+
+    /* Remove from task list */
+    task_t **link = &task_list_head;
+    while (*link && *link != task)
+        link = &(*link)->next;
+    if (*link)
+        *link = task->next;
+
+    spin_unlock(&tasklist_lock);
+
+    /* Unfindable by PID first, so nobody can look it up again */
+    pid_hash_remove(task);
+
+    /* Drop it from the run queues before the memory goes away */
+    scheduler_remove_task(task);
+    pid_free(task->pid);
+
+    fpu_task_free(task);
+    task_free_kernel_stack(task);
+
+    /* User tasks: the user stack and everything else mapped below
+     * the kernel go with the address space */
+    if (task->address_space)
     {
-        task_t *prev = task_list_head;
-        while (prev && prev->next != task)
-        {
-            prev = prev->next;
-        }
-        if (prev)
-        {
-            prev->next = task->next;
-        }
+        vmm_destroy_as(task->address_space);
     }
 
-    /* Free kernel stack */
-    if (task->kernel_stack_alloc)
+    /* Kernel tasks: free user stack if allocated */
+    if (task->user_stack)
     {
-        if (task->ring == 3)
-        {
-            /* User task: allocated with vmm_alloc_page */
-            vmm_free_page((void *)task->kernel_stack_alloc);
-        }
-        else
-        {
-            /* Kernel task: allocated with kmalloc */
-            kfree((void *)task->kernel_stack_alloc);
-        }
+        kfree((void *)task->user_stack);
+    }
+
+    task_free(task);
+}
+
+task_t *task_dup(task_t *parent)
+{
+    task_t *child = task_alloc();
+    if (!child)
+        return NULL;
+
+    memcpy(child, parent, sizeof(task_t));
+
+    /* Nothing the parent owns is shared: the PID, stacks, address
+     * space and FPU area are the caller's to fill in */
+    child->pid = 0;
+    child->pid_next = NULL;
+    child->kernel_stack = 0;
+    child->kernel_stack_alloc = 0;
+    child->user_stack = 0;
+    child->address_space = NULL;
+    child->page_directory = NULL;
+    child->user_stack_phys = 0;
+    child->fpu_state = NULL;
+
+    /* Scheduler links (scheduler_add_task() sets up the rest) */
+    child->on_cpu = 0;
+    child->on_rq = false;
+    child->rq_next = NULL;
+    child->rq_prev = NULL;
+    child->sched_next = NULL;
+    child->sleep_slot = 0;
+    child->preempt_count = 0;
+    child->dl_bw = 0; /* The reservation stays the parent's */
+
+    /* A boost is lent for the mutexes the parent holds, not inherited */
+    if (parent->pi_boosted) {
+        child->sched_class = parent->pi_base_class;
+        child->priority = parent->pi_base_priority;
+        child->rt_priority = parent->pi_base_rt_priority;
     }
+    child->pi_prio = PI_PRIO_NONE;
+    child->pi_boosted = false;
+    child->blocked_on = NULL;
+    child->pi_mutexes = NULL;
+
+    /* Hierarchy (task_register()) */
+    child->parent = NULL;
+    child->parent_pid = 0;
+    child->first_child = NULL;
+    child->next_sibling = NULL;
+    child->next = NULL;
+    wait_queue_init(&child->child_exit_wq);
+    child->exit_code = 0;
+    child->waited = false;
+
+    /* Fresh CPU time accounting */
+    child->utime = child->stime = child->irq_time = 0;
+    child->child_utime = child->child_stime = child->child_irq_time = 0;
+    child->nvcsw = child->nivcsw = 0;
+
+    return child;
+}
+
+/* ================================================================
+ * REAPER
+ * ================================================================ */
+
+/* Parent of every orphan: collects its adopted children like a parent
+ * in sys_wait() would, and frees them */
+static void reaper_main(void)
+{
+    task_t *self = current_task;
+    DEFINE_WAIT(wait);
 
-    /* Free user stack and address space for user tasks */
-    if (task->ring == 3)
+    while (1)
     {
-        /* Unmap and free user stack */
-        if (task->user_stack_phys)
-        {
-            vmm_unmap_page(USER_STACK_TOP - PAGE_SIZE);
-            pmm_free_block((void *)task->user_stack_phys);
-        }
+        prepare_to_wait(&self->child_exit_wq, &wait);
 
-        /* Destroy address space */
-        if (task->address_space)
+        task_t *zombie = task_take_zombie(self, NULL);
+        if (!zombie)
         {
-            vmm_destroy_as(task->address_space);
+            wait_schedule();
+            continue;
         }
+        finish_wait(&self->child_exit_wq, &wait);
+
+        klog_debug(KLOG_TASK, "reaper: freeing orphan PID %u (%s)",
+                   zombie->pid, zombie->name);
+        task_destroy(zombie);
+
+        spin_lock(&task_cache_lock);
+        cache_stats.orphans_reaped++;
+        spin_unlock(&task_cache_lock);
     }
-    else
+}
+
+void task_reaper_init(void)
+{
+    task_t *reaper = task_create("reaper", reaper_main, REAPER_PRIORITY);
+    if (!reaper)
     {
-        /* Kernel task: free user stack if allocated */
-        if (task->user_stack)
-        {
-            kfree((void *)task->user_stack);
-        }
+        terminal_writestring("[TASK] ERROR: Failed to create the reaper\n");
+        return;
     }
 
-    /* Free task structure */
-    kfree(task);
-}
\ No newline at end of file
+    reaper_task = reaper;
+    scheduler_add_task(reaper);
+}
@@ -13,6 +13,10 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "../lib/rbtree.h"
+#include "kernel.h"
+#include "wait.h"
+#include "smp.h"
 
 /* ================================================================
  * TASK STATES
@@ -75,6 +79,11 @@ typedef struct task
     /* CPU context - saved/restored on context switch */
     cpu_context_t context;
 
+    /* Set while some CPU is executing on this task's stack; cleared by
+     * switch.s once the context above has been saved (so another CPU
+     * may pick the task up). Must directly follow context. */
+    volatile uint32_t on_cpu;
+
     /* Memory management */
     uint32_t *page_directory; /* Virtual address space */
     uint32_t kernel_stack;    /* Kernel mode stack */
@@ -102,12 +111,69 @@ typedef struct task
     uint32_t time_slice; /* Remaining time quantum (ticks) */
     uint32_t total_time; /* Total CPU time used */
     uint32_t wake_time;  /* Wake up at this tick (for TASK_SLEEPING) */
+    uint32_t sleep_slot; /* Sleep heap index + 1 (0 = not sleeping) */
+    uint32_t sched_boost; /* Dynamic priority boost earned by blocking */
+    uint32_t cpu;         /* CPU it runs on, or whose run queue it is on */
+    bool is_idle;         /* A CPU's idle fallback, never queued */
+    uint32_t preempt_count; /* preempt_disable() depth (preempt.h) */
+
+    /* Run queue links (owned by scheduler.c) */
+    bool on_rq;               /* Queued on a priority run queue */
+    uint32_t rq_level;        /* Priority level it was queued at */
+    struct task *rq_next;     /* Next task at the same level */
+    struct task *rq_prev;     /* Previous task at the same level */
+    struct task *sched_next;  /* All tasks known to the scheduler */
+    struct task *pid_next;    /* PID hash chain (pid.c) */
+
+    /* Fair class (owned by scheduler.c) */
+    uint64_t vruntime;         /* Weighted CPU time in microseconds */
+    struct rb_node run_node;   /* Position in the vruntime or deadline tree */
+
+    /* Real-time classes (owned by scheduler.c) */
+    uint8_t sched_class;       /* SCHED_NORMAL/FIFO/RR/DEADLINE */
+    uint32_t rt_priority;      /* FIFO/RR level (0 = highest) */
+    uint32_t dl_runtime;       /* DEADLINE reservation, in ticks */
+    uint32_t dl_deadline;
+    uint32_t dl_period;
+    uint32_t dl_bw;            /* runtime / period in ppm */
+    uint32_t dl_budget;        /* Runtime left in the current period */
+    uint32_t dl_abs_deadline;  /* Tick the current period's work is due */
+    uint32_t dl_next_period;   /* Tick the next period starts */
+    bool dl_throttled;         /* Budget used up before the period ended */
+
+    /* Priority inheritance (mutex.c). While a waiter on one of its
+     * mutexes is more important, sched_class/priority/rt_priority above
+     * are raised to match and its own values are kept in pi_base_*. */
+    uint32_t pi_prio;          /* Inherited priority key, PI_PRIO_NONE if none */
+    bool pi_boosted;
+    uint8_t pi_base_class;
+    uint32_t pi_base_priority;
+    uint32_t pi_base_rt_priority;
+    struct mutex *blocked_on;  /* Mutex it is waiting for */
+    struct mutex *pi_mutexes;  /* Mutexes it owns that have waiters */
 
     /* PROCESS HIERARCHY (Phase 5) */
     struct task *parent;       /* Parent task */
     uint32_t parent_pid;       /* Parent PID (for safety) */
     struct task *first_child;  /* First child in linked list */
     struct task *next_sibling; /* Next sibling */
+    wait_queue_t child_exit_wq; /* Woken when a child exits */
+
+    /* CPU time in TSC cycles, charged at context switches, syscalls
+     * and interrupts (see acct_enter()) */
+    uint64_t utime;            /* Running in user mode */
+    uint64_t stime;            /* Running in the kernel on its behalf */
+    uint64_t irq_time;         /* Interrupt handlers that ran while it was current */
+    uint64_t child_utime;      /* Totals of reaped children */
+    uint64_t child_stime;
+    uint64_t child_irq_time;
+    uint32_t nvcsw;            /* Gave up the CPU (blocked, slept, exited) */
+    uint32_t nivcsw;           /* Was preempted while runnable */
+    uint8_t acct_mode;         /* ACCT_* it was in when switched out */
+
+    /* FXSAVE image (fpu.c): allocated on first FPU use, so NULL for
+     * integer-only tasks. May be stale while the task owns the FPU. */
+    struct fpu_state *fpu_state;
 
     /* Scheduler queue */
     struct task *next; /* Next in scheduler queue */
@@ -118,6 +184,19 @@ typedef struct task
     bool waited;   /* Has parent waited for this zombie? */
 } task_t;
 
+/* ================================================================
+ * CPU TIME ACCOUNTING
+ * ================================================================ */
+
+#define ACCT_KERNEL 0
+#define ACCT_USER   1
+#define ACCT_IRQ    2
+
+/* Charge the time since the last boundary to the current task in its
+ * current mode and switch this CPU to mode. Returns the previous mode,
+ * so an interrupt handler can hand it back on exit. */
+uint8_t acct_enter(uint8_t mode);
+
 /* ================================================================
  * TASK MANAGEMENT FUNCTIONS
  * ================================================================ */
@@ -128,15 +207,28 @@ void task_init(void);
 /* Create a new kernel task */
 task_t *task_create(const char *name, void (*entry_point)(void), uint32_t priority);
 
+/* Create the idle task of an application processor */
+task_t *task_create_idle(uint32_t cpu);
+
 /* Create a new user mode task from ELF binary */
 task_t *task_create_user(const char *name, void *elf_data, uint32_t priority);
 
 /* Setup user mode context for a task */
 void task_setup_user_context(task_t *task);
 
-/* Destroy a task */
+/* Free a task and everything it owns: kernel stack, address space, FPU
+ * area, PID. It must not be on a run queue - a reaped zombie, or a
+ * task that was never scheduled. */
 void task_destroy(task_t *task);
 
+/* Make a new task visible: child of parent (if any), on the task list
+ * and findable by PID. Scheduling it is separate. */
+void task_register(task_t *task, task_t *parent);
+
+/* Copy of parent for fork(): registers, name and scheduling parameters,
+ * but no PID, stacks, address space or family of its own yet */
+task_t *task_dup(task_t *parent);
+
 /* Get current running task */
 task_t *task_current(void);
 
@@ -168,10 +260,59 @@ void task_add_child(task_t *parent, task_t *child);
 /* Remove child from parent's child list */
 void task_remove_child(task_t *parent, task_t *child);
 
+/* Unlink the first zombie child of parent that nobody has waited for,
+ * ready for task_destroy(). NULL if there is none; *has_children (may
+ * be NULL) tells whether parent has any children at all. */
+task_t *task_take_zombie(task_t *parent, bool *has_children);
+
+/* ================================================================
+ * REAPING AND RECYCLING
+ * Orphans are adopted by the reaper thread, which waits for them the
+ * way a parent would. Freed task_t's and kernel stacks are cached for
+ * the next task.
+ * ================================================================ */
+
+#define REAPER_PRIORITY 5      /* Like the workqueue threads */
+
+typedef struct
+{
+    uint32_t cached_tasks;     /* task_t's waiting for reuse */
+    uint32_t cached_stacks;    /* Kernel stacks waiting for reuse */
+    uint32_t task_hits;        /* task_alloc() served from the cache */
+    uint32_t task_misses;
+    uint32_t stack_hits;       /* task_alloc_kernel_stack() likewise */
+    uint32_t stack_misses;
+    uint32_t orphans_reaped;   /* Freed by the reaper */
+} task_cache_stats_t;
+
+/* Start the reaper. Needs the scheduler. */
+void task_reaper_init(void);
+
+/* Zeroed task_t, from the cache if possible */
+task_t *task_alloc(void);
+
+/* Page-aligned kernel stack for task (kernel_stack/kernel_stack_alloc).
+ * Returns -1 when out of memory. */
+int task_alloc_kernel_stack(task_t *task);
+
+task_cache_stats_t task_get_cache_stats(void);
+
 /* ================================================================
  * KERNEL TASK
  * ================================================================ */
 extern task_t *kernel_task;
-extern task_t *current_task;
+
+/* Task running on the calling CPU. Read with interrupts off: a task
+ * preempted between finding its CPU and loading cpu->current could
+ * resume elsewhere and pick up another task's pointer. */
+static inline task_t *get_current(void)
+{
+    uint32_t flags = irq_save();
+    task_t *task = this_cpu()->current;
+    irq_restore(flags);
+    return task;
+}
+
+#define current_task get_current()
 
 #endif /* TASK_H */
\ No newline at end of file
@@ -7,54 +7,60 @@
 #include "tss.h"
 #include "gdt.h"
 #include "kernel.h"
+#include "smp.h"
 
 /* ====================================================================
- * GLOBAL TSS
+ * PER-CPU TSS
  * ==================================================================== */
 
-static struct tss_entry tss;
+/* Each CPU needs its own: esp0 is the kernel stack of the task that
+ * CPU is running */
+static struct tss_entry tss[SMP_MAX_CPUS];
 
 /* ====================================================================
  * TSS INITIALIZATION
  * ==================================================================== */
 
-void tss_init(void)
+void tss_init_cpu(uint32_t cpu)
 {
-    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
-    terminal_writestring("[TSS] Initializing Task State Segment...\n");
-    
     /* Zero out entire TSS structure */
-    memset(&tss, 0, sizeof(struct tss_entry));
-    
+    memset(&tss[cpu], 0, sizeof(struct tss_entry));
+
     /* Set up critical fields:
-     * 
+     *
      * ss0: Kernel data segment (0x10)
      *      When CPU switches to Ring 0, it loads this into SS
-     * 
+     *
      * esp0: Kernel stack pointer
      *      Will be set later by tss_set_kernel_stack() before
      *      entering user mode. For now, set to 0.
-     * 
+     *
      * iomap_base: I/O permission bitmap offset
      *      Set to sizeof(tss) to indicate "no I/O bitmap"
      */
-    
-    tss.ss0 = KERNEL_DS;           /* Use kernel data segment */
-    tss.esp0 = 0;                  /* Will be set before user mode */
-    tss.iomap_base = sizeof(struct tss_entry);
-    
-    /* Install TSS into GDT at entry 5 (0x28) */
-    uint32_t tss_base = (uint32_t)&tss;
-    uint32_t tss_limit = sizeof(struct tss_entry);
-    
-    gdt_set_tss(tss_base, tss_limit);
-    
-    /* Load TSS into task register */
-    tss_flush();
-    
+
+    tss[cpu].ss0 = KERNEL_DS;           /* Use kernel data segment */
+    tss[cpu].esp0 = 0;                  /* Will be set before user mode */
+    tss[cpu].iomap_base = sizeof(struct tss_entry);
+
+    /* Install TSS into this CPU's GDT at entry 5 + cpu */
+    gdt_set_tss(cpu, (uint32_t)&tss[cpu], sizeof(struct tss_entry));
+
+    /* Load TSS into task register - from here on smp_processor_id()
+     * returns cpu */
+    tss_flush(TSS_SEL_CPU(cpu));
+}
+
+void tss_init(void)
+{
+    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
+    terminal_writestring("[TSS] Initializing Task State Segment...\n");
+
+    tss_init_cpu(0);
+
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
     terminal_writestring("[TSS] TSS initialized at 0x");
-    terminal_write_hex(tss_base);
+    terminal_write_hex((uint32_t)&tss[0]);
     terminal_writestring("\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 }
@@ -77,5 +83,5 @@ void tss_init(void)
  */
 void tss_set_kernel_stack(uint32_t stack)
 {
-    tss.esp0 = stack;
+    tss[smp_processor_id()].esp0 = stack;
 }
\ No newline at end of file
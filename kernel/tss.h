@@ -55,14 +55,17 @@ struct tss_entry
  * FUNCTION PROTOTYPES
  * ==================================================================== */
 
-/* Initialize TSS */
+/* Initialize TSS (boot CPU) */
 void tss_init(void);
 
-/* Set kernel stack for next privilege transition
+/* Initialize and load the TSS of one CPU (after gdt_init_cpu) */
+void tss_init_cpu(uint32_t cpu);
+
+/* Set kernel stack for next privilege transition on this CPU
  * Call this before entering user mode! */
 void tss_set_kernel_stack(uint32_t stack);
 
-/* Assembly function to load TSS */
-extern void tss_flush(void);
+/* Assembly function to load TSS (selector TSS_SEL_CPU(cpu)) */
+extern void tss_flush(uint16_t selector);
 
 #endif /* TSS_H */
\ No newline at end of file
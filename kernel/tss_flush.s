@@ -3,8 +3,9 @@
 .section .text
 .global tss_flush
 
+/* void tss_flush(uint16_t selector) */
 tss_flush:
-    mov $0x28, %ax
+    mov 4(%esp), %ax
     ltr %ax
     ret
 
@@ -0,0 +1,84 @@
+/* kernel/vvar.c - Shared Time and Process Pages
+ *
+ * The time page is a page of kernel .bss, which is identity-mapped, so
+ * its frame address is its own. It is mapped VMM_KERNEL_FRAME: fork()
+ * shares it and tearing down an address space leaves it alone. Only
+ * CPU 0 writes it (from the tick, or at boot), so the sequence count
+ * needs no lock.
+ */
+
+#include "vvar.h"
+#include "kernel.h"
+#include "../mm/pmm.h"
+
+static union
+{
+    vvar_data_t data;
+    uint8_t page[PAGE_SIZE];         /* Nothing else shares the frame */
+} vvar_page __attribute__((aligned(PAGE_SIZE)));
+
+static inline void vvar_write_begin(void)
+{
+    vvar_page.data.seq++;
+    __asm__ volatile("" : : : "memory");
+}
+
+static inline void vvar_write_end(void)
+{
+    __asm__ volatile("" : : : "memory");
+    vvar_page.data.seq++;
+}
+
+/* ================================================================
+ * UPDATES
+ * ================================================================ */
+
+void vvar_update_ticks(uint64_t ticks)
+{
+    vvar_write_begin();
+    vvar_page.data.ticks_lo = (uint32_t)ticks;
+    vvar_page.data.ticks_hi = (uint32_t)(ticks >> 32);
+    vvar_write_end();
+}
+
+void vvar_update_clock(uint32_t mode, uint32_t mult, uint32_t shift,
+                       uint64_t base_count, uint64_t base_ns)
+{
+    vvar_write_begin();
+    vvar_page.data.clock_mode = mode;
+    vvar_page.data.tsc_khz = timer_tsc_khz();
+    vvar_page.data.mult = mult;
+    vvar_page.data.shift = shift;
+    vvar_page.data.base_count = base_count;
+    vvar_page.data.base_ns = base_ns;
+    vvar_write_end();
+}
+
+/* ================================================================
+ * MAPPING
+ * ================================================================ */
+
+int vvar_map(struct vmm_address_space *as, uint32_t pid)
+{
+    vvar_proc_t *proc = (vvar_proc_t *)pmm_alloc_block();
+    if (!proc)
+        return -1;
+
+    /* Frames are identity-mapped */
+    memset(proc, 0, PAGE_SIZE);
+    proc->pid = pid;
+
+    vmm_map_page_in_as(as, VVAR_DATA_ADDR, (uint32_t)&vvar_page,
+                       VMM_PRESENT | VMM_USER | VMM_KERNEL_FRAME);
+    vmm_map_page_in_as(as, VVAR_PROC_ADDR, (uint32_t)proc,
+                       VMM_PRESENT | VMM_USER);
+    return 0;
+}
+
+void vvar_set_pid(struct vmm_address_space *as, uint32_t pid)
+{
+    uint32_t phys = vmm_user_to_phys(as, VVAR_PROC_ADDR);
+
+    if (phys)
+        ((vvar_proc_t *)phys)->pid = pid;
+}
@@ -0,0 +1,67 @@
+/* kernel/vvar.h - Shared Time and Process Pages
+ *
+ * Every user address space gets two read-only pages at USER_VVAR_START,
+ * so that getpid() and clock_gettime(CLOCK_MONOTONIC) need no system
+ * call:
+ *
+ *   USER_VVAR_START           vvar_data_t - one frame, mapped into all
+ *                             processes and updated by the kernel on
+ *                             every tick
+ *   USER_VVAR_START + 4096    vvar_proc_t - a frame of the process's
+ *                             own, holding its PID
+ *
+ * The time page is written under a sequence count: odd while an update
+ * is in progress. A reader takes the count, reads what it needs and
+ * starts over if the count was odd or has changed (see user/ulib.h).
+ * With the TSC clocksource user code reads the TSC itself and converts
+ * it exactly the way ktime_get_ns() does, so both clocks agree.
+ *
+ * Layouts must match user/ulib.h.
+ */
+
+#ifndef VVAR_H
+#define VVAR_H
+
+#include <stdint.h>
+#include "../mm/vmm.h"
+
+#define VVAR_DATA_ADDR  USER_VVAR_START
+#define VVAR_PROC_ADDR  (USER_VVAR_START + PAGE_SIZE)
+
+/* vvar_data_t.clock_mode */
+#define VVAR_CLOCK_TICKS 0            /* ns = ticks * 1000000 */
+#define VVAR_CLOCK_TSC   1            /* ns = base_ns + ((tsc - base_count) * mult >> shift) */
+
+typedef struct vvar_data
+{
+    volatile uint32_t seq;           /* Odd while being written */
+    uint32_t clock_mode;             /* VVAR_CLOCK_* */
+    uint32_t ticks_lo;               /* Ticks (ms) since boot; may lag */
+    uint32_t ticks_hi;               /* while the tick is stopped */
+    uint32_t tsc_khz;
+    uint32_t mult;                   /* The clocksource's, see clocksource.h */
+    uint32_t shift;
+    uint64_t base_count;
+    uint64_t base_ns;
+} vvar_data_t;
+
+typedef struct vvar_proc
+{
+    uint32_t pid;
+} vvar_proc_t;
+
+/* Map both pages into a new process's address space. Returns 0, or -1
+ * if out of memory. */
+int vvar_map(struct vmm_address_space *as, uint32_t pid);
+
+/* The PID page of a fork()ed child still holds the parent's PID */
+void vvar_set_pid(struct vmm_address_space *as, uint32_t pid);
+
+/* Called on every tick (CPU 0) */
+void vvar_update_ticks(uint64_t ticks);
+
+/* Called when the clocksource changes (clocksource.c) */
+void vvar_update_clock(uint32_t mode, uint32_t mult, uint32_t shift,
+                       uint64_t base_count, uint64_t base_ns);
+
+#endif /* VVAR_H */
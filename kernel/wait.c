@@ -0,0 +1,185 @@
+/* kernel/wait.c - Wait Queues
+ *
+ * Waiters are kept in FIFO order. Wakeups unlink the entry themselves
+ * (so a task is never woken twice for the same event) and hand the
+ * task back to the scheduler; the waiter re-checks its condition when
+ * it runs again. The list is changed under the queue's spinlock,
+ * taken irqsave since IRQ handlers wake waiters too.
+ */
+
+#include "wait.h"
+#include "kernel.h"
+#include "task.h"
+#include "scheduler.h"
+#include "spinlock.h"
+
+/* ================================================================
+ * LIST HELPERS
+ * ================================================================ */
+
+static void wq_add_tail(wait_queue_t *wq, wait_queue_entry_t *entry)
+{
+    entry->next = NULL;
+    entry->prev = wq->tail;
+
+    if (wq->tail)
+        wq->tail->next = entry;
+    else
+        wq->head = entry;
+    wq->tail = entry;
+
+    entry->queued = true;
+}
+
+static void wq_remove(wait_queue_t *wq, wait_queue_entry_t *entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        wq->head = entry->next;
+
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    else
+        wq->tail = entry->prev;
+
+    entry->next = NULL;
+    entry->prev = NULL;
+    entry->queued = false;
+}
+
+/* ================================================================
+ * WAITING
+ * ================================================================ */
+
+void wait_queue_init(wait_queue_t *wq)
+{
+    wait_queue_t init = WAIT_QUEUE_INIT;
+    *wq = init;
+}
+
+static void prepare_to_wait_common(wait_queue_t *wq, wait_queue_entry_t *entry,
+                                   bool exclusive)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    entry->task = current_task;
+    entry->exclusive = exclusive;
+    if (!entry->queued)
+        wq_add_tail(wq, entry);
+
+    current_task->state = TASK_BLOCKED;
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void prepare_to_wait(wait_queue_t *wq, wait_queue_entry_t *entry)
+{
+    prepare_to_wait_common(wq, entry, false);
+}
+
+void prepare_to_wait_exclusive(wait_queue_t *wq, wait_queue_entry_t *entry)
+{
+    prepare_to_wait_common(wq, entry, true);
+}
+
+void finish_wait(wait_queue_t *wq, wait_queue_entry_t *entry)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    current_task->state = TASK_RUNNING;
+    if (entry->queued)
+        wq_remove(wq, entry);
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wait_schedule(void)
+{
+    if (current_task != kernel_task) {
+        task_yield();
+        return;
+    }
+
+    /* kernel_task is the idle fallback and can never leave the CPU for
+     * good: let whatever is runnable go first, otherwise halt until the
+     * next interrupt. "sti; hlt" is atomic, so a wakeup from an IRQ
+     * handler cannot slip in between the check and the halt. */
+    uint32_t flags = irq_save();
+
+    if (current_task->state == TASK_RUNNING) {
+        /* Already woken */
+        irq_restore(flags);
+        return;
+    }
+
+    if (scheduler_has_ready()) {
+        irq_restore(flags);
+        task_yield();
+        return;
+    }
+
+    uint64_t halt_start = rdtsc();
+    __asm__ volatile("sti; hlt");
+    this_cpu()->idle_cycles += rdtsc() - halt_start;
+    if (!(flags & 0x200))
+        __asm__ volatile("cli");
+}
+
+/* ================================================================
+ * WAKING
+ * ================================================================ */
+
+static void wake_entry(wait_queue_t *wq, wait_queue_entry_t *entry)
+{
+    task_t *task = entry->task;
+
+    wq_remove(wq, entry);
+
+    if (task->state == TASK_BLOCKED)
+        scheduler_wake_task(task);
+}
+
+void wake_up(wait_queue_t *wq)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    wait_queue_entry_t *entry = wq->head;
+    while (entry) {
+        wait_queue_entry_t *next = entry->next;
+        bool exclusive = entry->exclusive;
+
+        wake_entry(wq, entry);
+        if (exclusive)
+            break;
+
+        entry = next;
+    }
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wake_up_one(wait_queue_t *wq)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    if (wq->head)
+        wake_entry(wq, wq->head);
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wake_up_all(wait_queue_t *wq)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    while (wq->head)
+        wake_entry(wq, wq->head);
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+bool wait_queue_active(wait_queue_t *wq)
+{
+    return wq->head != NULL;
+}
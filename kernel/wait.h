@@ -0,0 +1,90 @@
+/* kernel/wait.h - Wait Queues
+ *
+ * A wait queue is a list of tasks sleeping until some condition
+ * becomes true (a child exits, a key is pressed, ...). The waiter
+ * registers itself with prepare_to_wait(), re-checks the condition and
+ * only then gives up the CPU; the code that makes the condition true
+ * calls wake_up() afterwards. Checking after registering means a
+ * wakeup can never fall between the check and the sleep.
+ *
+ * Typical use:
+ *
+ *     wait_event(keyboard_wq, keyboard_has_data());
+ */
+
+#ifndef WAIT_H
+#define WAIT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock_types.h"
+
+struct task;
+
+/* ================================================================
+ * WAIT QUEUE STRUCTURES
+ * ================================================================ */
+
+typedef struct wait_queue_entry
+{
+    struct task *task;
+    bool exclusive;   /* wake_up() wakes at most one exclusive waiter */
+    bool queued;      /* Linked on a wait queue */
+    struct wait_queue_entry *next;
+    struct wait_queue_entry *prev;
+} wait_queue_entry_t;
+
+typedef struct wait_queue
+{
+    wait_queue_entry_t *head;
+    wait_queue_entry_t *tail;
+    spinlock_t lock;  /* Waiter and waker may be on different CPUs */
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT {NULL, NULL, SPINLOCK_INIT_UNTRACKED("waitq", LOCK_ORDER_WAITQ)}
+
+/* Declare an idle wait queue entry for the current task */
+#define DEFINE_WAIT(name) wait_queue_entry_t name = {NULL, false, false, NULL, NULL}
+
+/* ================================================================
+ * WAIT QUEUE FUNCTIONS
+ * ================================================================ */
+
+void wait_queue_init(wait_queue_t *wq);
+
+/* Queue the current task on wq and mark it blocked. Call before
+ * checking the condition; the task keeps running until wait_schedule(). */
+void prepare_to_wait(wait_queue_t *wq, wait_queue_entry_t *entry);
+void prepare_to_wait_exclusive(wait_queue_t *wq, wait_queue_entry_t *entry);
+
+/* Leave the wait queue and mark the current task running again */
+void finish_wait(wait_queue_t *wq, wait_queue_entry_t *entry);
+
+/* Give up the CPU until woken (the idle task halts instead) */
+void wait_schedule(void);
+
+/* Wake every non-exclusive waiter plus one exclusive waiter */
+void wake_up(wait_queue_t *wq);
+
+/* Wake only the first waiter */
+void wake_up_one(wait_queue_t *wq);
+
+/* Wake every waiter, exclusive or not */
+void wake_up_all(wait_queue_t *wq);
+
+bool wait_queue_active(wait_queue_t *wq);
+
+/* Sleep until condition is true */
+#define wait_event(wq, condition)                       \
+    do {                                                \
+        DEFINE_WAIT(__wait);                            \
+        for (;;) {                                      \
+            prepare_to_wait(&(wq), &__wait);            \
+            if (condition)                              \
+                break;                                  \
+            wait_schedule();                            \
+        }                                               \
+        finish_wait(&(wq), &__wait);                    \
+    } while (0)
+
+#endif /* WAIT_H */
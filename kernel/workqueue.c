@@ -0,0 +1,160 @@
+/* kernel/workqueue.c - Work Queues
+ *
+ * task_create() entry points take no argument, so a worker finds its
+ * queue by looking itself up in the workqueue table; the table entry is
+ * filled in before the worker is handed to the scheduler.
+ *
+ * The item list is protected by the queue's spinlock; the wake-up is
+ * done after dropping it, since waking takes the scheduler lock.
+ */
+
+#include "workqueue.h"
+#include "kernel.h"
+#include "task.h"
+#include "scheduler.h"
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+static workqueue_t workqueues[WORKQUEUE_MAX];
+static uint32_t nr_workqueues = 0;
+
+workqueue_t *system_wq = NULL;
+
+/* ================================================================
+ * WORKER THREAD
+ * ================================================================ */
+
+static workqueue_t *worker_queue(void)
+{
+    for (uint32_t i = 0; i < nr_workqueues; i++) {
+        if (workqueues[i].worker == current_task)
+            return &workqueues[i];
+    }
+    return NULL;
+}
+
+static work_t *dequeue_work(workqueue_t *wq)
+{
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    work_t *work = wq->head;
+
+    if (work) {
+        wq->head = work->next;
+        if (!wq->head)
+            wq->tail = NULL;
+        wq->depth--;
+
+        uint64_t latency = rdtsc() - work->queued_at;
+        wq->latency_cycles += latency;
+        if (latency > wq->max_latency)
+            wq->max_latency = latency;
+
+        /* Cleared before it runs: queueing it again from here on means
+         * another run */
+        work->next = NULL;
+        work->pending = false;
+    }
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return work;
+}
+
+static void worker_thread(void)
+{
+    workqueue_t *wq = worker_queue();
+    if (!wq)
+        task_exit(1);
+
+    for (;;) {
+        wait_event(wq->wait, wq->head != NULL);
+
+        work_t *work;
+        while ((work = dequeue_work(wq))) {
+            work->func(work);
+            wq->executed++;
+        }
+    }
+}
+
+/* ================================================================
+ * QUEUEING
+ * ================================================================ */
+
+bool queue_work(workqueue_t *wq, work_t *work)
+{
+    if (!wq || __atomic_exchange_n(&work->pending, true, __ATOMIC_ACQ_REL))
+        return false;
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+
+    work->next = NULL;
+    work->queued_at = rdtsc();
+    if (wq->tail)
+        wq->tail->next = work;
+    else
+        wq->head = work;
+    wq->tail = work;
+
+    wq->queued++;
+    if (++wq->depth > wq->max_depth)
+        wq->max_depth = wq->depth;
+
+    spin_unlock_irqrestore(&wq->lock, flags);
+
+    wake_up(&wq->wait);
+    return true;
+}
+
+/* ================================================================
+ * CREATION
+ * ================================================================ */
+
+workqueue_t *workqueue_create(const char *name)
+{
+    if (nr_workqueues >= WORKQUEUE_MAX)
+        return NULL;
+
+    workqueue_t *wq = &workqueues[nr_workqueues];
+    memset(wq, 0, sizeof(*wq));
+    wq->name = name;
+    spin_lock_init(&wq->lock, "workqueue", LOCK_ORDER_WQ);
+    wait_queue_init(&wq->wait);
+
+    wq->worker = task_create(name, worker_thread, WORKQUEUE_PRIORITY);
+    if (!wq->worker)
+        return NULL;
+
+    nr_workqueues++;
+    scheduler_add_task(wq->worker);
+    return wq;
+}
+
+void workqueue_init(void)
+{
+    system_wq = workqueue_create("kworker");
+    if (!system_wq)
+        terminal_writestring("[WORKQUEUE] ERROR: Failed to start kworker\n");
+}
+
+/* ================================================================
+ * STATISTICS
+ * ================================================================ */
+
+void workqueue_show_stats(void)
+{
+    char line[96];
+
+    terminal_writestring("Workqueue   Queued  Done  Depth  Max  Avg wait (us)  Max wait (us)\n");
+    for (uint32_t i = 0; i < nr_workqueues; i++) {
+        workqueue_t *wq = &workqueues[i];
+        uint32_t started = wq->queued - wq->depth;
+        uint64_t avg = started ? div_u64(wq->latency_cycles, started) : 0;
+
+        ksnprintf(line, sizeof(line), "%-10s %7u %5u  %5u %4u  %13llu  %13llu\n",
+                  wq->name, wq->queued, wq->executed, wq->depth, wq->max_depth,
+                  timer_cycles_to_us(avg), timer_cycles_to_us(wq->max_latency));
+        terminal_writestring(line);
+    }
+}
@@ -0,0 +1,93 @@
+/* kernel/workqueue.h - Work Queues
+ *
+ * Deferred work that may take a while or sleep: each workqueue has a
+ * kernel thread (created with task_create()) that sleeps on a wait
+ * queue and runs queued work items one at a time, in order. Anything -
+ * an IRQ handler, a tasklet or a task - can queue work.
+ *
+ * A work item is queued at most once: queueing it again before it has
+ * started is a no-op, and the single run sees everything that led to
+ * both requests.
+ *
+ * Typical use:
+ *
+ *     static void flush_fn(work_t *work) { ... }
+ *     static work_t flush_work = WORK_INIT(flush_fn);
+ *
+ *     queue_work(system_wq, &flush_work);
+ */
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "spinlock.h"
+#include "wait.h"
+
+#define WORKQUEUE_MAX 4              /* Workqueues (and worker threads) */
+#define WORKQUEUE_PRIORITY 5         /* Worker threads run ahead of normal tasks */
+
+struct task;
+
+/* ================================================================
+ * TYPES
+ * ================================================================ */
+
+typedef struct work
+{
+    struct work *next;
+    void (*func)(struct work *work);
+    volatile bool pending;            /* Queued, not started yet */
+    uint64_t queued_at;               /* rdtsc when queued */
+} work_t;
+
+#define WORK_INIT(fn) { NULL, (fn), false, 0 }
+
+typedef struct workqueue
+{
+    const char *name;
+    spinlock_t lock;                  /* Protects the item list */
+    work_t *head;
+    work_t *tail;
+    wait_queue_t wait;                /* The worker sleeps here */
+    struct task *worker;
+
+    /* Statistics */
+    uint32_t queued;
+    uint32_t executed;
+    uint32_t depth;                   /* Items waiting right now */
+    uint32_t max_depth;
+    uint64_t latency_cycles;          /* Sum of queue -> start delays */
+    uint64_t max_latency;
+} workqueue_t;
+
+/* General-purpose queue, ready after workqueue_init() */
+extern workqueue_t *system_wq;
+
+/* ================================================================
+ * FUNCTIONS
+ * ================================================================ */
+
+/* Create system_wq. Needs the scheduler. */
+void workqueue_init(void);
+
+/* Create a workqueue and start its worker thread */
+workqueue_t *workqueue_create(const char *name);
+
+static inline void work_init(work_t *work, void (*func)(work_t *work))
+{
+    work->next = NULL;
+    work->func = func;
+    work->pending = false;
+    work->queued_at = 0;
+}
+
+/* Queue work on wq. Returns false if it was already pending. Safe from
+ * any context. */
+bool queue_work(workqueue_t *wq, work_t *work);
+
+/* Print per-queue counters */
+void workqueue_show_stats(void);
+
+#endif /* WORKQUEUE_H */
@@ -0,0 +1,302 @@
+/* lib/rbtree.c - Intrusive red-black tree
+ *
+ * Classic red-black tree with parent pointers; NULL children act as the
+ * black leaves. Insert and erase are O(log n) with at most three
+ * rotations.
+ */
+
+#include "rbtree.h"
+
+/* ================================================================
+ * HELPERS
+ * ================================================================ */
+
+static inline int rb_is_red(const struct rb_node *node)
+{
+    return node && node->color == RB_RED;
+}
+
+static inline int rb_is_black(const struct rb_node *node)
+{
+    return !node || node->color == RB_BLACK;
+}
+
+/* Point the parent's child slot (or the root) at new_node */
+static void rb_replace_child(struct rb_node *old_node, struct rb_node *new_node,
+                             struct rb_node *parent, struct rb_root *root)
+{
+    if (!parent)
+        root->node = new_node;
+    else if (parent->left == old_node)
+        parent->left = new_node;
+    else
+        parent->right = new_node;
+}
+
+static void rb_rotate_left(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *right = node->right;
+    struct rb_node *parent = node->parent;
+
+    node->right = right->left;
+    if (right->left)
+        right->left->parent = node;
+
+    right->left = node;
+    right->parent = parent;
+    rb_replace_child(node, right, parent, root);
+    node->parent = right;
+}
+
+static void rb_rotate_right(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *left = node->left;
+    struct rb_node *parent = node->parent;
+
+    node->left = left->right;
+    if (left->right)
+        left->right->parent = node;
+
+    left->right = node;
+    left->parent = parent;
+    rb_replace_child(node, left, parent, root);
+    node->parent = left;
+}
+
+/* ================================================================
+ * INSERTION
+ * ================================================================ */
+
+void rb_insert_color(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *parent;
+
+    while ((parent = node->parent) && parent->color == RB_RED)
+    {
+        /* Parent is red, so it is not the root: grandparent exists */
+        struct rb_node *gparent = parent->parent;
+
+        if (parent == gparent->left)
+        {
+            struct rb_node *uncle = gparent->right;
+
+            if (rb_is_red(uncle))
+            {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->right)
+            {
+                rb_rotate_left(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_right(gparent, root);
+        }
+        else
+        {
+            struct rb_node *uncle = gparent->left;
+
+            if (rb_is_red(uncle))
+            {
+                uncle->color = RB_BLACK;
+                parent->color = RB_BLACK;
+                gparent->color = RB_RED;
+                node = gparent;
+                continue;
+            }
+
+            if (node == parent->left)
+            {
+                rb_rotate_right(parent, root);
+                node = parent;
+                parent = node->parent;
+            }
+
+            parent->color = RB_BLACK;
+            gparent->color = RB_RED;
+            rb_rotate_left(gparent, root);
+        }
+    }
+
+    root->node->color = RB_BLACK;
+}
+
+/* ================================================================
+ * DELETION
+ * ================================================================ */
+
+/* Restore the black height after removing a black node; node (possibly
+ * NULL) is the child that took its place under parent */
+static void rb_erase_color(struct rb_node *node, struct rb_node *parent,
+                           struct rb_root *root)
+{
+    while (node != root->node && rb_is_black(node))
+    {
+        if (node == parent->left)
+        {
+            struct rb_node *sibling = parent->right;
+
+            if (rb_is_red(sibling))
+            {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_left(parent, root);
+                sibling = parent->right;
+            }
+
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right))
+            {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (rb_is_black(sibling->right))
+            {
+                sibling->left->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_right(sibling, root);
+                sibling = parent->right;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->right->color = RB_BLACK;
+            rb_rotate_left(parent, root);
+            node = root->node;
+            break;
+        }
+        else
+        {
+            struct rb_node *sibling = parent->left;
+
+            if (rb_is_red(sibling))
+            {
+                sibling->color = RB_BLACK;
+                parent->color = RB_RED;
+                rb_rotate_right(parent, root);
+                sibling = parent->left;
+            }
+
+            if (rb_is_black(sibling->left) && rb_is_black(sibling->right))
+            {
+                sibling->color = RB_RED;
+                node = parent;
+                parent = node->parent;
+                continue;
+            }
+
+            if (rb_is_black(sibling->left))
+            {
+                sibling->right->color = RB_BLACK;
+                sibling->color = RB_RED;
+                rb_rotate_left(sibling, root);
+                sibling = parent->left;
+            }
+
+            sibling->color = parent->color;
+            parent->color = RB_BLACK;
+            sibling->left->color = RB_BLACK;
+            rb_rotate_right(parent, root);
+            node = root->node;
+            break;
+        }
+    }
+
+    if (node)
+        node->color = RB_BLACK;
+}
+
+void rb_erase(struct rb_node *node, struct rb_root *root)
+{
+    struct rb_node *child;
+    struct rb_node *parent;
+    int color;
+
+    if (node->left && node->right)
+    {
+        /* Two children: splice out the in-order successor instead and
+         * move it into node's position */
+        struct rb_node *succ = node->right;
+        while (succ->left)
+            succ = succ->left;
+
+        child = succ->right;
+        parent = succ->parent;
+        color = succ->color;
+
+        if (parent == node)
+        {
+            parent = succ;
+        }
+        else
+        {
+            parent->left = child;
+            if (child)
+                child->parent = parent;
+            succ->right = node->right;
+            node->right->parent = succ;
+        }
+
+        succ->left = node->left;
+        node->left->parent = succ;
+        succ->parent = node->parent;
+        succ->color = node->color;
+        rb_replace_child(node, succ, node->parent, root);
+    }
+    else
+    {
+        child = node->left ? node->left : node->right;
+        parent = node->parent;
+        color = node->color;
+
+        if (child)
+            child->parent = parent;
+        rb_replace_child(node, child, parent, root);
+    }
+
+    if (color == RB_BLACK)
+        rb_erase_color(child, parent, root);
+
+    node->parent = node->left = node->right = NULL;
+}
+
+/* ================================================================
+ * TRAVERSAL
+ * ================================================================ */
+
+struct rb_node *rb_first(const struct rb_root *root)
+{
+    struct rb_node *node = root->node;
+
+    if (!node)
+        return NULL;
+    while (node->left)
+        node = node->left;
+    return node;
+}
+
+struct rb_node *rb_next(const struct rb_node *node)
+{
+    if (node->right)
+    {
+        node = node->right;
+        while (node->left)
+            node = node->left;
+        return (struct rb_node *)node;
+    }
+
+    while (node->parent && node == node->parent->right)
+        node = node->parent;
+
+    return node->parent;
+}
@@ -0,0 +1,57 @@
+/* lib/rbtree.h - Intrusive red-black tree
+ *
+ * The node is embedded in the owning structure; callers walk the tree
+ * themselves to find the insertion point, link the node with
+ * rb_link_node() and then call rb_insert_color() to rebalance. This
+ * keeps the comparison logic (and its key type) with the caller.
+ */
+
+#ifndef RBTREE_H
+#define RBTREE_H
+
+#include <stddef.h>
+
+#define RB_RED   0
+#define RB_BLACK 1
+
+struct rb_node
+{
+    struct rb_node *parent;
+    struct rb_node *left;
+    struct rb_node *right;
+    int color;
+};
+
+struct rb_root
+{
+    struct rb_node *node;
+};
+
+#define RB_ROOT ((struct rb_root){NULL})
+
+/* Get the structure containing an embedded rb_node */
+#define rb_entry(ptr, type, member) \
+    ((type *)((char *)(ptr) - offsetof(type, member)))
+
+/* Attach a new node at *link (a child slot of parent) */
+static inline void rb_link_node(struct rb_node *node, struct rb_node *parent,
+                                struct rb_node **link)
+{
+    node->parent = parent;
+    node->left = NULL;
+    node->right = NULL;
+    node->color = RB_RED;
+    *link = node;
+}
+
+/* Rebalance after rb_link_node() */
+void rb_insert_color(struct rb_node *node, struct rb_root *root);
+
+/* Unlink a node and rebalance */
+void rb_erase(struct rb_node *node, struct rb_root *root);
+
+/* In-order traversal */
+struct rb_node *rb_first(const struct rb_root *root);
+struct rb_node *rb_next(const struct rb_node *node);
+
+#endif /* RBTREE_H */
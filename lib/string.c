@@ -246,6 +246,184 @@ void utoa(uint32_t n, char *str, int base)
     reverse(str);
 }
 
+/* ==================== FORMATTED OUTPUT ==================== */
+
+/* Divide a 64-bit value in place, returning the remainder. Works on
+ * 16-bit chunks so it needs no libgcc 64-bit division helpers. */
+static uint32_t div64_small(uint64_t *value, uint32_t base)
+{
+    uint32_t parts[4] = {
+        (uint32_t)(*value >> 48) & 0xFFFF, (uint32_t)(*value >> 32) & 0xFFFF,
+        (uint32_t)(*value >> 16) & 0xFFFF, (uint32_t)*value & 0xFFFF
+    };
+    uint32_t rem = 0;
+
+    for (int i = 0; i < 4; i++)
+    {
+        uint32_t cur = (rem << 16) | parts[i];
+        parts[i] = cur / base;
+        rem = cur % base;
+    }
+
+    *value = ((uint64_t)parts[0] << 48) | ((uint64_t)parts[1] << 32) |
+             ((uint64_t)parts[2] << 16) | parts[3];
+    return rem;
+}
+
+/* Format into buf (always NUL-terminated if size > 0).
+ * Supports %d %i %u %x %X %p %s %c %% with an optional '-' or '0'
+ * flag, a field width and the l/ll length modifiers.
+ * Returns the number of characters that would have been written. */
+int kvsnprintf(char *buf, size_t size, const char *fmt, va_list args)
+{
+    size_t pos = 0;
+
+#define KPUT(ch) do { if (pos + 1 < size) buf[pos] = (ch); pos++; } while (0)
+
+    for (; *fmt; fmt++)
+    {
+        if (*fmt != '%')
+        {
+            KPUT(*fmt);
+            continue;
+        }
+
+        fmt++;
+
+        bool left = false;
+        char pad = ' ';
+        for (;; fmt++)
+        {
+            if (*fmt == '-')
+                left = true;
+            else if (*fmt == '0')
+                pad = '0';
+            else
+                break;
+        }
+
+        int width = 0;
+        while (*fmt >= '0' && *fmt <= '9')
+            width = width * 10 + (*fmt++ - '0');
+
+        int longs = 0;
+        while (*fmt == 'l')
+        {
+            longs++;
+            fmt++;
+        }
+
+        char tmp[24];
+        const char *str = tmp;
+        int len = 0;
+        bool negative = false;
+
+        switch (*fmt)
+        {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'p':
+        {
+            uint64_t value;
+            uint32_t base = (*fmt == 'd' || *fmt == 'i' || *fmt == 'u') ? 10 : 16;
+            const char *digits = (*fmt == 'X') ? "0123456789ABCDEF" : "0123456789abcdef";
+
+            if (*fmt == 'p')
+                value = (uint32_t)va_arg(args, void *);
+            else if (longs >= 2)
+                value = va_arg(args, uint64_t);
+            else
+                value = va_arg(args, uint32_t);
+
+            if ((*fmt == 'd' || *fmt == 'i'))
+            {
+                if (longs >= 2 && (int64_t)value < 0)
+                {
+                    negative = true;
+                    value = 0 - value;
+                }
+                else if (longs < 2 && (int32_t)value < 0)
+                {
+                    negative = true;
+                    value = (uint32_t)(0u - (uint32_t)value);
+                }
+            }
+
+            int i = sizeof(tmp);
+            do
+            {
+                tmp[--i] = digits[div64_small(&value, base)];
+            } while (value && i > 1);
+
+            if (negative)
+                tmp[--i] = '-';
+
+            str = &tmp[i];
+            len = sizeof(tmp) - i;
+            break;
+        }
+        case 's':
+            str = va_arg(args, const char *);
+            if (!str)
+                str = "(null)";
+            len = strlen(str);
+            break;
+        case 'c':
+            tmp[0] = (char)va_arg(args, int);
+            len = 1;
+            break;
+        case '%':
+            tmp[0] = '%';
+            len = 1;
+            break;
+        case '\0':
+            fmt--;
+            continue;
+        default:
+            tmp[0] = '%';
+            tmp[1] = *fmt;
+            len = 2;
+            break;
+        }
+
+        /* Zero padding goes after the sign */
+        if (!left && pad == '0' && negative)
+        {
+            KPUT('-');
+            str++;
+            len--;
+            width--;
+        }
+
+        if (!left)
+            for (int i = len; i < width; i++)
+                KPUT(pad);
+        for (int i = 0; i < len; i++)
+            KPUT(str[i]);
+        if (left)
+            for (int i = len; i < width; i++)
+                KPUT(' ');
+    }
+
+#undef KPUT
+
+    if (size)
+        buf[pos < size ? pos : size - 1] = '\0';
+    return (int)pos;
+}
+
+int ksnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int n = kvsnprintf(buf, size, fmt, args);
+    va_end(args);
+    return n;
+}
+
 /* ==================== HEAP-ENABLED FUNCTIONS ==================== */
 
 /* Duplicate string (uses heap) */
@@ -294,17 +472,12 @@ char *strconcat(const char *s1, const char *s2)
 /* Format string (simple version, uses heap) */
 char *strfmt(const char *fmt, ...)
 {
-    /* Simple buffer for now - we'll implement proper formatting later */
     char buffer[256];
     va_list args;
     va_start(args, fmt);
-    
-    /* For now, just copy the format string */
-    strncpy(buffer, fmt, sizeof(buffer) - 1);
-    buffer[sizeof(buffer) - 1] = '\0';
-    
+    kvsnprintf(buffer, sizeof(buffer), fmt, args);
     va_end(args);
-    
+
     return strdup(buffer);
 }
 
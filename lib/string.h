@@ -33,6 +33,10 @@ void itoa(int n, char* str);
 void utoa(uint32_t n, char* str, int base);
 void reverse(char* str);
 
+/* Formatted output (%d %i %u %x %X %p %s %c, width, 0/- flags, l/ll) */
+int kvsnprintf(char* buf, size_t size, const char* fmt, va_list args);
+int ksnprintf(char* buf, size_t size, const char* fmt, ...);
+
 /* Heap-enabled functions (require kmalloc) */
 char* strdup(const char* s);
 char* strndup(const char* s, size_t n);
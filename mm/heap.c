@@ -2,12 +2,17 @@
  *
  * This implements a simple heap that allocates whole pages from PMM
  * for large allocations, and manages sub-page blocks for small allocations.
+ *
+ * Locking: heap_lock covers the small-block free list and the page
+ * table. It is never held across calls into the PMM or the shrinkers -
+ * shrinkers free memory through kfree() themselves.
  */
 
 #include "heap.h"
 #include "pmm.h"
 #include "../lib/string.h"
 #include "../kernel/kernel.h"
+#include "../kernel/spinlock.h"
 
 /* Heap block structure for small allocations (< PAGE_SIZE/2) */
 typedef struct heap_block
@@ -31,6 +36,8 @@ static struct
     heap_block_t *free_list;
 } heap;
 
+static spinlock_t heap_lock = SPINLOCK_INIT("heap", LOCK_ORDER_HEAP);
+
 /* Align size to 8 bytes */
 static inline size_t align_size(size_t size)
 {
@@ -91,6 +98,16 @@ static int heap_grow(void)
         return 0;
     }
 
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+
+    /* Another CPU may have filled the last slot meanwhile */
+    if (heap.page_count >= HEAP_MAX_PAGES)
+    {
+        spin_unlock_irqrestore(&heap_lock, flags);
+        pmm_free_block(page);
+        return 0;
+    }
+
     heap.pages[heap.page_count++] = page;
 
     /* Add new page to free list */
@@ -101,6 +118,7 @@ static int heap_grow(void)
     block->magic = HEAP_MAGIC;
     heap.free_list = block;
 
+    spin_unlock_irqrestore(&heap_lock, flags);
     return 1;
 }
 
@@ -147,6 +165,39 @@ static void merge_blocks(void)
     }
 }
 
+/* First fit from the free list (heap_lock held) */
+static void *alloc_small(size_t size)
+{
+    heap_block_t *prev = NULL;
+    heap_block_t *curr = heap.free_list;
+
+    while (curr)
+    {
+        if (curr->free && curr->size >= size)
+        {
+            /* Found a suitable block */
+            split_block(curr, align_size(size));
+            curr->free = 0;
+
+            /* Remove from free list */
+            if (prev)
+            {
+                prev->next = curr->next;
+            }
+            else
+            {
+                heap.free_list = curr->next;
+            }
+
+            return (void *)((char *)curr + sizeof(heap_block_t));
+        }
+        prev = curr;
+        curr = curr->next;
+    }
+
+    return NULL;
+}
+
 /* Allocate memory from the heap */
 void *kmalloc(size_t size)
 {
@@ -197,39 +248,19 @@ void *kmalloc(size_t size)
         return (void *)((size_t *)first_page + 1);
     }
 
-    /* Small allocation: use block allocator */
-    heap_block_t *prev = NULL;
-    heap_block_t *curr = heap.free_list;
-
-    while (curr)
+    /* Small allocation: use block allocator, growing the heap (outside
+     * the lock) until a block fits */
+    do
     {
-        if (curr->free && curr->size >= size)
-        {
-            /* Found a suitable block */
-            split_block(curr, align_size(size));
-            curr->free = 0;
-
-            /* Remove from free list */
-            if (prev)
-            {
-                prev->next = curr->next;
-            }
-            else
-            {
-                heap.free_list = curr->next;
-            }
+        uint32_t flags = spin_lock_irqsave(&heap_lock);
+        void *ptr = alloc_small(size);
+        spin_unlock_irqrestore(&heap_lock, flags);
 
-            return (void *)((char *)curr + sizeof(heap_block_t));
+        if (ptr)
+        {
+            return ptr;
         }
-        prev = curr;
-        curr = curr->next;
-    }
-
-    /* No suitable block found, try to grow heap */
-    if (heap_grow())
-    {
-        return kmalloc(size); /* Try again */
-    }
+    } while (heap_grow());
 
     return NULL;
 }
@@ -269,12 +300,16 @@ void kfree(void *ptr)
         return;
     }
 
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
+
     block->free = 1;
     block->next = heap.free_list;
     heap.free_list = block;
 
     /* Try to merge with adjacent free blocks */
     merge_blocks();
+
+    spin_unlock_irqrestore(&heap_lock, flags);
 }
 
 /* Allocate aligned memory */
@@ -306,6 +341,7 @@ void *kmalloc_aligned(size_t size, size_t alignment)
 heap_stats_t heap_get_stats(void)
 {
     heap_stats_t stats = {0};
+    uint32_t flags = spin_lock_irqsave(&heap_lock);
 
     /* Count free/used in small blocks */
     heap_block_t *curr = heap.free_list;
@@ -325,5 +361,7 @@ heap_stats_t heap_get_stats(void)
     stats.total_pages = heap.page_count;
     stats.total_bytes = heap.page_count * PAGE_SIZE;
 
+    spin_unlock_irqrestore(&heap_lock, flags);
+
     return stats;
 }
\ No newline at end of file
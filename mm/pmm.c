@@ -1,6 +1,8 @@
 #include "pmm.h"
+#include "shrinker.h"
 #include "../lib/string.h"
 #include "../kernel/kernel.h"
+#include "../kernel/spinlock.h"
 
 /*
  * Each bit represents one 4KB page.
@@ -11,6 +13,9 @@ static uint32_t pmm_bitmap[MEMORY_LIMIT / PAGE_SIZE / 32];
 static uint32_t used_blocks = 0;
 static uint32_t max_blocks  = 0;
 
+/* Covers the bitmap and used_blocks; the shrinkers run outside it */
+static spinlock_t pmm_lock = SPINLOCK_INIT("pmm", LOCK_ORDER_PMM);
+
 /* --- Bitmap helpers --- */
 
 static inline void bitmap_set(uint32_t bit) {
@@ -36,16 +41,23 @@ void pmm_init(uint32_t mem_size) {
 
 /* Allocate a single 4KB physical page */
 void* pmm_alloc_block() {
-    if (used_blocks >= max_blocks)
+    /* Under memory pressure, ask caches to give frames back first */
+    if (max_blocks - used_blocks < SHRINKER_LOW_WATERMARK)
+        shrinker_balance();
+
+    if (used_blocks >= max_blocks && shrink_caches(1) == 0)
         return 0;
 
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
     for (uint32_t i = 0; i < max_blocks; i++) {
         if (!bitmap_test(i)) {
             bitmap_set(i);
             used_blocks++;
+            spin_unlock_irqrestore(&pmm_lock, flags);
             return (void*)(i * PAGE_SIZE);  // physical address
         }
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
     return 0;
 }
 
@@ -56,10 +68,12 @@ void pmm_free_block(void* addr) {
     if (bit >= max_blocks)
         return;
 
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
     if (bitmap_test(bit)) {
         bitmap_unset(bit);
         used_blocks--;
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 /* --- Region management --- */
@@ -68,6 +82,7 @@ void pmm_free_block(void* addr) {
 void pmm_init_region(void* base, size_t size) {
     uint32_t start = ((uint32_t)base + PAGE_SIZE - 1) / PAGE_SIZE;
     uint32_t blocks = size / PAGE_SIZE;
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
 
     for (uint32_t i = 0; i < blocks; i++) {
         uint32_t bit = start + i;
@@ -76,12 +91,14 @@ void pmm_init_region(void* base, size_t size) {
             used_blocks--;
         }
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 /* Mark region as USED (reserved) */
 void pmm_deinit_region(void* base, size_t size) {
     uint32_t start = (uint32_t)base / PAGE_SIZE;
     uint32_t blocks = size / PAGE_SIZE;
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
 
     for (uint32_t i = 0; i < blocks; i++) {
         uint32_t bit = start + i;
@@ -90,6 +107,7 @@ void pmm_deinit_region(void* base, size_t size) {
             used_blocks++;
         }
     }
+    spin_unlock_irqrestore(&pmm_lock, flags);
 }
 
 /* --- Stats --- */
@@ -0,0 +1,205 @@
+/* mm/shrinker.c - Cache reclaim under memory pressure
+ *
+ * Keeps a list of registered shrinkers. When the PMM runs low on free
+ * frames, the remaining reclaim target is split between the shrinkers in
+ * proportion to how much each one could free, scaled down for caches
+ * that are expensive to rebuild (high seeks). A second pass ignores the
+ * seeks weighting if the first one did not free enough.
+ *
+ * Any CPU may end up here from pmm_alloc_block(). One reclaim runs at a
+ * time: a CPU that finds another one reclaiming leaves it to that one.
+ * The list is changed under shrinker_lock but walked without it (the
+ * shrinkers are called with no lock held); unregister_shrinker() waits
+ * for running walks before handing the shrinker back.
+ */
+
+#include "shrinker.h"
+#include "pmm.h"
+#include "../kernel/kernel.h"
+#include "../kernel/spinlock.h"
+
+/* ================================================================
+ * GLOBAL STATE
+ * ================================================================ */
+
+static spinlock_t shrinker_lock = SPINLOCK_INIT("shrinker", LOCK_ORDER_SHRINKER);
+
+static shrinker_t *shrinker_list = NULL;
+static bool in_reclaim = false;         /* Claimed with an atomic exchange */
+static volatile uint32_t list_walkers = 0;
+
+/* Bracket a walk of shrinker_list */
+static inline void walk_begin(void)
+{
+    __atomic_add_fetch(&list_walkers, 1, __ATOMIC_ACQUIRE);
+}
+
+static inline void walk_end(void)
+{
+    __atomic_sub_fetch(&list_walkers, 1, __ATOMIC_RELEASE);
+}
+
+/* Reclaim statistics */
+static uint32_t reclaim_runs = 0;
+static uint32_t reclaim_pages = 0;
+static uint32_t reclaim_failures = 0;
+
+/* ================================================================
+ * REGISTRATION
+ * ================================================================ */
+
+int register_shrinker(shrinker_t *s)
+{
+    if (!s || !s->count_objects || !s->scan_objects)
+        return -1;
+
+    if (s->seeks == 0)
+        s->seeks = SHRINKER_DEFAULT_SEEKS;
+
+    s->nr_calls = 0;
+    s->nr_freed = 0;
+
+    uint32_t flags = spin_lock_irqsave(&shrinker_lock);
+    s->next = shrinker_list;
+    __atomic_store_n(&shrinker_list, s, __ATOMIC_RELEASE);
+    spin_unlock_irqrestore(&shrinker_lock, flags);
+    return 0;
+}
+
+/* Must not be called from a shrinker callback (it would wait for
+ * itself) */
+void unregister_shrinker(shrinker_t *s)
+{
+    uint32_t flags = spin_lock_irqsave(&shrinker_lock);
+
+    shrinker_t **pp = &shrinker_list;
+    while (*pp && *pp != s)
+        pp = &(*pp)->next;
+    if (*pp)
+        __atomic_store_n(pp, s->next, __ATOMIC_RELEASE);
+
+    spin_unlock_irqrestore(&shrinker_lock, flags);
+
+    /* A walk may still be standing on s: keep s->next intact until it
+     * has moved on */
+    while (__atomic_load_n(&list_walkers, __ATOMIC_ACQUIRE))
+        __asm__ volatile("pause");
+    s->next = NULL;
+}
+
+/* ================================================================
+ * RECLAIM
+ * ================================================================ */
+
+uint32_t shrink_caches(uint32_t nr_pages)
+{
+    if (nr_pages == 0 || !shrinker_list)
+        return 0;
+
+    /* Shrinkers free memory through pmm_free_block()/kfree(), but a
+     * careless one might allocate - never recurse into reclaim, and
+     * never run two reclaims at once. */
+    if (__atomic_exchange_n(&in_reclaim, true, __ATOMIC_ACQUIRE))
+        return 0;
+
+    walk_begin();
+    reclaim_runs++;
+
+    uint32_t freed = 0;
+
+    for (int pass = 0; pass < 2 && freed < nr_pages; pass++)
+    {
+        uint32_t total = 0;
+        for (shrinker_t *s = shrinker_list; s; s = s->next)
+            total += s->count_objects(s);
+
+        if (total == 0)
+            break;
+
+        for (shrinker_t *s = shrinker_list; s && freed < nr_pages; s = s->next)
+        {
+            uint32_t count = s->count_objects(s);
+            if (count == 0)
+                continue;
+
+            /* Proportional share of what is still missing */
+            uint32_t want = nr_pages - freed;
+            uint32_t nr = (want * count + total - 1) / total;
+
+            /* First pass: go easy on caches that are costly to refill */
+            if (pass == 0 && s->seeks > SHRINKER_DEFAULT_SEEKS)
+                nr = nr * SHRINKER_DEFAULT_SEEKS / s->seeks;
+
+            if (nr == 0)
+                nr = 1;
+            if (nr > count)
+                nr = count;
+
+            uint32_t got = s->scan_objects(s, nr);
+            s->nr_calls++;
+            s->nr_freed += got;
+            freed += got;
+        }
+    }
+
+    reclaim_pages += freed;
+    if (freed < nr_pages)
+        reclaim_failures++;
+
+    walk_end();
+    __atomic_store_n(&in_reclaim, false, __ATOMIC_RELEASE);
+    return freed;
+}
+
+void shrinker_balance(void)
+{
+    uint32_t free = pmm_get_free_blocks();
+
+    if (free >= SHRINKER_LOW_WATERMARK || !shrinker_list)
+        return;
+
+    shrink_caches(SHRINKER_HIGH_WATERMARK - free);
+}
+
+/* ================================================================
+ * STATISTICS
+ * ================================================================ */
+
+void shrinker_show_stats(void)
+{
+    terminal_writestring("Reclaim watermarks : low ");
+    terminal_write_dec(SHRINKER_LOW_WATERMARK);
+    terminal_writestring(" / high ");
+    terminal_write_dec(SHRINKER_HIGH_WATERMARK);
+    terminal_writestring(" blocks\n");
+
+    terminal_writestring("Reclaim runs       : ");
+    terminal_write_dec(reclaim_runs);
+    terminal_writestring(" (");
+    terminal_write_dec(reclaim_pages);
+    terminal_writestring(" pages freed, ");
+    terminal_write_dec(reclaim_failures);
+    terminal_writestring(" short)\n");
+
+    if (!shrinker_list)
+    {
+        terminal_writestring("Shrinkers          : (none registered)\n");
+        return;
+    }
+
+    terminal_writestring("Shrinkers:\n");
+    walk_begin();
+    for (shrinker_t *s = shrinker_list; s; s = s->next)
+    {
+        terminal_writestring("  ");
+        terminal_writestring(s->name ? s->name : "(unnamed)");
+        terminal_writestring(": ");
+        terminal_write_dec(s->count_objects(s));
+        terminal_writestring(" reclaimable, ");
+        terminal_write_dec(s->nr_freed);
+        terminal_writestring(" freed in ");
+        terminal_write_dec(s->nr_calls);
+        terminal_writestring(" calls\n");
+    }
+    walk_end();
+}
@@ -0,0 +1,68 @@
+/* mm/shrinker.h - Cache reclaim under memory pressure
+ *
+ * Subsystems that keep reclaimable memory around (page cache, dentry
+ * cache, tarfs buffers, buffer cache...) register a shrinker. When the
+ * number of free physical frames drops below SHRINKER_LOW_WATERMARK,
+ * pmm_alloc_block() asks the registered shrinkers to give pages back
+ * until SHRINKER_HIGH_WATERMARK is reached again. Every frame the heap
+ * grows by comes through there as well.
+ *
+ * Caches can therefore grow aggressively without turning into OOM
+ * failures for user memory.
+ */
+
+#ifndef SHRINKER_H
+#define SHRINKER_H
+
+#include <stdint.h>
+
+/* ================================================================
+ * CONFIGURATION
+ * ================================================================ */
+
+#define SHRINKER_LOW_WATERMARK  128  /* Start reclaiming below 512KB free */
+#define SHRINKER_HIGH_WATERMARK 256  /* Reclaim until 1MB is free again */
+#define SHRINKER_DEFAULT_SEEKS  2    /* Relative cost to rebuild an object */
+
+/* ================================================================
+ * SHRINKER DESCRIPTOR
+ * ================================================================ */
+
+typedef struct shrinker
+{
+    const char *name;
+
+    /* Number of pages that could be freed right now (0 = nothing) */
+    uint32_t (*count_objects)(struct shrinker *s);
+
+    /* Free up to nr_to_scan pages, return the number actually freed */
+    uint32_t (*scan_objects)(struct shrinker *s, uint32_t nr_to_scan);
+
+    /* Higher = more expensive to rebuild = reclaimed less eagerly */
+    uint32_t seeks;
+
+    /* Statistics (maintained by the shrinker core) */
+    uint32_t nr_calls;
+    uint32_t nr_freed;
+
+    struct shrinker *next;
+} shrinker_t;
+
+/* ================================================================
+ * SHRINKER FUNCTIONS
+ * ================================================================ */
+
+/* Register / unregister a cache with the reclaim core */
+int register_shrinker(shrinker_t *s);
+void unregister_shrinker(shrinker_t *s);
+
+/* Ask the shrinkers for up to nr_pages pages, returns pages freed */
+uint32_t shrink_caches(uint32_t nr_pages);
+
+/* Reclaim if free frames are below the low watermark (allocator hook) */
+void shrinker_balance(void);
+
+/* Print registered shrinkers and reclaim statistics */
+void shrinker_show_stats(void);
+
+#endif /* SHRINKER_H */
@@ -7,11 +7,22 @@
 #include "pmm.h"
 #include "../lib/string.h"
 #include "../kernel/kernel.h"
+#include "../kernel/fpu.h"
+#include "../kernel/spinlock.h"
 
 /* Global state */
 static uint32_t *kernel_page_dir = NULL;
 struct vmm_address_space *vmm_current_as = NULL;
 
+/* Reference counts of frames mapped VMM_SHARED: one per address space
+ * mapping them. The frame is freed with the last one. */
+static struct
+{
+    uint32_t frame;
+    uint32_t refs;
+} shared_frames[VMM_SHARED_FRAMES];
+static spinlock_t shared_lock = SPINLOCK_INIT("vmm_shared", LOCK_ORDER_NONE);
+
 /* Static kernel address space for bootstrapping */
 static struct vmm_address_space kernel_as_static;
 static struct vmm_region kernel_heap_region_static;
@@ -357,27 +368,213 @@ struct vmm_address_space *vmm_create_as(void)
     return as;
 }
 
+/* ================================================================
+ * SHARED FRAMES
+ * ================================================================ */
+
+/* Start counting a new shared frame. Returns false if the table is full. */
+static bool shared_frame_add(uint32_t frame)
+{
+    uint32_t flags = spin_lock_irqsave(&shared_lock);
+
+    for (uint32_t i = 0; i < VMM_SHARED_FRAMES; i++)
+    {
+        if (!shared_frames[i].refs)
+        {
+            shared_frames[i].frame = frame;
+            shared_frames[i].refs = 1;
+            spin_unlock_irqrestore(&shared_lock, flags);
+            return true;
+        }
+    }
+
+    spin_unlock_irqrestore(&shared_lock, flags);
+    return false;
+}
+
+/* One more (inc) or one fewer mapping of frame. Returns true when the
+ * last one went away and the frame may be freed. */
+static bool shared_frame_ref(uint32_t frame, bool inc)
+{
+    uint32_t flags = spin_lock_irqsave(&shared_lock);
+    bool last = false;
+
+    for (uint32_t i = 0; i < VMM_SHARED_FRAMES; i++)
+    {
+        if (shared_frames[i].refs && shared_frames[i].frame == frame)
+        {
+            if (inc)
+                shared_frames[i].refs++;
+            else
+                last = --shared_frames[i].refs == 0;
+            break;
+        }
+    }
+
+    spin_unlock_irqrestore(&shared_lock, flags);
+    return last;
+}
+
+/* Walk as's tables; 0 if virt_addr is not mapped */
+uint32_t vmm_user_to_phys(struct vmm_address_space *as, uint32_t virt_addr)
+{
+    if (!as || !as->page_dir)
+        return 0;
+
+    uint32_t pde = as->page_dir[pd_index(virt_addr)];
+    if (!(pde & VMM_PRESENT))
+        return 0;
+
+    uint32_t pte = ((uint32_t *)(pde & ~0xFFF))[pt_index(virt_addr)];
+    if (!(pte & VMM_PRESENT))
+        return 0;
+
+    return (pte & ~0xFFF) | (virt_addr & 0xFFF);
+}
+
+uint32_t vmm_map_shared(struct vmm_address_space *as, uint32_t pages)
+{
+    if (!as || !pages || pages > (USER_SHARED_END - USER_SHARED_START) / PAGE_SIZE)
+        return 0;
+
+    /* First run of pages free pages */
+    uint32_t start = USER_SHARED_START, run = 0;
+    for (uint32_t virt = USER_SHARED_START; virt < USER_SHARED_END && run < pages;
+         virt += PAGE_SIZE)
+    {
+        if (vmm_user_to_phys(as, virt))
+        {
+            start = virt + PAGE_SIZE;
+            run = 0;
+        }
+        else
+        {
+            run++;
+        }
+    }
+    if (run < pages)
+        return 0;
+
+    for (uint32_t i = 0; i < pages; i++)
+    {
+        uint32_t virt = start + i * PAGE_SIZE;
+        void *frame = pmm_alloc_block();
+
+        if (frame && shared_frame_add((uint32_t)frame))
+        {
+            memset(frame, 0, PAGE_SIZE);
+            vmm_map_page_in_as(as, virt, (uint32_t)frame,
+                               VMM_PRESENT | VMM_WRITE | VMM_USER | VMM_SHARED);
+            if (vmm_user_to_phys(as, virt))
+                continue;
+
+            /* No memory for the page table */
+            shared_frame_ref((uint32_t)frame, false);
+        }
+        if (frame)
+            pmm_free_block(frame);
+
+        /* Undo the pages mapped so far; nobody else maps them yet */
+        while (i--)
+        {
+            virt = start + i * PAGE_SIZE;
+            shared_frame_ref(vmm_user_to_phys(as, virt) & ~0xFFF, false);
+            vmm_unmap_page_in_as(as, virt);
+        }
+        return 0;
+    }
+
+    return start;
+}
+
+/* Page table entry copied from the kernel directory by vmm_create_as()
+ * (the identity map): shared by every address space, so never copied
+ * or freed with one */
+static inline int vmm_pde_shared(uint32_t pd_idx, uint32_t pde)
+{
+    return pde == kernel_page_dir[pd_idx];
+}
+
+/* Copy an address space for fork(): every private user page table and
+ * page is duplicated, shared kernel entries, VMM_SHARED and
+ * VMM_KERNEL_FRAME pages stay shared */
+struct vmm_address_space *vmm_clone_as(struct vmm_address_space *src)
+{
+    if (!src || !src->page_dir)
+        return NULL;
+
+    struct vmm_address_space *as = vmm_create_as();
+    if (!as)
+        return NULL;
+
+    for (uint32_t pd_idx = 0; pd_idx < 768; pd_idx++)
+    {
+        uint32_t pde = src->page_dir[pd_idx];
+        if (!(pde & VMM_PRESENT) || vmm_pde_shared(pd_idx, pde))
+            continue;
+
+        uint32_t *src_pt = (uint32_t *)(pde & ~0xFFF);
+        uint32_t *pt = (uint32_t *)pmm_alloc_block();
+        if (!pt)
+            goto fail;
+        memset(pt, 0, PAGE_SIZE);
+        as->page_dir[pd_idx] = (uint32_t)pt | (pde & 0xFFF);
+
+        for (uint32_t pt_idx = 0; pt_idx < 1024; pt_idx++)
+        {
+            uint32_t pte = src_pt[pt_idx];
+            if (!(pte & VMM_PRESENT))
+                continue;
+
+            if (pte & (VMM_SHARED | VMM_KERNEL_FRAME))
+            {
+                if (pte & VMM_SHARED)
+                    shared_frame_ref(pte & ~0xFFF, true);
+                pt[pt_idx] = pte;
+                continue;
+            }
+
+            void *page = pmm_alloc_block();
+            if (!page)
+                goto fail;
+
+            /* Frames are identity-mapped, like the page tables */
+            copy_page(page, (void *)(pte & ~0xFFF));
+            pt[pt_idx] = (uint32_t)page | (pte & 0xFFF);
+        }
+    }
+
+    return as;
+
+fail:
+    /* Frees whatever was copied so far */
+    vmm_destroy_as(as);
+    return NULL;
+}
+
 /* Destroy address space */
 void vmm_destroy_as(struct vmm_address_space *as)
 {
     if (!as)
         return;
 
-    /* Free user mappings (first 768 entries) */
+    /* Free user mappings (first 768 entries); the identity map belongs
+     * to the kernel */
     for (uint32_t pd_idx = 0; pd_idx < 768; pd_idx++)
     {
         uint32_t pde = as->page_dir[pd_idx];
-        if (pde & VMM_PRESENT)
+        if ((pde & VMM_PRESENT) && !vmm_pde_shared(pd_idx, pde))
         {
             uint32_t *pt = (uint32_t *)(pde & ~0xFFF);
 
             /* Free all pages */
             for (uint32_t pt_idx = 0; pt_idx < 1024; pt_idx++)
             {
-                if (pt[pt_idx] & VMM_PRESENT)
+                if ((pt[pt_idx] & VMM_PRESENT) && !(pt[pt_idx] & VMM_KERNEL_FRAME))
                 {
                     uint32_t phys = pt[pt_idx] & ~0xFFF;
-                    if (phys >= 0x100000)
+                    bool shared = pt[pt_idx] & VMM_SHARED;
+                    if (phys >= 0x100000 && (!shared || shared_frame_ref(phys, false)))
                     {
                         pmm_free_block((void *)phys);
                     }
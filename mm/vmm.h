@@ -20,6 +20,8 @@
 #define VMM_DIRTY         0x40
 #define VMM_PAGESIZE      0x80
 #define VMM_GLOBAL        0x100
+#define VMM_SHARED        0x200  /* Available bit: frame shared across fork() */
+#define VMM_KERNEL_FRAME  0x400  /* Available bit: kernel's frame, never freed */
 
 /* Memory layout - constants from kernel.h */
 #define KERNEL_BASE        0xC0000000
@@ -30,6 +32,11 @@
 #define USER_STACK_TOP     0xBFFFFFFF
 #define USER_STACK_SIZE    0x00100000  /* 1MB */
 #define USER_STACK_BOTTOM  (USER_STACK_TOP - USER_STACK_SIZE)
+#define USER_SHARED_START  0x20000000  /* vmm_map_shared() window */
+#define USER_SHARED_END    0x20400000
+
+#define VMM_SHARED_FRAMES  64          /* Shared frames in use at once */
+#define USER_VVAR_START    0xB0000000  /* Read-only time and PID pages (vvar.h) */
 
 /* Virtual memory region */
 struct vmm_region {
@@ -55,6 +62,7 @@ void vmm_init(void);
 
 /* Address space management */
 struct vmm_address_space* vmm_create_as(void);
+struct vmm_address_space* vmm_clone_as(struct vmm_address_space* src);
 void vmm_destroy_as(struct vmm_address_space* as);
 void vmm_switch_as(struct vmm_address_space* as);
 
@@ -79,8 +87,14 @@ void vmm_unmap_page_in_as(struct vmm_address_space *as,
                           uint32_t virt_addr);
 
 
+/* Map pages zeroed frames into as at the first free spot of the shared
+ * window. fork() gives the child the same frames instead of copies.
+ * Returns the virtual address, or 0. */
+uint32_t vmm_map_shared(struct vmm_address_space *as, uint32_t pages);
+
 /* Query functions */
 uint32_t vmm_virt_to_phys(uint32_t virt_addr);
+uint32_t vmm_user_to_phys(struct vmm_address_space *as, uint32_t virt_addr);
 uint32_t vmm_get_flags(uint32_t virt_addr);
 int vmm_is_mapped(uint32_t virt_addr);
 
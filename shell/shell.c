@@ -6,9 +6,21 @@
 #include "../drivers/terminal.h"
 #include "../kernel/kernel.h"
 #include "../mm/pmm.h"
+#include "../mm/shrinker.h"
 #include "../interrupts/pagefault.h"
 #include "../kernel/scheduler.h"
+#include "../kernel/schedtrace.h"
+#include "../kernel/klog.h"
 #include "../kernel/task.h"
+#include "../kernel/smp.h"
+#include "../kernel/spinlock.h"
+#include "../kernel/preempt.h"
+#include "../kernel/pid.h"
+#include "../kernel/softirq.h"
+#include "../kernel/workqueue.h"
+#include "../kernel/mutex.h"
+#include "../kernel/clocksource.h"
+#include "../kernel/ktimer.h"
 #include "test_tasks.h"
 #include "../fs/vfs.h"
 #include "../drivers/ata.h"
@@ -23,9 +35,6 @@ static size_t command_pos = 0;
 static char history[HISTORY_SIZE][SHELL_BUFFER_SIZE] __attribute__((unused));
 static size_t history_count = 0;
 
-extern char keyboard_buffer_pop(void);
-extern bool keyboard_has_data(void);
-
 static void cmd_forktest(void);
 static void cmd_waitdemo(void);
 static void cmd_syscalltest(void);
@@ -58,10 +67,21 @@ static void cmd_help(void)
     terminal_writestring("  sysinfo          - Show system information\n");
     terminal_writestring("  testpf           - Test page fault handling\n");
     terminal_writestring("  heaptest         - Test heap allocator\n");
+    terminal_writestring("  pfstat [reset]   - Show page fault statistics\n");
 
     terminal_writestring("\nTask & Scheduler:\n");
     terminal_writestring("  ps               - List all running tasks\n");
-    terminal_writestring("  sched            - Show scheduler statistics\n");
+    terminal_writestring("  sched [fair|prio|load] - Scheduler statistics / policy / load\n");
+    terminal_writestring("  schedtrace [on|off|clear|export <file>|<n>] - Scheduler event trace\n");
+    terminal_writestring("  chrt [<pid> <class> <args>] - Show/set real-time classes\n");
+    terminal_writestring("  smp [sched on|off] - Show CPUs / let tasks run on all CPUs\n");
+    terminal_writestring("  lockstat [reset] - Show spinlock contention statistics\n");
+    terminal_writestring("  softirqs         - Show softirq and workqueue statistics\n");
+    terminal_writestring("  latency [<KB>]   - Wakeup latency during a file copy\n");
+    terminal_writestring("  pi               - Priority inversion with and without inheritance\n");
+    terminal_writestring("  timers [test]    - Kernel timer statistics / arm 2000 timers\n");
+    terminal_writestring("  dmesg [clear|<subsys>] - Show kernel log\n");
+    terminal_writestring("  loglevel [<level> [<console>]] - Set log levels (err..debug)\n");
     terminal_writestring("  spawn            - Spawn test tasks\n");
 
     terminal_writestring("\nFile System:\n");
@@ -143,6 +163,9 @@ static void cmd_meminfo(void)
     terminal_writestring("\n\n  Block size   : ");
     terminal_write_dec(PAGE_SIZE);
     terminal_writestring(" bytes\n\n");
+
+    shrinker_show_stats();
+    terminal_writestring("\n");
 }
 
 static void cmd_sysinfo(void)
@@ -176,6 +199,15 @@ static void cmd_sysinfo(void)
     terminal_writestring("  Kernel   : 0x00100000 - 0x08000000 (127 MB)\n");
     terminal_writestring("  Heap     : 0xC0400000 - 0xC0800000 (4 MB)\n");
 
+    const clocksource_t *cs = clocksource_current();
+    char line[80];
+    terminal_writestring("\nClock:\n");
+    ksnprintf(line, sizeof(line), "  Source   : %s (%u ns resolution)\n",
+              cs->name, cs->resolution_ns);
+    terminal_writestring(line);
+    ksnprintf(line, sizeof(line), "  Uptime   : %llu ns\n", ktime_get_ns());
+    terminal_writestring(line);
+
     terminal_writestring("\nSubsystems Status:\n");
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREEN, VGA_COLOR_BLACK));
     terminal_writestring("  [✓] PMM        - Physical Memory Manager\n");
@@ -195,6 +227,65 @@ static void cmd_sysinfo(void)
 
 static void cmd_testpf(void) { test_page_fault_recovery(); }
 
+static void cmd_pfstat(const char *args)
+{
+    if (strcmp(args, "reset") == 0)
+    {
+        pagefault_reset_stats();
+        terminal_writestring("Page fault statistics reset\n");
+        return;
+    }
+
+    pf_stats_t stats = pagefault_get_stats();
+
+    terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
+    terminal_writestring("\n╔══════════════════════════════════════════════════════════╗\n");
+    terminal_writestring("║               Page Fault Statistics                      ║\n");
+    terminal_writestring("╚══════════════════════════════════════════════════════════╝\n\n");
+
+    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
+    terminal_writestring("Total faults      : ");
+    terminal_write_dec(stats.total);
+    terminal_writestring("\n  Minor           : ");
+    terminal_write_dec(stats.minor);
+    terminal_writestring("\n  Major           : ");
+    terminal_write_dec(stats.major);
+    terminal_writestring("\n  Kernel heap     : ");
+    terminal_write_dec(stats.kernel_heap);
+    terminal_writestring("\n  From user mode  : ");
+    terminal_write_dec(stats.user);
+    terminal_writestring("\n  Unrecoverable   : ");
+    terminal_write_dec(stats.unrecoverable);
+    terminal_writestring(" (");
+    terminal_write_dec(stats.wp_fatal);
+    terminal_writestring(" write-protect)");
+    terminal_writestring("\nFault-around pages: ");
+    terminal_write_dec(stats.fault_around);
+    terminal_writestring(" (window ");
+    terminal_write_dec(PF_FAULT_AROUND_PAGES);
+    terminal_writestring(" pages, ");
+    terminal_write_dec(stats.fa_reclaimed);
+    terminal_writestring(" reclaimed untouched)\n\n");
+
+    terminal_writestring("Latency (cycles):\n");
+    for (int i = 0; i < PF_LATENCY_BUCKETS; i++)
+    {
+        if (!stats.latency[i])
+            continue;
+
+        if (i == PF_LATENCY_BUCKETS - 1)
+            terminal_writestring("  >= 2^");
+        else
+            terminal_writestring("  <  2^");
+        terminal_write_dec(i == PF_LATENCY_BUCKETS - 1 ? i - 1 + PF_LATENCY_SHIFT
+                                                       : i + PF_LATENCY_SHIFT);
+        terminal_writestring(" : ");
+        terminal_write_dec(stats.latency[i]);
+        terminal_writestring("\n");
+    }
+    terminal_writestring("\n");
+}
+
 static void cmd_heaptest(void)
 {
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
@@ -270,6 +361,17 @@ static void cmd_heaptest(void)
     terminal_writestring("\n");
 }
 
+/* TSC cycles as milliseconds with three decimals, right-aligned */
+static void write_cpu_ms(uint64_t cycles)
+{
+    char buf[24];
+    uint32_t us;
+    uint32_t ms = (uint32_t)div_u64_rem(timer_cycles_to_us(cycles), 1000, &us);
+
+    ksnprintf(buf, sizeof(buf), "%7u.%03u  ", ms, us);
+    terminal_writestring(buf);
+}
+
 static void cmd_ps(void)
 {
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
@@ -278,8 +380,8 @@ static void cmd_ps(void)
     terminal_writestring("╚══════════════════════════════════════════════════════════╝\n\n");
 
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
-    terminal_writestring("PID  STATE    NAME\n");
-    terminal_writestring("---  -------  --------------------\n");
+    terminal_writestring("PID  STATE    USER(ms)     SYS(ms)      IRQ(ms)      NAME\n");
+    terminal_writestring("---  -------  -----------  -----------  -----------  --------------------\n");
 
     task_t *task = kernel_task;
     if (!task)
@@ -319,17 +421,47 @@ static void cmd_ps(void)
         }
 
         terminal_writestring(" ");
+        write_cpu_ms(task->utime);
+        write_cpu_ms(task->stime);
+        write_cpu_ms(task->irq_time);
         terminal_writestring(task->name);
         terminal_writestring("\n");
 
         task = task->next;
     } while (task && task != start); // ← STOP when we loop back!
 
-    terminal_writestring("\n");
+    task_cache_stats_t cache = task_get_cache_stats();
+    char line[96];
+    ksnprintf(line, sizeof(line), "\n%u of %u PIDs in use\n", pid_count(), PID_MAX - 1);
+    terminal_writestring(line);
+    ksnprintf(line, sizeof(line),
+              "Task cache: %u structs, %u stacks (hits %u/%u); %u orphans reaped\n\n",
+              cache.cached_tasks, cache.cached_stacks, cache.task_hits,
+              cache.task_hits + cache.task_misses, cache.orphans_reaped);
+    terminal_writestring(line);
 }
 
-static void cmd_sched(void)
+static void cmd_sched(const char *args)
 {
+    if (strcmp(args, "fair") == 0 || strcmp(args, "prio") == 0)
+    {
+        scheduler_set_policy(strcmp(args, "fair") == 0 ? SCHED_POLICY_FAIR : SCHED_POLICY_PRIO);
+        terminal_writestring("Scheduling policy set to ");
+        terminal_writestring(args);
+        terminal_writestring("\n");
+        return;
+    }
+    else if (strcmp(args, "load") == 0)
+    {
+        scheduler_show_load();
+        return;
+    }
+    else if (args[0])
+    {
+        terminal_writestring("Usage: sched [fair|prio|load]\n");
+        return;
+    }
+
     scheduler_stats_t stats = scheduler_get_stats();
 
     terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_CYAN, VGA_COLOR_BLACK));
@@ -340,6 +472,9 @@ static void cmd_sched(void)
     terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK));
 
     char buf[16];
+    terminal_writestring("Policy            : ");
+    terminal_writestring(stats.policy == SCHED_POLICY_FAIR ? "fair (vruntime)" : "prio (O(1) run queues)");
+    terminal_writestring("\n");
     terminal_writestring("Total tasks       : ");
     itoa(stats.total_tasks, buf);
     terminal_writestring(buf);
@@ -352,14 +487,719 @@ static void cmd_sched(void)
     itoa(stats.blocked_tasks, buf);
     terminal_writestring(buf);
     terminal_writestring("\n");
+    terminal_writestring("  of which asleep : ");
+    itoa(stats.sleeping_tasks, buf);
+    terminal_writestring(buf);
+    terminal_writestring("\n");
     terminal_writestring("Context switches  : ");
     itoa(stats.context_switches, buf);
     terminal_writestring(buf);
     terminal_writestring("\n");
+    terminal_writestring("Kernel preemption : ");
+    itoa(stats.preempt_irq, buf);
+    terminal_writestring(buf);
+    terminal_writestring(" on IRQ exit, ");
+    itoa(stats.preempt_sync, buf);
+    terminal_writestring(buf);
+    terminal_writestring(" in preempt_enable()\n");
     terminal_writestring("Total ticks       : ");
     itoa(stats.total_ticks, buf);
     terminal_writestring(buf);
-    terminal_writestring("\n\n");
+    terminal_writestring("\n");
+    terminal_writestring("Runqueue bitmap   : ");
+    terminal_write_hex(stats.runqueue_bitmap);
+    terminal_writestring("\n");
+    terminal_writestring("Ready levels      :");
+    if (!stats.runqueue_bitmap)
+        terminal_writestring(" (none)");
+    for (uint32_t level = 0; level < SCHEDULER_PRIO_LEVELS; level++)
+    {
+        if (stats.runqueue_bitmap & (1u << level))
+        {
+            itoa(level, buf);
+            terminal_writestring(" ");
+            terminal_writestring(buf);
+        }
+    }
+    terminal_writestring("\n");
+    terminal_writestring("Tick stops        : ");
+    itoa(stats.nohz.stops, buf);
+    terminal_writestring(buf);
+    terminal_writestring(" (");
+    itoa(stats.nohz.ticks_avoided, buf);
+    terminal_writestring(buf);
+    terminal_writestring(" ticks avoided)\n");
+    terminal_writestring("Fair load         : ");
+    itoa(stats.fair_load, buf);
+    terminal_writestring(buf);
+    terminal_writestring("\n");
+    terminal_writestring("RT / DL tasks     : ");
+    itoa(stats.rt_tasks, buf);
+    terminal_writestring(buf);
+    terminal_writestring(" / ");
+    itoa(stats.dl_tasks, buf);
+    terminal_writestring(buf);
+    terminal_writestring("\n");
+    terminal_writestring("DL throttled      : ");
+    itoa(stats.dl_throttles, buf);
+    terminal_writestring(buf);
+    terminal_writestring(" (");
+    itoa(stats.dl_misses, buf);
+    terminal_writestring(buf);
+    terminal_writestring(" ticks past a deadline)\n\n");
+
+    scheduler_show_fairness();
+    terminal_writestring("\n");
+}
+
+/* Parse a decimal number and skip the spaces after it; NULL if there
+ * are no digits */
+static const char *parse_uint(const char *s, uint32_t *out)
+{
+    if (*s < '0' || *s > '9')
+        return NULL;
+
+    uint32_t value = 0;
+    while (*s >= '0' && *s <= '9')
+        value = value * 10 + (uint32_t)(*s++ - '0');
+    while (*s == ' ')
+        s++;
+
+    *out = value;
+    return s;
+}
+
+static void cmd_chrt(const char *args)
+{
+    if (!args[0])
+    {
+        scheduler_show_classes();
+        return;
+    }
+
+    sched_attr_t attr;
+    uint32_t pid;
+    memset(&attr, 0, sizeof(attr));
+
+    const char *p = parse_uint(args, &pid);
+    if (p && strncmp(p, "normal ", 7) == 0)
+    {
+        attr.policy = SCHED_NORMAL;
+        p = parse_uint(p + 7, &attr.priority);
+    }
+    else if (p && strncmp(p, "fifo ", 5) == 0)
+    {
+        attr.policy = SCHED_FIFO;
+        p = parse_uint(p + 5, &attr.priority);
+    }
+    else if (p && strncmp(p, "rr ", 3) == 0)
+    {
+        attr.policy = SCHED_RR;
+        p = parse_uint(p + 3, &attr.priority);
+    }
+    else if (p && strncmp(p, "deadline ", 9) == 0)
+    {
+        attr.policy = SCHED_DEADLINE;
+        p = parse_uint(p + 9, &attr.runtime);
+        if (p)
+            p = parse_uint(p, &attr.deadline);
+        if (p)
+            p = parse_uint(p, &attr.period);
+    }
+    else
+    {
+        p = NULL;
+    }
+
+    if (!p || *p)
+    {
+        terminal_writestring("Usage: chrt [<pid> normal|fifo|rr <prio>]\n");
+        terminal_writestring("       chrt <pid> deadline <runtime> <deadline> <period>  (ms)\n");
+        return;
+    }
+
+    if (scheduler_setscheduler(pid, &attr) < 0)
+    {
+        terminal_writestring("chrt: no such task, bad parameters or not enough deadline bandwidth\n");
+        return;
+    }
+
+    scheduler_show_classes();
+}
+
+static void cmd_smp(const char *args)
+{
+    if (strcmp(args, "sched on") == 0 || strcmp(args, "sched off") == 0)
+    {
+        bool on = strcmp(args, "sched on") == 0;
+
+        if (on && smp_num_cpus < 2)
+        {
+            terminal_writestring("Only one CPU online\n");
+            return;
+        }
+
+        smp_set_sched(on);
+        terminal_writestring(on ? "Tasks may now run on all CPUs\n"
+                                : "Tasks run on CPU 0 only\n");
+        return;
+    }
+    else if (args[0])
+    {
+        terminal_writestring("Usage: smp [sched on|off]\n");
+        return;
+    }
+
+    smp_show();
+}
+
+static void cmd_lockstat(const char *args)
+{
+    if (strcmp(args, "reset") == 0)
+    {
+        spinlock_reset_stats();
+        terminal_writestring("Lock statistics reset\n");
+        return;
+    }
+    else if (args[0])
+    {
+        terminal_writestring("Usage: lockstat [reset]\n");
+        return;
+    }
+
+    spinlock_show_stats();
+}
+
+static void cmd_softirqs(void)
+{
+    softirq_show_stats();
+    terminal_writestring("\n");
+    workqueue_show_stats();
+}
+
+/* ====================================================================
+ * latency - Wakeup latency of an interactive task during a file copy
+ *
+ * A copier task copies a scratch file in LATENCY_CHUNK pieces while a
+ * high-priority sampler sleeps 1ms at a time and measures how late it
+ * gets the CPU back. The copy runs twice: preemptible, and once more
+ * inside one preempt_disable() section - how every system call and
+ * filesystem operation used to run, with the tick unable to switch.
+ * ==================================================================== */
+
+#define LATENCY_SRC "/latsrc.tmp"
+#define LATENCY_DST "/latdst.tmp"
+#define LATENCY_CHUNK 4096
+#define LATENCY_DEFAULT_KB 256
+#define LATENCY_MAX_KB 1024
+#define LATENCY_SAMPLER_PRIORITY 1
+#define LATENCY_COPIER_PRIORITY 16
+
+static struct
+{
+    bool atomic;                 /* Copy with preemption disabled */
+    volatile bool copy_done;
+    volatile bool sampler_done;
+    int copy_result;             /* Bytes copied, -1 on error */
+    uint64_t copy_cycles;
+    uint32_t samples;
+    uint64_t total_us;           /* Sum of delays past 1ms */
+    uint64_t max_us;
+} latency;
+
+static void latency_copy_task(void)
+{
+    uint8_t *buf = kmalloc(LATENCY_CHUNK);
+    int in = vfs_open(LATENCY_SRC, O_RDONLY);
+    int out = vfs_open(LATENCY_DST, O_WRONLY | O_CREAT | O_TRUNC);
+    int copied = -1;
+
+    if (buf && in >= 0 && out >= 0)
+    {
+        uint64_t start = rdtsc();
+        int n;
+
+        if (latency.atomic)
+            preempt_disable();
+
+        copied = 0;
+        while ((n = vfs_read(in, buf, LATENCY_CHUNK)) > 0)
+        {
+            if (vfs_write(out, buf, n) != n)
+            {
+                copied = -1;
+                break;
+            }
+            copied += n;
+        }
+
+        if (latency.atomic)
+            preempt_enable();
+
+        latency.copy_cycles = rdtsc() - start;
+    }
+
+    if (in >= 0)
+        vfs_close(in);
+    if (out >= 0)
+        vfs_close(out);
+    if (buf)
+        kfree(buf);
+
+    latency.copy_result = copied;
+    latency.copy_done = true;
+    task_exit(0);
+}
+
+static void latency_sample_task(void)
+{
+    while (!latency.copy_done)
+    {
+        uint64_t before = rdtsc();
+        task_sleep(1);
+        uint64_t us = timer_cycles_to_us(rdtsc() - before);
+        uint64_t late = us > 1000 ? us - 1000 : 0;
+
+        latency.samples++;
+        latency.total_us += late;
+        if (late > latency.max_us)
+            latency.max_us = late;
+    }
+
+    latency.sampler_done = true;
+    task_exit(0);
+}
+
+static bool latency_make_source(uint32_t kb)
+{
+    uint8_t *buf = kmalloc(LATENCY_CHUNK);
+    int fd = vfs_open(LATENCY_SRC, O_WRONLY | O_CREAT | O_TRUNC);
+    bool ok = buf && fd >= 0;
+
+    if (ok)
+    {
+        for (uint32_t i = 0; i < LATENCY_CHUNK; i++)
+            buf[i] = (uint8_t)('a' + i % 26);
+        for (uint32_t done = 0; ok && done < kb * 1024; done += LATENCY_CHUNK)
+            ok = vfs_write(fd, buf, LATENCY_CHUNK) == LATENCY_CHUNK;
+    }
+
+    if (fd >= 0)
+        vfs_close(fd);
+    if (buf)
+        kfree(buf);
+    return ok;
+}
+
+static void latency_run(bool atomic)
+{
+    scheduler_stats_t before = scheduler_get_stats();
+    char line[96];
+
+    memset(&latency, 0, sizeof(latency));
+    latency.atomic = atomic;
+
+    task_t *copier = task_create("lat-copy", latency_copy_task, LATENCY_COPIER_PRIORITY);
+    task_t *sampler = task_create("lat-sample", latency_sample_task, LATENCY_SAMPLER_PRIORITY);
+    if (!copier || !sampler)
+    {
+        terminal_writestring("latency: cannot create tasks\n");
+        return;
+    }
+    scheduler_add_task(copier);
+    scheduler_add_task(sampler);
+
+    while (!latency.copy_done || !latency.sampler_done)
+        task_sleep(10);
+
+    scheduler_stats_t after = scheduler_get_stats();
+
+    if (latency.copy_result < 0)
+    {
+        terminal_writestring("latency: copy failed\n");
+        return;
+    }
+
+    ksnprintf(line, sizeof(line),
+              "%-15s %4u KB in %5llu ms  %5u wakeups  avg %5llu us  max %6llu us\n",
+              atomic ? "non-preemptible" : "preemptible",
+              (uint32_t)latency.copy_result / 1024,
+              div_u64(timer_cycles_to_us(latency.copy_cycles), 1000),
+              latency.samples,
+              latency.samples ? div_u64(latency.total_us, latency.samples) : 0,
+              latency.max_us);
+    terminal_writestring(line);
+
+    ksnprintf(line, sizeof(line), "%-15s preempted %u times on IRQ exit, %u in preempt_enable()\n",
+              "", after.preempt_irq - before.preempt_irq,
+              after.preempt_sync - before.preempt_sync);
+    terminal_writestring(line);
+}
+
+static void cmd_latency(const char *args)
+{
+    uint32_t kb = LATENCY_DEFAULT_KB;
+
+    if (args[0] && (!parse_uint(args, &kb) || !kb || kb > LATENCY_MAX_KB))
+    {
+        terminal_writestring("Usage: latency [<KB>]  (1-1024, default 256)\n");
+        return;
+    }
+
+    terminal_writestring("Creating ");
+    terminal_write_dec(kb);
+    terminal_writestring(" KB scratch file...\n");
+    if (!latency_make_source(kb))
+    {
+        terminal_writestring("latency: cannot write " LATENCY_SRC " (no writable filesystem?)\n");
+        vfs_unlink(LATENCY_SRC);
+        return;
+    }
+
+    terminal_writestring("Sampler wakeup delay past 1ms while the file is copied:\n");
+    latency_run(false);
+    latency_run(true);
+
+    vfs_unlink(LATENCY_SRC);
+    vfs_unlink(LATENCY_DST);
+}
+
+/* ====================================================================
+ * pi - Priority inversion
+ *
+ * A low priority task takes a mutex and works for PI_HOLD_MS while
+ * holding it. A high priority task then blocks on the mutex and a
+ * medium priority one starts burning CPU for PI_HOG_MS. Without
+ * priority inheritance the holder waits behind the medium task, and
+ * so does the high priority task; with it the holder runs at high
+ * priority until it lets go. Everything runs on one CPU so the tasks
+ * really compete.
+ * ==================================================================== */
+
+#define PI_HOLD_MS 30
+#define PI_HOG_MS 150
+#define PI_LOW_PRIORITY 20
+#define PI_MEDIUM_PRIORITY 10
+#define PI_HIGH_PRIORITY 1
+
+static mutex_t pi_mutex = MUTEX_INIT("pi-demo");
+
+static struct
+{
+    volatile bool locked;        /* Low task holds pi_mutex */
+    volatile uint32_t done;      /* Tasks finished */
+    uint64_t wait_cycles;        /* High task's mutex_lock() */
+} pi_demo;
+
+static void pi_spin_ms(uint32_t ms)
+{
+    uint64_t start = rdtsc();
+    while (timer_cycles_to_us(rdtsc() - start) < (uint64_t)ms * 1000)
+        ;
+}
+
+static void pi_low_task(void)
+{
+    mutex_lock(&pi_mutex);
+    pi_demo.locked = true;
+    pi_spin_ms(PI_HOLD_MS);
+    mutex_unlock(&pi_mutex);
+
+    pi_demo.done++;
+    task_exit(0);
+}
+
+static void pi_medium_task(void)
+{
+    pi_spin_ms(PI_HOG_MS);
+
+    pi_demo.done++;
+    task_exit(0);
+}
+
+static void pi_high_task(void)
+{
+    uint64_t start = rdtsc();
+    mutex_lock(&pi_mutex);
+    pi_demo.wait_cycles = rdtsc() - start;
+    mutex_unlock(&pi_mutex);
+
+    pi_demo.done++;
+    task_exit(0);
+}
+
+static void pi_run(bool inherit)
+{
+    uint32_t boosts = mutex_pi_boosts();
+    char line[96];
+
+    memset(&pi_demo, 0, sizeof(pi_demo));
+    mutex_set_pi(inherit);
+
+    task_t *low = task_create("pi-low", pi_low_task, PI_LOW_PRIORITY);
+    if (!low)
+    {
+        terminal_writestring("pi: cannot create tasks\n");
+        return;
+    }
+    scheduler_add_task(low);
+    while (!pi_demo.locked)
+        task_sleep(1);
+
+    /* High first, so it is already waiting when the hog starts */
+    task_t *high = task_create("pi-high", pi_high_task, PI_HIGH_PRIORITY);
+    task_t *medium = task_create("pi-medium", pi_medium_task, PI_MEDIUM_PRIORITY);
+    if (high)
+        scheduler_add_task(high);
+    if (medium)
+        scheduler_add_task(medium);
+
+    uint32_t expected = 1 + (high ? 1 : 0) + (medium ? 1 : 0);
+    while (pi_demo.done < expected)
+        task_sleep(10);
+
+    if (!high || !medium)
+    {
+        terminal_writestring("pi: cannot create tasks\n");
+        return;
+    }
+
+    ksnprintf(line, sizeof(line), "%-18s high task waited %5llu ms  (%u boosts)\n",
+              inherit ? "with inheritance" : "without",
+              div_u64(timer_cycles_to_us(pi_demo.wait_cycles), 1000),
+              mutex_pi_boosts() - boosts);
+    terminal_writestring(line);
+}
+
+static void cmd_pi(void)
+{
+    bool smp = smp_sched_enabled;
+    bool inherit = mutex_pi_enabled();
+
+    terminal_writestring("Holder works ");
+    terminal_write_dec(PI_HOLD_MS);
+    terminal_writestring(" ms, medium priority hog runs ");
+    terminal_write_dec(PI_HOG_MS);
+    terminal_writestring(" ms:\n");
+
+    scheduler_set_smp(false);
+    pi_run(false);
+    pi_run(true);
+    scheduler_set_smp(smp);
+    mutex_set_pi(inherit);
+}
+
+/* ====================================================================
+ * timers - Kernel timer wheel
+ *
+ * "timers test" arms TIMERS_TEST_COUNT timers spread over the next
+ * TIMERS_TEST_SPAN_MS, far enough for most of them to start on the
+ * upper levels of the wheel and cascade down, then deletes every
+ * TIMERS_TEST_DEL_EVERY-th one. Each callback checks that it did not
+ * run before its expiry.
+ * ==================================================================== */
+
+#define TIMERS_TEST_COUNT 2000
+#define TIMERS_TEST_SPAN_MS 3000
+#define TIMERS_TEST_DEL_EVERY 8
+
+static struct
+{
+    volatile uint32_t fired;
+    volatile uint32_t early;     /* Ran before expires - must stay 0 */
+    volatile uint32_t max_late;
+} timers_test;
+
+static void timers_test_fn(uint32_t data)
+{
+    ktimer_t *timer = (ktimer_t *)data;
+    uint32_t now = timer_get_ticks();
+
+    if (time_after(timer->expires, now))
+        timers_test.early++;
+    else if (now - timer->expires > timers_test.max_late)
+        timers_test.max_late = now - timer->expires;
+    timers_test.fired++;
+}
+
+static void timers_run_test(void)
+{
+    ktimer_t *timers = kmalloc(TIMERS_TEST_COUNT * sizeof(ktimer_t));
+    if (!timers)
+    {
+        terminal_writestring("timers: out of memory\n");
+        return;
+    }
+
+    memset(&timers_test, 0, sizeof(timers_test));
+
+    uint32_t seed = (uint32_t)rdtsc();
+    uint32_t now = timer_get_ticks();
+    uint64_t start = rdtsc();
+    for (uint32_t i = 0; i < TIMERS_TEST_COUNT; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        setup_timer(&timers[i], timers_test_fn, (uint32_t)&timers[i]);
+        mod_timer(&timers[i], now + 1 + (seed >> 8) % TIMERS_TEST_SPAN_MS);
+    }
+    uint64_t arm_cycles = rdtsc() - start;
+
+    uint32_t deleted = 0;
+    for (uint32_t i = 0; i < TIMERS_TEST_COUNT; i += TIMERS_TEST_DEL_EVERY)
+    {
+        if (del_timer(&timers[i]))
+            deleted++;
+    }
+
+    uint32_t expected = TIMERS_TEST_COUNT - deleted;
+    uint32_t waited = 0;
+    while (timers_test.fired < expected && waited < TIMERS_TEST_SPAN_MS + 1000)
+    {
+        task_sleep(100);
+        waited += 100;
+    }
+
+    for (uint32_t i = 0; i < TIMERS_TEST_COUNT; i++)
+        del_timer_sync(&timers[i]);
+    kfree(timers);
+
+    char line[96];
+    ksnprintf(line, sizeof(line), "Armed %u timers in %llu us, deleted %u\n",
+              TIMERS_TEST_COUNT, timer_cycles_to_us(arm_cycles), deleted);
+    terminal_writestring(line);
+    ksnprintf(line, sizeof(line), "Fired %u of %u, %u early, max %u ms late  [%s]\n\n",
+              timers_test.fired, expected, timers_test.early, timers_test.max_late,
+              timers_test.fired == expected && !timers_test.early ? "OK" : "FAIL");
+    terminal_writestring(line);
+}
+
+static void cmd_timers(const char *args)
+{
+    if (strcmp(args, "test") == 0)
+        timers_run_test();
+    else if (*args)
+    {
+        terminal_writestring("Usage: timers [test]\n");
+        return;
+    }
+
+    ktimer_show_stats();
+}
+
+static void cmd_schedtrace(const char *args)
+{
+    if (strcmp(args, "on") == 0 || strcmp(args, "off") == 0)
+    {
+        schedtrace_enable(strcmp(args, "on") == 0);
+        terminal_writestring("Scheduler tracing ");
+        terminal_writestring(args);
+        terminal_writestring("\n");
+        return;
+    }
+
+    if (strcmp(args, "clear") == 0)
+    {
+        schedtrace_clear();
+        terminal_writestring("Scheduler trace cleared\n");
+        return;
+    }
+
+    if (strncmp(args, "export", 6) == 0)
+    {
+        const char *path = args + 6;
+        while (*path == ' ')
+            path++;
+        if (!*path)
+        {
+            terminal_writestring("Usage: schedtrace export <file>\n");
+            return;
+        }
+
+        int bytes = schedtrace_export(path);
+        if (bytes < 0)
+        {
+            terminal_writestring("schedtrace: cannot write ");
+            terminal_writestring(path);
+            terminal_writestring("\n");
+            return;
+        }
+
+        terminal_writestring("Wrote ");
+        terminal_write_dec(bytes);
+        terminal_writestring(" bytes to ");
+        terminal_writestring(path);
+        terminal_writestring("\n");
+        return;
+    }
+
+    /* Optional event count, default 32 */
+    uint32_t count = 0;
+    for (const char *p = args; *p >= '0' && *p <= '9'; p++)
+        count = count * 10 + (*p - '0');
+    if (count == 0)
+        count = 32;
+
+    schedtrace_dump(count);
+}
+
+static void cmd_dmesg(const char *args)
+{
+    if (strcmp(args, "clear") == 0)
+    {
+        klog_clear();
+        terminal_writestring("Kernel log cleared\n");
+        return;
+    }
+
+    klog_subsys_t subsys = KLOG_NR_SUBSYS;
+    if (*args)
+    {
+        int s = klog_parse_subsys(args);
+        if (s < 0)
+        {
+            terminal_writestring("dmesg: unknown subsystem ");
+            terminal_writestring(args);
+            terminal_writestring(" (core sched task mm fs syscall irq driver)\n");
+            return;
+        }
+        subsys = (klog_subsys_t)s;
+    }
+
+    klog_dump(subsys);
+}
+
+static void cmd_loglevel(const char *args)
+{
+    if (*args)
+    {
+        char level[16];
+        int i = 0;
+        while (*args && *args != ' ' && i < (int)sizeof(level) - 1)
+            level[i++] = *args++;
+        level[i] = '\0';
+        while (*args == ' ')
+            args++;
+
+        int record = klog_parse_level(level);
+        int console = *args ? klog_parse_level(args) : klog_get_console_level();
+        if (record < 0 || console < 0)
+        {
+            terminal_writestring("loglevel: levels are err, warn, notice, info, debug (or 0-4)\n");
+            return;
+        }
+
+        klog_set_level(record);
+        klog_set_console_level(console);
+
+        if (record > KLOG_COMPILE_LEVEL)
+            terminal_writestring("Note: messages above the compile-time level are not built in\n");
+    }
+
+    terminal_writestring("Log level: ");
+    terminal_writestring(klog_level_name(klog_get_level()));
+    terminal_writestring(", console: ");
+    terminal_writestring(klog_level_name(klog_get_console_level()));
+    terminal_writestring("\n");
 }
 
 static void cmd_spawn(void)
@@ -1251,7 +2091,19 @@ static void cmd_waitdemo(void)
         child = child->next_sibling;
     }
 
-    terminal_writestring("\nNote: In user mode, parent would call wait() to reap zombies.\n\n");
+    /* The shell runs on the idle task and cannot block in wait(), so
+     * it reaps the zombies listed above right here */
+    uint32_t reaped = 0;
+    task_t *zombie;
+    while ((zombie = task_take_zombie(current_task, NULL)))
+    {
+        task_destroy(zombie);
+        reaped++;
+    }
+
+    terminal_writestring("\nReaped ");
+    terminal_write_dec(reaped);
+    terminal_writestring(" zombie(s). In user mode, parent would call wait().\n\n");
 }
 
 /* Command: syscalltest - Test system call infrastructure */
@@ -1343,6 +2195,11 @@ static void shell_execute_command(const char *cmd)
         cmd_heaptest();
         success = true;
     }
+    else if (strcmp(cmd, "pfstat") == 0 || strncmp(cmd, "pfstat ", 7) == 0)
+    {
+        cmd_pfstat(args);
+        success = true;
+    }
 
     /* Task commands */
     else if (strcmp(cmd, "ps") == 0)
@@ -1350,9 +2207,59 @@ static void shell_execute_command(const char *cmd)
         cmd_ps();
         success = true;
     }
-    else if (strcmp(cmd, "sched") == 0)
+    else if (strcmp(cmd, "sched") == 0 || strncmp(cmd, "sched ", 6) == 0)
+    {
+        cmd_sched(args);
+        success = true;
+    }
+    else if (strcmp(cmd, "schedtrace") == 0 || strncmp(cmd, "schedtrace ", 11) == 0)
+    {
+        cmd_schedtrace(args);
+        success = true;
+    }
+    else if (strcmp(cmd, "chrt") == 0 || strncmp(cmd, "chrt ", 5) == 0)
+    {
+        cmd_chrt(args);
+        success = true;
+    }
+    else if (strcmp(cmd, "smp") == 0 || strncmp(cmd, "smp ", 4) == 0)
+    {
+        cmd_smp(args);
+        success = true;
+    }
+    else if (strcmp(cmd, "lockstat") == 0 || strncmp(cmd, "lockstat ", 9) == 0)
+    {
+        cmd_lockstat(args);
+        success = true;
+    }
+    else if (strcmp(cmd, "softirqs") == 0)
+    {
+        cmd_softirqs();
+        success = true;
+    }
+    else if (strcmp(cmd, "latency") == 0 || strncmp(cmd, "latency ", 8) == 0)
+    {
+        cmd_latency(args);
+        success = true;
+    }
+    else if (strcmp(cmd, "timers") == 0 || strncmp(cmd, "timers ", 7) == 0)
+    {
+        cmd_timers(args);
+        success = true;
+    }
+    else if (strcmp(cmd, "pi") == 0)
+    {
+        cmd_pi();
+        success = true;
+    }
+    else if (strcmp(cmd, "dmesg") == 0 || strncmp(cmd, "dmesg ", 6) == 0)
+    {
+        cmd_dmesg(args);
+        success = true;
+    }
+    else if (strcmp(cmd, "loglevel") == 0 || strncmp(cmd, "loglevel ", 9) == 0)
     {
-        cmd_sched();
+        cmd_loglevel(args);
         success = true;
     }
     else if (strcmp(cmd, "spawn") == 0)
@@ -1614,7 +2521,7 @@ void shell_run(void)
 
     while (1)
     {
+        keyboard_wait_for_data();
         shell_process_input();
-        __asm__ volatile("hlt");
     }
 }
\ No newline at end of file
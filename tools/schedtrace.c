@@ -0,0 +1,187 @@
+/* tools/schedtrace.c - Analyze an OSComplex scheduler trace
+ *
+ * Reads a file written by the shell's "schedtrace export <file>" and
+ * prints per-event counts plus log2 histograms of:
+ *   - wakeup latency: wakeup of a task -> switch to that task
+ *   - run time:       switch to a task -> switch away from it
+ * Times are in TSC cycles, or microseconds if the trace carries the
+ * TSC frequency.
+ *
+ * Usage: gcc -o schedtrace schedtrace.c && ./schedtrace trace.bin
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#pragma pack(push, 1)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t event_size;
+    uint32_t nr_cpus;
+    uint32_t nr_events;
+    uint32_t tsc_khz;
+    uint32_t dropped;
+} trace_header_t;
+
+#pragma pack(pop)
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t pid;
+    uint32_t arg;
+    uint8_t  type;
+    uint8_t  cpu;
+    uint8_t  state;
+    uint8_t  reserved;
+    uint32_t seq;
+} __attribute__((packed, aligned(4))) trace_event_t;
+
+#define TRACE_MAGIC   0x43525453
+#define TRACE_SWITCH  1
+#define TRACE_WAKEUP  2
+#define TRACE_BLOCK   3
+#define TRACE_SLEEP   4
+#define TRACE_IRQ     5
+
+#define MAX_PIDS      4096
+#define HIST_BUCKETS  40
+
+static uint32_t tsc_khz;
+
+static int cmp_tsc(const void *a, const void *b)
+{
+    const trace_event_t *x = a, *y = b;
+    return x->tsc < y->tsc ? -1 : x->tsc > y->tsc;
+}
+
+static int log2_bucket(uint64_t v)
+{
+    int b = 0;
+    while (v > 1 && b < HIST_BUCKETS - 1) {
+        v >>= 1;
+        b++;
+    }
+    return b;
+}
+
+static void print_hist(const char *title, const uint64_t *hist, uint64_t max)
+{
+    uint64_t total = 0;
+    int first = -1, last = -1;
+
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        total += hist[i];
+        if (hist[i]) {
+            if (first < 0) first = i;
+            last = i;
+        }
+    }
+
+    printf("\n%s (%llu samples, max %llu %s)\n", title,
+           (unsigned long long)total,
+           (unsigned long long)(tsc_khz ? max * 1000 / tsc_khz : max),
+           tsc_khz ? "us" : "cycles");
+    if (!total)
+        return;
+
+    for (int i = first; i <= last; i++) {
+        uint64_t lo = 1ULL << i;
+        if (tsc_khz)
+            lo = lo * 1000 / tsc_khz;
+        int bar = (int)(hist[i] * 50 / total);
+        printf("  >= %10llu %s : %8llu |", (unsigned long long)lo,
+               tsc_khz ? "us" : "cy", (unsigned long long)hist[i]);
+        for (int j = 0; j < bar; j++)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        printf("Usage: %s <trace.bin>\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        printf("ERROR: Cannot open %s\n", argv[1]);
+        return 1;
+    }
+
+    trace_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TRACE_MAGIC) {
+        printf("ERROR: %s is not a schedtrace export\n", argv[1]);
+        return 1;
+    }
+    if (hdr.event_size != sizeof(trace_event_t)) {
+        printf("ERROR: unexpected event size %u\n", hdr.event_size);
+        return 1;
+    }
+    tsc_khz = hdr.tsc_khz;
+
+    trace_event_t *ev = calloc(hdr.nr_events ? hdr.nr_events : 1, sizeof(*ev));
+    size_t n = fread(ev, sizeof(*ev), hdr.nr_events, f);
+    fclose(f);
+
+    /* Drop torn slots, merge CPUs into one timeline */
+    size_t valid = 0;
+    for (size_t i = 0; i < n; i++)
+        if (ev[i].seq)
+            ev[valid++] = ev[i];
+    qsort(ev, valid, sizeof(*ev), cmp_tsc);
+
+    printf("Trace: %zu events (%u CPUs, %u overwritten, %zu torn)\n",
+           valid, hdr.nr_cpus, hdr.dropped, n - valid);
+
+    uint64_t counts[6] = {0};
+    uint64_t wake_hist[HIST_BUCKETS] = {0}, run_hist[HIST_BUCKETS] = {0};
+    uint64_t wake_max = 0, run_max = 0;
+    static uint64_t woken_at[MAX_PIDS], running_since[MAX_PIDS];
+
+    for (size_t i = 0; i < valid; i++) {
+        trace_event_t *e = &ev[i];
+        if (e->type < 6)
+            counts[e->type]++;
+
+        switch (e->type) {
+        case TRACE_WAKEUP:
+            if (e->pid < MAX_PIDS)
+                woken_at[e->pid] = e->tsc;
+            break;
+        case TRACE_SWITCH:
+            if (e->pid < MAX_PIDS && running_since[e->pid]) {
+                uint64_t d = e->tsc - running_since[e->pid];
+                run_hist[log2_bucket(d)]++;
+                if (d > run_max) run_max = d;
+                running_since[e->pid] = 0;
+            }
+            if (e->arg < MAX_PIDS) {
+                if (woken_at[e->arg]) {
+                    uint64_t d = e->tsc - woken_at[e->arg];
+                    wake_hist[log2_bucket(d)]++;
+                    if (d > wake_max) wake_max = d;
+                    woken_at[e->arg] = 0;
+                }
+                running_since[e->arg] = e->tsc;
+            }
+            break;
+        }
+    }
+
+    printf("  switch %llu  wakeup %llu  block %llu  sleep %llu  irq %llu\n",
+           (unsigned long long)counts[TRACE_SWITCH], (unsigned long long)counts[TRACE_WAKEUP],
+           (unsigned long long)counts[TRACE_BLOCK], (unsigned long long)counts[TRACE_SLEEP],
+           (unsigned long long)counts[TRACE_IRQ]);
+
+    print_hist("Wakeup latency", wake_hist, wake_max);
+    print_hist("Run time per switch-in", run_hist, run_max);
+
+    free(ev);
+    return 0;
+}
@@ -0,0 +1,111 @@
+/* user/cyclic.c - Wakeup Latency Test (cyclictest-style)
+ *
+ * Sleeps for INTERVAL_MS over and over and measures, with the
+ * monotonic clock, how much later than requested it gets the CPU back. A forked child burns
+ * CPU the whole time, so the sampler has to preempt it. The test runs
+ * three times: as a normal task, as SCHED_FIFO and as SCHED_DEADLINE.
+ * Tests: sleep, fork, wait, sched_setscheduler, clock_gettime
+ */
+
+#include "start.h"
+
+#define INTERVAL_MS 1
+#define LOOPS 500
+
+static unsigned long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* CPU hog competing with the sampler for ms milliseconds */
+static int start_hog(unsigned int ms)
+{
+    int pid = fork();
+
+    if (pid == 0) {
+        /* Back to the normal class: a FIFO hog at the sampler's level
+         * would never give the CPU back */
+        struct sched_attr attr = {SCHED_NORMAL, 16, 0, 0, 0};
+        sched_setscheduler(0, &attr);
+
+        unsigned long long end = now_us() + (unsigned long long)ms * 1000;
+        while (now_us() < end)
+            ;
+        exit(0);
+    }
+
+    return pid;
+}
+
+static void run(const char *label)
+{
+    unsigned int min = 0xFFFFFFFF, max = 0, total = 0;
+    int i;
+
+    if (start_hog(LOOPS * INTERVAL_MS * 2) < 0) {
+        write("  fork failed\n");
+        return;
+    }
+
+    for (i = 0; i < LOOPS; i++) {
+        unsigned long long before = now_us();
+        sleep(INTERVAL_MS);
+        unsigned int elapsed = (unsigned int)(now_us() - before);
+
+        /* Anything past the requested interval is latency */
+        unsigned int latency = elapsed > INTERVAL_MS * 1000 ?
+                               elapsed - INTERVAL_MS * 1000 : 0;
+
+        if (latency < min) min = latency;
+        if (latency > max) max = latency;
+        total += latency;
+    }
+
+    wait(0);
+
+    write("  ");
+    write(label);
+    write("  min ");
+    print_num(min);
+    write("  avg ");
+    print_num(total / LOOPS);
+    write("  max ");
+    print_num(max);
+    write(" us\n");
+}
+
+void main(void)
+{
+    struct sched_attr attr = {0, 0, 0, 0, 0};
+
+    write("\nWakeup latency (PID ");
+    print_num(getpid());
+    write("), ");
+    print_num(LOOPS);
+    write(" x ");
+    print_num(INTERVAL_MS);
+    write("ms against a CPU hog\n");
+
+    run("normal  ");
+
+    attr.policy = SCHED_FIFO;
+    attr.priority = 0;
+    if (sched_setscheduler(0, &attr) == 0)
+        run("fifo    ");
+    else
+        write("  fifo     sched_setscheduler failed\n");
+
+    attr.policy = SCHED_DEADLINE;
+    attr.runtime = 2;
+    attr.deadline = 5;
+    attr.period = 5;
+    if (sched_setscheduler(0, &attr) == 0)
+        run("deadline");
+    else
+        write("  deadline sched_setscheduler failed (bandwidth?)\n");
+
+    write("\n");
+}
@@ -0,0 +1,121 @@
+/* user/futex.c - Futex Lock and Condition Variable Test
+ *
+ * Times an uncontended umutex_lock()/umutex_unlock() pair against a
+ * bare system call, then forks WORKERS children that increment a
+ * shared counter under one lock while the parent sleeps on a condition
+ * variable until they are all done. The total shows whether the lock
+ * held; the contended count shows how often a worker had to sleep.
+ * Tests: mmap_shared, futex, fork, wait
+ */
+
+#include "start.h"
+
+#define WORKERS 2
+#define LOOPS 200000
+#define TIMING_LOOPS 10000
+
+struct shared
+{
+    umutex_t lock;
+    ucond_t done_cond;
+    unsigned int counter;
+    unsigned int contended;      /* Lock attempts that found it taken */
+    unsigned int done;           /* Workers finished */
+};
+
+static inline unsigned long long rdtsc(void)
+{
+    unsigned int lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+static void timing(void)
+{
+    umutex_t lock = UMUTEX_INIT;
+    unsigned long long start;
+    unsigned int lock_cycles, syscall_cycles;
+    int i;
+
+    start = rdtsc();
+    for (i = 0; i < TIMING_LOOPS; i++) {
+        umutex_lock(&lock);
+        umutex_unlock(&lock);
+    }
+    lock_cycles = (unsigned int)(rdtsc() - start) / TIMING_LOOPS;
+
+    start = rdtsc();
+    for (i = 0; i < TIMING_LOOPS; i++)
+        syscall0(SYS_GETPID);
+    syscall_cycles = (unsigned int)(rdtsc() - start) / TIMING_LOOPS;
+
+    write("  uncontended lock+unlock ");
+    print_num(lock_cycles);
+    write(" cycles, getpid() ");
+    print_num(syscall_cycles);
+    write(" cycles\n");
+}
+
+static void worker(struct shared *sh)
+{
+    int i;
+
+    for (i = 0; i < LOOPS; i++) {
+        if (!umutex_trylock(&sh->lock)) {
+            umutex_lock(&sh->lock);
+            sh->contended++;
+        }
+        sh->counter++;
+        umutex_unlock(&sh->lock);
+    }
+
+    umutex_lock(&sh->lock);
+    sh->done++;
+    ucond_signal(&sh->done_cond);
+    umutex_unlock(&sh->lock);
+
+    exit(0);
+}
+
+void main(void)
+{
+    struct shared *sh;
+    int i, started = 0;
+
+    write("\nFutex test (PID ");
+    print_num(getpid());
+    write(")\n");
+
+    timing();
+
+    sh = mmap_shared(sizeof(*sh));
+    if (!sh) {
+        write("  mmap_shared failed\n");
+        return;
+    }
+
+    for (i = 0; i < WORKERS; i++) {
+        int pid = fork();
+        if (pid == 0)
+            worker(sh);
+        if (pid > 0)
+            started++;
+    }
+
+    umutex_lock(&sh->lock);
+    while (sh->done < (unsigned int)started)
+        ucond_wait(&sh->done_cond, &sh->lock);
+    umutex_unlock(&sh->lock);
+
+    for (i = 0; i < started; i++)
+        wait(0);
+
+    write("  counter ");
+    print_num(sh->counter);
+    write(" of ");
+    print_num(started * LOOPS);
+    write(sh->counter == (unsigned int)(started * LOOPS) ? " (ok)" : " (LOST UPDATES)");
+    write(", ");
+    print_num(sh->contended);
+    write(" contended acquisitions\n\n");
+}
@@ -1,13 +1,27 @@
 /* user/sysinfo.c - System Information
  *
  * Displays system information using various syscalls.
- * Tests: multiple syscalls, formatted output
+ * Tests: multiple syscalls, formatted output, sched_getinfo
  */
 
 #include "start.h"
 
+/* Fixed-point load as n.nn */
+static void print_load(unsigned int load)
+{
+    unsigned int frac;
+
+    load += LOAD_FIXED_1 / 200;
+    frac = ((load & (LOAD_FIXED_1 - 1)) * 100) >> LOAD_FSHIFT;
+    print_num(load >> LOAD_FSHIFT);
+    write(frac < 10 ? ".0" : ".");
+    print_num(frac);
+}
+
 void main(void)
 {
+    struct sched_info info;
+
     write("\n");
     write("+----------------------------------+\n");
     write("|       System Information         |\n");
@@ -22,6 +36,34 @@ void main(void)
     write("  Code Base:      0x08048000\n");
     write("  Stack Base:     0xBFFFFFFF\n");
 
+    if (sched_getinfo(0, &info) == 0) {
+        write("\n");
+        write("  Load average:   ");
+        print_load(info.loadavg[0]);
+        write(" ");
+        print_load(info.loadavg[1]);
+        write(" ");
+        print_load(info.loadavg[2]);
+        write("\n");
+        write("  Tasks:          ");
+        print_num(info.nr_running);
+        write(" runnable of ");
+        print_num(info.nr_tasks);
+        write(" on ");
+        print_num(info.nr_cpus);
+        write(" CPU(s)\n");
+        write("  Uptime / idle:  ");
+        print_num(info.uptime_ms);
+        write(" / ");
+        print_num(info.idle_ms);
+        write(" ms\n");
+        write("  Our switches:   ");
+        print_num(info.nvcsw);
+        write(" voluntary, ");
+        print_num(info.nivcsw);
+        write(" involuntary\n");
+    }
+
     write("\n");
     write("  Syscalls available:\n");
     write("    - exit(code)\n");
@@ -32,6 +74,7 @@ void main(void)
     write("    - fork()\n");
     write("    - wait(status)\n");
     write("    - exec(path)\n");
+    write("    - sched_getinfo(pid, info)\n");
 
     write("\n");
     write("+----------------------------------+\n");
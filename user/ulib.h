@@ -22,36 +22,158 @@
 #define SYS_OPEN    9
 #define SYS_CLOSE   10
 #define SYS_FREAD   11
+#define SYS_GETRUSAGE 12
+#define SYS_SCHED_SETSCHEDULER 13
+#define SYS_FUTEX   14
+#define SYS_MMAP_SHARED 15
+#define SYS_SCHED_GETINFO 16
+#define SYS_CLOCK_GETTIME 17
+
+/* ================================================================
+ * SYSCALL DATA (must match kernel/syscall.h)
+ * ================================================================ */
+
+#define RUSAGE_SELF      0
+#define RUSAGE_CHILDREN  (-1)
+
+struct timeval
+{
+    unsigned int tv_sec;
+    unsigned int tv_usec;
+};
+
+struct rusage
+{
+    struct timeval ru_utime;    /* User mode */
+    struct timeval ru_stime;    /* Kernel on our behalf */
+    struct timeval ru_irqtime;  /* Interrupts taken while we ran */
+    unsigned int ru_nvcsw;      /* Voluntary context switches */
+    unsigned int ru_nivcsw;     /* Involuntary context switches */
+};
+
+/* Scheduling classes (must match kernel/scheduler.h) */
+#define SCHED_NORMAL   0
+#define SCHED_FIFO     1
+#define SCHED_RR       2
+#define SCHED_DEADLINE 3
+
+struct sched_attr
+{
+    unsigned int policy;     /* SCHED_* */
+    unsigned int priority;   /* NORMAL/FIFO/RR level, 0 = highest */
+    unsigned int runtime;    /* DEADLINE: ms reserved per period */
+    unsigned int deadline;   /* DEADLINE: ms after period start */
+    unsigned int period;     /* DEADLINE: ms */
+};
+
+/* Load averages are fixed point: LOAD_FIXED_1 = 1.0 */
+#define LOAD_FSHIFT 11
+#define LOAD_FIXED_1 (1 << LOAD_FSHIFT)
+
+/* Run queue length histogram: 0, 1, 2, 3, 4-7, 8-15, 16-31, 32+ */
+#define SCHED_RQ_HIST_BUCKETS 8
+
+struct sched_info
+{
+    unsigned int loadavg[3];    /* 1, 5 and 15 minutes */
+    unsigned int nr_running;    /* Runnable tasks, running included */
+    unsigned int nr_tasks;
+    unsigned int nr_cpus;
+    unsigned int uptime_ms;
+    unsigned int idle_ms;       /* Summed over the CPUs */
+    unsigned int context_switches;
+    unsigned int involuntary_switches;
+    unsigned int rq_hist[SCHED_RQ_HIST_BUCKETS]; /* CPU-ticks per length */
+
+    /* The task asked about */
+    unsigned int pid;
+    unsigned int nvcsw;         /* Voluntary context switches */
+    unsigned int nivcsw;        /* Involuntary context switches */
+    unsigned int run_ms;
+};
+
+/* clock_gettime() clocks */
+#define CLOCK_REALTIME  0       /* Not available yet */
+#define CLOCK_MONOTONIC 1       /* Since boot */
+
+struct timespec
+{
+    unsigned int tv_sec;
+    unsigned int tv_nsec;
+};
+
+/* SYS_FUTEX operations (must match kernel/futex.h) */
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+/* ================================================================
+ * SHARED TIME AND PID PAGES (must match kernel/vvar.h)
+ *
+ * Mapped read-only into every process. The kernel bumps seq to an odd
+ * value before changing the time page and back to even after, so a
+ * reader retries if it saw an odd or changed seq.
+ * ================================================================ */
+
+#define VVAR_DATA_ADDR 0xB0000000
+#define VVAR_PROC_ADDR 0xB0001000
+
+#define VVAR_CLOCK_TICKS 0
+#define VVAR_CLOCK_TSC   1
+
+struct vvar_data
+{
+    unsigned int seq;
+    unsigned int clock_mode;
+    unsigned int ticks_lo;
+    unsigned int ticks_hi;
+    unsigned int tsc_khz;
+    unsigned int mult;
+    unsigned int shift;
+    unsigned long long base_count;
+    unsigned long long base_ns;
+};
+
+struct vvar_proc
+{
+    unsigned int pid;
+};
+
+#define VVAR_DATA ((volatile struct vvar_data *)VVAR_DATA_ADDR)
+#define VVAR_PROC ((volatile struct vvar_proc *)VVAR_PROC_ADDR)
 
 /* ================================================================
  * SYSCALL WRAPPERS
+ *
+ * The kernel reads and writes user buffers behind the compiler's back,
+ * hence the memory clobbers.
  * ================================================================ */
 
 static inline int syscall0(int num)
 {
     int ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num));
+    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num) : "memory");
     return ret;
 }
 
 static inline int syscall1(int num, int arg1)
 {
     int ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1));
+    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1) : "memory");
     return ret;
 }
 
 static inline int syscall2(int num, int arg1, int arg2)
 {
     int ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1), "c"(arg2));
+    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1), "c"(arg2) : "memory");
     return ret;
 }
 
 static inline int syscall3(int num, int arg1, int arg2, int arg3)
 {
     int ret;
-    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1), "c"(arg2), "d"(arg3));
+    __asm__ volatile("int $0x80" : "=a"(ret) : "a"(num), "b"(arg1), "c"(arg2), "d"(arg3)
+                     : "memory");
     return ret;
 }
 
@@ -72,10 +194,10 @@ static inline int write(const char *str)
     return syscall1(SYS_WRITE, (int)str);
 }
 
-/* Get current process ID */
+/* Get current process ID (from the PID page, no system call) */
 static inline int getpid(void)
 {
-    return syscall0(SYS_GETPID);
+    return (int)VVAR_PROC->pid;
 }
 
 /* Yield CPU to other processes */
@@ -108,6 +230,211 @@ static inline int exec(const char *path)
     return syscall1(SYS_EXEC, (int)path);
 }
 
+/* CPU time used by this process or its reaped children */
+static inline int getrusage(int who, struct rusage *usage)
+{
+    return syscall2(SYS_GETRUSAGE, who, (int)usage);
+}
+
+/* Change the scheduling class of a task (pid 0 = this one) */
+static inline int sched_setscheduler(int pid, const struct sched_attr *attr)
+{
+    return syscall2(SYS_SCHED_SETSCHEDULER, pid, (int)attr);
+}
+
+/* Load, idle time and switch counts of the system and of task pid
+ * (0 = this one) */
+static inline int sched_getinfo(int pid, struct sched_info *info)
+{
+    return syscall2(SYS_SCHED_GETINFO, pid, (int)info);
+}
+
+/* ================================================================
+ * TIME
+ *
+ * Read from the shared time page without entering the kernel. There is
+ * no libgcc, so 64-bit arithmetic sticks to what the CPU does natively.
+ * ================================================================ */
+
+static inline unsigned long long vvar_rdtsc(void)
+{
+    unsigned int lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/* (a * mul) >> shift for shift <= 32, as the kernel does it */
+static inline unsigned long long vvar_mul_shr(unsigned long long a, unsigned int mul,
+                                              unsigned int shift)
+{
+    unsigned long long lo = (unsigned long long)(unsigned int)a * mul;
+    unsigned long long hi = (unsigned long long)(unsigned int)(a >> 32) * mul;
+
+    return (hi << (32 - shift)) + (lo >> shift);
+}
+
+/* n / d with the remainder in *rem, using two divl */
+static inline unsigned long long vvar_div(unsigned long long n, unsigned int d,
+                                          unsigned int *rem)
+{
+    unsigned int hi = (unsigned int)(n >> 32), lo = (unsigned int)n;
+    unsigned int q_hi = hi / d, r = hi % d, q_lo;
+
+    __asm__("divl %2" : "=a"(q_lo), "+d"(r) : "rm"(d), "0"(lo));
+    *rem = r;
+    return ((unsigned long long)q_hi << 32) | q_lo;
+}
+
+/* Milliseconds since boot, as of the last tick */
+static inline unsigned long long uptime_ms(void)
+{
+    unsigned int seq, lo, hi;
+
+    do {
+        seq = VVAR_DATA->seq;
+        __asm__ volatile("" : : : "memory");
+        lo = VVAR_DATA->ticks_lo;
+        hi = VVAR_DATA->ticks_hi;
+        __asm__ volatile("" : : : "memory");
+    } while ((seq & 1) || seq != VVAR_DATA->seq);
+
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/* Nanoseconds since boot; the same clock as CLOCK_MONOTONIC */
+static inline unsigned long long monotonic_ns(void)
+{
+    unsigned int seq;
+    unsigned long long ns;
+
+    do {
+        seq = VVAR_DATA->seq;
+        __asm__ volatile("" : : : "memory");
+        if (VVAR_DATA->clock_mode == VVAR_CLOCK_TSC) {
+            ns = VVAR_DATA->base_ns +
+                 vvar_mul_shr(vvar_rdtsc() - VVAR_DATA->base_count,
+                              VVAR_DATA->mult, VVAR_DATA->shift);
+        } else {
+            ns = (((unsigned long long)VVAR_DATA->ticks_hi << 32) |
+                  VVAR_DATA->ticks_lo) * 1000000;
+        }
+        __asm__ volatile("" : : : "memory");
+    } while ((seq & 1) || seq != VVAR_DATA->seq);
+
+    return ns;
+}
+
+/* Time on clock, to the resolution of the kernel's clocksource.
+ * CLOCK_MONOTONIC comes from the time page; anything else asks the
+ * kernel. */
+static inline int clock_gettime(int clock, struct timespec *ts)
+{
+    if (clock != CLOCK_MONOTONIC)
+        return syscall2(SYS_CLOCK_GETTIME, clock, (int)ts);
+
+    ts->tv_sec = (unsigned int)vvar_div(monotonic_ns(), 1000000000, &ts->tv_nsec);
+    return 0;
+}
+
+/* Sleep while *uaddr == val (FUTEX_WAIT) or wake up to val sleepers
+ * on uaddr (FUTEX_WAKE) */
+static inline int futex(volatile unsigned int *uaddr, int op, unsigned int val)
+{
+    return syscall3(SYS_FUTEX, (int)uaddr, op, (int)val);
+}
+
+/* Zeroed memory that fork()ed children share instead of copying.
+ * Returns 0 on failure. */
+static inline void *mmap_shared(unsigned int size)
+{
+    int addr = syscall1(SYS_MMAP_SHARED, (int)size);
+    return addr == -1 ? 0 : (void *)addr;
+}
+
+/* ================================================================
+ * LOCKS AND CONDITION VARIABLES
+ *
+ * Built on futex(): taking a free lock or signalling a condition
+ * nobody waits on is an atomic instruction and no system call. To be
+ * shared between processes they must live in mmap_shared() memory.
+ * ================================================================ */
+
+/* 0 = free, 1 = locked, 2 = locked and somebody may be sleeping */
+typedef struct
+{
+    volatile unsigned int state;
+} umutex_t;
+
+typedef struct
+{
+    volatile unsigned int seq;       /* Bumped by every signal */
+    volatile unsigned int waiters;
+} ucond_t;
+
+#define UMUTEX_INIT {0}
+#define UCOND_INIT {0, 0}
+
+static inline void umutex_lock(umutex_t *m)
+{
+    unsigned int c = 0;
+
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return;
+
+    /* Contended: mark it so the holder's unlock wakes us, then sleep
+     * until we are the one who finds it free */
+    if (c != 2)
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex(&m->state, FUTEX_WAIT, 2);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+static inline int umutex_trylock(umutex_t *m)
+{
+    unsigned int c = 0;
+    return __atomic_compare_exchange_n(&m->state, &c, 1, 0,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static inline void umutex_unlock(umutex_t *m)
+{
+    /* 1 -> 0 means nobody waited */
+    if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+        futex(&m->state, FUTEX_WAKE, 1);
+    }
+}
+
+/* Unlock m, sleep until signalled, lock m again. Wakeups can be
+ * spurious: re-check the condition in a loop. */
+static inline void ucond_wait(ucond_t *c, umutex_t *m)
+{
+    unsigned int seq = c->seq;
+
+    __atomic_add_fetch(&c->waiters, 1, __ATOMIC_ACQ_REL);
+    umutex_unlock(m);
+    futex(&c->seq, FUTEX_WAIT, seq);
+    __atomic_sub_fetch(&c->waiters, 1, __ATOMIC_ACQ_REL);
+    umutex_lock(m);
+}
+
+static inline void ucond_signal(ucond_t *c)
+{
+    __atomic_add_fetch(&c->seq, 1, __ATOMIC_ACQ_REL);
+    if (c->waiters)
+        futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+static inline void ucond_broadcast(ucond_t *c)
+{
+    __atomic_add_fetch(&c->seq, 1, __ATOMIC_ACQ_REL);
+    if (c->waiters)
+        futex(&c->seq, FUTEX_WAKE, 0x7FFFFFFF);
+}
+
 /* ================================================================
  * STRING UTILITIES
  * ================================================================ */
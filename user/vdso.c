@@ -0,0 +1,112 @@
+/* user/vdso.c - Shared Time Page Test
+ *
+ * Times getpid() and clock_gettime(CLOCK_MONOTONIC) through the shared
+ * pages against the same calls made as system calls, checks that both
+ * agree, and that a fork()ed child sees its own PID in its page.
+ * Tests: getpid, clock_gettime, fork, wait
+ */
+
+#include "start.h"
+
+#define LOOPS 10000
+
+static unsigned int per_call(unsigned long long start)
+{
+    unsigned int rem;
+    return (unsigned int)vvar_div(vvar_rdtsc() - start, LOOPS, &rem);
+}
+
+static void timing(void)
+{
+    struct timespec ts;
+    unsigned long long start;
+    unsigned int page_pid, sys_pid, page_clock, sys_clock;
+    int i;
+
+    start = vvar_rdtsc();
+    for (i = 0; i < LOOPS; i++)
+        getpid();
+    page_pid = per_call(start);
+
+    start = vvar_rdtsc();
+    for (i = 0; i < LOOPS; i++)
+        syscall0(SYS_GETPID);
+    sys_pid = per_call(start);
+
+    start = vvar_rdtsc();
+    for (i = 0; i < LOOPS; i++)
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+    page_clock = per_call(start);
+
+    start = vvar_rdtsc();
+    for (i = 0; i < LOOPS; i++)
+        syscall2(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (int)&ts);
+    sys_clock = per_call(start);
+
+    write("  getpid()         page ");
+    print_num(page_pid);
+    write(" cycles, syscall ");
+    print_num(sys_pid);
+    write(" cycles\n");
+    write("  clock_gettime()  page ");
+    print_num(page_clock);
+    write(" cycles, syscall ");
+    print_num(sys_clock);
+    write(" cycles\n");
+}
+
+/* page <= syscall <= page, or the two clocks disagree */
+static void agreement(void)
+{
+    struct timespec before, kernel, after;
+
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    syscall2(SYS_CLOCK_GETTIME, CLOCK_MONOTONIC, (int)&kernel);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+
+    unsigned long long b = (unsigned long long)before.tv_sec * 1000000000 + before.tv_nsec;
+    unsigned long long k = (unsigned long long)kernel.tv_sec * 1000000000 + kernel.tv_nsec;
+    unsigned long long a = (unsigned long long)after.tv_sec * 1000000000 + after.tv_nsec;
+
+    write("  clocks agree:    ");
+    write(b <= k && k <= a ? "yes" : "NO");
+    write(" (uptime ");
+    print_num(kernel.tv_sec);
+    write(" s, ");
+    print_num((unsigned int)uptime_ms());
+    write(" ticks)\n");
+}
+
+static void fork_pid(void)
+{
+    int pid = fork();
+
+    if (pid == 0) {
+        /* The syscall is the reference */
+        exit(getpid() == syscall0(SYS_GETPID) ? 0 : 1);
+    }
+
+    int status = -1;
+    if (pid < 0 || wait(&status) < 0) {
+        write("  fork failed\n");
+        return;
+    }
+
+    write("  child's PID page: ");
+    write(status == 0 ? "own PID\n" : "WRONG PID\n");
+}
+
+void main(void)
+{
+    write("\nShared time page (PID ");
+    print_num(getpid());
+    write(", clock ");
+    write(VVAR_DATA->clock_mode == VVAR_CLOCK_TSC ? "tsc" : "ticks");
+    write(")\n");
+
+    timing();
+    agreement();
+    fork_pid();
+
+    write("\n");
+}